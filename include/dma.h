@@ -3,11 +3,31 @@
 
 #include <stdint.h>
 
-void dma_setup(void);
-void dma_soft_reset(void);
-void dma_hard_reset(void);
+#define DMA_NR_CHANNELS                 7
 
-uint32_t dma_read32(uint32_t address);
-void dma_write32(uint32_t address, uint32_t value);
+struct psx_machine;
+struct state;
+
+struct dma {
+    struct {
+        /* TODO: Handle updating of base address & block control following DMA */
+        uint32_t base_address;
+        uint32_t block_control;
+        uint32_t channel_control;
+    } channel[DMA_NR_CHANNELS];
+
+    uint32_t priority_control;
+    uint32_t interrupt_control;
+};
+
+void dma_setup(struct psx_machine *psx);
+void dma_soft_reset(struct psx_machine *psx);
+void dma_hard_reset(struct psx_machine *psx);
+
+uint32_t dma_read32(struct psx_machine *psx, uint32_t address);
+void dma_write32(struct psx_machine *psx, uint32_t address, uint32_t value);
+
+void dma_save_state(struct psx_machine *psx, struct state *state);
+void dma_load_state(struct psx_machine *psx, struct state *state);
 
 #endif /* DMA_H */
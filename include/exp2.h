@@ -3,9 +3,22 @@
 
 #include <stdint.h>
 
-void exp2_setup(void);
+#define EXP2_TX_BUF_SIZE        128
+
+struct psx_machine;
+struct state;
+
+struct exp2 {
+    char tx_buf[EXP2_TX_BUF_SIZE];
+    int tx_buf_len;
+};
+
+void exp2_setup(struct psx_machine *psx);
 
 uint8_t exp2_read8(uint32_t address);
-void exp2_write8(uint32_t address, uint8_t value);
+void exp2_write8(struct psx_machine *psx, uint32_t address, uint8_t value);
+
+void exp2_save_state(struct psx_machine *psx, struct state *state);
+void exp2_load_state(struct psx_machine *psx, struct state *state);
 
 #endif /* EXP2_H */
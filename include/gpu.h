@@ -0,0 +1,107 @@
+#ifndef GPU_H
+#define GPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpu_raster.h"
+#include "gpu_texcache.h"
+#include "gpu_thread.h"
+
+#define GPU_FIFO_SIZE       16
+
+struct psx_machine;
+struct state;
+
+enum gpu_mode {
+    GPU_MODE_COMMAND,
+    GPU_MODE_POLYLINE,
+    GPU_MODE_CPU_TO_VRAM
+};
+
+/* Rectangle being streamed between VRAM and GP0 or GPUREAD */
+struct gpu_transfer {
+    unsigned int x, y;
+    unsigned int width, height;
+    unsigned int column, row;
+    bool active;
+};
+
+/*
+ * The parts of GPUSTAT the emulation thread can work out itself, updated as
+ * GP0 and GP1 writes are queued, so reading GPUSTAT doesn't wait for the GPU
+ * thread. Commands are followed only far enough to find their boundaries.
+ */
+struct gpu_shadow {
+    uint32_t status;
+    enum gpu_mode mode;
+    uint32_t fifo[GPU_FIFO_SIZE];
+    unsigned int fifo_len;
+    unsigned int command_len;
+    unsigned int words;             /* Left of a CPU to VRAM transfer */
+    bool texture_disable;
+    bool vram_to_cpu;               /* Only the GPU knows when it ends */
+};
+
+struct gpu {
+    /* Followed by other fields, which the AVX2 span kernel's gathers need */
+    uint16_t vram[GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT]
+        __attribute__ ((aligned (16)));
+
+    uint32_t status;            /* GPUSTAT, without the ready bits */
+    uint32_t read;              /* Latched GPUREAD response */
+
+    enum gpu_mode mode;
+    uint32_t fifo[GPU_FIFO_SIZE];
+    unsigned int fifo_len;
+    unsigned int command_len;
+
+    struct gpu_transfer cpu_to_vram;
+    struct gpu_transfer vram_to_cpu;
+
+    struct gpu_vertex polyline;     /* Last vertex of the current polyline */
+
+    bool texture_disable;           /* GP1(09h) */
+
+    uint8_t window_mask_x, window_mask_y;
+    uint8_t window_offset_x, window_offset_y;
+
+    struct gpu_rect area;
+    int16_t offset_x, offset_y;
+
+    uint16_t display_x, display_y;
+    uint16_t display_x1, display_x2;
+    uint16_t display_y1, display_y2;
+
+    struct gpu_raster raster;
+    struct gpu_texcache texcache;
+    struct gpu_thread thread;
+    struct gpu_shadow shadow;
+};
+
+void gpu_setup(struct psx_machine *psx);
+void gpu_shutdown(struct psx_machine *psx);
+void gpu_hard_reset(struct psx_machine *psx);
+
+bool gpu_set_threaded(struct psx_machine *psx, bool threaded);
+void gpu_set_workers(struct psx_machine *psx, unsigned int nr_workers);
+void gpu_use_host_cpus(struct psx_machine *psx);
+
+void gpu_gp0(struct psx_machine *psx, uint32_t value);
+void gpu_gp1(struct psx_machine *psx, uint32_t value);
+uint32_t gpu_read(struct psx_machine *psx);
+uint32_t gpu_status(struct psx_machine *psx);
+
+/* Executes a port write on the calling thread, used by the GPU thread */
+void gpu_process(struct psx_machine *psx, enum gpu_port port, uint32_t value);
+
+void gpu_vblank(struct psx_machine *psx);
+
+uint16_t * gpu_debug_vram(struct psx_machine *psx);
+void gpu_save_state(struct psx_machine *psx, struct state *state);
+void gpu_load_state(struct psx_machine *psx, struct state *state);
+
+void gpu_debug_texcache(struct psx_machine *psx,
+                        struct gpu_texcache_stats *stats);
+
+#endif /* GPU_H */
@@ -0,0 +1,123 @@
+#ifndef GPU_RASTER_H
+#define GPU_RASTER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPU_VRAM_WIDTH              1024
+#define GPU_VRAM_HEIGHT             512
+
+#define GPU_RASTER_TILE_SHIFT       6
+#define GPU_RASTER_TILE_SIZE        (1 << GPU_RASTER_TILE_SHIFT)
+#define GPU_RASTER_TILES_X          (GPU_VRAM_WIDTH >> GPU_RASTER_TILE_SHIFT)
+#define GPU_RASTER_TILES_Y          (GPU_VRAM_HEIGHT >> GPU_RASTER_TILE_SHIFT)
+#define GPU_RASTER_NR_TILES         (GPU_RASTER_TILES_X * GPU_RASTER_TILES_Y)
+
+#define GPU_RASTER_MAX_PRIMITIVES   4096
+#define GPU_RASTER_MAX_WORKERS      8
+#define GPU_RASTER_MAX_SAMPLED      16
+
+struct psx_machine;
+
+enum gpu_primitive_type {
+    GPU_PRIMITIVE_TRIANGLE,
+    GPU_PRIMITIVE_RECTANGLE,
+    GPU_PRIMITIVE_LINE,
+    GPU_PRIMITIVE_FILL
+};
+
+enum gpu_primitive_flags {
+    GPU_PRIMITIVE_GOURAUD = 0x1,
+    GPU_PRIMITIVE_TEXTURED = 0x2,
+    GPU_PRIMITIVE_RAW = 0x4,        /* Texture colours are not modulated */
+    GPU_PRIMITIVE_SEMI = 0x8,
+    GPU_PRIMITIVE_DITHER = 0x10,
+    GPU_PRIMITIVE_SET_MASK = 0x20,
+    GPU_PRIMITIVE_CHECK_MASK = 0x40,
+    GPU_PRIMITIVE_FEEDBACK = 0x80   /* Samples VRAM it draws over */
+};
+
+/* Half-open rectangle in VRAM coordinates */
+struct gpu_rect {
+    int16_t x0, y0;
+    int16_t x1, y1;
+};
+
+struct gpu_vertex {
+    int32_t x, y;
+    uint8_t r, g, b;
+    uint8_t u, v;
+};
+
+/*
+ * A draw command with all the GPU state it depends on captured, so that the
+ * batch can be rasterized after later commands have changed that state.
+ * Rectangles keep their bottom right corner in v[1], fills only use bounds.
+ */
+struct gpu_primitive {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t semi_mode;
+    uint8_t depth;
+
+    uint16_t texpage_x, texpage_y;
+    uint16_t clut_x, clut_y;
+
+    uint8_t window_mask_x, window_mask_y;
+    uint8_t window_offset_x, window_offset_y;
+
+    struct gpu_rect bounds;         /* Clipped to the drawing area */
+    struct gpu_vertex v[3];
+
+    const uint16_t *texture;        /* Decoded 4/8bpp page, or NULL */
+};
+
+/*
+ * Primitives are queued until VRAM has to be coherent, then VRAM is split
+ * into tiles which the workers and the emulation thread render concurrently.
+ * Each tile replays the whole batch in order, clipped to itself.
+ */
+struct gpu_raster {
+    struct gpu_primitive primitive[GPU_RASTER_MAX_PRIMITIVES];
+    unsigned int nr_primitives;
+    unsigned int batch;             /* Incremented once a batch is drawn */
+
+    struct gpu_rect dirty;          /* Union of the queued bounds */
+    uint64_t area;                  /* Sum of the queued bounds */
+
+    /* Texture pages and CLUTs the batch reads, which it must not draw to */
+    struct gpu_rect sampled[GPU_RASTER_MAX_SAMPLED];
+    unsigned int nr_sampled;
+
+    uint16_t tile[GPU_RASTER_NR_TILES];
+    unsigned int nr_tiles;
+    unsigned int next_tile;
+
+    pthread_t worker[GPU_RASTER_MAX_WORKERS];
+    unsigned int nr_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int generation;
+    unsigned int active;
+    bool quit;
+};
+
+void gpu_raster_setup(struct psx_machine *psx);
+void gpu_raster_shutdown(struct psx_machine *psx);
+
+unsigned int gpu_raster_nr_cpus(void);
+void gpu_raster_set_workers(struct psx_machine *psx, unsigned int nr_workers);
+unsigned int gpu_raster_workers(struct psx_machine *psx);
+
+unsigned int gpu_raster_sampled(const struct gpu_primitive *p,
+                                struct gpu_rect *rect);
+
+void gpu_raster_queue(struct psx_machine *psx,
+                      const struct gpu_primitive *primitive);
+void gpu_raster_flush(struct psx_machine *psx);
+void gpu_raster_discard(struct psx_machine *psx);
+
+#endif /* GPU_RASTER_H */
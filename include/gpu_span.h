@@ -0,0 +1,114 @@
+#ifndef GPU_SPAN_H
+#define GPU_SPAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpu_raster.h"
+
+/*
+ * Span kernels draw a horizontal run of pixels of one primitive: shading,
+ * texture and CLUT fetch, dithering, semi-transparency and mask bits. The
+ * vector kernels must produce exactly what the scalar one does.
+ */
+
+enum gpu_span_attr {
+    GPU_SPAN_R,
+    GPU_SPAN_G,
+    GPU_SPAN_B,
+    GPU_SPAN_U,
+    GPU_SPAN_V,
+    GPU_SPAN_NR_ATTRS
+};
+
+enum gpu_span_isa {
+    GPU_SPAN_SCALAR,
+    GPU_SPAN_SSE41,
+    GPU_SPAN_AVX2,
+    GPU_SPAN_NR_ISAS
+};
+
+/* Attributes are 16.16 fixed point, stepped once per pixel */
+struct gpu_span {
+    int x, y;
+    int length;
+    int32_t attr[GPU_SPAN_NR_ATTRS];
+    int32_t attr_dx[GPU_SPAN_NR_ATTRS];
+};
+
+extern const int8_t GPU_SPAN_DITHER[4][4];
+
+static inline int
+gpu_span_clamp8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Texture window, then a 4/8bpp CLUT or 15bpp direct fetch */
+static inline uint16_t
+gpu_span_texel(const uint16_t *vram, const struct gpu_primitive *p,
+               unsigned int u, unsigned int v)
+{
+    unsigned int x, y, index;
+    uint16_t word;
+
+    u = (u & ~(p->window_mask_x * 8u)) |
+        ((p->window_offset_x & p->window_mask_x) * 8u);
+    v = (v & ~(p->window_mask_y * 8u)) |
+        ((p->window_offset_y & p->window_mask_y) * 8u);
+
+    u &= 0xff;
+
+    if (p->texture) {
+        return p->texture[(v & 0xff) * 256 + u];
+    }
+
+    y = (p->texpage_y + (v & 0xff)) & (GPU_VRAM_HEIGHT - 1);
+
+    switch (p->depth) {
+    case 0:
+        x = (p->texpage_x + u / 4) & (GPU_VRAM_WIDTH - 1);
+        word = vram[y * GPU_VRAM_WIDTH + x];
+        index = (word >> ((u & 3) * 4)) & 0xf;
+        break;
+    case 1:
+        x = (p->texpage_x + u / 2) & (GPU_VRAM_WIDTH - 1);
+        word = vram[y * GPU_VRAM_WIDTH + x];
+        index = (word >> ((u & 1) * 8)) & 0xff;
+        break;
+    default:
+        x = (p->texpage_x + u) & (GPU_VRAM_WIDTH - 1);
+        return vram[y * GPU_VRAM_WIDTH + x];
+    }
+
+    x = (p->clut_x + index) & (GPU_VRAM_WIDTH - 1);
+    return vram[p->clut_y * GPU_VRAM_WIDTH + x];
+}
+
+/*
+ * The AVX2 kernel gathers 32 bits per texel, so VRAM and decoded texture
+ * pages must be followed by at least one more halfword of addressable memory.
+ */
+typedef void (*gpu_span_kernel)(uint16_t *vram, const struct gpu_primitive *p,
+                                const struct gpu_span *span);
+
+void gpu_span_scalar(uint16_t *vram, const struct gpu_primitive *p,
+                     const struct gpu_span *span);
+void gpu_span_sse41(uint16_t *vram, const struct gpu_primitive *p,
+                    const struct gpu_span *span);
+void gpu_span_avx2(uint16_t *vram, const struct gpu_primitive *p,
+                   const struct gpu_span *span);
+
+void gpu_span_setup(void);
+
+bool gpu_span_supported(enum gpu_span_isa isa);
+gpu_span_kernel gpu_span_get(enum gpu_span_isa isa);
+const char * gpu_span_isa_name(enum gpu_span_isa isa);
+
+bool gpu_span_select(enum gpu_span_isa isa);
+enum gpu_span_isa gpu_span_selected(void);
+
+void gpu_span_draw(uint16_t *vram, const struct gpu_primitive *p,
+                   const struct gpu_span *span);
+
+#endif /* GPU_SPAN_H */
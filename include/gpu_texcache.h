@@ -0,0 +1,67 @@
+#ifndef GPU_TEXCACHE_H
+#define GPU_TEXCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpu_raster.h"
+
+#define GPU_TEXCACHE_PAGE_SIZE      256     /* Decoded pages are 256x256 */
+#define GPU_TEXCACHE_NR_ENTRIES     16
+#define GPU_TEXCACHE_MAX_SOURCES    4
+
+/*
+ * A 4bpp or 8bpp texture page with its CLUT already applied. The texels
+ * come first so the AVX2 span kernel's gathers may read one past the end.
+ */
+struct gpu_texcache_entry {
+    uint16_t texel[GPU_TEXCACHE_PAGE_SIZE * GPU_TEXCACHE_PAGE_SIZE];
+
+    uint16_t texpage_x, texpage_y;
+    uint16_t clut_x, clut_y;
+    uint8_t depth;
+    bool valid;
+
+    /* The texture page and CLUT, split where they wrap around VRAM */
+    struct gpu_rect source[GPU_TEXCACHE_MAX_SOURCES];
+    unsigned int nr_sources;
+
+    unsigned int batch;             /* Last raster batch to sample it */
+    uint64_t last_used;
+};
+
+struct gpu_texcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;         /* Entries dropped by VRAM writes */
+};
+
+/*
+ * Only the GPU thread updates the cache; the statistics are written
+ * atomically so that the GUI may read them at any time.
+ */
+struct gpu_texcache {
+    struct gpu_texcache_entry entry[GPU_TEXCACHE_NR_ENTRIES];
+    uint64_t clock;
+
+    struct gpu_texcache_stats stats;
+};
+
+void gpu_texcache_setup(struct gpu_texcache *cache);
+
+const uint16_t * gpu_texcache_lookup(struct gpu_texcache *cache,
+                                     const uint16_t *vram,
+                                     const struct gpu_primitive *p,
+                                     unsigned int batch);
+
+void gpu_texcache_invalidate(struct gpu_texcache *cache,
+                             const struct gpu_rect *rect);
+void gpu_texcache_invalidate_area(struct gpu_texcache *cache, int x, int y,
+                                  int width, int height);
+void gpu_texcache_invalidate_all(struct gpu_texcache *cache);
+
+void gpu_texcache_stats(const struct gpu_texcache *cache,
+                        struct gpu_texcache_stats *stats);
+
+#endif /* GPU_TEXCACHE_H */
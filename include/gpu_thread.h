@@ -0,0 +1,57 @@
+#ifndef GPU_THREAD_H
+#define GPU_THREAD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPU_THREAD_RING_SIZE    (1 << 16)   /* Entries, a power of two */
+#define GPU_THREAD_SPIN         1024        /* Polls before sleeping */
+
+struct psx_machine;
+
+enum gpu_port {
+    GPU_PORT_GP0,
+    GPU_PORT_GP1,
+    GPU_PORT_VBLANK
+};
+
+/*
+ * Single producer (emulation thread), single consumer (GPU thread) ring of
+ * port writes. Each side owns one index and only reads the other, so the
+ * fast path needs no locks; the mutex only parks an idle thread.
+ */
+struct gpu_thread {
+    uint64_t ring[GPU_THREAD_RING_SIZE];
+
+    size_t head __attribute__ ((aligned (64)));     /* Producer owned */
+    size_t tail_cache;
+    size_t tail __attribute__ ((aligned (64)));     /* Consumer owned */
+
+    bool running;
+    bool quit;
+    bool irq;                   /* GP0(1Fh) executed, not yet delivered */
+    bool irq_pending;           /* A word that may be GP0(1Fh) was queued */
+
+    bool consumer_waiting;
+    bool producer_waiting;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+};
+
+void gpu_thread_setup(struct psx_machine *psx);
+void gpu_thread_shutdown(struct psx_machine *psx);
+
+bool gpu_thread_start(struct psx_machine *psx);
+void gpu_thread_stop(struct psx_machine *psx);
+bool gpu_thread_running(struct psx_machine *psx);
+
+void gpu_thread_push(struct psx_machine *psx, enum gpu_port port,
+                     uint32_t value);
+void gpu_thread_sync(struct psx_machine *psx);
+
+#endif /* GPU_THREAD_H */
@@ -0,0 +1,107 @@
+#ifndef GTE_H
+#define GTE_H
+
+#include <stdint.h>
+
+#define GTE_NR_REGISTERS        32
+
+/* FLAG bits, bit 31 summarises those in GTE_FLAG_ERROR_MASK */
+#define GTE_FLAG_MAC_POS(i)     (1u << (31 - (i)))  /* MAC1-3 */
+#define GTE_FLAG_MAC_NEG(i)     (1u << (28 - (i)))
+#define GTE_FLAG_IR(i)          (1u << (25 - (i)))  /* IR1-3 */
+#define GTE_FLAG_COLOR(i)       (1u << (21 - (i)))  /* R, G, B */
+#define GTE_FLAG_SZ             (1u << 18)
+#define GTE_FLAG_DIVIDE         (1u << 17)
+#define GTE_FLAG_MAC0_POS       (1u << 16)
+#define GTE_FLAG_MAC0_NEG       (1u << 15)
+#define GTE_FLAG_SX             (1u << 14)
+#define GTE_FLAG_SY             (1u << 13)
+#define GTE_FLAG_IR0            (1u << 12)
+#define GTE_FLAG_ERROR          (1u << 31)
+#define GTE_FLAG_ERROR_MASK     0x7f87e000
+
+struct psx_machine;
+struct state;
+
+enum gte_matrix {
+    GTE_MATRIX_ROTATION,
+    GTE_MATRIX_LIGHT,
+    GTE_MATRIX_COLOR,
+    GTE_NR_MATRICES
+};
+
+enum gte_vector {
+    GTE_VECTOR_TRANSLATION,
+    GTE_VECTOR_BACKGROUND,
+    GTE_VECTOR_FAR_COLOR,
+    GTE_NR_VECTORS
+};
+
+enum gte_isa {
+    GTE_SCALAR,
+    GTE_SSE41,
+    GTE_AVX2,
+    GTE_NR_ISAS
+};
+
+/* Geometry Transformation Engine, coprocessor 2 */
+struct gte {
+    /* Data registers */
+    int16_t v[3][3];
+    uint8_t rgbc[4];
+    uint16_t otz;
+    int16_t ir[4];
+    int16_t sxy[3][2];              /* Screen XY FIFO, oldest first */
+    uint16_t sz[4];                 /* Screen Z FIFO, oldest first */
+    uint8_t rgb[3][4];              /* Colour FIFO, oldest first */
+    uint32_t res1;
+    int32_t mac[4];
+    int32_t lzcs;
+    uint32_t lzcr;
+
+    /* Control registers */
+    int16_t matrix[GTE_NR_MATRICES][3][3];
+    int32_t vector[GTE_NR_VECTORS][3];
+    int32_t ofx, ofy;
+    uint16_t h;
+    int16_t dqa;
+    int32_t dqb;
+    int16_t zsf3, zsf4;
+    uint32_t flag;
+};
+
+/*
+ * Computes t * 0x1000 + m * v one product at a time, with each partial sum
+ * checked and wrapped to 44 bits like the MAC1-3 accumulators. Returns the
+ * MAC overflow flags. The vector kernels must match the scalar one exactly.
+ */
+typedef uint32_t (*gte_matvec_kernel)(const int16_t m[3][3],
+                                      const int32_t t[3],
+                                      const int16_t v[3],
+                                      int64_t result[3]);
+
+uint32_t gte_matvec_scalar(const int16_t m[3][3], const int32_t t[3],
+                           const int16_t v[3], int64_t result[3]);
+uint32_t gte_matvec_sse41(const int16_t m[3][3], const int32_t t[3],
+                          const int16_t v[3], int64_t result[3]);
+uint32_t gte_matvec_avx2(const int16_t m[3][3], const int32_t t[3],
+                         const int16_t v[3], int64_t result[3]);
+
+void gte_setup(struct psx_machine *psx);
+void gte_hard_reset(struct psx_machine *psx);
+
+const char * gte_isa_name(enum gte_isa isa);
+enum gte_isa gte_selected(void);
+
+uint32_t gte_read_data(struct psx_machine *psx, unsigned int reg);
+void gte_write_data(struct psx_machine *psx, unsigned int reg, uint32_t value);
+uint32_t gte_read_control(struct psx_machine *psx, unsigned int reg);
+void gte_write_control(struct psx_machine *psx, unsigned int reg,
+                       uint32_t value);
+
+void gte_execute(struct psx_machine *psx, uint32_t instruction);
+
+void gte_save_state(struct psx_machine *psx, struct state *state);
+void gte_load_state(struct psx_machine *psx, struct state *state);
+
+#endif /* GTE_H */
@@ -11,7 +11,10 @@ extern "C" {
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 
+struct psx_machine;
+
 void gui_setup(SDL_Window *window, SDL_GLContext context);
+void gui_attach(struct psx_machine *psx);
 void gui_shutdown(void);
 
 void gui_process_event(SDL_Event event);
@@ -22,6 +25,8 @@ void gui_add_tty_entry(const char *str, size_t len);
 
 bool gui_should_quit(void);
 bool gui_should_continue(void);
+bool gui_should_rewind(void);
+void gui_run_ahead(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,113 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "psx.h"
+
+/*
+ * Emulation performance counters. They are only compiled in when PSX_PERF is
+ * defined, otherwise the PERF_* hooks expand to nothing.
+ */
+
+enum perf_section {
+    PERF_SECTION_CPU,
+    PERF_SECTION_SPU,
+    PERF_SECTION_DMA,
+    PERF_SECTION_GPU,
+    PERF_SECTION_GUI,
+    PERF_NR_SECTIONS
+};
+
+enum perf_region {
+    PERF_REGION_RAM,
+    PERF_REGION_BIOS,
+    PERF_REGION_IO,
+    PERF_REGION_OTHER,
+    PERF_NR_REGIONS
+};
+
+struct perf_frame {
+    uint64_t instructions;      /* Guest instructions retired */
+    uint64_t cycles;            /* Guest cycles, idle skips included */
+    uint64_t frame_ns;          /* Host time spent in psx_run_frame */
+    uint64_t section_ns[PERF_NR_SECTIONS];
+    uint64_t bus[PERF_NR_REGIONS];  /* CPU data accesses per region */
+};
+
+struct perf {
+    struct perf_frame current;
+    struct perf_frame last;
+
+    uint64_t frames;
+    uint64_t frame_start;
+    uint64_t frame_timestamp;
+    uint64_t section_start[PERF_NR_SECTIONS];
+};
+
+uint64_t perf_now(void);
+
+const char * perf_section_name(enum perf_section section);
+const char * perf_region_name(enum perf_region region);
+
+#ifdef PSX_PERF
+
+void perf_frame_begin(struct psx_machine *psx);
+void perf_frame_end(struct psx_machine *psx);
+
+void perf_section_begin(struct psx_machine *psx, enum perf_section section);
+void perf_section_end(struct psx_machine *psx, enum perf_section section);
+
+const struct perf_frame * perf_last_frame(struct psx_machine *psx);
+uint64_t perf_frames(struct psx_machine *psx);
+
+void perf_csv_header(FILE *fp);
+void perf_csv_write(struct psx_machine *psx, FILE *fp);
+
+static inline enum perf_region
+perf_region(uint32_t address)
+{
+    address &= 0x1fffffff;
+
+    if (address < PSX_RAM_SIZE * 4) {
+        return PERF_REGION_RAM;
+    }
+
+    if (address >= PSX_BIOS_START && address < PSX_BIOS_END) {
+        return PERF_REGION_BIOS;
+    }
+
+    if (address >= 0x1f801000 && address < 0x1f804000) {
+        return PERF_REGION_IO;
+    }
+
+    return PERF_REGION_OTHER;
+}
+
+#define PERF_FRAME_BEGIN(psx)       perf_frame_begin(psx)
+#define PERF_FRAME_END(psx)         perf_frame_end(psx)
+#define PERF_FRAME_SAVE(psx, f)     ((f) = (psx)->perf.current)
+#define PERF_FRAME_RESTORE(psx, f)  ((psx)->perf.current = (f))
+#define PERF_BEGIN(psx, section)    perf_section_begin(psx, section)
+#define PERF_END(psx, section)      perf_section_end(psx, section)
+
+/* These two touch the machine, so users need psx_machine.h */
+#define PERF_INSTRUCTIONS(psx, n)   ((psx)->perf.current.instructions += (n))
+#define PERF_BUS(psx, address)      \
+    ((psx)->perf.current.bus[perf_region(address)]++)
+
+#else
+
+#define PERF_FRAME_BEGIN(psx)       ((void)0)
+#define PERF_FRAME_END(psx)         ((void)0)
+#define PERF_FRAME_SAVE(psx, f)     ((void)(f))
+#define PERF_FRAME_RESTORE(psx, f)  ((void)(f))
+#define PERF_BEGIN(psx, section)    ((void)0)
+#define PERF_END(psx, section)      ((void)0)
+#define PERF_INSTRUCTIONS(psx, n)   ((void)0)
+#define PERF_BUS(psx, address)      ((void)0)
+
+#endif /* PSX_PERF */
+
+#endif /* PERF_H */
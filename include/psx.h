@@ -1,6 +1,8 @@
 #ifndef PSX_H
 #define PSX_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "macros.h"
@@ -8,8 +10,27 @@
 #define PSX_RAM_SIZE    MEGABYTES(2)
 #define PSX_BIOS_SIZE   KILOBYTES(512)
 
+#define PSX_RAM_START   0x00000000
+#define PSX_RAM_END     PSX_RAM_START + PSX_RAM_SIZE
+
+#define PSX_BIOS_START  0x1fc00000
+#define PSX_BIOS_END    PSX_BIOS_START + PSX_BIOS_SIZE
+
+#define PSX_PAGE_SHIFT  16
+#define PSX_PAGE_SIZE   (1 << PSX_PAGE_SHIFT)
+#define PSX_PAGE_MASK   (PSX_PAGE_SIZE - 1)
+#define PSX_NR_PAGES    (1 << (32 - PSX_PAGE_SHIFT))
+
+#define PSX_CODE_PAGE_SHIFT     12
+#define PSX_CODE_PAGE_SIZE      (1 << PSX_CODE_PAGE_SHIFT)
+
+#define PSX_REFRESH_RATE        60
+#define PSX_MAX_RUN_AHEAD       4
+#define PSX_CYCLES_PER_FRAME    (R3000_FREQ / PSX_REFRESH_RATE)
+
 #define PSX_INTERRUPT_STATUS    0x1f801070
 #define PSX_INTERRUPT_MASK      0x1f801074
+#define PSX_GPUSTAT             0x1f801814
 
 enum psx_interrupt {
     PSX_INTERRUPT_VBLANK = 0x1,
@@ -25,28 +46,91 @@ enum psx_interrupt {
     PSX_INTERRUPT_PIO = 0x400,
 };
 
-void psx_setup(const char *bios_path);
-void psx_shutdown(void);
-void psx_soft_reset(void);
-void psx_hard_reset(void);
+/* What the slow path finds behind a page without a host pointer */
+enum psx_mmio {
+    PSX_MMIO_NONE,
+    PSX_MMIO_RAM,               /* Only reached for pages holding code */
+    PSX_MMIO_BIOS,
+    PSX_MMIO_EXP1,
+    PSX_MMIO_IO,                /* I/O ports and EXP2 */
+    PSX_MMIO_CACHECTRL
+};
+
+/*
+ * Host pointers for each page of the virtual address space, or NULL where the
+ * access has to take the slow path. Indexed by virtual address, so KUSEG, KSEG0
+ * and KSEG1 mirrors resolve without translation. Pages holding translated code
+ * have no write pointer, so that stores reach the block cache; which of their
+ * 4 KiB code pages hold code is kept per page, so that stores elsewhere in
+ * them need not look for blocks.
+ */
+struct psx_page_table {
+    uint8_t *read[PSX_NR_PAGES];
+    uint8_t *write[PSX_NR_PAGES];
+    uint8_t mmio[PSX_NR_PAGES];
+
+    uint16_t code[PSX_RAM_SIZE >> PSX_PAGE_SHIFT];
+};
+
+enum psx_cpu {
+    PSX_CPU_INTERPRETER,
+    PSX_CPU_JIT
+};
+
+/* Callbacks into the frontend, any of which may be left NULL */
+struct psx_host {
+    void (*tty)(void *opaque, const char *str, size_t len);
+    void (*audio)(void *opaque, int16_t *samples, size_t amount);
+
+    void *opaque;
+};
+
+struct psx_machine;
+
+struct psx_machine * psx_create(const char *bios_path);
+void psx_destroy(struct psx_machine *psx);
+void psx_set_host(struct psx_machine *psx, const struct psx_host *host);
+
+void psx_soft_reset(struct psx_machine *psx);
+void psx_hard_reset(struct psx_machine *psx);
+
+bool psx_set_cpu(struct psx_machine *psx, enum psx_cpu cpu);
+
+bool psx_load_exe(struct psx_machine *psx, const char *exe_path);
+bool psx_load_exe_data(struct psx_machine *psx, const void *data,
+                       size_t size);
+
+size_t psx_state_size(struct psx_machine *psx, uint32_t flags);
+size_t psx_save_state(struct psx_machine *psx, void *buffer, size_t size,
+                      uint32_t flags);
+bool psx_load_state(struct psx_machine *psx, const void *buffer, size_t size);
+
+void psx_step(struct psx_machine *psx);
+void psx_run_frame(struct psx_machine *psx);
+bool psx_run_ahead(struct psx_machine *psx, unsigned int frames,
+                   uint16_t *vram);
 
-void psx_step(void);
-void psx_run_frame(void);
+void psx_assert_irq(struct psx_machine *psx, enum psx_interrupt i);
 
-void psx_assert_irq(enum psx_interrupt i);
+void psx_protect_page(struct psx_machine *psx, uint32_t address);
+void psx_unprotect_page(struct psx_machine *psx, uint32_t address);
 
-uint8_t psx_read_memory8(uint32_t address);
-uint16_t psx_read_memory16(uint32_t address);
-uint32_t psx_read_memory32(uint32_t address);
-void psx_write_memory8(uint32_t address, uint8_t value);
-void psx_write_memory16(uint32_t address, uint16_t value);
-void psx_write_memory32(uint32_t address, uint32_t value);
+uint8_t psx_read_memory8(struct psx_machine *psx, uint32_t address);
+uint16_t psx_read_memory16(struct psx_machine *psx, uint32_t address);
+uint32_t psx_read_memory32(struct psx_machine *psx, uint32_t address);
+void psx_write_memory8(struct psx_machine *psx, uint32_t address,
+                       uint8_t value);
+void psx_write_memory16(struct psx_machine *psx, uint32_t address,
+                        uint16_t value);
+void psx_write_memory32(struct psx_machine *psx, uint32_t address,
+                        uint32_t value);
 
-uint8_t psx_debug_read_memory8(uint32_t address);
-uint32_t psx_debug_read_memory32(uint32_t address);
-void psx_debug_write_memory32(uint32_t address, uint32_t value);
+uint8_t psx_debug_read_memory8(struct psx_machine *psx, uint32_t address);
+uint32_t psx_debug_read_memory32(struct psx_machine *psx, uint32_t address);
+void psx_debug_write_memory32(struct psx_machine *psx, uint32_t address,
+                              uint32_t value);
 
-uint8_t * psx_debug_ram(void);
-uint8_t * psx_debug_bios(void);
+uint8_t * psx_debug_ram(struct psx_machine *psx);
+uint8_t * psx_debug_bios(struct psx_machine *psx);
 
 #endif /* PSX_H */
@@ -0,0 +1,66 @@
+#ifndef PSX_MACHINE_H
+#define PSX_MACHINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dma.h"
+#include "exp2.h"
+#include "gpu.h"
+#include "gte.h"
+#include "perf.h"
+#include "psx.h"
+#include "r3000.h"
+#include "r3000_cache.h"
+#include "r3000_idle.h"
+#include "r3000_jit.h"
+#include "replay.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include "spu.h"
+#include "timer.h"
+
+/*
+ * Complete state of one emulated console. Each subsystem keeps its state in
+ * its own member, and every entry point takes the machine it operates on, so
+ * that any number of instances can coexist in one process. The structure is
+ * a single allocation, guest memory included.
+ */
+struct psx_machine {
+    struct r3000 r3000;     /* First, as the JIT addresses it from rbx */
+    struct scheduler scheduler;
+
+    enum psx_cpu cpu;
+    bool frame_done;
+
+    struct {
+        uint32_t status;
+        uint32_t mask;
+    } interrupt;
+
+    struct psx_host host;
+
+    struct dma dma;
+    struct exp2 exp2;
+    struct gpu gpu;
+    struct gte gte;
+    struct spu spu;
+    struct timer timer;
+
+    struct r3000_idle r3000_idle;
+    struct r3000_jit r3000_jit;
+    struct r3000_cache r3000_cache;
+
+    struct psx_page_table pages;
+    struct rewind rewind;
+    struct replay replay;
+
+#ifdef PSX_PERF
+    struct perf perf;
+#endif
+
+    uint8_t ram[PSX_RAM_SIZE] __attribute__ ((aligned (16)));
+    uint8_t bios[PSX_BIOS_SIZE] __attribute__ ((aligned (16)));
+};
+
+#endif /* PSX_MACHINE_H */
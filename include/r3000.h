@@ -7,6 +7,8 @@
 #define R3000_REGISTER_HI       32
 #define R3000_REGISTER_LO       33
 
+#define R3000_REGISTER_SCRATCH  34 /* Receives writes to $zero */
+
 #define R3000_NR_REGISTERS      34 /* 32 GPRs + $hi and $lo */
 #define R3000_COP0_NR_REGISTERS 32
 
@@ -35,38 +37,73 @@ enum R3000Exception {
     R3000_EXCEPTION_OVERFLOW,
 };
 
+struct psx_machine;
+struct state;
+
+struct r3000 {
+    uint32_t pc, current_pc, next_pc;
+    uint32_t gpr[R3000_NR_REGISTERS + 1];
+
+    bool branch, branch_delay;
+
+    /* Interrupts enabled and pending, updated whenever sr or cause change */
+    bool interrupt;
+
+    struct {
+        uint32_t sr;
+        uint32_t cause;
+        uint32_t epc;
+    } cop0;
+};
+
 const char * r3000_register_name(unsigned int reg);
 const char * r3000_cop0_register_name(unsigned int reg);
 
-void r3000_setup(void);
-void r3000_soft_reset(void);
-void r3000_hard_reset(void);
+void r3000_setup(struct psx_machine *psx);
+void r3000_soft_reset(struct psx_machine *psx);
+void r3000_hard_reset(struct psx_machine *psx);
+
+void r3000_assert_irq(struct psx_machine *psx, bool state);
+void r3000_exception(struct psx_machine *psx, enum R3000Exception e);
+void r3000_exit_exception(struct psx_machine *psx);
+
+uint32_t r3000_read_pc(struct psx_machine *psx);
+uint32_t r3000_read_current_pc(struct psx_machine *psx);
+uint32_t r3000_read_next_pc(struct psx_machine *psx);
+void r3000_jump(struct psx_machine *psx, uint32_t address);
+void r3000_branch(struct psx_machine *psx, uint32_t offset);
+void r3000_set_pc(struct psx_machine *psx, uint32_t address);
 
-void r3000_assert_irq(bool state);
-void r3000_exception(enum R3000Exception e);
-void r3000_exit_exception(void);
+uint32_t r3000_read_reg(struct psx_machine *psx, unsigned int reg);
+void r3000_write_reg(struct psx_machine *psx, unsigned int reg, uint32_t value);
 
-uint32_t r3000_read_pc(void);
-uint32_t r3000_read_next_pc(void);
-void r3000_jump(uint32_t address);
-void r3000_branch(uint32_t offset);
+uint32_t r3000_cop0_read(struct psx_machine *psx, unsigned int reg);
+void r3000_cop0_write(struct psx_machine *psx, unsigned int reg,
+                      uint32_t value);
 
-uint32_t r3000_read_reg(unsigned int reg);
-void r3000_write_reg(unsigned int reg, uint32_t value);
+uint32_t r3000_translate_virtaddr(uint32_t address);
+bool r3000_interrupt_deliverable(struct psx_machine *psx);
+bool r3000_advance_pc(struct psx_machine *psx);
 
-uint32_t r3000_cop0_read(unsigned int reg);
-void r3000_cop0_write(unsigned int reg, uint32_t value);
+uint32_t r3000_read_code(struct psx_machine *psx);
+uint8_t r3000_read_memory8(struct psx_machine *psx, uint32_t address);
+uint16_t r3000_read_memory16(struct psx_machine *psx, uint32_t address);
+uint32_t r3000_read_memory32(struct psx_machine *psx, uint32_t address);
+void r3000_write_memory8(struct psx_machine *psx, uint32_t address,
+                         uint8_t value);
+void r3000_write_memory16(struct psx_machine *psx, uint32_t address,
+                          uint16_t value);
+void r3000_write_memory32(struct psx_machine *psx, uint32_t address,
+                          uint32_t value);
 
-uint32_t r3000_read_code(void);
-uint8_t r3000_read_memory8(uint32_t address);
-uint16_t r3000_read_memory16(uint32_t address);
-uint32_t r3000_read_memory32(uint32_t address);
-void r3000_write_memory8(uint32_t address, uint8_t value);
-void r3000_write_memory16(uint32_t address, uint16_t value);
-void r3000_write_memory32(uint32_t address, uint32_t value);
+void r3000_debug_force_pc(struct psx_machine *psx, uint32_t address);
+void r3000_debug_write_reg(struct psx_machine *psx, unsigned int reg,
+                           uint32_t value);
+uint32_t r3000_debug_read_memory32(struct psx_machine *psx, uint32_t address);
+void r3000_debug_write_memory32(struct psx_machine *psx, uint32_t address,
+                                uint32_t value);
 
-void r3000_debug_force_pc(uint32_t address);
-uint32_t r3000_debug_read_memory32(uint32_t address);
-void r3000_debug_write_memory32(uint32_t address, uint32_t value);
+void r3000_save_state(struct psx_machine *psx, struct state *state);
+void r3000_load_state(struct psx_machine *psx, struct state *state);
 
 #endif /* R3000_H */
@@ -0,0 +1,71 @@
+#ifndef R3000_CACHE_H
+#define R3000_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macros.h"
+#include "psx.h"
+
+#define R3000_CACHE_PAGE_SIZE   KILOBYTES(4)
+#define R3000_CACHE_NR_REGIONS  2
+
+struct psx_machine;
+
+/*
+ * Common header of a translated block of guest code. Execution backends embed
+ * this at the start of their own block structures and allocate them with
+ * malloc, as the cache takes ownership once a block has been inserted.
+ */
+struct r3000_block {
+    uint32_t address;           /* Physical address of the first instruction */
+    uint32_t size;              /* Size of the guest code in bytes */
+
+    bool valid;
+    bool idle;                  /* Side-effect free loop back to its start */
+
+    struct r3000_block *next;   /* Next block starting in the same page */
+};
+
+struct r3000_cache_region {
+    uint32_t start;
+    uint32_t size;
+
+    struct r3000_block **lookup;    /* One entry per instruction word */
+    struct r3000_block **pages;     /* Blocks starting within each page */
+
+    unsigned int *code;             /* Blocks touching each code page */
+};
+
+struct r3000_cache {
+    struct r3000_cache_region region[R3000_CACHE_NR_REGIONS];
+
+    /* Blocks which have been invalidated but may still be executing */
+    struct r3000_block *garbage;
+
+    /* Backing storage of the regions, kept inline in the machine */
+    struct r3000_block *ram_lookup[PSX_RAM_SIZE / sizeof(uint32_t)];
+    struct r3000_block *ram_pages[PSX_RAM_SIZE / R3000_CACHE_PAGE_SIZE];
+    unsigned int ram_code[PSX_RAM_SIZE / PSX_CODE_PAGE_SIZE];
+
+    struct r3000_block *bios_lookup[PSX_BIOS_SIZE / sizeof(uint32_t)];
+    struct r3000_block *bios_pages[PSX_BIOS_SIZE / R3000_CACHE_PAGE_SIZE];
+    unsigned int bios_code[PSX_BIOS_SIZE / PSX_CODE_PAGE_SIZE];
+};
+
+void r3000_cache_setup(struct psx_machine *psx);
+void r3000_cache_shutdown(struct psx_machine *psx);
+
+bool r3000_cache_cacheable(struct psx_machine *psx, uint32_t address);
+
+struct r3000_block * r3000_cache_lookup(struct psx_machine *psx,
+                                        uint32_t address);
+void r3000_cache_insert(struct psx_machine *psx, struct r3000_block *block);
+void r3000_cache_collect(struct psx_machine *psx);
+
+void r3000_cache_invalidate(struct psx_machine *psx, uint32_t address);
+void r3000_cache_invalidate_range(struct psx_machine *psx, uint32_t address,
+                                  uint32_t size);
+void r3000_cache_flush(struct psx_machine *psx);
+
+#endif /* R3000_CACHE_H */
@@ -0,0 +1,35 @@
+#ifndef R3000_IDLE_H
+#define R3000_IDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define R3000_IDLE_MAX_LOOPS    64
+
+struct psx_machine;
+
+struct r3000_idle_loop {
+    uint32_t address;
+
+    uint64_t skips;
+    uint64_t cycles;
+
+    /* Times not skipped for a load with side effects, and the last one */
+    uint64_t refused;
+    uint32_t load;
+};
+
+struct r3000_idle {
+    struct r3000_idle_loop loop[R3000_IDLE_MAX_LOOPS];
+    size_t nr_loops;
+};
+
+void r3000_idle_setup(struct psx_machine *psx);
+void r3000_idle_dump_stats(struct psx_machine *psx);
+
+bool r3000_idle_detect(const uint32_t *instructions, unsigned int length);
+unsigned int r3000_idle_skip(struct psx_machine *psx, uint32_t address,
+                             unsigned int length);
+
+#endif /* R3000_IDLE_H */
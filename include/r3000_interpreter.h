@@ -1,6 +1,16 @@
 #ifndef R3000_INTERPRETER_H
 #define R3000_INTERPRETER_H
 
-void r3000_interpreter_execute(void);
+#include <stdint.h>
 
-#endif /* R3000_INTERPRETER_H */
\ No newline at end of file
+struct psx_machine;
+
+typedef void (*r3000_interpreter_handler)(struct psx_machine *psx,
+                                          uint32_t instruction);
+
+r3000_interpreter_handler r3000_interpreter_decode(uint32_t instruction);
+
+void r3000_interpreter_execute(struct psx_machine *psx);
+unsigned int r3000_interpreter_execute_block(struct psx_machine *psx);
+
+#endif /* R3000_INTERPRETER_H */
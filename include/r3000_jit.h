@@ -0,0 +1,24 @@
+#ifndef R3000_JIT_H
+#define R3000_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct psx_machine;
+
+struct r3000_jit {
+    uint8_t *buffer;
+    size_t used;
+
+    uint8_t *ptr;
+};
+
+bool r3000_jit_supported(void);
+
+bool r3000_jit_setup(struct psx_machine *psx);
+void r3000_jit_shutdown(struct psx_machine *psx);
+
+unsigned int r3000_jit_execute(struct psx_machine *psx);
+
+#endif /* R3000_JIT_H */
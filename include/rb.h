@@ -5,12 +5,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define RB_FRAME_SIZE   (2 * sizeof(int16_t))   /* One int16 stereo frame */
+
+/*
+ * Single producer, single consumer byte ring. head and tail run freely and
+ * are masked on access; each side owns one of them and only reads the
+ * other, with acquire/release ordering, so no locks are needed. Each side
+ * also counts the calls it could not complete in full.
+ */
 struct rb {
-    void *buffer;
-    size_t length;
-    size_t head;
-    size_t tail;
-    size_t count;
+    uint8_t *buffer;
+    size_t length;                  /* Bytes, a power of two */
+    size_t mask;
+
+    size_t head __attribute__ ((aligned (64)));     /* Producer owned */
+    uint64_t overruns;
+
+    size_t tail __attribute__ ((aligned (64)));     /* Consumer owned */
+    uint64_t underruns;
 };
 
 bool rb_init(struct rb *rb, size_t length);
@@ -20,6 +32,14 @@ void rb_clear(struct rb *rb);
 size_t rb_read(struct rb *rb, void *dest, size_t amount);
 size_t rb_write(struct rb *rb, const void *src, size_t amount);
 
+size_t rb_read_frames(struct rb *rb, int16_t *frames, size_t nr_frames);
+size_t rb_write_frames(struct rb *rb, const int16_t *frames,
+                       size_t nr_frames);
+
+size_t rb_count(struct rb *rb);
 float rb_usage(struct rb *rb);
 
+uint64_t rb_overruns(struct rb *rb);
+uint64_t rb_underruns(struct rb *rb);
+
 #endif /* RB_H */
@@ -0,0 +1,97 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A replay log is a savestate of the machine when recording began, then
+ * every input from outside the emulated console, stamped with the cycle it
+ * arrived at. Frames and steps the frontend ran are logged too, in runs, as
+ * devices are only serviced between blocks and so the way the CPU was driven
+ * matters. A hash of RAM and the CPU is logged every REPLAY_HASH_INTERVAL
+ * frames for playback to check against.
+ */
+
+#define REPLAY_MAGIC            "PSXREPLY"
+#define REPLAY_VERSION          1
+#define REPLAY_HASH_INTERVAL    60
+
+struct psx_machine;
+
+enum replay_event_type {
+    REPLAY_EVENT_FRAMES,            /* arg[0] frames run */
+    REPLAY_EVENT_STEPS,             /* arg[0] instructions stepped */
+    REPLAY_EVENT_HASH,              /* arg[0] low and arg[1] high word */
+    REPLAY_EVENT_SOFT_RESET,
+    REPLAY_EVENT_HARD_RESET,
+    REPLAY_EVENT_WRITE_REG,         /* arg[0] register, arg[1] value */
+    REPLAY_EVENT_FORCE_PC,          /* arg[0] address */
+    REPLAY_EVENT_WRITE_MEMORY32,    /* arg[0] address, arg[1] value */
+    REPLAY_EVENT_EXE,               /* PS-EXE image as payload */
+    REPLAY_NR_EVENTS
+};
+
+struct replay_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t state_size;            /* Savestate following the header */
+};
+
+struct replay_event {
+    uint32_t type;
+    uint32_t size;                  /* Payload following the event */
+    uint64_t timestamp;
+    uint32_t arg[2];
+};
+
+enum replay_mode {
+    REPLAY_OFF,
+    REPLAY_RECORDING,
+    REPLAY_PLAYING
+};
+
+enum replay_status {
+    REPLAY_FRAME,                   /* Ran a logged frame */
+    REPLAY_INPUT,                   /* Applied anything else */
+    REPLAY_END,
+    REPLAY_DESYNC
+};
+
+struct replay {
+    enum replay_mode mode;
+    FILE *fp;
+
+    uint64_t frames;                /* Since the log began */
+    uint64_t hashes;                /* Checked while playing */
+
+    /* Frames or steps run since the last event, or being played back */
+    enum replay_event_type run;
+    uint32_t run_count;
+    uint64_t run_timestamp;
+};
+
+struct replay_stats {
+    uint64_t frames;
+    uint64_t hashes;
+};
+
+bool replay_record(struct psx_machine *psx, const char *path);
+bool replay_play(struct psx_machine *psx, const char *path);
+void replay_stop(struct psx_machine *psx);
+enum replay_mode replay_mode(struct psx_machine *psx);
+void replay_stats(struct psx_machine *psx, struct replay_stats *stats);
+
+enum replay_status replay_next(struct psx_machine *psx);
+uint64_t replay_hash(struct psx_machine *psx);
+
+/* Called by the entry points the frontend drives the machine through */
+void replay_log_frame(struct psx_machine *psx);
+void replay_log_step(struct psx_machine *psx);
+void replay_log(struct psx_machine *psx, enum replay_event_type type,
+                uint32_t arg0, uint32_t arg1, const void *payload,
+                uint32_t size);
+
+#endif /* REPLAY_H */
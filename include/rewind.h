@@ -0,0 +1,80 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macros.h"
+#include "psx.h"
+
+/*
+ * Rewind keeps the newest frame whole in shadow copies, the keyframe, and a
+ * ring of deltas back from it. Each delta holds the old contents of the
+ * 4 KiB blocks that changed over one frame, as runs of differing words. RAM
+ * and SPU RAM blocks are found through dirty bitmaps set by the write paths;
+ * the rest of the machine is serialized and compared. Once the ring is full
+ * the oldest frames are dropped. Run-ahead uses the keyframe alone, to come
+ * back from the frames it runs.
+ */
+
+#define REWIND_BLOCK_SHIFT      12
+#define REWIND_BLOCK_SIZE       (1 << REWIND_BLOCK_SHIFT)
+#define REWIND_DEFAULT_SIZE     MEGABYTES(256)
+
+#define REWIND_DIRTY_WORDS      (PSX_RAM_SIZE >> REWIND_BLOCK_SHIFT >> 6)
+
+struct psx_machine;
+
+enum rewind_region {
+    REWIND_RAM,
+    REWIND_SPU_RAM,
+    REWIND_CORE,                    /* Everything else, serialized */
+    REWIND_NR_REGIONS
+};
+
+struct rewind {
+    /* Blocks written since the shadows were last updated, kept always */
+    uint64_t dirty[REWIND_CORE][REWIND_DIRTY_WORDS];
+
+    uint8_t *shadow[REWIND_NR_REGIONS];
+    size_t size[REWIND_NR_REGIONS];
+
+    uint8_t *core;                  /* Machine serialized without memory */
+
+    /* History, only while enabled */
+    uint8_t *scratch;               /* Delta being built or applied */
+
+    uint8_t *ring;
+    size_t capacity;                /* Zero while rewind is disabled */
+    size_t head, tail;              /* Free running byte offsets */
+    unsigned int frames;
+};
+
+struct rewind_stats {
+    unsigned int frames;
+    size_t used;
+    size_t capacity;
+};
+
+#define REWIND_MARK(psx, region, offset)                                     \
+    ((psx)->rewind.dirty[region][(offset) >> REWIND_BLOCK_SHIFT >> 6] |=    \
+     (uint64_t)1 << ((offset) >> REWIND_BLOCK_SHIFT & 63))
+
+void rewind_mark_range(struct psx_machine *psx, enum rewind_region region,
+                       uint32_t offset, uint32_t size);
+
+bool rewind_enable(struct psx_machine *psx, size_t capacity);
+void rewind_disable(struct psx_machine *psx);
+bool rewind_enabled(struct psx_machine *psx);
+void rewind_shutdown(struct psx_machine *psx);
+
+void rewind_push(struct psx_machine *psx);
+bool rewind_step(struct psx_machine *psx);
+
+bool rewind_capture(struct psx_machine *psx);
+void rewind_restore(struct psx_machine *psx);
+
+void rewind_stats(struct psx_machine *psx, struct rewind_stats *stats);
+
+#endif /* REWIND_H */
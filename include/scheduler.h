@@ -0,0 +1,57 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct psx_machine;
+struct state;
+
+enum scheduler_event {
+    SCHEDULER_EVENT_SPU,
+    SCHEDULER_EVENT_VBLANK,
+    SCHEDULER_EVENT_TIMER0,
+    SCHEDULER_EVENT_TIMER1,
+    SCHEDULER_EVENT_TIMER2,
+    SCHEDULER_NR_EVENTS
+};
+
+/* Called with the cycle the event was due at, which may be in the past */
+typedef void (*scheduler_callback)(struct psx_machine *psx, uint64_t timestamp);
+
+struct scheduler_entry {
+    uint64_t timestamp;
+    scheduler_callback callback;
+
+    int position;   /* Index into the heap */
+};
+
+struct scheduler {
+    uint64_t now;
+
+    struct scheduler_entry entry[SCHEDULER_NR_EVENTS];
+
+    /* Min-heap of pending events, ordered by timestamp */
+    enum scheduler_event heap[SCHEDULER_NR_EVENTS];
+    int size;
+};
+
+void scheduler_setup(struct psx_machine *psx);
+
+uint64_t scheduler_now(struct psx_machine *psx);
+uint64_t scheduler_next_deadline(struct psx_machine *psx);
+void scheduler_advance(struct psx_machine *psx, uint64_t cycles);
+void scheduler_run(struct psx_machine *psx);
+
+void scheduler_schedule(struct psx_machine *psx, enum scheduler_event e,
+                        uint64_t timestamp, scheduler_callback callback);
+void scheduler_cancel(struct psx_machine *psx, enum scheduler_event e);
+bool scheduler_pending(struct psx_machine *psx, enum scheduler_event e);
+
+void scheduler_register(struct psx_machine *psx, enum scheduler_event e,
+                        scheduler_callback callback);
+
+void scheduler_save_state(struct psx_machine *psx, struct state *state);
+void scheduler_load_state(struct psx_machine *psx, struct state *state);
+
+#endif /* SCHEDULER_H */
@@ -1,21 +1,128 @@
 #ifndef SPU_H
 #define SPU_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "macros.h"
+
 #define SPU_NR_VOICES   24
 
 #define SPU_RAM_SIZE    KILOBYTES(512)
 
-void spu_setup(void);
-void spu_shutdown(void);
-void spu_hard_reset(void);
+#define SPU_SAMPLE_BUFFER_SIZE          256
+#define SPU_FIFO_SIZE                   32
+
+#define SPU_VOICE_NR_SAMPLES            28
+#define SPU_VOICE_BUFFER_SIZE           32      /* Padded for the gathers */
+
+struct psx_machine;
+struct state;
+
+struct spu_volume {
+    union {
+        struct {
+            int16_t left;
+            int16_t right;
+        };
+        uint32_t both;
+    };
+};
+
+enum spu_voice_state {
+    SPU_VOICE_STATE_DISABLED,
+    SPU_VOICE_STATE_ATTACK,
+    SPU_VOICE_STATE_DECAY,
+    SPU_VOICE_STATE_SUSTAIN,
+    SPU_VOICE_STATE_RELEASE
+};
+
+struct spu_voice {
+    enum spu_voice_state state;
+
+    uint32_t start_address;
+    uint32_t repeat_address;
+    uint32_t current_address;
+
+    uint32_t adsr;
+    size_t adsr_cycles;
+
+    /* Parameters of the current ADSR phase */
+    uint32_t adsr_rate_cycles;
+    int32_t adsr_step;
+    int32_t adsr_target;
+    bool adsr_exponential;
+    bool adsr_decrease;
+
+    int16_t prev_sample[2];
+
+    bool reset;
+};
+
+/*
+ * Voice state the mixer touches every sample, one array per field so that
+ * the vector kernels load eight voices at a time. Values are kept in 32-bit
+ * lanes; volumes and the envelope are 1.15 fixed point.
+ */
+struct spu_voices {
+    int16_t sample_buffer[SPU_NR_VOICES][SPU_VOICE_BUFFER_SIZE];
+
+    uint32_t pitch_counter[SPU_NR_VOICES];
+    uint32_t pitch_step[SPU_NR_VOICES];
+    int32_t envelope[SPU_NR_VOICES];
+    int32_t volume_left[SPU_NR_VOICES];
+    int32_t volume_right[SPU_NR_VOICES];
+};
+
+struct spu {
+    uint8_t ram[SPU_RAM_SIZE];
+
+    struct spu_volume main_volume;
+    struct spu_volume reverb_volume;
+    struct spu_volume cd_volume;
+    struct spu_volume external_volume;
+
+    uint32_t key_on;
+    uint32_t key_off;
+
+    uint16_t control;
+    uint16_t status;
+
+    struct {
+        uint32_t address;
+        uint32_t current_address;
+
+        uint16_t buffer[SPU_FIFO_SIZE];
+        size_t buffer_index;
+
+        uint16_t control;
+    } data_transfer;
+
+    struct spu_voice voice[SPU_NR_VOICES];
+    struct spu_voices voices;
+    uint32_t active;                /* Voices not disabled, one bit each */
+
+    int16_t samples[SPU_SAMPLE_BUFFER_SIZE];
+    size_t sample_index;
+
+    uint64_t timestamp;             /* Cycle the next sample is due at */
+};
+
+void spu_setup(struct psx_machine *psx);
+void spu_hard_reset(struct psx_machine *psx);
+
+void spu_sync(struct psx_machine *psx);
+
+uint16_t spu_read16(struct psx_machine *psx, uint32_t address);
+void spu_write16(struct psx_machine *psx, uint32_t address, uint16_t value);
 
-void spu_step(void);
+uint32_t spu_dma_read32(struct psx_machine *psx);
+void spu_dma_write32(struct psx_machine *psx, uint32_t value);
 
-uint16_t spu_read16(uint32_t address);
-void spu_write16(uint32_t address, uint16_t value);
+uint8_t * spu_debug_ram(struct psx_machine *psx);
 
-uint8_t * spu_debug_ram(void);
+void spu_save_state(struct psx_machine *psx, struct state *state);
+void spu_load_state(struct psx_machine *psx, struct state *state);
 
 #endif /* SPU_H */
@@ -0,0 +1,47 @@
+#ifndef SPU_MIX_H
+#define SPU_MIX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spu.h"
+
+/*
+ * Mix kernels produce one stereo sample from the active voices, in the fixed
+ * point the hardware uses, and step their pitch counters. The vector kernels
+ * must produce exactly what the scalar one does.
+ */
+
+enum spu_mix_isa {
+    SPU_MIX_SCALAR,
+    SPU_MIX_SSE41,
+    SPU_MIX_AVX2,
+    SPU_MIX_NR_ISAS
+};
+
+/*
+ * Sums (sample * envelope >> 15) * volume >> 15 over the voices in active,
+ * unclamped. Returns the voices whose sample index reached the end of their
+ * buffer, which the caller must wrap and refill before the next call.
+ */
+typedef uint32_t (*spu_mix_kernel)(struct spu_voices *v, uint32_t active,
+                                   int32_t out[2]);
+
+uint32_t spu_mix_scalar(struct spu_voices *v, uint32_t active,
+                        int32_t out[2]);
+uint32_t spu_mix_sse41(struct spu_voices *v, uint32_t active,
+                       int32_t out[2]);
+uint32_t spu_mix_avx2(struct spu_voices *v, uint32_t active, int32_t out[2]);
+
+void spu_mix_setup(void);
+
+bool spu_mix_supported(enum spu_mix_isa isa);
+spu_mix_kernel spu_mix_get(enum spu_mix_isa isa);
+const char * spu_mix_isa_name(enum spu_mix_isa isa);
+
+bool spu_mix_select(enum spu_mix_isa isa);
+enum spu_mix_isa spu_mix_selected(void);
+
+uint32_t spu_mix(struct spu_voices *v, uint32_t active, int32_t out[2]);
+
+#endif /* SPU_MIX_H */
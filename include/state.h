@@ -0,0 +1,80 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Savestate format: a header, then one section per subsystem, each a section
+ * header followed by its payload padded to STATE_ALIGN. Subsystems copy
+ * their structures in bulk, so bump STATE_VERSION whenever the layout of a
+ * saved structure changes.
+ */
+
+#define STATE_MAGIC     "PSXSTATE"
+#define STATE_VERSION   2
+#define STATE_ALIGN     16
+
+/* Header flags */
+#define STATE_NO_MEMORY 0x1     /* RAM, BIOS and SPU RAM are left out */
+
+enum state_section {
+    STATE_SECTION_R3000,
+    STATE_SECTION_SCHEDULER,
+    STATE_SECTION_PSX,
+    STATE_SECTION_RAM,
+    STATE_SECTION_BIOS,
+    STATE_SECTION_DMA,
+    STATE_SECTION_EXP2,
+    STATE_SECTION_GPU,
+    STATE_SECTION_GTE,
+    STATE_SECTION_SPU,
+    STATE_SECTION_TIMER,
+    STATE_NR_SECTIONS
+};
+
+struct state_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;                  /* Including this header */
+    uint32_t flags;
+};
+
+struct state_section_header {
+    uint32_t id;
+    uint32_t size;                  /* Payload, without the padding */
+    uint8_t pad[STATE_ALIGN - 8];
+};
+
+/*
+ * Cursor over a state buffer. Writing with a NULL buffer only measures, so
+ * the same save path gives the size of a state and of each section.
+ */
+struct state {
+    uint8_t *buffer;
+    size_t size;
+    size_t offset;
+    uint32_t flags;
+
+    size_t section;                 /* Offset of the open section header */
+    enum state_section id;
+    size_t end;                     /* End of the section being read */
+    uint32_t sizes[STATE_NR_SECTIONS];
+
+    bool error;
+};
+
+void state_begin_write(struct state *state, void *buffer, size_t size,
+                       uint32_t flags);
+size_t state_end_write(struct state *state);
+
+void state_begin_section(struct state *state, enum state_section section);
+void state_end_section(struct state *state);
+void state_write(struct state *state, const void *data, size_t size);
+
+bool state_begin_read(struct state *state, const void *buffer, size_t size);
+bool state_find_section(struct state *state, enum state_section section);
+void state_read(struct state *state, void *data, size_t size);
+
+#endif /* STATE_H */
@@ -0,0 +1,44 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_NR_COUNTERS       3
+
+struct psx_machine;
+struct state;
+
+/*
+ * Root counter. Nothing ticks: value is what the counter held at the cycle
+ * in base, and accesses and events catch it up from the clock source.
+ */
+struct timer_counter {
+    uint64_t base;
+    uint16_t value;
+    uint16_t mode;
+    uint16_t target;
+
+    bool paused;                /* Stopped by its sync mode */
+    bool irq_done;              /* One-shot IRQ already raised */
+};
+
+struct timer {
+    struct timer_counter counter[TIMER_NR_COUNTERS];
+
+    unsigned int dot_divider;   /* Video clocks per dot */
+};
+
+void timer_setup(struct psx_machine *psx);
+void timer_hard_reset(struct psx_machine *psx);
+
+uint32_t timer_read(struct psx_machine *psx, uint32_t address);
+void timer_write(struct psx_machine *psx, uint32_t address, uint32_t value);
+
+void timer_vblank(struct psx_machine *psx);
+void timer_display_mode(struct psx_machine *psx, uint32_t mode);
+
+void timer_save_state(struct psx_machine *psx, struct state *state);
+void timer_load_state(struct psx_machine *psx, struct state *state);
+
+#endif /* TIMER_H */
@@ -2,6 +2,16 @@
 #define WINDOW_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct window_audio_stats {
+    float usage;                    /* Fraction of the buffer filled */
+    float latency;                  /* Buffered audio, in milliseconds */
+    double ratio;                   /* Resampler input per output frame */
+    uint64_t underruns;
+    uint64_t overruns;
+};
 
 bool window_setup(void);
 void window_shutdown(void);
@@ -10,5 +20,6 @@ bool window_update(void);
 
 void window_audio_pause(bool pause);
 void window_audio_write_samples(int16_t *samples, size_t amount);
+void window_audio_stats(struct window_audio_stats *stats);
 
 #endif /* WINDOW_H */
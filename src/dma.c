@@ -3,10 +3,13 @@
 #include <string.h>
 
 #include "dma.h"
+#include "gpu.h"
 #include "macros.h"
+#include "perf.h"
 #include "psx.h"
-
-#define DMA_NR_CHANNELS                 7
+#include "psx_machine.h"
+#include "spu.h"
+#include "state.h"
 
 #define DMA_BCR_BLOCK_SIZE              0xffff
 #define DMA_BCR_BLOCK_AMOUNT            0xffff0000
@@ -55,114 +58,101 @@ enum dma_channel_sync_mode {
     DMA_CHANNEL_SYNC_MODE_RESERVED
 };
 
-struct dma {
-    struct {
-        /* TODO: Handle updating of base address & block control following DMA */
-        uint32_t base_address;
-        uint32_t block_control;
-        uint32_t channel_control;
-    } channel[DMA_NR_CHANNELS];
-
-    uint32_t priority_control;
-    uint32_t interrupt_control;
-};
-
-static struct dma dma;
-
 static bool
-dma_irq_force(void)
+dma_irq_force(struct psx_machine *psx)
 {
-    return dma.interrupt_control & DMA_DICR_IRQ_FORCE;
+    return psx->dma.interrupt_control & DMA_DICR_IRQ_FORCE;
 }
 
 static bool
-dma_irq_master_enable(void)
+dma_irq_master_enable(struct psx_machine *psx)
 {
-    return dma.interrupt_control & DMA_DICR_IRQ_MASTER_ENABLE;
+    return psx->dma.interrupt_control & DMA_DICR_IRQ_MASTER_ENABLE;
 }
 
 
 static bool
-dma_irq_status(void)
+dma_irq_status(struct psx_machine *psx)
 {
     uint8_t irq_flags, irq_masks;
 
-    irq_flags = (dma.interrupt_control & DMA_DICR_IRQ_FLAGS) >> 24;
-    irq_masks = (dma.interrupt_control & DMA_DICR_IRQ_MASKS) >> 16;
+    irq_flags = (psx->dma.interrupt_control & DMA_DICR_IRQ_FLAGS) >> 24;
+    irq_masks = (psx->dma.interrupt_control & DMA_DICR_IRQ_MASKS) >> 16;
 
     return irq_flags & irq_masks;
 }
 
 static void
-dma_update_master_flag(void)
+dma_update_master_flag(struct psx_machine *psx)
 {
     bool force_irq, enable_irq, irq_status, prev_irq;
 
-    force_irq = dma_irq_force();
-    enable_irq = dma_irq_master_enable();
-    irq_status = dma_irq_status();
-    prev_irq = dma.interrupt_control & DMA_DICR_IRQ_MASTER;
+    force_irq = dma_irq_force(psx);
+    enable_irq = dma_irq_master_enable(psx);
+    irq_status = dma_irq_status(psx);
+    prev_irq = psx->dma.interrupt_control & DMA_DICR_IRQ_MASTER;
 
-    dma.interrupt_control &= ~DMA_DICR_IRQ_MASTER;
+    psx->dma.interrupt_control &= ~DMA_DICR_IRQ_MASTER;
 
     if (force_irq || (enable_irq && irq_status)) {
-        dma.interrupt_control |= DMA_DICR_IRQ_MASTER;
+        psx->dma.interrupt_control |= DMA_DICR_IRQ_MASTER;
 
         if (!prev_irq) {
-            psx_assert_irq(PSX_INTERRUPT_DMA);
+            psx_assert_irq(psx, PSX_INTERRUPT_DMA);
         }
     }
 }
 
 static uint32_t
-dma_channel_base_address(enum dma_channel channel)
+dma_channel_base_address(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return dma.channel[channel].base_address;
+    return psx->dma.channel[channel].base_address;
 }
 
 static uint32_t
-dma_channel_block_size(enum dma_channel channel)
+dma_channel_block_size(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return dma.channel[channel].block_control & DMA_BCR_BLOCK_SIZE;
+    return psx->dma.channel[channel].block_control & DMA_BCR_BLOCK_SIZE;
 }
 
 static uint32_t
-dma_channel_block_amount(enum dma_channel channel)
+dma_channel_block_amount(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return (dma.channel[channel].block_control & DMA_BCR_BLOCK_AMOUNT) >> 16;
+    return (psx->dma.channel[channel].block_control
+            & DMA_BCR_BLOCK_AMOUNT) >> 16;
 }
 
 static enum dma_channel_direction
-dma_channel_direction(enum dma_channel channel)
+dma_channel_direction(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return dma.channel[channel].channel_control & DMA_CHCR_DIRECTION;
+    return psx->dma.channel[channel].channel_control & DMA_CHCR_DIRECTION;
 }
 
 static enum dma_channel_step
-dma_channel_step(enum dma_channel channel)
+dma_channel_step(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return (dma.channel[channel].channel_control & DMA_CHCR_STEP) >> 1;
+    return (psx->dma.channel[channel].channel_control & DMA_CHCR_STEP) >> 1;
 }
 
 static enum dma_channel_sync_mode
-dma_channel_sync_mode(enum dma_channel channel)
+dma_channel_sync_mode(struct psx_machine *psx, enum dma_channel channel)
 {
     uint32_t channel_control;
     enum dma_channel_sync_mode sync_mode;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    channel_control = dma.channel[channel].channel_control;
+    channel_control = psx->dma.channel[channel].channel_control;
 
     sync_mode = (channel_control & DMA_CHCR_SYNC_MODE) >> 9;
     assert(sync_mode != DMA_CHANNEL_SYNC_MODE_RESERVED);
@@ -171,48 +161,48 @@ dma_channel_sync_mode(enum dma_channel channel)
 }
 
 static bool
-dma_channel_start(enum dma_channel channel)
+dma_channel_start(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return dma.channel[channel].channel_control & DMA_CHCR_START;
+    return psx->dma.channel[channel].channel_control & DMA_CHCR_START;
 }
 
 static void
-dma_channel_start_clear(enum dma_channel channel)
+dma_channel_start_clear(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    dma.channel[channel].channel_control &= ~DMA_CHCR_START;
+    psx->dma.channel[channel].channel_control &= ~DMA_CHCR_START;
 }
 
 static bool
-dma_channel_trigger(enum dma_channel channel)
+dma_channel_trigger(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    return dma.channel[channel].channel_control & DMA_CHCR_TRIGGER;
+    return psx->dma.channel[channel].channel_control & DMA_CHCR_TRIGGER;
 }
 
 static void
-dma_channel_trigger_clear(enum dma_channel channel)
+dma_channel_trigger_clear(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    dma.channel[channel].channel_control &= ~DMA_CHCR_TRIGGER;
+    psx->dma.channel[channel].channel_control &= ~DMA_CHCR_TRIGGER;
 }
 
 static uint32_t
-dma_channel_read32(uint32_t address)
+dma_channel_read32(struct psx_machine *psx, uint32_t address)
 {
     uint32_t channel = (address >> 4) & 0x7;
     uint32_t offset = address & 0xf;
 
     switch (address & 0xf) {
     case 0x0:
-        return dma.channel[channel].base_address;
+        return psx->dma.channel[channel].base_address;
     case 0x8:
-        return dma.channel[channel].channel_control;
+        return psx->dma.channel[channel].channel_control;
     default:
         printf("dma: error: read from unknown channel offset 0x%x\n", offset);
         PANIC;
@@ -222,7 +212,7 @@ dma_channel_read32(uint32_t address)
 }
 
 static bool
-dma_enabled(enum dma_channel channel)
+dma_enabled(struct psx_machine *psx, enum dma_channel channel)
 {
     uint32_t mask;
 
@@ -230,26 +220,26 @@ dma_enabled(enum dma_channel channel)
 
     mask = 1 << ((channel * 4) + 3);
 
-    return dma.priority_control & mask;
+    return psx->dma.priority_control & mask;
 }
 
 static bool
-dma_activated(enum dma_channel channel)
+dma_activated(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_sync_mode sync_mode;
     bool trigger;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    sync_mode = dma_channel_sync_mode(channel);
+    sync_mode = dma_channel_sync_mode(psx, channel);
     trigger = (sync_mode == DMA_CHANNEL_SYNC_MODE_MANUAL) ?
-              dma_channel_trigger(channel) : true;
+              dma_channel_trigger(psx, channel) : true;
 
-    return dma_channel_start(channel) && trigger;
+    return dma_channel_start(psx, channel) && trigger;
 }
 
 static bool
-dma_irq_masked(enum dma_channel channel)
+dma_irq_masked(struct psx_machine *psx, enum dma_channel channel)
 {
     uint32_t mask;
 
@@ -257,11 +247,11 @@ dma_irq_masked(enum dma_channel channel)
 
     mask = 1 << (DMA_DICR_IRQ_MASK_BASE + channel);
 
-    return dma.interrupt_control & mask;
+    return psx->dma.interrupt_control & mask;
 }
 
 static void
-dma_assert_irq(enum dma_channel channel)
+dma_assert_irq(struct psx_machine *psx, enum dma_channel channel)
 {
     uint32_t mask;
 
@@ -269,25 +259,25 @@ dma_assert_irq(enum dma_channel channel)
 
     mask = 1 << (DMA_DICR_IRQ_FLAG_BASE + channel);
 
-    dma.interrupt_control |= mask;
-    dma_update_master_flag();
+    psx->dma.interrupt_control |= mask;
+    dma_update_master_flag(psx);
 }
 
 static uint32_t
-dma_channel_remaining(enum dma_channel channel)
+dma_channel_remaining(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_sync_mode sync_mode;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    sync_mode = dma_channel_sync_mode(channel);
+    sync_mode = dma_channel_sync_mode(psx, channel);
 
     switch (sync_mode) {
     case DMA_CHANNEL_SYNC_MODE_MANUAL:
-        return dma_channel_block_size(channel);
+        return dma_channel_block_size(psx, channel);
     case DMA_CHANNEL_SYNC_MODE_REQUEST:
-        return dma_channel_block_size(channel)
-               * dma_channel_block_amount(channel);
+        return dma_channel_block_size(psx, channel)
+               * dma_channel_block_amount(psx, channel);
     case DMA_CHANNEL_SYNC_MODE_LINKED_LIST:
         return 0;
     default:
@@ -297,16 +287,16 @@ dma_channel_remaining(enum dma_channel channel)
 }
 
 static void
-dma_transfer_manual(enum dma_channel channel)
+dma_transfer_manual(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_direction direction;
     uint32_t address, remaining, value;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    direction = dma_channel_direction(channel);
-    address = dma_channel_base_address(channel) & ~0x3;
-    remaining = dma_channel_remaining(channel);
+    direction = dma_channel_direction(psx, channel);
+    address = dma_channel_base_address(psx, channel) & ~0x3;
+    remaining = dma_channel_remaining(psx, channel);
     value = 0;
 
     switch (channel) {
@@ -320,7 +310,7 @@ dma_transfer_manual(enum dma_channel channel)
         while (remaining) {
             value = (remaining == 1) ? 0xffffff : ((address - 4) & 0x1ffffc);
 
-            psx_write_memory32(address, value);
+            psx_write_memory32(psx, address, value);
 
             address = value;
             remaining--;
@@ -336,30 +326,60 @@ dma_transfer_manual(enum dma_channel channel)
 
 
 static void
-dma_transfer_request(enum dma_channel channel)
+dma_transfer_request(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_direction direction;
     enum dma_channel_step step;
     uint32_t address, remaining;
+    uint32_t value;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    direction = dma_channel_direction(channel);
-    step = dma_channel_step(channel);
-    address = dma_channel_base_address(channel) & ~0x3;
-    remaining = dma_channel_remaining(channel);
+    direction = dma_channel_direction(psx, channel);
+    step = dma_channel_step(psx, channel);
+    address = dma_channel_base_address(psx, channel) & ~0x3;
+    remaining = dma_channel_remaining(psx, channel);
 
     switch (channel) {
     case DMA_CHANNEL_GPU:
         switch (direction) {
         case DMA_CHANNEL_DIRECTION_TO_RAM:
-            PANIC;
+            while (remaining--) {
+                psx_write_memory32(psx, address, gpu_read(psx));
+
+                address += step ? -4 : 4;
+                address &= 0x1ffffc;
+            }
+
             break;
         case DMA_CHANNEL_DIRECTION_FROM_RAM:
             while (remaining--) {
-                //data = psx_read_memory32(address);
+                value = psx_read_memory32(psx, address);
+                gpu_gp0(psx, value);
+
+                address += step ? -4 : 4;
+                address &= 0x1ffffc;
+            }
+
+            break;
+        }
+        break;
+    case DMA_CHANNEL_SPU:
+        spu_sync(psx);
+
+        switch (direction) {
+        case DMA_CHANNEL_DIRECTION_TO_RAM:
+            while (remaining--) {
+                psx_write_memory32(psx, address, spu_dma_read32(psx));
 
-                /* TODO: Send data to GP0 */
+                address += step ? -4 : 4;
+                address &= 0x1ffffc;
+            }
+
+            break;
+        case DMA_CHANNEL_DIRECTION_FROM_RAM:
+            while (remaining--) {
+                spu_dma_write32(psx, psx_read_memory32(psx, address));
 
                 address += step ? -4 : 4;
                 address &= 0x1ffffc;
@@ -376,29 +396,27 @@ dma_transfer_request(enum dma_channel channel)
 }
 
 static void
-dma_transfer_linked_list(enum dma_channel channel)
+dma_transfer_linked_list(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_direction direction;
     uint32_t address, header, size;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    direction = dma_channel_direction(channel);
-    address = dma_channel_base_address(channel) & ~0x3;
+    direction = dma_channel_direction(psx, channel);
+    address = dma_channel_base_address(psx, channel) & ~0x3;
 
     switch (channel) {
     case DMA_CHANNEL_GPU:
         assert(direction == DMA_CHANNEL_DIRECTION_FROM_RAM);
 
         for (;;) {
-            header = psx_read_memory32(address);
+            header = psx_read_memory32(psx, address);
             size = header >> 24;
 
             for (uint32_t i = 0; i < size; ++i) {
                 address = (address + 4) & 0x1ffffc;
-                //command = psx_read_memory32(address);
-
-                /* TODO: Send data to GP0 */
+                gpu_gp0(psx, psx_read_memory32(psx, address));
             }
 
             if (header & 0x800000) {
@@ -417,57 +435,61 @@ dma_transfer_linked_list(enum dma_channel channel)
 }
 
 static void
-dma_transfer_finish(enum dma_channel channel)
+dma_transfer_finish(struct psx_machine *psx, enum dma_channel channel)
 {
     assert(channel < DMA_NR_CHANNELS);
 
-    dma_channel_start_clear(channel);
+    dma_channel_start_clear(psx, channel);
 
-    if (dma_irq_masked(channel)) {
-        dma_assert_irq(channel);
+    if (dma_irq_masked(psx, channel)) {
+        dma_assert_irq(psx, channel);
     }
 }
 
 static void
-dma_transfer_start(enum dma_channel channel)
+dma_transfer_start(struct psx_machine *psx, enum dma_channel channel)
 {
     enum dma_channel_sync_mode sync_mode;
 
     assert(channel < DMA_NR_CHANNELS);
 
-    sync_mode = dma_channel_sync_mode(channel);
+    sync_mode = dma_channel_sync_mode(psx, channel);
+
+    dma_channel_trigger_clear(psx, channel);
 
-    dma_channel_trigger_clear(channel);
+    PERF_BEGIN(psx, PERF_SECTION_DMA);
 
     switch (sync_mode) {
     case DMA_CHANNEL_SYNC_MODE_MANUAL:
-        dma_transfer_manual(channel);
+        dma_transfer_manual(psx, channel);
         break;
     case DMA_CHANNEL_SYNC_MODE_REQUEST:
-        dma_transfer_request(channel);
+        dma_transfer_request(psx, channel);
         break;
     case DMA_CHANNEL_SYNC_MODE_LINKED_LIST:
-        dma_transfer_linked_list(channel);
+        dma_transfer_linked_list(psx, channel);
         break;
     default:
         PANIC;
     }
 
-    dma_transfer_finish(channel);
+    PERF_END(psx, PERF_SECTION_DMA);
+
+    dma_transfer_finish(psx, channel);
 }
 
 static void
-dma_channel_write32(uint32_t address, uint32_t value)
+dma_channel_write32(struct psx_machine *psx, uint32_t address, uint32_t value)
 {
     uint32_t channel = (address >> 4) & 0x7;
     uint32_t offset = address & 0xf;
 
     switch (offset) {
     case 0x0:
-        dma.channel[channel].base_address = value & 0xffffff;
+        psx->dma.channel[channel].base_address = value & 0xffffff;
         break;
     case 0x4:
-        dma.channel[channel].block_control = value;
+        psx->dma.channel[channel].block_control = value;
         break;
     case 0x8:
         if (channel == DMA_CHANNEL_OTC) {
@@ -475,10 +497,10 @@ dma_channel_write32(uint32_t address, uint32_t value)
             value |= DMA_CHCR_STEP;
         }
 
-        dma.channel[channel].channel_control = value;
+        psx->dma.channel[channel].channel_control = value;
 
-        if (dma_activated(channel) && dma_enabled(channel)) {
-            dma_transfer_start(channel);
+        if (dma_activated(psx, channel) && dma_enabled(psx, channel)) {
+            dma_transfer_start(psx, channel);
         }
 
         break;
@@ -489,34 +511,34 @@ dma_channel_write32(uint32_t address, uint32_t value)
 }
 
 void
-dma_setup(void)
+dma_setup(struct psx_machine *psx)
 {
-    dma_hard_reset();
-    dma_soft_reset();
+    dma_hard_reset(psx);
+    dma_soft_reset(psx);
 }
 
 void
-dma_soft_reset(void)
+dma_soft_reset(struct psx_machine *psx)
 {
-    dma.priority_control = 0x07654321;
+    psx->dma.priority_control = 0x07654321;
 }
 
 void
-dma_hard_reset(void)
+dma_hard_reset(struct psx_machine *psx)
 {
-    memset(&dma, 0, sizeof(dma));
+    memset(&psx->dma, 0, sizeof(psx->dma));
 }
 
 uint32_t
-dma_read32(uint32_t address)
+dma_read32(struct psx_machine *psx, uint32_t address)
 {
     switch (address) {
     case 0x1f801080 ... 0x1f8010ef:
-        return dma_channel_read32(address);
+        return dma_channel_read32(psx, address);
     case 0x1f8010f0:
-        return dma.priority_control;
+        return psx->dma.priority_control;
     case 0x1f8010f4:
-        return dma.interrupt_control;
+        return psx->dma.interrupt_control;
     default:
         printf("dma: error: read from unknown register 0x%08x\n", address);
         PANIC;
@@ -526,21 +548,21 @@ dma_read32(uint32_t address)
 }
 
 void
-dma_write32(uint32_t address, uint32_t value)
+dma_write32(struct psx_machine *psx, uint32_t address, uint32_t value)
 {
     switch (address) {
     case 0x1f801080 ... 0x1f8010ef:
-        dma_channel_write32(address, value);
+        dma_channel_write32(psx, address, value);
         break;
     case 0x1f8010f0:
-        dma.priority_control = value;
+        psx->dma.priority_control = value;
         break;
     case 0x1f8010f4:
-        dma.interrupt_control &= ~DMA_DICR_WRITABLE;            /* Mask off all non-writable bits */
-        dma.interrupt_control &= ~(value & DMA_DICR_IRQ_FLAGS); /* Acknowledge any IRQ flags */
-        dma.interrupt_control |= value & DMA_DICR_WRITABLE;     /* Update writable values */
+        psx->dma.interrupt_control &= ~DMA_DICR_WRITABLE;            /* Mask off all non-writable bits */
+        psx->dma.interrupt_control &= ~(value & DMA_DICR_IRQ_FLAGS); /* Acknowledge any IRQ flags */
+        psx->dma.interrupt_control |= value & DMA_DICR_WRITABLE;     /* Update writable values */
 
-        dma_update_master_flag();
+        dma_update_master_flag(psx);
         break;
     default:
         printf("dma: error: write to unknown register 0x%08x: 0x%08x\n",
@@ -548,3 +570,19 @@ dma_write32(uint32_t address, uint32_t value)
         PANIC;
     }
 }
+
+void
+dma_save_state(struct psx_machine *psx, struct state *state)
+{
+    state_begin_section(state, STATE_SECTION_DMA);
+    state_write(state, &psx->dma, sizeof(psx->dma));
+    state_end_section(state);
+}
+
+void
+dma_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (state_find_section(state, STATE_SECTION_DMA)) {
+        state_read(state, &psx->dma, sizeof(psx->dma));
+    }
+}
@@ -2,8 +2,9 @@
 #include <stdio.h>
 
 #include "exp2.h"
-#include "gui.h"
 #include "macros.h"
+#include "psx_machine.h"
+#include "state.h"
 
 #define EXP2_BASE               0x1f802000
 #define EXP2_DUART_MRA          EXP2_BASE + 0x20
@@ -25,37 +26,37 @@
 #define EXP2_DUART_SR_TXRDY     0x4
 #define EXP2_DUART_SR_TXEMT     0x8
 
-#define EXP2_TX_BUF_SIZE        128
-
-static char exp2_tx_buf[EXP2_TX_BUF_SIZE];
-static int exp2_tx_buf_len;
-
 static void
-exp2_tx_byte(char byte)
+exp2_tx_byte(struct psx_machine *psx, char byte)
 {
-    assert(exp2_tx_buf_len < EXP2_TX_BUF_SIZE);
+    assert(psx->exp2.tx_buf_len < EXP2_TX_BUF_SIZE);
 
     if (byte == '\r') {
         return;
     }
 
     if (byte == '\n') {
-        if (exp2_tx_buf_len != 0) {
-            exp2_tx_byte('\0');
-            gui_add_tty_entry(exp2_tx_buf, exp2_tx_buf_len);
-            exp2_tx_buf_len = 0;
+        if (psx->exp2.tx_buf_len != 0) {
+            exp2_tx_byte(psx, '\0');
+
+            if (psx->host.tty) {
+                psx->host.tty(psx->host.opaque, psx->exp2.tx_buf,
+                              psx->exp2.tx_buf_len);
+            }
+
+            psx->exp2.tx_buf_len = 0;
         }
 
         return;
     }
 
-    exp2_tx_buf[exp2_tx_buf_len++] = byte;
+    psx->exp2.tx_buf[psx->exp2.tx_buf_len++] = byte;
 }
 
 void
-exp2_setup(void)
+exp2_setup(struct psx_machine *psx)
 {
-    exp2_tx_buf_len = 0;
+    psx->exp2.tx_buf_len = 0;
 }
 
 uint8_t
@@ -73,7 +74,7 @@ exp2_read8(uint32_t address)
 }
 
 void
-exp2_write8(uint32_t address, uint8_t value)
+exp2_write8(struct psx_machine *psx, uint32_t address, uint8_t value)
 {
     switch (address) {
     case EXP2_DUART_MRA:
@@ -83,7 +84,7 @@ exp2_write8(uint32_t address, uint8_t value)
     case EXP2_DUART_CRA:
         break;
     case EXP2_DUART_THRA:
-        exp2_tx_byte(value);
+        exp2_tx_byte(psx, value);
         break;
     case EXP2_DUART_ACR:
         break;
@@ -110,3 +111,19 @@ exp2_write8(uint32_t address, uint8_t value)
         PANIC;
     }
 }
+
+void
+exp2_save_state(struct psx_machine *psx, struct state *state)
+{
+    state_begin_section(state, STATE_SECTION_EXP2);
+    state_write(state, &psx->exp2, sizeof(psx->exp2));
+    state_end_section(state);
+}
+
+void
+exp2_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (state_find_section(state, STATE_SECTION_EXP2)) {
+        state_read(state, &psx->exp2, sizeof(psx->exp2));
+    }
+}
@@ -0,0 +1,1235 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpu.h"
+#include "gpu_raster.h"
+#include "gpu_thread.h"
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "state.h"
+#include "timer.h"
+
+#define GPU_STATUS_TEXPAGE          0x000001ff
+#define GPU_STATUS_DRAW_MODE        0x000007ff
+#define GPU_STATUS_DITHER           (1 << 9)
+#define GPU_STATUS_SET_MASK         (1 << 11)
+#define GPU_STATUS_CHECK_MASK       (1 << 12)
+#define GPU_STATUS_FIELD            (1 << 13)
+#define GPU_STATUS_REVERSE          (1 << 14)
+#define GPU_STATUS_TEXTURE_DISABLE  (1 << 15)
+#define GPU_STATUS_DISPLAY_MODE     (0x7f << 16)
+#define GPU_STATUS_INTERLACE        (1 << 22)
+#define GPU_STATUS_DISPLAY_DISABLE  (1 << 23)
+#define GPU_STATUS_IRQ              (1 << 24)
+#define GPU_STATUS_DMA_REQUEST      (1 << 25)
+#define GPU_STATUS_READY_COMMAND    (1 << 26)
+#define GPU_STATUS_READY_VRAM       (1 << 27)
+#define GPU_STATUS_READY_DMA        (1 << 28)
+#define GPU_STATUS_DMA_DIRECTION    (3 << 29)
+#define GPU_STATUS_ODD_LINE         (1u << 31)
+
+#define GPU_STATUS_RESET \
+    (GPU_STATUS_DISPLAY_DISABLE | GPU_STATUS_FIELD)
+
+#define GPU_COMMAND_GOURAUD         (1 << 28)
+#define GPU_COMMAND_QUAD            (1 << 27)
+#define GPU_COMMAND_POLYLINE        (1 << 27)
+#define GPU_COMMAND_TEXTURED        (1 << 26)
+#define GPU_COMMAND_SEMI            (1 << 25)
+#define GPU_COMMAND_RAW             (1 << 24)
+
+#define GPU_POLYLINE_END_MASK       0xf000f000
+#define GPU_POLYLINE_END            0x50005000
+
+#define GPU_MAX_WIDTH               1024
+#define GPU_MAX_HEIGHT              512
+
+static int32_t
+gpu_sign_extend11(uint32_t value)
+{
+    return (int32_t)(value << 21) >> 21;
+}
+
+static uint16_t *
+gpu_vram_pixel(struct gpu *gpu, unsigned int x, unsigned int y)
+{
+    x &= GPU_VRAM_WIDTH - 1;
+    y &= GPU_VRAM_HEIGHT - 1;
+
+    return &gpu->vram[y * GPU_VRAM_WIDTH + x];
+}
+
+/* Pixel writes from transfers honour the mask settings too */
+static void
+gpu_vram_write(struct gpu *gpu, unsigned int x, unsigned int y,
+               uint16_t value)
+{
+    uint16_t *pixel;
+
+    pixel = gpu_vram_pixel(gpu, x, y);
+
+    if ((gpu->status & GPU_STATUS_CHECK_MASK) && (*pixel & 0x8000)) {
+        return;
+    }
+
+    if (gpu->status & GPU_STATUS_SET_MASK) {
+        value |= 0x8000;
+    }
+
+    *pixel = value;
+}
+
+static void
+gpu_transfer_start(struct gpu_transfer *transfer, uint32_t position,
+                   uint32_t size)
+{
+    transfer->x = position & 0x3ff;
+    transfer->y = (position >> 16) & 0x1ff;
+    transfer->width = ((size - 1) & 0x3ff) + 1;
+    transfer->height = (((size >> 16) - 1) & 0x1ff) + 1;
+    transfer->column = 0;
+    transfer->row = 0;
+    transfer->active = true;
+}
+
+static void
+gpu_transfer_advance(struct gpu_transfer *transfer)
+{
+    if (++transfer->column < transfer->width) {
+        return;
+    }
+
+    transfer->column = 0;
+
+    if (++transfer->row == transfer->height) {
+        transfer->active = false;
+    }
+}
+
+static unsigned int
+gpu_command_length(uint32_t command)
+{
+    unsigned int nr_vertices, length;
+
+    switch (command >> 29) {
+    case 0x1: /* Polygon */
+        nr_vertices = (command & GPU_COMMAND_QUAD) ? 4 : 3;
+        length = 1 + nr_vertices;
+
+        if (command & GPU_COMMAND_TEXTURED) {
+            length += nr_vertices;
+        }
+
+        if (command & GPU_COMMAND_GOURAUD) {
+            length += nr_vertices - 1;
+        }
+
+        return length;
+    case 0x2: /* Line, polylines continue in GPU_MODE_POLYLINE */
+        if (command & GPU_COMMAND_POLYLINE) {
+            return 2;
+        }
+
+        return (command & GPU_COMMAND_GOURAUD) ? 4 : 3;
+    case 0x3: /* Rectangle */
+        length = 2;
+
+        if (command & GPU_COMMAND_TEXTURED) {
+            length++;
+        }
+
+        if (!(command & (3 << 27))) {
+            length++;
+        }
+
+        return length;
+    case 0x4: /* VRAM to VRAM */
+        return 4;
+    case 0x5: /* CPU to VRAM */
+    case 0x6: /* VRAM to CPU */
+        return 3;
+    default:
+        return (command >> 24) == 0x02 ? 3 : 1;
+    }
+}
+
+static void
+gpu_decode_vertex(struct gpu *gpu, struct gpu_vertex *vertex,
+                  uint32_t position, uint32_t color, uint32_t texcoord)
+{
+    vertex->x = gpu_sign_extend11(position) + gpu->offset_x;
+    vertex->y = gpu_sign_extend11(position >> 16) + gpu->offset_y;
+
+    vertex->r = color;
+    vertex->g = color >> 8;
+    vertex->b = color >> 16;
+
+    vertex->u = texcoord;
+    vertex->v = texcoord >> 8;
+}
+
+/*
+ * GPUSTAT after a texture page is set, by GP0(E1h) or a textured polygon.
+ * Pure functions of the old value, so the shadow can follow along.
+ */
+static uint32_t
+gpu_texpage_status(uint32_t status, uint32_t value, bool texture_disable)
+{
+    status &= ~(GPU_STATUS_TEXPAGE | GPU_STATUS_TEXTURE_DISABLE);
+    status |= value & GPU_STATUS_TEXPAGE;
+
+    if (texture_disable && (value & (1 << 11))) {
+        status |= GPU_STATUS_TEXTURE_DISABLE;
+    }
+
+    return status;
+}
+
+static uint32_t
+gpu_environment_status(uint32_t status, uint32_t value, bool texture_disable)
+{
+    switch (value >> 24) {
+    case 0xe1:
+        status &= ~GPU_STATUS_DRAW_MODE;
+        status |= value & GPU_STATUS_DRAW_MODE;
+        return gpu_texpage_status(status, value, texture_disable);
+    case 0xe6:
+        status &= ~(GPU_STATUS_SET_MASK | GPU_STATUS_CHECK_MASK);
+        return status | (value & 0x3) << 11;
+    default:
+        return status;
+    }
+}
+
+static uint32_t
+gpu_gp1_status(uint32_t status, uint32_t value)
+{
+    switch (value >> 24) {
+    case 0x00:
+        return GPU_STATUS_RESET;
+    case 0x02:
+        return status & ~GPU_STATUS_IRQ;
+    case 0x03:
+        status &= ~GPU_STATUS_DISPLAY_DISABLE;
+        return status | (value & 0x1) << 23;
+    case 0x04:
+        status &= ~GPU_STATUS_DMA_DIRECTION;
+        return status | (value & 0x3) << 29;
+    case 0x08:
+        status &= ~(GPU_STATUS_DISPLAY_MODE | GPU_STATUS_REVERSE);
+        status |= (value & 0x3f) << 17;
+        status |= ((value >> 6) & 0x1) << 16;
+        return status | ((value >> 7) & 0x1) << 14;
+    default:
+        return status;
+    }
+}
+
+static uint32_t
+gpu_vblank_status(uint32_t status)
+{
+    status ^= GPU_STATUS_ODD_LINE;
+
+    if (status & GPU_STATUS_INTERLACE) {
+        status ^= GPU_STATUS_FIELD;
+    }
+
+    return status;
+}
+
+static void
+gpu_set_texpage(struct gpu *gpu, uint32_t value)
+{
+    gpu->status = gpu_texpage_status(gpu->status, value,
+                                     gpu->texture_disable);
+}
+
+/* Capture the drawing state a primitive depends on */
+static void
+gpu_primitive_setup(struct gpu *gpu, struct gpu_primitive *p,
+                    enum gpu_primitive_type type, uint32_t command,
+                    bool textured)
+{
+    memset(p, 0, sizeof(*p));
+
+    p->type = type;
+
+    if (textured && !(gpu->status & GPU_STATUS_TEXTURE_DISABLE)) {
+        p->flags |= GPU_PRIMITIVE_TEXTURED;
+
+        if (command & GPU_COMMAND_RAW) {
+            p->flags |= GPU_PRIMITIVE_RAW;
+        }
+    }
+
+    if (command & GPU_COMMAND_SEMI) {
+        p->flags |= GPU_PRIMITIVE_SEMI;
+    }
+
+    if (gpu->status & GPU_STATUS_SET_MASK) {
+        p->flags |= GPU_PRIMITIVE_SET_MASK;
+    }
+
+    if (gpu->status & GPU_STATUS_CHECK_MASK) {
+        p->flags |= GPU_PRIMITIVE_CHECK_MASK;
+    }
+
+    p->semi_mode = (gpu->status >> 5) & 0x3;
+    p->depth = (gpu->status >> 7) & 0x3;
+
+    p->texpage_x = (gpu->status & 0xf) * 64;
+    p->texpage_y = ((gpu->status >> 4) & 0x1) * 256;
+
+    p->window_mask_x = gpu->window_mask_x;
+    p->window_mask_y = gpu->window_mask_y;
+    p->window_offset_x = gpu->window_offset_x;
+    p->window_offset_y = gpu->window_offset_y;
+}
+
+static void
+gpu_primitive_clut(struct gpu_primitive *p, uint32_t clut)
+{
+    p->clut_x = (clut & 0x3f) * 16;
+    p->clut_y = (clut >> 6) & 0x1ff;
+}
+
+/* Clip the inclusive bounding box of some vertices to the drawing area */
+static bool
+gpu_primitive_bounds(struct gpu *gpu, struct gpu_primitive *p,
+                     unsigned int nr_vertices)
+{
+    int32_t x0, y0, x1, y1;
+
+    x0 = x1 = p->v[0].x;
+    y0 = y1 = p->v[0].y;
+
+    for (unsigned int i = 1; i < nr_vertices; ++i) {
+        x0 = MIN(x0, p->v[i].x);
+        y0 = MIN(y0, p->v[i].y);
+        x1 = MAX(x1, p->v[i].x);
+        y1 = MAX(y1, p->v[i].y);
+    }
+
+    /* The hardware skips primitives which are too large */
+    if (x1 - x0 >= GPU_MAX_WIDTH || y1 - y0 >= GPU_MAX_HEIGHT) {
+        return false;
+    }
+
+    p->bounds.x0 = MAX(x0, gpu->area.x0);
+    p->bounds.y0 = MAX(y0, gpu->area.y0);
+    p->bounds.x1 = MIN(x1 + 1, gpu->area.x1);
+    p->bounds.y1 = MIN(y1 + 1, gpu->area.y1);
+
+    return p->bounds.x0 < p->bounds.x1 && p->bounds.y0 < p->bounds.y1;
+}
+
+static void
+gpu_queue_triangle(struct psx_machine *psx, struct gpu_primitive *p,
+                   const struct gpu_vertex *v0, const struct gpu_vertex *v1,
+                   const struct gpu_vertex *v2)
+{
+    int64_t area;
+
+    area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) -
+           (int64_t)(v1->y - v0->y) * (v2->x - v0->x);
+
+    if (!area) {
+        return;
+    }
+
+    /* The rasterizer expects a positive area */
+    p->v[0] = *v0;
+    p->v[1] = area > 0 ? *v1 : *v2;
+    p->v[2] = area > 0 ? *v2 : *v1;
+
+    if (gpu_primitive_bounds(&psx->gpu, p, 3)) {
+        gpu_raster_queue(psx, p);
+    }
+}
+
+static void
+gpu_draw_polygon(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_vertex vertex[4];
+    struct gpu_primitive p;
+    uint32_t command, color, texcoord[4];
+    unsigned int nr_vertices, word;
+    bool textured, gouraud;
+
+    command = gpu->fifo[0];
+    nr_vertices = (command & GPU_COMMAND_QUAD) ? 4 : 3;
+    textured = command & GPU_COMMAND_TEXTURED;
+    gouraud = command & GPU_COMMAND_GOURAUD;
+
+    color = command;
+    word = 1;
+
+    for (unsigned int i = 0; i < nr_vertices; ++i) {
+        if (gouraud && i) {
+            color = gpu->fifo[word++];
+        }
+
+        texcoord[i] = textured ? gpu->fifo[word + 1] : 0;
+        gpu_decode_vertex(gpu, &vertex[i], gpu->fifo[word], color,
+                          texcoord[i]);
+
+        word += textured ? 2 : 1;
+    }
+
+    /* Textured polygons carry their own texture page */
+    if (textured) {
+        gpu_set_texpage(gpu, texcoord[1] >> 16);
+    }
+
+    gpu_primitive_setup(gpu, &p, GPU_PRIMITIVE_TRIANGLE, command, textured);
+    gpu_primitive_clut(&p, texcoord[0] >> 16);
+
+    if (p.flags & GPU_PRIMITIVE_RAW) {
+        gouraud = false;
+    }
+
+    if (gouraud) {
+        p.flags |= GPU_PRIMITIVE_GOURAUD;
+    }
+
+    if ((gpu->status & GPU_STATUS_DITHER) &&
+        (gouraud || (p.flags & GPU_PRIMITIVE_TEXTURED &&
+                     !(p.flags & GPU_PRIMITIVE_RAW)))) {
+        p.flags |= GPU_PRIMITIVE_DITHER;
+    }
+
+    gpu_queue_triangle(psx, &p, &vertex[0], &vertex[1], &vertex[2]);
+
+    if (nr_vertices == 4) {
+        gpu_queue_triangle(psx, &p, &vertex[1], &vertex[2], &vertex[3]);
+    }
+}
+
+static void
+gpu_queue_line(struct psx_machine *psx, uint32_t command,
+               const struct gpu_vertex *v0, const struct gpu_vertex *v1)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_primitive p;
+
+    gpu_primitive_setup(gpu, &p, GPU_PRIMITIVE_LINE, command, false);
+
+    if (command & GPU_COMMAND_GOURAUD) {
+        p.flags |= GPU_PRIMITIVE_GOURAUD;
+
+        if (gpu->status & GPU_STATUS_DITHER) {
+            p.flags |= GPU_PRIMITIVE_DITHER;
+        }
+    }
+
+    p.v[0] = *v0;
+    p.v[1] = *v1;
+
+    if (gpu_primitive_bounds(gpu, &p, 2)) {
+        gpu_raster_queue(psx, &p);
+    }
+}
+
+static void
+gpu_draw_line(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_vertex v0, v1;
+    uint32_t command;
+
+    command = gpu->fifo[0];
+    gpu_decode_vertex(gpu, &v0, gpu->fifo[1], command, 0);
+
+    if (command & GPU_COMMAND_POLYLINE) {
+        gpu->polyline = v0;
+        gpu->fifo_len = 1;
+        gpu->mode = GPU_MODE_POLYLINE;
+        return;
+    }
+
+    if (command & GPU_COMMAND_GOURAUD) {
+        gpu_decode_vertex(gpu, &v1, gpu->fifo[3], gpu->fifo[2], 0);
+    } else {
+        gpu_decode_vertex(gpu, &v1, gpu->fifo[2], command, 0);
+    }
+
+    gpu_queue_line(psx, command, &v0, &v1);
+}
+
+static void
+gpu_polyline(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_vertex vertex;
+    uint32_t command, color;
+
+    if ((value & GPU_POLYLINE_END_MASK) == GPU_POLYLINE_END) {
+        gpu->mode = GPU_MODE_COMMAND;
+        gpu->fifo_len = 0;
+        return;
+    }
+
+    command = gpu->fifo[0];
+    gpu->fifo[gpu->fifo_len++] = value;
+
+    /* Shaded polylines send a colour ahead of each vertex */
+    if ((command & GPU_COMMAND_GOURAUD) && gpu->fifo_len < 3) {
+        return;
+    }
+
+    color = (command & GPU_COMMAND_GOURAUD) ? gpu->fifo[1] : command;
+    gpu_decode_vertex(gpu, &vertex, value, color, 0);
+
+    gpu_queue_line(psx, command, &gpu->polyline, &vertex);
+
+    gpu->polyline = vertex;
+    gpu->fifo_len = 1;
+}
+
+static void
+gpu_draw_rectangle(struct psx_machine *psx)
+{
+    static const unsigned int SIZES[4] = { 0, 1, 8, 16 };
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_primitive p;
+    unsigned int width, height, word;
+    uint32_t command, texcoord;
+    bool textured;
+
+    command = gpu->fifo[0];
+    textured = command & GPU_COMMAND_TEXTURED;
+    texcoord = textured ? gpu->fifo[2] : 0;
+    word = textured ? 3 : 2;
+
+    width = height = SIZES[(command >> 27) & 0x3];
+
+    if (!width) {
+        width = gpu->fifo[word] & 0x3ff;
+        height = (gpu->fifo[word] >> 16) & 0x1ff;
+    }
+
+    if (!width || !height) {
+        return;
+    }
+
+    gpu_primitive_setup(gpu, &p, GPU_PRIMITIVE_RECTANGLE, command, textured);
+    gpu_primitive_clut(&p, texcoord >> 16);
+
+    gpu_decode_vertex(gpu, &p.v[0], gpu->fifo[1], command, texcoord);
+    p.v[1].x = p.v[0].x + width - 1;
+    p.v[1].y = p.v[0].y + height - 1;
+
+    if (gpu_primitive_bounds(gpu, &p, 2)) {
+        gpu_raster_queue(psx, &p);
+    }
+}
+
+/* Fills ignore the drawing area and mask, and wrap around VRAM */
+static void
+gpu_fill(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_primitive p;
+    int x, y, width, height;
+
+    x = gpu->fifo[1] & 0x3f0;
+    y = (gpu->fifo[1] >> 16) & 0x1ff;
+    width = ((gpu->fifo[2] & 0x3ff) + 0xf) & ~0xf;
+    height = (gpu->fifo[2] >> 16) & 0x1ff;
+
+    memset(&p, 0, sizeof(p));
+    p.type = GPU_PRIMITIVE_FILL;
+    p.v[0].r = gpu->fifo[0];
+    p.v[0].g = gpu->fifo[0] >> 8;
+    p.v[0].b = gpu->fifo[0] >> 16;
+
+    /* Up to four pieces, empty ones are dropped by the rasterizer */
+    for (unsigned int i = 0; i < 2; ++i) {
+        p.bounds.y0 = i ? 0 : y;
+        p.bounds.y1 = i ? y + height - GPU_VRAM_HEIGHT
+                        : MIN(y + height, GPU_VRAM_HEIGHT);
+
+        for (unsigned int j = 0; j < 2; ++j) {
+            p.bounds.x0 = j ? 0 : x;
+            p.bounds.x1 = j ? x + width - GPU_VRAM_WIDTH
+                            : MIN(x + width, GPU_VRAM_WIDTH);
+
+            gpu_raster_queue(psx, &p);
+        }
+    }
+}
+
+static void
+gpu_copy_vram(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_transfer src, dst;
+    uint16_t value;
+
+    gpu_raster_flush(psx);
+
+    gpu_transfer_start(&src, gpu->fifo[1], gpu->fifo[3]);
+    gpu_transfer_start(&dst, gpu->fifo[2], gpu->fifo[3]);
+
+    gpu_texcache_invalidate_area(&gpu->texcache, dst.x, dst.y, dst.width,
+                                 dst.height);
+
+    while (src.active) {
+        value = *gpu_vram_pixel(gpu, src.x + src.column, src.y + src.row);
+        gpu_vram_write(gpu, dst.x + dst.column, dst.y + dst.row, value);
+
+        gpu_transfer_advance(&src);
+        gpu_transfer_advance(&dst);
+    }
+}
+
+static void
+gpu_cpu_to_vram(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_transfer *transfer = &gpu->cpu_to_vram;
+
+    for (unsigned int i = 0; i < 2 && transfer->active; ++i) {
+        gpu_vram_write(gpu, transfer->x + transfer->column,
+                       transfer->y + transfer->row, value >> (i * 16));
+        gpu_transfer_advance(transfer);
+    }
+
+    if (!transfer->active) {
+        gpu->mode = GPU_MODE_COMMAND;
+    }
+}
+
+static void
+gpu_environment(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    switch (value >> 24) {
+    case 0xe1:
+    case 0xe6:
+        gpu->status = gpu_environment_status(gpu->status, value,
+                                             gpu->texture_disable);
+        break;
+    case 0xe2:
+        gpu->window_mask_x = value & 0x1f;
+        gpu->window_mask_y = (value >> 5) & 0x1f;
+        gpu->window_offset_x = (value >> 10) & 0x1f;
+        gpu->window_offset_y = (value >> 15) & 0x1f;
+        break;
+    case 0xe3:
+        gpu->area.x0 = value & 0x3ff;
+        gpu->area.y0 = (value >> 10) & 0x1ff;
+        break;
+    case 0xe4:
+        gpu->area.x1 = (value & 0x3ff) + 1;
+        gpu->area.y1 = ((value >> 10) & 0x1ff) + 1;
+        break;
+    case 0xe5:
+        gpu->offset_x = gpu_sign_extend11(value);
+        gpu->offset_y = gpu_sign_extend11(value >> 11);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+gpu_execute(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    uint32_t command;
+
+    command = gpu->fifo[0];
+
+    switch (command >> 29) {
+    case 0x1:
+        gpu_draw_polygon(psx);
+        break;
+    case 0x2:
+        gpu_draw_line(psx);
+        break;
+    case 0x3:
+        gpu_draw_rectangle(psx);
+        break;
+    case 0x4:
+        gpu_copy_vram(psx);
+        break;
+    case 0x5:
+        gpu_raster_flush(psx);
+        gpu_transfer_start(&gpu->cpu_to_vram, gpu->fifo[1], gpu->fifo[2]);
+        gpu_texcache_invalidate_area(&gpu->texcache, gpu->cpu_to_vram.x,
+                                     gpu->cpu_to_vram.y,
+                                     gpu->cpu_to_vram.width,
+                                     gpu->cpu_to_vram.height);
+        gpu->mode = GPU_MODE_CPU_TO_VRAM;
+        break;
+    case 0x6:
+        gpu_raster_flush(psx);
+        gpu_transfer_start(&gpu->vram_to_cpu, gpu->fifo[1], gpu->fifo[2]);
+        break;
+    case 0x7:
+        gpu_environment(psx, command);
+        break;
+    default:
+        switch (command >> 24) {
+        case 0x02:
+            gpu_fill(psx);
+            break;
+        case 0x1f:
+            gpu->status |= GPU_STATUS_IRQ;
+
+            /* The GPU thread can't touch the CPU, gpu_sync delivers it */
+            if (gpu->thread.running) {
+                __atomic_store_n(&gpu->thread.irq, true, __ATOMIC_RELAXED);
+            } else {
+                psx_assert_irq(psx, PSX_INTERRUPT_GPU);
+            }
+            break;
+        default: /* NOP and texture cache flush */
+            break;
+        }
+    }
+}
+
+static void
+gpu_reset(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    gpu->status = GPU_STATUS_RESET;
+    gpu->read = 0;
+
+    gpu->mode = GPU_MODE_COMMAND;
+    gpu->fifo_len = 0;
+    gpu->cpu_to_vram.active = false;
+    gpu->vram_to_cpu.active = false;
+
+    gpu->texture_disable = false;
+
+    gpu->window_mask_x = gpu->window_mask_y = 0;
+    gpu->window_offset_x = gpu->window_offset_y = 0;
+
+    gpu->area.x0 = gpu->area.y0 = 0;
+    gpu->area.x1 = gpu->area.y1 = 1;
+    gpu->offset_x = gpu->offset_y = 0;
+
+    gpu->display_x = gpu->display_y = 0;
+    gpu->display_x1 = 0x200;
+    gpu->display_x2 = 0xc00;
+    gpu->display_y1 = 0x10;
+    gpu->display_y2 = 0x100;
+}
+
+static void
+gpu_info(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    switch (value & 0x7) {
+    case 0x2:
+        gpu->read = gpu->window_mask_x | (gpu->window_mask_y << 5) |
+                    (gpu->window_offset_x << 10) |
+                    (gpu->window_offset_y << 15);
+        break;
+    case 0x3:
+        gpu->read = gpu->area.x0 | (gpu->area.y0 << 10);
+        break;
+    case 0x4:
+        gpu->read = (gpu->area.x1 - 1) | ((gpu->area.y1 - 1) << 10);
+        break;
+    case 0x5:
+        gpu->read = (gpu->offset_x & 0x7ff) |
+                    ((gpu->offset_y & 0x7ff) << 11);
+        break;
+    case 0x7:
+        gpu->read = 2; /* GPU version */
+        break;
+    default:
+        break;
+    }
+}
+
+/* Restarts the shadow from the GPU's own state, once nothing is queued */
+static void
+gpu_shadow_reset(struct gpu *gpu)
+{
+    struct gpu_shadow *shadow = &gpu->shadow;
+    struct gpu_transfer *transfer = &gpu->cpu_to_vram;
+    unsigned int pixels;
+
+    shadow->status = gpu->status;
+    shadow->mode = gpu->mode;
+    memcpy(shadow->fifo, gpu->fifo, sizeof(shadow->fifo));
+    shadow->fifo_len = gpu->fifo_len;
+    shadow->command_len = gpu->command_len;
+    shadow->texture_disable = gpu->texture_disable;
+    shadow->vram_to_cpu = gpu->vram_to_cpu.active;
+
+    pixels = (transfer->height - transfer->row) * transfer->width -
+             transfer->column;
+    shadow->words = transfer->active ? (pixels + 1) / 2 : 0;
+}
+
+static void
+gpu_shadow_gp0(struct gpu *gpu, uint32_t value)
+{
+    struct gpu_shadow *shadow = &gpu->shadow;
+    struct gpu_transfer transfer;
+    uint32_t command;
+
+    switch (shadow->mode) {
+    case GPU_MODE_CPU_TO_VRAM:
+        if (!--shadow->words) {
+            shadow->mode = GPU_MODE_COMMAND;
+        }
+        return;
+    case GPU_MODE_POLYLINE:
+        if ((value & GPU_POLYLINE_END_MASK) == GPU_POLYLINE_END) {
+            shadow->mode = GPU_MODE_COMMAND;
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (!shadow->fifo_len) {
+        shadow->command_len = gpu_command_length(value);
+    }
+
+    shadow->fifo[shadow->fifo_len++] = value;
+
+    if (shadow->fifo_len < shadow->command_len) {
+        return;
+    }
+
+    shadow->fifo_len = 0;
+    command = shadow->fifo[0];
+
+    switch (command >> 29) {
+    case 0x1:
+        /* The texture page comes with the second vertex */
+        if (command & GPU_COMMAND_TEXTURED) {
+            value = shadow->fifo[(command & GPU_COMMAND_GOURAUD) ? 5 : 4];
+            shadow->status = gpu_texpage_status(shadow->status, value >> 16,
+                                                shadow->texture_disable);
+        }
+        break;
+    case 0x2:
+        if (command & GPU_COMMAND_POLYLINE) {
+            shadow->mode = GPU_MODE_POLYLINE;
+        }
+        break;
+    case 0x5:
+        gpu_transfer_start(&transfer, 0, shadow->fifo[2]);
+        shadow->words = (transfer.width * transfer.height + 1) / 2;
+        shadow->mode = GPU_MODE_CPU_TO_VRAM;
+        break;
+    case 0x6:
+        shadow->vram_to_cpu = true;
+        break;
+    case 0x7:
+        shadow->status = gpu_environment_status(shadow->status, command,
+                                                shadow->texture_disable);
+        break;
+    default:
+        if ((command >> 24) == 0x1f) {
+            shadow->status |= GPU_STATUS_IRQ;
+        }
+        break;
+    }
+}
+
+static void
+gpu_shadow_gp1(struct gpu *gpu, uint32_t value)
+{
+    struct gpu_shadow *shadow = &gpu->shadow;
+
+    shadow->status = gpu_gp1_status(shadow->status, value);
+
+    switch (value >> 24) {
+    case 0x00:
+        shadow->texture_disable = false;
+        shadow->vram_to_cpu = false;
+        /* Fall through */
+    case 0x01:
+        shadow->mode = GPU_MODE_COMMAND;
+        shadow->fifo_len = 0;
+        break;
+    case 0x09:
+        shadow->texture_disable = value & 0x1;
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+gpu_sync(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    if (!thread->running) {
+        return;
+    }
+
+    gpu_thread_sync(psx);
+
+    assert(psx->gpu.shadow.status == psx->gpu.status);
+    gpu_shadow_reset(&psx->gpu);
+
+    if (__atomic_load_n(&thread->irq, __ATOMIC_RELAXED)) {
+        thread->irq = false;
+        psx_assert_irq(psx, PSX_INTERRUPT_GPU);
+    }
+}
+
+void
+gpu_setup(struct psx_machine *psx)
+{
+    memset(psx->gpu.vram, 0, sizeof(psx->gpu.vram));
+
+    gpu_reset(psx);
+    gpu_texcache_setup(&psx->gpu.texcache);
+    gpu_raster_setup(psx);
+    gpu_thread_setup(psx);
+}
+
+void
+gpu_shutdown(struct psx_machine *psx)
+{
+    gpu_thread_shutdown(psx);
+    gpu_raster_shutdown(psx);
+}
+
+void
+gpu_hard_reset(struct psx_machine *psx)
+{
+    gpu_thread_sync(psx);
+    psx->gpu.thread.irq = false;
+
+    gpu_raster_discard(psx);
+    memset(psx->gpu.vram, 0, sizeof(psx->gpu.vram));
+    gpu_texcache_invalidate_all(&psx->gpu.texcache);
+
+    gpu_reset(psx);
+    gpu_shadow_reset(&psx->gpu);
+}
+
+bool
+gpu_set_threaded(struct psx_machine *psx, bool threaded)
+{
+    gpu_sync(psx);
+
+    if (!threaded) {
+        gpu_thread_stop(psx);
+        return true;
+    }
+
+    gpu_shadow_reset(&psx->gpu);
+    return gpu_thread_start(psx);
+}
+
+void
+gpu_set_workers(struct psx_machine *psx, unsigned int nr_workers)
+{
+    gpu_sync(psx);
+    gpu_raster_set_workers(psx, nr_workers);
+}
+
+/*
+ * Machines render on the emulation thread alone until a frontend asks for
+ * this, so library callers don't get threads they didn't want.
+ */
+void
+gpu_use_host_cpus(struct psx_machine *psx)
+{
+    unsigned int nr_cpus = gpu_raster_nr_cpus();
+
+    /* Not worth a thread if it has to share the only core with the CPU */
+    if (nr_cpus > 1 && !gpu_set_threaded(psx, true)) {
+        printf("gpu: warning: unable to start gpu thread\n");
+    }
+
+    /* The emulation thread renders tiles too */
+    gpu_set_workers(psx, nr_cpus - 1);
+}
+
+static void
+gpu_process_gp0(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    switch (gpu->mode) {
+    case GPU_MODE_CPU_TO_VRAM:
+        gpu_cpu_to_vram(psx, value);
+        return;
+    case GPU_MODE_POLYLINE:
+        gpu_polyline(psx, value);
+        return;
+    default:
+        break;
+    }
+
+    if (!gpu->fifo_len) {
+        gpu->command_len = gpu_command_length(value);
+    }
+
+    assert(gpu->fifo_len < GPU_FIFO_SIZE);
+    gpu->fifo[gpu->fifo_len++] = value;
+
+    if (gpu->fifo_len < gpu->command_len) {
+        return;
+    }
+
+    gpu->fifo_len = 0;
+    gpu_execute(psx);
+}
+
+static void
+gpu_process_gp1(struct psx_machine *psx, uint32_t value)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    switch (value >> 24) {
+    case 0x00:
+        gpu_raster_flush(psx);
+        gpu_reset(psx);
+        break;
+    case 0x01:
+        gpu->mode = GPU_MODE_COMMAND;
+        gpu->fifo_len = 0;
+        gpu->cpu_to_vram.active = false;
+        break;
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x08:
+        gpu->status = gpu_gp1_status(gpu->status, value);
+        break;
+    case 0x05:
+        gpu->display_x = value & 0x3fe;
+        gpu->display_y = (value >> 10) & 0x1ff;
+        break;
+    case 0x06:
+        gpu->display_x1 = value & 0xfff;
+        gpu->display_x2 = (value >> 12) & 0xfff;
+        break;
+    case 0x07:
+        gpu->display_y1 = value & 0x3ff;
+        gpu->display_y2 = (value >> 10) & 0x3ff;
+        break;
+    case 0x09:
+        gpu->texture_disable = value & 0x1;
+        break;
+    default:
+        if ((value >> 24) >= 0x10 && (value >> 24) <= 0x1f) {
+            gpu_info(psx, value);
+            break;
+        }
+
+        printf("gpu: info: unhandled gp1 command 0x%08x\n", value);
+        break;
+    }
+}
+
+static void
+gpu_process_vblank(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+
+    /* VRAM has to be complete for whoever displays the frame */
+    gpu_raster_flush(psx);
+
+    gpu->status = gpu_vblank_status(gpu->status);
+}
+
+void
+gpu_process(struct psx_machine *psx, enum gpu_port port, uint32_t value)
+{
+    switch (port) {
+    case GPU_PORT_GP0:
+        gpu_process_gp0(psx, value);
+        break;
+    case GPU_PORT_GP1:
+        gpu_process_gp1(psx, value);
+        break;
+    case GPU_PORT_VBLANK:
+        gpu_process_vblank(psx);
+        break;
+    default:
+        PANIC;
+    }
+}
+
+void
+gpu_gp0(struct psx_machine *psx, uint32_t value)
+{
+    if (psx->gpu.thread.running) {
+        gpu_shadow_gp0(&psx->gpu, value);
+        gpu_thread_push(psx, GPU_PORT_GP0, value);
+    } else {
+        gpu_process_gp0(psx, value);
+    }
+}
+
+void
+gpu_gp1(struct psx_machine *psx, uint32_t value)
+{
+    /* Timer 0 follows the dot clock without waiting on the GPU thread */
+    switch (value >> 24) {
+    case 0x00:
+        timer_display_mode(psx, 0);
+        break;
+    case 0x08:
+        timer_display_mode(psx, value);
+        break;
+    default:
+        break;
+    }
+
+    if (psx->gpu.thread.running) {
+        gpu_shadow_gp1(&psx->gpu, value);
+        gpu_thread_push(psx, GPU_PORT_GP1, value);
+    } else {
+        gpu_process_gp1(psx, value);
+    }
+}
+
+uint32_t
+gpu_read(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    struct gpu_transfer *transfer = &gpu->vram_to_cpu;
+    uint32_t value;
+
+    gpu_sync(psx);
+
+    if (!transfer->active) {
+        return gpu->read;
+    }
+
+    value = 0;
+
+    for (unsigned int i = 0; i < 2 && transfer->active; ++i) {
+        value |= *gpu_vram_pixel(gpu, transfer->x + transfer->column,
+                                 transfer->y + transfer->row) << (i * 16);
+        gpu_transfer_advance(transfer);
+    }
+
+    return value;
+}
+
+uint32_t
+gpu_status(struct psx_machine *psx)
+{
+    struct gpu *gpu = &psx->gpu;
+    uint32_t status;
+
+    /* A GP0(1Fh) IRQ is still delivered by the first read after it */
+    if (gpu->thread.running && !gpu->shadow.vram_to_cpu &&
+        !gpu->thread.irq_pending) {
+        status = gpu->shadow.status;
+    } else {
+        gpu_sync(psx);
+        status = gpu->status;
+
+        if (gpu->vram_to_cpu.active) {
+            status |= GPU_STATUS_READY_VRAM;
+        }
+    }
+
+    /* Commands appear to execute instantly, so the GPU is always ready */
+    status |= GPU_STATUS_READY_COMMAND | GPU_STATUS_READY_DMA;
+
+    switch ((status & GPU_STATUS_DMA_DIRECTION) >> 29) {
+    case 1:
+    case 2:
+        status |= GPU_STATUS_DMA_REQUEST;
+        break;
+    case 3:
+        if (status & GPU_STATUS_READY_VRAM) {
+            status |= GPU_STATUS_DMA_REQUEST;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return status;
+}
+
+void
+gpu_vblank(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    if (!thread->running) {
+        gpu_process_vblank(psx);
+        return;
+    }
+
+    psx->gpu.shadow.status = gpu_vblank_status(psx->gpu.shadow.status);
+    gpu_thread_push(psx, GPU_PORT_VBLANK, 0);
+
+    /* Bounds the latency of a GP0(1Fh) IRQ without making it racy */
+    if (thread->irq_pending) {
+        gpu_sync(psx);
+    }
+}
+
+/* Registers run from status up to the raster, which is host state */
+#define GPU_STATE_REGISTERS \
+    (offsetof(struct gpu, raster) - offsetof(struct gpu, status))
+
+void
+gpu_save_state(struct psx_machine *psx, struct state *state)
+{
+    gpu_sync(psx);
+    gpu_raster_flush(psx);
+
+    state_begin_section(state, STATE_SECTION_GPU);
+    state_write(state, psx->gpu.vram, sizeof(psx->gpu.vram));
+    state_write(state, &psx->gpu.status, GPU_STATE_REGISTERS);
+    state_end_section(state);
+}
+
+void
+gpu_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (!state_find_section(state, STATE_SECTION_GPU)) {
+        return;
+    }
+
+    gpu_thread_sync(psx);
+    psx->gpu.thread.irq = false;
+    gpu_raster_discard(psx);
+
+    state_read(state, psx->gpu.vram, sizeof(psx->gpu.vram));
+    state_read(state, &psx->gpu.status, GPU_STATE_REGISTERS);
+
+    gpu_texcache_invalidate_all(&psx->gpu.texcache);
+    gpu_shadow_reset(&psx->gpu);
+}
+
+uint16_t *
+gpu_debug_vram(struct psx_machine *psx)
+{
+    /* Callers expect every queued primitive to be visible */
+    gpu_sync(psx);
+    gpu_raster_flush(psx);
+
+    return psx->gpu.vram;
+}
+
+void
+gpu_debug_texcache(struct psx_machine *psx, struct gpu_texcache_stats *stats)
+{
+    gpu_texcache_stats(&psx->gpu.texcache, stats);
+}
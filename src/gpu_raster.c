@@ -0,0 +1,708 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "gpu_raster.h"
+#include "gpu_span.h"
+#include "gpu_texcache.h"
+#include "gpu_thread.h"
+#include "macros.h"
+#include "perf.h"
+#include "psx_machine.h"
+
+/* Batches covering less than a tile are not worth waking the workers for */
+#define GPU_RASTER_PARALLEL_AREA    \
+    (GPU_RASTER_TILE_SIZE * GPU_RASTER_TILE_SIZE)
+
+static bool
+gpu_raster_intersect(struct gpu_rect *result, const struct gpu_rect *a,
+                     const struct gpu_rect *b)
+{
+    result->x0 = MAX(a->x0, b->x0);
+    result->y0 = MAX(a->y0, b->y0);
+    result->x1 = MIN(a->x1, b->x1);
+    result->y1 = MIN(a->y1, b->y1);
+
+    return result->x0 < result->x1 && result->y0 < result->y1;
+}
+
+/* Lines are drawn a pixel at a time, through the reference kernel */
+static inline void
+gpu_raster_plot(uint16_t *vram, const struct gpu_primitive *p, int x, int y,
+                int32_t r, int32_t g, int32_t b)
+{
+    struct gpu_span span;
+
+    memset(&span, 0, sizeof(span));
+
+    span.x = x;
+    span.y = y;
+    span.length = 1;
+    span.attr[GPU_SPAN_R] = r;
+    span.attr[GPU_SPAN_G] = g;
+    span.attr[GPU_SPAN_B] = b;
+
+    gpu_span_scalar(vram, p, &span);
+}
+
+static bool
+gpu_raster_top_left(const struct gpu_vertex *a, const struct gpu_vertex *b)
+{
+    return b->y < a->y || (b->y == a->y && b->x > a->x);
+}
+
+static void
+gpu_raster_attributes(const struct gpu_vertex *v, int64_t *a)
+{
+    a[0] = v->r;
+    a[1] = v->g;
+    a[2] = v->b;
+    a[3] = v->u;
+    a[4] = v->v;
+}
+
+/* Narrow [*first, *last) to the pixels of a row where an edge is inside */
+static void
+gpu_raster_edge(int32_t w, int32_t w_dx, int *first, int *last)
+{
+    if (w_dx > 0) {
+        if (w < 0) {
+            *first = MAX(*first, (int)((-(int64_t)w + w_dx - 1) / w_dx));
+        }
+    } else if (w_dx < 0) {
+        *last = w < 0 ? 0 : MIN(*last, (int)((int64_t)w / -w_dx + 1));
+    } else if (w < 0) {
+        *last = 0;
+    }
+}
+
+static void
+gpu_raster_triangle(uint16_t *vram, const struct gpu_primitive *p,
+                    const struct gpu_rect *clip)
+{
+    const struct gpu_vertex *v0 = &p->v[0], *v1 = &p->v[1], *v2 = &p->v[2];
+    int64_t attr_dx[5], attr_dy[5], attr_row[5];
+    int64_t a0[5], a1[5], a2[5], area, num;
+    int32_t w0_row, w1_row, w2_row;
+    int32_t w0_dx, w1_dx, w2_dx, w0_dy, w1_dy, w2_dy;
+    unsigned int first, last;
+    struct gpu_span span;
+    int start, end;
+
+    /* Vertices were ordered by gpu_raster_queue so that the area is positive */
+    area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) -
+           (int64_t)(v1->y - v0->y) * (v2->x - v0->x);
+    assert(area > 0);
+
+    w0_dx = v1->y - v2->y;
+    w1_dx = v2->y - v0->y;
+    w2_dx = v0->y - v1->y;
+    w0_dy = v2->x - v1->x;
+    w1_dy = v0->x - v2->x;
+    w2_dy = v1->x - v0->x;
+
+    /* Edge functions at the top left of the clip, biased for the fill rule */
+    w0_row = (v2->x - v1->x) * (clip->y0 - v1->y) -
+             (v2->y - v1->y) * (clip->x0 - v1->x);
+    w1_row = (v0->x - v2->x) * (clip->y0 - v2->y) -
+             (v0->y - v2->y) * (clip->x0 - v2->x);
+    w2_row = (v1->x - v0->x) * (clip->y0 - v0->y) -
+             (v1->y - v0->y) * (clip->x0 - v0->x);
+
+    w0_row -= !gpu_raster_top_left(v1, v2);
+    w1_row -= !gpu_raster_top_left(v2, v0);
+    w2_row -= !gpu_raster_top_left(v0, v1);
+
+    /* Only the attributes in use are stepped, in 16.16 fixed point */
+    first = (p->flags & GPU_PRIMITIVE_GOURAUD) ? 0 : 3;
+    last = (p->flags & GPU_PRIMITIVE_TEXTURED) ? 5 : 3;
+
+    gpu_raster_attributes(v0, a0);
+    gpu_raster_attributes(v1, a1);
+    gpu_raster_attributes(v2, a2);
+
+    memset(&span, 0, sizeof(span));
+
+    for (unsigned int i = 0; i < first; ++i) {
+        span.attr[i] = a0[i] << 16;
+    }
+
+    for (unsigned int i = first; i < last; ++i) {
+        num = a0[i] * w0_dx + a1[i] * w1_dx + a2[i] * w2_dx;
+        attr_dx[i] = num * 65536 / area;
+
+        num = a0[i] * w0_dy + a1[i] * w1_dy + a2[i] * w2_dy;
+        attr_dy[i] = num * 65536 / area;
+
+        attr_row[i] = (a0[i] << 16) + 0x8000 +
+                      attr_dx[i] * (clip->x0 - v0->x) +
+                      attr_dy[i] * (clip->y0 - v0->y);
+
+        /* Steep slopes wrap, but the values inside the triangle fit */
+        span.attr_dx[i] = (int32_t)(uint32_t)attr_dx[i];
+    }
+
+    for (int y = clip->y0; y < clip->y1; ++y) {
+        start = 0;
+        end = clip->x1 - clip->x0;
+
+        gpu_raster_edge(w0_row, w0_dx, &start, &end);
+        gpu_raster_edge(w1_row, w1_dx, &start, &end);
+        gpu_raster_edge(w2_row, w2_dx, &start, &end);
+
+        if (start < end) {
+            span.x = clip->x0 + start;
+            span.y = y;
+            span.length = end - start;
+
+            for (unsigned int i = first; i < last; ++i) {
+                span.attr[i] = (int32_t)(uint32_t)(attr_row[i] +
+                                                   attr_dx[i] * start);
+            }
+
+            gpu_span_draw(vram, p, &span);
+        }
+
+        w0_row += w0_dy;
+        w1_row += w1_dy;
+        w2_row += w2_dy;
+
+        for (unsigned int i = first; i < last; ++i) {
+            attr_row[i] += attr_dy[i];
+        }
+    }
+}
+
+static void
+gpu_raster_rectangle(uint16_t *vram, const struct gpu_primitive *p,
+                     const struct gpu_rect *clip)
+{
+    const struct gpu_vertex *v0 = &p->v[0];
+    struct gpu_span span;
+    unsigned int u;
+    int x, length;
+
+    memset(&span, 0, sizeof(span));
+
+    span.attr[GPU_SPAN_R] = v0->r << 16;
+    span.attr[GPU_SPAN_G] = v0->g << 16;
+    span.attr[GPU_SPAN_B] = v0->b << 16;
+    span.attr_dx[GPU_SPAN_U] = 1 << 16;
+
+    for (int y = clip->y0; y < clip->y1; ++y) {
+        span.y = y;
+        span.attr[GPU_SPAN_V] = ((v0->v + (y - v0->y)) & 0xff) << 16;
+
+        /* Texture coordinates wrap, which splits the row */
+        for (x = clip->x0; x < clip->x1; x += length) {
+            u = (v0->u + (x - v0->x)) & 0xff;
+            length = clip->x1 - x;
+
+            if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+                length = MIN(length, (int)(256 - u));
+            }
+
+            span.x = x;
+            span.length = length;
+            span.attr[GPU_SPAN_U] = u << 16;
+
+            gpu_span_draw(vram, p, &span);
+        }
+    }
+}
+
+static void
+gpu_raster_line(uint16_t *vram, const struct gpu_primitive *p,
+                const struct gpu_rect *clip)
+{
+    const struct gpu_vertex *v0 = &p->v[0], *v1 = &p->v[1];
+    int64_t x, y, r, g, b, dx, dy, dr, dg, db;
+    int steps, px, py;
+
+    dx = v1->x - v0->x;
+    dy = v1->y - v0->y;
+    steps = MAX(dx < 0 ? -dx : dx, dy < 0 ? -dy : dy);
+
+    x = ((int64_t)v0->x << 16) + 0x8000;
+    y = ((int64_t)v0->y << 16) + 0x8000;
+    r = ((int64_t)v0->r << 16) + 0x8000;
+    g = ((int64_t)v0->g << 16) + 0x8000;
+    b = ((int64_t)v0->b << 16) + 0x8000;
+    dr = dg = db = 0;
+
+    if (steps) {
+        dx = (dx << 16) / steps;
+        dy = (dy << 16) / steps;
+
+        if (p->flags & GPU_PRIMITIVE_GOURAUD) {
+            dr = (((int64_t)v1->r - v0->r) << 16) / steps;
+            dg = (((int64_t)v1->g - v0->g) << 16) / steps;
+            db = (((int64_t)v1->b - v0->b) << 16) / steps;
+        }
+    }
+
+    /* Both end points are drawn */
+    for (int i = 0; i <= steps; ++i) {
+        px = x >> 16;
+        py = y >> 16;
+
+        if (px >= clip->x0 && px < clip->x1 &&
+            py >= clip->y0 && py < clip->y1) {
+            gpu_raster_plot(vram, p, px, py, r, g, b);
+        }
+
+        x += dx;
+        y += dy;
+        r += dr;
+        g += dg;
+        b += db;
+    }
+}
+
+static void
+gpu_raster_fill(uint16_t *vram, const struct gpu_primitive *p,
+                const struct gpu_rect *clip)
+{
+    uint16_t color;
+
+    color = (p->v[0].r >> 3) | ((p->v[0].g >> 3) << 5) |
+            ((p->v[0].b >> 3) << 10);
+
+    for (int y = clip->y0; y < clip->y1; ++y) {
+        for (int x = clip->x0; x < clip->x1; ++x) {
+            vram[y * GPU_VRAM_WIDTH + x] = color;
+        }
+    }
+}
+
+static void
+gpu_raster_tile(struct psx_machine *psx, unsigned int tile)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+    const struct gpu_primitive *p;
+    struct gpu_rect bounds, clip;
+
+    bounds.x0 = (tile % GPU_RASTER_TILES_X) << GPU_RASTER_TILE_SHIFT;
+    bounds.y0 = (tile / GPU_RASTER_TILES_X) << GPU_RASTER_TILE_SHIFT;
+    bounds.x1 = bounds.x0 + GPU_RASTER_TILE_SIZE;
+    bounds.y1 = bounds.y0 + GPU_RASTER_TILE_SIZE;
+
+    for (unsigned int i = 0; i < raster->nr_primitives; ++i) {
+        p = &raster->primitive[i];
+
+        if (!gpu_raster_intersect(&clip, &p->bounds, &bounds)) {
+            continue;
+        }
+
+        switch (p->type) {
+        case GPU_PRIMITIVE_TRIANGLE:
+            gpu_raster_triangle(psx->gpu.vram, p, &clip);
+            break;
+        case GPU_PRIMITIVE_RECTANGLE:
+            gpu_raster_rectangle(psx->gpu.vram, p, &clip);
+            break;
+        case GPU_PRIMITIVE_LINE:
+            gpu_raster_line(psx->gpu.vram, p, &clip);
+            break;
+        case GPU_PRIMITIVE_FILL:
+            gpu_raster_fill(psx->gpu.vram, p, &clip);
+            break;
+        default:
+            PANIC;
+        }
+    }
+}
+
+/* Render tiles until none are left, from any thread */
+static void
+gpu_raster_run(struct psx_machine *psx)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+    unsigned int i;
+
+    for (;;) {
+        i = __atomic_fetch_add(&raster->next_tile, 1, __ATOMIC_RELAXED);
+
+        if (i >= raster->nr_tiles) {
+            break;
+        }
+
+        gpu_raster_tile(psx, raster->tile[i]);
+    }
+}
+
+static void *
+gpu_raster_worker(void *arg)
+{
+    struct psx_machine *psx = arg;
+    struct gpu_raster *raster = &psx->gpu.raster;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&raster->lock);
+
+    for (;;) {
+        while (raster->generation == generation && !raster->quit) {
+            pthread_cond_wait(&raster->start, &raster->lock);
+        }
+
+        if (raster->quit) {
+            break;
+        }
+
+        generation = raster->generation;
+        pthread_mutex_unlock(&raster->lock);
+
+        gpu_raster_run(psx);
+
+        pthread_mutex_lock(&raster->lock);
+
+        if (--raster->active == 0) {
+            pthread_cond_signal(&raster->done);
+        }
+    }
+
+    pthread_mutex_unlock(&raster->lock);
+    return NULL;
+}
+
+unsigned int
+gpu_raster_nr_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long nr_cpus;
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return nr_cpus > 0 ? nr_cpus : 1;
+#endif
+}
+
+static void
+gpu_raster_reset_batch(struct gpu_raster *raster)
+{
+    raster->nr_primitives = 0;
+    raster->batch++;
+    raster->area = 0;
+
+    raster->dirty.x0 = GPU_VRAM_WIDTH;
+    raster->dirty.y0 = GPU_VRAM_HEIGHT;
+    raster->dirty.x1 = 0;
+    raster->dirty.y1 = 0;
+
+    raster->nr_sampled = 0;
+}
+
+/* Split a VRAM area that may wrap horizontally into at most two rects */
+static unsigned int
+gpu_raster_wrap(struct gpu_rect *rect, int x, int y, int width, int height)
+{
+    rect[0].x0 = x;
+    rect[0].y0 = y;
+    rect[0].x1 = MIN(x + width, GPU_VRAM_WIDTH);
+    rect[0].y1 = MIN(y + height, GPU_VRAM_HEIGHT);
+
+    if (x + width <= GPU_VRAM_WIDTH) {
+        return 1;
+    }
+
+    rect[1].x0 = 0;
+    rect[1].y0 = rect[0].y0;
+    rect[1].x1 = x + width - GPU_VRAM_WIDTH;
+    rect[1].y1 = rect[0].y1;
+
+    return 2;
+}
+
+/* VRAM read by a textured primitive: its texture page and CLUT */
+unsigned int
+gpu_raster_sampled(const struct gpu_primitive *p, struct gpu_rect *rect)
+{
+    static const int TEXPAGE_WIDTH[4] = { 64, 128, 256, 256 };
+    static const int CLUT_WIDTH[4] = { 16, 256, 0, 0 };
+    unsigned int n;
+
+    if (!(p->flags & GPU_PRIMITIVE_TEXTURED)) {
+        return 0;
+    }
+
+    n = gpu_raster_wrap(rect, p->texpage_x, p->texpage_y,
+                        TEXPAGE_WIDTH[p->depth], 256);
+
+    if (CLUT_WIDTH[p->depth]) {
+        n += gpu_raster_wrap(rect + n, p->clut_x, p->clut_y,
+                             CLUT_WIDTH[p->depth], 1);
+    }
+
+    return n;
+}
+
+/*
+ * Tiles replay the batch independently, so a primitive may only be added if
+ * it does not sample what the batch draws, nor draw what the batch samples.
+ */
+static bool
+gpu_raster_hazard(struct gpu_raster *raster, const struct gpu_primitive *p,
+                  const struct gpu_rect *sampled, unsigned int nr_sampled)
+{
+    struct gpu_rect clip;
+
+    if (raster->nr_sampled + nr_sampled > GPU_RASTER_MAX_SAMPLED) {
+        return true;
+    }
+
+    for (unsigned int i = 0; i < nr_sampled; ++i) {
+        if (gpu_raster_intersect(&clip, &sampled[i], &raster->dirty)) {
+            return true;
+        }
+    }
+
+    for (unsigned int i = 0; i < raster->nr_sampled; ++i) {
+        if (gpu_raster_intersect(&clip, &raster->sampled[i], &p->bounds)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+gpu_raster_add_sampled(struct gpu_raster *raster, const struct gpu_rect *rect)
+{
+    for (unsigned int i = 0; i < raster->nr_sampled; ++i) {
+        if (!memcmp(&raster->sampled[i], rect, sizeof(*rect))) {
+            return;
+        }
+    }
+
+    raster->sampled[raster->nr_sampled++] = *rect;
+}
+
+static void
+gpu_raster_start_workers(struct psx_machine *psx, unsigned int nr_workers)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+
+    if (nr_workers > GPU_RASTER_MAX_WORKERS) {
+        nr_workers = GPU_RASTER_MAX_WORKERS;
+    }
+
+    /* Workers start at generation 0, a flush may beat them to the lock */
+    raster->generation = 0;
+    raster->quit = false;
+    raster->nr_workers = 0;
+
+    for (unsigned int i = 0; i < nr_workers; ++i) {
+        if (pthread_create(&raster->worker[i], NULL, gpu_raster_worker,
+                           psx)) {
+            printf("gpu_raster: warning: unable to start worker %u\n", i);
+            break;
+        }
+
+        raster->nr_workers++;
+    }
+}
+
+static void
+gpu_raster_stop_workers(struct psx_machine *psx)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+
+    pthread_mutex_lock(&raster->lock);
+    raster->quit = true;
+    pthread_cond_broadcast(&raster->start);
+    pthread_mutex_unlock(&raster->lock);
+
+    for (unsigned int i = 0; i < raster->nr_workers; ++i) {
+        pthread_join(raster->worker[i], NULL);
+    }
+
+    raster->nr_workers = 0;
+}
+
+void
+gpu_raster_setup(struct psx_machine *psx)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+
+    gpu_raster_reset_batch(raster);
+    gpu_span_setup();
+
+    raster->active = 0;
+
+    pthread_mutex_init(&raster->lock, NULL);
+    pthread_cond_init(&raster->start, NULL);
+    pthread_cond_init(&raster->done, NULL);
+
+    raster->nr_workers = 0;
+}
+
+void
+gpu_raster_shutdown(struct psx_machine *psx)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+
+    gpu_raster_stop_workers(psx);
+
+    pthread_cond_destroy(&raster->done);
+    pthread_cond_destroy(&raster->start);
+    pthread_mutex_destroy(&raster->lock);
+}
+
+void
+gpu_raster_set_workers(struct psx_machine *psx, unsigned int nr_workers)
+{
+    gpu_raster_flush(psx);
+    gpu_raster_stop_workers(psx);
+    gpu_raster_start_workers(psx, nr_workers);
+}
+
+unsigned int
+gpu_raster_workers(struct psx_machine *psx)
+{
+    return psx->gpu.raster.nr_workers;
+}
+
+void
+gpu_raster_queue(struct psx_machine *psx, const struct gpu_primitive *primitive)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+    struct gpu_texcache *texcache = &psx->gpu.texcache;
+    const struct gpu_rect *bounds = &primitive->bounds;
+    struct gpu_rect sampled[4], clip;
+    struct gpu_primitive *p;
+    const uint16_t *texture;
+    unsigned int nr_sampled;
+    bool feedback;
+
+    if (bounds->x0 >= bounds->x1 || bounds->y0 >= bounds->y1) {
+        return;
+    }
+
+    nr_sampled = gpu_raster_sampled(primitive, sampled);
+
+    if (raster->nr_primitives == GPU_RASTER_MAX_PRIMITIVES ||
+        gpu_raster_hazard(raster, primitive, sampled, nr_sampled)) {
+        gpu_raster_flush(psx);
+    }
+
+    feedback = false;
+
+    for (unsigned int i = 0; i < nr_sampled; ++i) {
+        feedback |= gpu_raster_intersect(&clip, &sampled[i], bounds);
+    }
+
+    /* A page drawn over while it's sampled has to be read as it changes */
+    texture = NULL;
+
+    if ((primitive->flags & GPU_PRIMITIVE_TEXTURED) && primitive->depth < 2 &&
+        !feedback) {
+        texture = gpu_texcache_lookup(texcache, psx->gpu.vram, primitive,
+                                      raster->batch);
+
+        if (!texture) {
+            gpu_raster_flush(psx);
+            texture = gpu_texcache_lookup(texcache, psx->gpu.vram,
+                                          primitive, raster->batch);
+        }
+    }
+
+    gpu_texcache_invalidate(texcache, bounds);
+
+    p = &raster->primitive[raster->nr_primitives++];
+    *p = *primitive;
+    p->texture = texture;
+
+    if (feedback) {
+        p->flags |= GPU_PRIMITIVE_FEEDBACK;
+    }
+
+    for (unsigned int i = 0; i < nr_sampled; ++i) {
+        gpu_raster_add_sampled(raster, &sampled[i]);
+    }
+
+    raster->dirty.x0 = MIN(raster->dirty.x0, bounds->x0);
+    raster->dirty.y0 = MIN(raster->dirty.y0, bounds->y0);
+    raster->dirty.x1 = MAX(raster->dirty.x1, bounds->x1);
+    raster->dirty.y1 = MAX(raster->dirty.y1, bounds->y1);
+
+    raster->area += (bounds->x1 - bounds->x0) * (bounds->y1 - bounds->y0);
+}
+
+void
+gpu_raster_flush(struct psx_machine *psx)
+{
+    struct gpu_raster *raster = &psx->gpu.raster;
+    int tx0, ty0, tx1, ty1;
+    bool timed;
+
+    if (!raster->nr_primitives) {
+        return;
+    }
+
+    /* The GPU thread can't update the counters, gpu_thread_sync times it */
+    timed = !gpu_thread_running(psx);
+
+    if (timed) {
+        PERF_BEGIN(psx, PERF_SECTION_GPU);
+    }
+
+    tx0 = raster->dirty.x0 >> GPU_RASTER_TILE_SHIFT;
+    ty0 = raster->dirty.y0 >> GPU_RASTER_TILE_SHIFT;
+    tx1 = (raster->dirty.x1 - 1) >> GPU_RASTER_TILE_SHIFT;
+    ty1 = (raster->dirty.y1 - 1) >> GPU_RASTER_TILE_SHIFT;
+
+    raster->nr_tiles = 0;
+    raster->next_tile = 0;
+
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            raster->tile[raster->nr_tiles++] = ty * GPU_RASTER_TILES_X + tx;
+        }
+    }
+
+    if (raster->nr_workers && raster->nr_tiles > 1 &&
+        raster->area >= GPU_RASTER_PARALLEL_AREA) {
+        pthread_mutex_lock(&raster->lock);
+        raster->active = raster->nr_workers;
+        raster->generation++;
+        pthread_cond_broadcast(&raster->start);
+        pthread_mutex_unlock(&raster->lock);
+
+        gpu_raster_run(psx);
+
+        pthread_mutex_lock(&raster->lock);
+
+        while (raster->active) {
+            pthread_cond_wait(&raster->done, &raster->lock);
+        }
+
+        pthread_mutex_unlock(&raster->lock);
+    } else {
+        gpu_raster_run(psx);
+    }
+
+    gpu_raster_reset_batch(raster);
+
+    if (timed) {
+        PERF_END(psx, PERF_SECTION_GPU);
+    }
+}
+
+void
+gpu_raster_discard(struct psx_machine *psx)
+{
+    gpu_raster_reset_batch(&psx->gpu.raster);
+}
@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gpu_span.h"
+
+/* Shorter spans don't amortise the vector setup */
+#define GPU_SPAN_MIN_VECTOR     4
+
+const int8_t GPU_SPAN_DITHER[4][4] = {
+    { -4,  0, -3,  1 },
+    {  2, -2,  3, -1 },
+    { -3,  1, -4,  0 },
+    {  3, -1,  2, -2 }
+};
+
+static const char *GPU_SPAN_ISA_NAMES[GPU_SPAN_NR_ISAS] = {
+    "scalar", "sse4.1", "avx2"
+};
+
+static const gpu_span_kernel GPU_SPAN_KERNELS[GPU_SPAN_NR_ISAS] = {
+    gpu_span_scalar,
+#if defined(__x86_64__) || defined(__i386__)
+    gpu_span_sse41,
+    gpu_span_avx2
+#else
+    NULL,
+    NULL
+#endif
+};
+
+static enum gpu_span_isa gpu_span_isa = GPU_SPAN_SCALAR;
+static gpu_span_kernel gpu_span_kernel_selected = gpu_span_scalar;
+static pthread_once_t gpu_span_once = PTHREAD_ONCE_INIT;
+
+static inline uint16_t
+gpu_span_blend(uint16_t back, uint16_t front, unsigned int mode)
+{
+    uint16_t result;
+    int b, f, c;
+
+    result = 0;
+
+    for (unsigned int shift = 0; shift < 15; shift += 5) {
+        b = (back >> shift) & 0x1f;
+        f = (front >> shift) & 0x1f;
+
+        switch (mode) {
+        case 0:
+            c = (b + f) >> 1;
+            break;
+        case 1:
+            c = b + f < 31 ? b + f : 31;
+            break;
+        case 2:
+            c = b - f > 0 ? b - f : 0;
+            break;
+        default:
+            c = b + (f >> 2) < 31 ? b + (f >> 2) : 31;
+            break;
+        }
+
+        result |= c << shift;
+    }
+
+    return result;
+}
+
+void
+gpu_span_scalar(uint16_t *vram, const struct gpu_primitive *p,
+                const struct gpu_span *span)
+{
+    const int8_t *dither = GPU_SPAN_DITHER[span->y & 3];
+    int32_t attr[GPU_SPAN_NR_ATTRS];
+    uint16_t *pixel, color, mask, texel;
+    int r, g, b, u, v;
+
+    memcpy(attr, span->attr, sizeof(attr));
+    pixel = &vram[span->y * GPU_VRAM_WIDTH + span->x];
+    texel = 0;
+
+    for (int i = 0; i < span->length; ++i, ++pixel) {
+        r = gpu_span_clamp8(attr[GPU_SPAN_R] >> 16);
+        g = gpu_span_clamp8(attr[GPU_SPAN_G] >> 16);
+        b = gpu_span_clamp8(attr[GPU_SPAN_B] >> 16);
+        u = gpu_span_clamp8(attr[GPU_SPAN_U] >> 16);
+        v = gpu_span_clamp8(attr[GPU_SPAN_V] >> 16);
+
+        /* Wraps like the vector lanes do */
+        for (unsigned int j = 0; j < GPU_SPAN_NR_ATTRS; ++j) {
+            attr[j] = (int32_t)((uint32_t)attr[j] + span->attr_dx[j]);
+        }
+
+        if ((p->flags & GPU_PRIMITIVE_CHECK_MASK) && (*pixel & 0x8000)) {
+            continue;
+        }
+
+        mask = 0;
+
+        if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+            texel = gpu_span_texel(vram, p, u, v);
+
+            /* A texel of zero is transparent */
+            if (!texel) {
+                continue;
+            }
+
+            if (p->flags & GPU_PRIMITIVE_RAW) {
+                r = (texel & 0x1f) << 3;
+                g = ((texel >> 5) & 0x1f) << 3;
+                b = ((texel >> 10) & 0x1f) << 3;
+            } else {
+                r = ((texel & 0x1f) * r) >> 4;
+                g = (((texel >> 5) & 0x1f) * g) >> 4;
+                b = (((texel >> 10) & 0x1f) * b) >> 4;
+            }
+
+            mask = texel & 0x8000;
+        }
+
+        if (p->flags & GPU_PRIMITIVE_DITHER) {
+            r += dither[(span->x + i) & 3];
+            g += dither[(span->x + i) & 3];
+            b += dither[(span->x + i) & 3];
+        }
+
+        color = (gpu_span_clamp8(r) >> 3) |
+                ((gpu_span_clamp8(g) >> 3) << 5) |
+                ((gpu_span_clamp8(b) >> 3) << 10);
+
+        /* Textured pixels are only blended where the texel asks for it */
+        if ((p->flags & GPU_PRIMITIVE_SEMI) &&
+            (!(p->flags & GPU_PRIMITIVE_TEXTURED) || mask)) {
+            color = gpu_span_blend(*pixel, color, p->semi_mode);
+        }
+
+        if (p->flags & GPU_PRIMITIVE_SET_MASK) {
+            mask = 0x8000;
+        }
+
+        *pixel = color | mask;
+    }
+}
+
+static void
+gpu_span_setup_once(void)
+{
+    if (gpu_span_supported(GPU_SPAN_AVX2)) {
+        gpu_span_select(GPU_SPAN_AVX2);
+    } else if (gpu_span_supported(GPU_SPAN_SSE41)) {
+        gpu_span_select(GPU_SPAN_SSE41);
+    } else {
+        gpu_span_select(GPU_SPAN_SCALAR);
+    }
+}
+
+/* The kernel is process-wide, other machines may already be drawing with it */
+void
+gpu_span_setup(void)
+{
+    pthread_once(&gpu_span_once, gpu_span_setup_once);
+}
+
+/* CPUID, including whether the OS saves the AVX registers */
+bool
+gpu_span_supported(enum gpu_span_isa isa)
+{
+    assert(isa < GPU_SPAN_NR_ISAS);
+
+    switch (isa) {
+    case GPU_SPAN_SCALAR:
+        return true;
+#if defined(__x86_64__) || defined(__i386__)
+    case GPU_SPAN_SSE41:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.1");
+    case GPU_SPAN_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+gpu_span_kernel
+gpu_span_get(enum gpu_span_isa isa)
+{
+    assert(isa < GPU_SPAN_NR_ISAS);
+
+    return gpu_span_supported(isa) ? GPU_SPAN_KERNELS[isa] : NULL;
+}
+
+const char *
+gpu_span_isa_name(enum gpu_span_isa isa)
+{
+    assert(isa < GPU_SPAN_NR_ISAS);
+
+    return GPU_SPAN_ISA_NAMES[isa];
+}
+
+bool
+gpu_span_select(enum gpu_span_isa isa)
+{
+    gpu_span_kernel kernel = gpu_span_get(isa);
+
+    if (!kernel) {
+        return false;
+    }
+
+    gpu_span_isa = isa;
+    gpu_span_kernel_selected = kernel;
+    return true;
+}
+
+enum gpu_span_isa
+gpu_span_selected(void)
+{
+    return gpu_span_isa;
+}
+
+void
+gpu_span_draw(uint16_t *vram, const struct gpu_primitive *p,
+              const struct gpu_span *span)
+{
+    /* Vector kernels fetch texels ahead of writing, so they can't be used
+     * when a primitive samples what it draws */
+    if (span->length < GPU_SPAN_MIN_VECTOR ||
+        (p->flags & GPU_PRIMITIVE_FEEDBACK)) {
+        gpu_span_scalar(vram, p, span);
+        return;
+    }
+
+    gpu_span_kernel_selected(vram, p, span);
+}
@@ -0,0 +1,285 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "gpu_span.h"
+
+#define GPU_SPAN_AVX2_LANES     16
+
+/* packs works within 128-bit lanes, put the quarters back in order */
+static inline __m256i
+gpu_span_avx2_pack(__m256i packed)
+{
+    return _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/* Two vectors of eight 16.16 values to sixteen clamped 8-bit values */
+static inline __m256i
+gpu_span_avx2_attr(__m256i lo, __m256i hi)
+{
+    __m256i value;
+
+    value = gpu_span_avx2_pack(_mm256_packs_epi32(_mm256_srai_epi32(lo, 16),
+                                                  _mm256_srai_epi32(hi, 16)));
+    value = _mm256_max_epi16(value, _mm256_setzero_si256());
+    return _mm256_min_epi16(value, _mm256_set1_epi16(255));
+}
+
+static inline __m256i
+gpu_span_avx2_channel(__m256i color, int shift)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(color, shift),
+                            _mm256_set1_epi16(0x1f));
+}
+
+static inline __m256i
+gpu_span_avx2_gather(const uint16_t *vram, __m256i index)
+{
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int *)vram, index,
+                                                   2),
+                            _mm256_set1_epi32(0xffff));
+}
+
+/* Eight texels, with u and v as 32-bit lanes */
+static inline __m256i
+gpu_span_avx2_texel(const uint16_t *vram, const struct gpu_primitive *p,
+                    __m256i u, __m256i v)
+{
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    __m256i x, y, word, index;
+
+    u = _mm256_or_si256(_mm256_andnot_si256(
+            _mm256_set1_epi32(p->window_mask_x * 8), u),
+        _mm256_set1_epi32((p->window_offset_x & p->window_mask_x) * 8));
+    v = _mm256_or_si256(_mm256_andnot_si256(
+            _mm256_set1_epi32(p->window_mask_y * 8), v),
+        _mm256_set1_epi32((p->window_offset_y & p->window_mask_y) * 8));
+
+    u = _mm256_and_si256(u, byte);
+
+    if (p->texture) {
+        return gpu_span_avx2_gather(p->texture, _mm256_or_si256(
+                   _mm256_slli_epi32(_mm256_and_si256(v, byte), 8), u));
+    }
+
+    y = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(p->texpage_y),
+                                          _mm256_and_si256(v, byte)),
+                         _mm256_set1_epi32(GPU_VRAM_HEIGHT - 1));
+    y = _mm256_slli_epi32(y, 10);
+
+    switch (p->depth) {
+    case 0:
+        x = _mm256_srli_epi32(u, 2);
+        break;
+    case 1:
+        x = _mm256_srli_epi32(u, 1);
+        break;
+    default:
+        x = u;
+        break;
+    }
+
+    x = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(p->texpage_x), x),
+                         _mm256_set1_epi32(GPU_VRAM_WIDTH - 1));
+    word = gpu_span_avx2_gather(vram, _mm256_or_si256(y, x));
+
+    switch (p->depth) {
+    case 0:
+        index = _mm256_srlv_epi32(word, _mm256_slli_epi32(
+                    _mm256_and_si256(u, _mm256_set1_epi32(3)), 2));
+        index = _mm256_and_si256(index, _mm256_set1_epi32(0xf));
+        break;
+    case 1:
+        index = _mm256_srlv_epi32(word, _mm256_slli_epi32(
+                    _mm256_and_si256(u, _mm256_set1_epi32(1)), 3));
+        index = _mm256_and_si256(index, byte);
+        break;
+    default:
+        return word;
+    }
+
+    x = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(p->clut_x), index),
+                         _mm256_set1_epi32(GPU_VRAM_WIDTH - 1));
+    return gpu_span_avx2_gather(vram, _mm256_add_epi32(
+               _mm256_set1_epi32(p->clut_y * GPU_VRAM_WIDTH), x));
+}
+
+static inline __m256i
+gpu_span_avx2_blend(__m256i back, __m256i front, unsigned int mode)
+{
+    const __m256i limit = _mm256_set1_epi16(31);
+    __m256i result, b, f, c;
+
+    result = _mm256_setzero_si256();
+
+    for (int shift = 0; shift < 15; shift += 5) {
+        b = gpu_span_avx2_channel(back, shift);
+        f = gpu_span_avx2_channel(front, shift);
+
+        switch (mode) {
+        case 0:
+            c = _mm256_srli_epi16(_mm256_add_epi16(b, f), 1);
+            break;
+        case 1:
+            c = _mm256_min_epi16(_mm256_add_epi16(b, f), limit);
+            break;
+        case 2:
+            c = _mm256_subs_epu16(b, f);
+            break;
+        default:
+            c = _mm256_min_epi16(_mm256_add_epi16(b, _mm256_srli_epi16(f, 2)),
+                                 limit);
+            break;
+        }
+
+        result = _mm256_or_si256(result, _mm256_slli_epi16(c, shift));
+    }
+
+    return result;
+}
+
+/* Same steps as gpu_span_scalar, sixteen pixels at a time */
+static inline __m256i
+gpu_span_avx2_shade(const struct gpu_primitive *p, __m256i r, __m256i g,
+                    __m256i b, __m256i texel, __m256i back, __m256i dither)
+{
+    const __m256i max = _mm256_set1_epi16(255);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i color, mask, write, semi;
+
+    mask = zero;
+    write = _mm256_set1_epi16(-1);
+    semi = write;
+
+    if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+        if (p->flags & GPU_PRIMITIVE_RAW) {
+            r = _mm256_slli_epi16(gpu_span_avx2_channel(texel, 0), 3);
+            g = _mm256_slli_epi16(gpu_span_avx2_channel(texel, 5), 3);
+            b = _mm256_slli_epi16(gpu_span_avx2_channel(texel, 10), 3);
+        } else {
+            r = _mm256_srli_epi16(_mm256_mullo_epi16(
+                    gpu_span_avx2_channel(texel, 0), r), 4);
+            g = _mm256_srli_epi16(_mm256_mullo_epi16(
+                    gpu_span_avx2_channel(texel, 5), g), 4);
+            b = _mm256_srli_epi16(_mm256_mullo_epi16(
+                    gpu_span_avx2_channel(texel, 10), b), 4);
+        }
+
+        mask = _mm256_and_si256(texel, _mm256_set1_epi16((int16_t)0x8000));
+        write = _mm256_xor_si256(_mm256_cmpeq_epi16(texel, zero), write);
+        semi = _mm256_srai_epi16(texel, 15);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_DITHER) {
+        r = _mm256_add_epi16(r, dither);
+        g = _mm256_add_epi16(g, dither);
+        b = _mm256_add_epi16(b, dither);
+    }
+
+    r = _mm256_min_epi16(_mm256_max_epi16(r, zero), max);
+    g = _mm256_min_epi16(_mm256_max_epi16(g, zero), max);
+    b = _mm256_min_epi16(_mm256_max_epi16(b, zero), max);
+
+    color = _mm256_or_si256(
+        _mm256_or_si256(_mm256_srli_epi16(r, 3),
+                        _mm256_slli_epi16(_mm256_srli_epi16(g, 3), 5)),
+        _mm256_slli_epi16(_mm256_srli_epi16(b, 3), 10));
+
+    if (p->flags & GPU_PRIMITIVE_SEMI) {
+        color = _mm256_blendv_epi8(color,
+                                   gpu_span_avx2_blend(back, color,
+                                                       p->semi_mode), semi);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_SET_MASK) {
+        mask = _mm256_set1_epi16((int16_t)0x8000);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_CHECK_MASK) {
+        write = _mm256_andnot_si256(_mm256_srai_epi16(back, 15), write);
+    }
+
+    return _mm256_blendv_epi8(back, _mm256_or_si256(color, mask), write);
+}
+
+void
+gpu_span_avx2(uint16_t *vram, const struct gpu_primitive *p,
+              const struct gpu_span *span)
+{
+    __m256i lo[GPU_SPAN_NR_ATTRS], hi[GPU_SPAN_NR_ATTRS];
+    __m256i step[GPU_SPAN_NR_ATTRS];
+    __m256i r, g, b, u, v, texel, back, dither, result;
+    uint16_t tail[GPU_SPAN_AVX2_LANES];
+    int16_t lane_dither[GPU_SPAN_AVX2_LANES];
+    const int8_t *row;
+    uint16_t *pixel, *dest;
+    int n;
+
+    for (unsigned int i = 0; i < GPU_SPAN_NR_ATTRS; ++i) {
+        __m256i dx = _mm256_set1_epi32(span->attr_dx[i]);
+
+        lo[i] = _mm256_add_epi32(_mm256_set1_epi32(span->attr[i]),
+                                 _mm256_mullo_epi32(dx,
+                                     _mm256_setr_epi32(0, 1, 2, 3,
+                                                       4, 5, 6, 7)));
+        hi[i] = _mm256_add_epi32(lo[i], _mm256_slli_epi32(dx, 3));
+        step[i] = _mm256_slli_epi32(dx, 4);
+    }
+
+    /* Blocks start on multiples of four pixels from x, so one row will do */
+    row = GPU_SPAN_DITHER[span->y & 3];
+
+    for (int i = 0; i < GPU_SPAN_AVX2_LANES; ++i) {
+        lane_dither[i] = row[(span->x + i) & 3];
+    }
+
+    dither = _mm256_loadu_si256((const __m256i *)lane_dither);
+
+    pixel = &vram[span->y * GPU_VRAM_WIDTH + span->x];
+    texel = _mm256_setzero_si256();
+
+    for (int i = 0; i < span->length; i += GPU_SPAN_AVX2_LANES) {
+        n = span->length - i;
+        dest = pixel + i;
+
+        if (n < GPU_SPAN_AVX2_LANES) {
+            memcpy(tail, dest, n * sizeof(uint16_t));
+            dest = tail;
+        }
+
+        r = gpu_span_avx2_attr(lo[GPU_SPAN_R], hi[GPU_SPAN_R]);
+        g = gpu_span_avx2_attr(lo[GPU_SPAN_G], hi[GPU_SPAN_G]);
+        b = gpu_span_avx2_attr(lo[GPU_SPAN_B], hi[GPU_SPAN_B]);
+
+        if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+            u = gpu_span_avx2_attr(lo[GPU_SPAN_U], hi[GPU_SPAN_U]);
+            v = gpu_span_avx2_attr(lo[GPU_SPAN_V], hi[GPU_SPAN_V]);
+
+            texel = gpu_span_avx2_pack(_mm256_packus_epi32(
+                gpu_span_avx2_texel(vram, p,
+                    _mm256_cvtepu16_epi32(_mm256_castsi256_si128(u)),
+                    _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v))),
+                gpu_span_avx2_texel(vram, p,
+                    _mm256_cvtepu16_epi32(_mm256_extracti128_si256(u, 1)),
+                    _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)))));
+        }
+
+        back = _mm256_loadu_si256((const __m256i *)dest);
+        result = gpu_span_avx2_shade(p, r, g, b, texel, back, dither);
+        _mm256_storeu_si256((__m256i *)dest, result);
+
+        if (n < GPU_SPAN_AVX2_LANES) {
+            memcpy(pixel + i, tail, n * sizeof(uint16_t));
+        }
+
+        for (unsigned int j = 0; j < GPU_SPAN_NR_ATTRS; ++j) {
+            lo[j] = _mm256_add_epi32(lo[j], step[j]);
+            hi[j] = _mm256_add_epi32(hi[j], step[j]);
+        }
+    }
+}
+
+#endif
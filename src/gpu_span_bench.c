@@ -0,0 +1,222 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpu_span.h"
+
+#define GPU_SPAN_BENCH_SPANS    200000
+#define GPU_SPAN_BENCH_CHECKS   2000
+#define GPU_SPAN_BENCH_MAX_LEN  320
+
+/* The AVX2 kernel may read one halfword past the end of VRAM or a page */
+#define GPU_SPAN_BENCH_VRAM     (GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT + 2)
+#define GPU_SPAN_BENCH_PAGE     (256 * 256 + 2)
+
+struct gpu_span_bench_case {
+    const char *name;
+    uint8_t flags;
+    uint8_t depth;
+    uint8_t semi_mode;
+    bool cached;                    /* Sampled from a decoded page */
+};
+
+static const struct gpu_span_bench_case GPU_SPAN_BENCH_CASES[] = {
+    { "flat", 0, 0, 0, false },
+    { "gouraud", GPU_PRIMITIVE_GOURAUD, 0, 0, false },
+    { "gouraud dither",
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_DITHER, 0, 0, false },
+    { "texture 4bpp", GPU_PRIMITIVE_TEXTURED, 0, 0, false },
+    { "texture 8bpp", GPU_PRIMITIVE_TEXTURED, 1, 0, false },
+    { "texture 15bpp", GPU_PRIMITIVE_TEXTURED, 2, 0, false },
+    { "texture cached", GPU_PRIMITIVE_TEXTURED, 1, 0, true },
+    { "texture raw",
+      GPU_PRIMITIVE_TEXTURED | GPU_PRIMITIVE_RAW, 1, 0, false },
+    { "texture gouraud dither", GPU_PRIMITIVE_TEXTURED |
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_DITHER, 1, 0, false },
+    { "semi average",
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_SEMI, 0, 0, false },
+    { "semi add",
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_SEMI, 0, 1, false },
+    { "semi subtract",
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_SEMI, 0, 2, false },
+    { "semi add quarter",
+      GPU_PRIMITIVE_GOURAUD | GPU_PRIMITIVE_SEMI, 0, 3, false },
+    { "texture semi",
+      GPU_PRIMITIVE_TEXTURED | GPU_PRIMITIVE_SEMI, 1, 1, false },
+    { "mask", GPU_PRIMITIVE_TEXTURED | GPU_PRIMITIVE_SET_MASK |
+      GPU_PRIMITIVE_CHECK_MASK, 2, 0, false }
+};
+
+#define GPU_SPAN_BENCH_NR_CASES \
+    (sizeof(GPU_SPAN_BENCH_CASES) / sizeof(GPU_SPAN_BENCH_CASES[0]))
+
+static uint32_t gpu_span_bench_seed = 1;
+
+static uint32_t
+gpu_span_bench_random(void)
+{
+    gpu_span_bench_seed = gpu_span_bench_seed * 1664525 + 1013904223;
+    return gpu_span_bench_seed >> 8;
+}
+
+static uint64_t
+gpu_span_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+gpu_span_bench_primitive(struct gpu_primitive *p,
+                         const struct gpu_span_bench_case *c,
+                         const uint16_t *page)
+{
+    memset(p, 0, sizeof(*p));
+
+    p->type = GPU_PRIMITIVE_TRIANGLE;
+    p->flags = c->flags;
+    p->depth = c->depth;
+    p->semi_mode = c->semi_mode;
+
+    p->texpage_x = 512;
+    p->texpage_y = 256;
+    p->clut_x = 768;
+    p->clut_y = 496;
+
+    p->texture = c->cached ? page : NULL;
+}
+
+/* Random spans, kept clear of the texture page and CLUT */
+static void
+gpu_span_bench_spans(struct gpu_span *spans, unsigned int nr_spans)
+{
+    struct gpu_span *span;
+
+    for (unsigned int i = 0; i < nr_spans; ++i) {
+        span = &spans[i];
+
+        span->length = 1 + gpu_span_bench_random() % GPU_SPAN_BENCH_MAX_LEN;
+        span->x = gpu_span_bench_random() % (512 - span->length);
+        span->y = gpu_span_bench_random() % GPU_VRAM_HEIGHT;
+
+        for (unsigned int j = 0; j < GPU_SPAN_NR_ATTRS; ++j) {
+            span->attr[j] = (gpu_span_bench_random() % (288 << 16)) -
+                            (16 << 16);
+            span->attr_dx[j] = (int32_t)(gpu_span_bench_random() % 0x20000) -
+                               0x10000;
+        }
+    }
+}
+
+static void
+gpu_span_bench_fill(uint16_t *buffer, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; ++i) {
+        buffer[i] = gpu_span_bench_random();
+    }
+}
+
+static void
+gpu_span_bench_run(uint16_t *vram, const struct gpu_primitive *p,
+                   gpu_span_kernel kernel, const struct gpu_span *spans,
+                   unsigned int nr_spans)
+{
+    for (unsigned int i = 0; i < nr_spans; ++i) {
+        kernel(vram, p, &spans[i]);
+    }
+}
+
+int
+main(void)
+{
+    const struct gpu_span_bench_case *c;
+    struct gpu_primitive p;
+    struct gpu_span *spans;
+    uint16_t *vram, *reference, *initial, *page;
+    gpu_span_kernel kernel;
+    uint64_t pixels, start, elapsed;
+    bool failed;
+
+    spans = malloc(GPU_SPAN_BENCH_SPANS * sizeof(*spans));
+    vram = malloc(GPU_SPAN_BENCH_VRAM * sizeof(*vram));
+    reference = malloc(GPU_SPAN_BENCH_VRAM * sizeof(*reference));
+    initial = malloc(GPU_SPAN_BENCH_VRAM * sizeof(*initial));
+    page = malloc(GPU_SPAN_BENCH_PAGE * sizeof(*page));
+
+    if (!spans || !vram || !reference || !initial || !page) {
+        printf("gpu_span_bench: error: out of memory\n");
+        return 1;
+    }
+
+    gpu_span_bench_fill(initial, GPU_SPAN_BENCH_VRAM);
+    gpu_span_bench_fill(page, GPU_SPAN_BENCH_PAGE);
+    gpu_span_bench_spans(spans, GPU_SPAN_BENCH_SPANS);
+
+    pixels = 0;
+
+    for (unsigned int i = 0; i < GPU_SPAN_BENCH_SPANS; ++i) {
+        pixels += spans[i].length;
+    }
+
+    failed = false;
+
+    printf("%-24s", "case");
+
+    for (unsigned int isa = 0; isa < GPU_SPAN_NR_ISAS; ++isa) {
+        printf("%12s", gpu_span_isa_name(isa));
+    }
+
+    printf("   (Mpixel/s)\n");
+
+    for (unsigned int i = 0; i < GPU_SPAN_BENCH_NR_CASES; ++i) {
+        c = &GPU_SPAN_BENCH_CASES[i];
+        gpu_span_bench_primitive(&p, c, page);
+
+        memcpy(reference, initial, GPU_SPAN_BENCH_VRAM * sizeof(*vram));
+        gpu_span_bench_run(reference, &p, gpu_span_scalar, spans,
+                           GPU_SPAN_BENCH_CHECKS);
+
+        printf("%-24s", c->name);
+
+        for (unsigned int isa = 0; isa < GPU_SPAN_NR_ISAS; ++isa) {
+            kernel = gpu_span_get(isa);
+
+            if (!kernel) {
+                printf("%12s", "-");
+                continue;
+            }
+
+            /* Every kernel has to match the scalar one bit for bit */
+            memcpy(vram, initial, GPU_SPAN_BENCH_VRAM * sizeof(*vram));
+            gpu_span_bench_run(vram, &p, kernel, spans,
+                               GPU_SPAN_BENCH_CHECKS);
+
+            if (memcmp(vram, reference, GPU_SPAN_BENCH_VRAM * sizeof(*vram))) {
+                printf("%12s", "MISMATCH");
+                failed = true;
+                continue;
+            }
+
+            start = gpu_span_bench_now();
+            gpu_span_bench_run(vram, &p, kernel, spans, GPU_SPAN_BENCH_SPANS);
+            elapsed = gpu_span_bench_now() - start;
+
+            printf("%12.1f", pixels * 1e3 / (elapsed ? elapsed : 1));
+        }
+
+        printf("\n");
+    }
+
+    free(page);
+    free(initial);
+    free(reference);
+    free(vram);
+    free(spans);
+
+    return failed;
+}
@@ -0,0 +1,201 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "gpu_span.h"
+
+#define GPU_SPAN_SSE41_LANES    8
+
+/* Two vectors of four 16.16 values to eight clamped 8-bit values */
+static inline __m128i
+gpu_span_sse41_attr(__m128i lo, __m128i hi)
+{
+    __m128i value;
+
+    value = _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+    value = _mm_max_epi16(value, _mm_setzero_si128());
+    return _mm_min_epi16(value, _mm_set1_epi16(255));
+}
+
+static inline __m128i
+gpu_span_sse41_channel(__m128i color, int shift)
+{
+    return _mm_and_si128(_mm_srli_epi16(color, shift), _mm_set1_epi16(0x1f));
+}
+
+static inline __m128i
+gpu_span_sse41_blend(__m128i back, __m128i front, unsigned int mode)
+{
+    __m128i result, b, f, c;
+
+    result = _mm_setzero_si128();
+
+    for (int shift = 0; shift < 15; shift += 5) {
+        b = gpu_span_sse41_channel(back, shift);
+        f = gpu_span_sse41_channel(front, shift);
+
+        switch (mode) {
+        case 0:
+            c = _mm_srli_epi16(_mm_add_epi16(b, f), 1);
+            break;
+        case 1:
+            c = _mm_min_epi16(_mm_add_epi16(b, f), _mm_set1_epi16(31));
+            break;
+        case 2:
+            c = _mm_subs_epu16(b, f);
+            break;
+        default:
+            c = _mm_min_epi16(_mm_add_epi16(b, _mm_srli_epi16(f, 2)),
+                              _mm_set1_epi16(31));
+            break;
+        }
+
+        result = _mm_or_si128(result, _mm_slli_epi16(c, shift));
+    }
+
+    return result;
+}
+
+/* Same steps as gpu_span_scalar, eight pixels at a time */
+static inline __m128i
+gpu_span_sse41_shade(const struct gpu_primitive *p, __m128i r, __m128i g,
+                     __m128i b, __m128i texel, __m128i back, __m128i dither)
+{
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i color, mask, write, semi;
+
+    mask = zero;
+    write = _mm_set1_epi16(-1);
+    semi = write;
+
+    if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+        if (p->flags & GPU_PRIMITIVE_RAW) {
+            r = _mm_slli_epi16(gpu_span_sse41_channel(texel, 0), 3);
+            g = _mm_slli_epi16(gpu_span_sse41_channel(texel, 5), 3);
+            b = _mm_slli_epi16(gpu_span_sse41_channel(texel, 10), 3);
+        } else {
+            r = _mm_srli_epi16(_mm_mullo_epi16(
+                    gpu_span_sse41_channel(texel, 0), r), 4);
+            g = _mm_srli_epi16(_mm_mullo_epi16(
+                    gpu_span_sse41_channel(texel, 5), g), 4);
+            b = _mm_srli_epi16(_mm_mullo_epi16(
+                    gpu_span_sse41_channel(texel, 10), b), 4);
+        }
+
+        mask = _mm_and_si128(texel, _mm_set1_epi16((int16_t)0x8000));
+        write = _mm_xor_si128(_mm_cmpeq_epi16(texel, zero), write);
+        semi = _mm_srai_epi16(texel, 15);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_DITHER) {
+        r = _mm_add_epi16(r, dither);
+        g = _mm_add_epi16(g, dither);
+        b = _mm_add_epi16(b, dither);
+    }
+
+    r = _mm_min_epi16(_mm_max_epi16(r, zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(g, zero), max);
+    b = _mm_min_epi16(_mm_max_epi16(b, zero), max);
+
+    color = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(r, 3),
+                                      _mm_slli_epi16(_mm_srli_epi16(g, 3), 5)),
+                         _mm_slli_epi16(_mm_srli_epi16(b, 3), 10));
+
+    if (p->flags & GPU_PRIMITIVE_SEMI) {
+        color = _mm_blendv_epi8(color,
+                                gpu_span_sse41_blend(back, color,
+                                                     p->semi_mode), semi);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_SET_MASK) {
+        mask = _mm_set1_epi16((int16_t)0x8000);
+    }
+
+    if (p->flags & GPU_PRIMITIVE_CHECK_MASK) {
+        write = _mm_andnot_si128(_mm_srai_epi16(back, 15), write);
+    }
+
+    return _mm_blendv_epi8(back, _mm_or_si128(color, mask), write);
+}
+
+void
+gpu_span_sse41(uint16_t *vram, const struct gpu_primitive *p,
+               const struct gpu_span *span)
+{
+    __m128i lo[GPU_SPAN_NR_ATTRS], hi[GPU_SPAN_NR_ATTRS];
+    __m128i step[GPU_SPAN_NR_ATTRS];
+    __m128i r, g, b, u, v, texel, back, dither, result;
+    uint16_t lane_u[GPU_SPAN_SSE41_LANES], lane_v[GPU_SPAN_SSE41_LANES];
+    uint16_t lane_texel[GPU_SPAN_SSE41_LANES];
+    uint16_t tail[GPU_SPAN_SSE41_LANES];
+    const int8_t *row;
+    uint16_t *pixel, *dest;
+    int n;
+
+    for (unsigned int i = 0; i < GPU_SPAN_NR_ATTRS; ++i) {
+        __m128i dx = _mm_set1_epi32(span->attr_dx[i]);
+
+        lo[i] = _mm_add_epi32(_mm_set1_epi32(span->attr[i]),
+                              _mm_mullo_epi32(dx, _mm_setr_epi32(0, 1, 2, 3)));
+        hi[i] = _mm_add_epi32(lo[i], _mm_slli_epi32(dx, 2));
+        step[i] = _mm_slli_epi32(dx, 3);
+    }
+
+    /* Blocks start on multiples of four pixels from x, so one row will do */
+    row = GPU_SPAN_DITHER[span->y & 3];
+    dither = _mm_setr_epi16(row[span->x & 3], row[(span->x + 1) & 3],
+                            row[(span->x + 2) & 3], row[(span->x + 3) & 3],
+                            row[span->x & 3], row[(span->x + 1) & 3],
+                            row[(span->x + 2) & 3], row[(span->x + 3) & 3]);
+
+    pixel = &vram[span->y * GPU_VRAM_WIDTH + span->x];
+    texel = _mm_setzero_si128();
+
+    for (int i = 0; i < span->length; i += GPU_SPAN_SSE41_LANES) {
+        n = span->length - i;
+        dest = pixel + i;
+
+        if (n < GPU_SPAN_SSE41_LANES) {
+            memcpy(tail, dest, n * sizeof(uint16_t));
+            dest = tail;
+        }
+
+        r = gpu_span_sse41_attr(lo[GPU_SPAN_R], hi[GPU_SPAN_R]);
+        g = gpu_span_sse41_attr(lo[GPU_SPAN_G], hi[GPU_SPAN_G]);
+        b = gpu_span_sse41_attr(lo[GPU_SPAN_B], hi[GPU_SPAN_B]);
+
+        /* No gather before AVX2, the texels are fetched one by one */
+        if (p->flags & GPU_PRIMITIVE_TEXTURED) {
+            u = gpu_span_sse41_attr(lo[GPU_SPAN_U], hi[GPU_SPAN_U]);
+            v = gpu_span_sse41_attr(lo[GPU_SPAN_V], hi[GPU_SPAN_V]);
+
+            _mm_storeu_si128((__m128i *)lane_u, u);
+            _mm_storeu_si128((__m128i *)lane_v, v);
+
+            for (int j = 0; j < GPU_SPAN_SSE41_LANES; ++j) {
+                lane_texel[j] = gpu_span_texel(vram, p, lane_u[j], lane_v[j]);
+            }
+
+            texel = _mm_loadu_si128((const __m128i *)lane_texel);
+        }
+
+        back = _mm_loadu_si128((const __m128i *)dest);
+        result = gpu_span_sse41_shade(p, r, g, b, texel, back, dither);
+        _mm_storeu_si128((__m128i *)dest, result);
+
+        if (n < GPU_SPAN_SSE41_LANES) {
+            memcpy(pixel + i, tail, n * sizeof(uint16_t));
+        }
+
+        for (unsigned int j = 0; j < GPU_SPAN_NR_ATTRS; ++j) {
+            lo[j] = _mm_add_epi32(lo[j], step[j]);
+            hi[j] = _mm_add_epi32(hi[j], step[j]);
+        }
+    }
+}
+
+#endif
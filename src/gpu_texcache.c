@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gpu_texcache.h"
+#include "macros.h"
+
+static inline void
+gpu_texcache_count(uint64_t *counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static bool
+gpu_texcache_overlaps(const struct gpu_rect *a, const struct gpu_rect *b)
+{
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+static bool
+gpu_texcache_match(const struct gpu_texcache_entry *entry,
+                   const struct gpu_primitive *p)
+{
+    return entry->valid && entry->depth == p->depth &&
+           entry->texpage_x == p->texpage_x &&
+           entry->texpage_y == p->texpage_y &&
+           entry->clut_x == p->clut_x && entry->clut_y == p->clut_y;
+}
+
+static void
+gpu_texcache_decode(struct gpu_texcache_entry *entry, const uint16_t *vram)
+{
+    const unsigned int per_word = entry->depth ? 2 : 4;
+    const unsigned int bits = 16 / per_word;
+    uint16_t clut[256], *texel, word;
+    unsigned int nr_colors, y, x;
+
+    nr_colors = 1u << bits;
+
+    for (unsigned int i = 0; i < nr_colors; ++i) {
+        x = (entry->clut_x + i) & (GPU_VRAM_WIDTH - 1);
+        clut[i] = vram[entry->clut_y * GPU_VRAM_WIDTH + x];
+    }
+
+    texel = entry->texel;
+
+    for (unsigned int v = 0; v < GPU_TEXCACHE_PAGE_SIZE; ++v) {
+        y = (entry->texpage_y + v) & (GPU_VRAM_HEIGHT - 1);
+
+        for (unsigned int i = 0; i < GPU_TEXCACHE_PAGE_SIZE / per_word; ++i) {
+            x = (entry->texpage_x + i) & (GPU_VRAM_WIDTH - 1);
+            word = vram[y * GPU_VRAM_WIDTH + x];
+
+            for (unsigned int j = 0; j < per_word; ++j) {
+                *texel++ = clut[(word >> (j * bits)) & (nr_colors - 1)];
+            }
+        }
+    }
+}
+
+void
+gpu_texcache_setup(struct gpu_texcache *cache)
+{
+    gpu_texcache_invalidate_all(cache);
+
+    cache->clock = 0;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+/*
+ * Entries sampled by the current batch must outlive it, so NULL is returned
+ * when all of them are; the caller flushes the batch and tries again.
+ */
+const uint16_t *
+gpu_texcache_lookup(struct gpu_texcache *cache, const uint16_t *vram,
+                    const struct gpu_primitive *p, unsigned int batch)
+{
+    struct gpu_texcache_entry *entry, *victim;
+
+    assert(p->flags & GPU_PRIMITIVE_TEXTURED);
+    assert(p->depth < 2);
+
+    victim = NULL;
+
+    for (unsigned int i = 0; i < GPU_TEXCACHE_NR_ENTRIES; ++i) {
+        entry = &cache->entry[i];
+
+        if (gpu_texcache_match(entry, p)) {
+            entry->batch = batch;
+            entry->last_used = ++cache->clock;
+            gpu_texcache_count(&cache->stats.hits);
+            return entry->texel;
+        }
+
+        if (entry->valid && entry->batch == batch) {
+            continue;
+        }
+
+        if (!victim || !entry->valid ||
+            (victim->valid && entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+
+    if (!victim) {
+        return NULL;
+    }
+
+    if (victim->valid) {
+        gpu_texcache_count(&cache->stats.evictions);
+    }
+
+    gpu_texcache_count(&cache->stats.misses);
+
+    victim->texpage_x = p->texpage_x;
+    victim->texpage_y = p->texpage_y;
+    victim->clut_x = p->clut_x;
+    victim->clut_y = p->clut_y;
+    victim->depth = p->depth;
+    victim->nr_sources = gpu_raster_sampled(p, victim->source);
+
+    gpu_texcache_decode(victim, vram);
+
+    victim->valid = true;
+    victim->batch = batch;
+    victim->last_used = ++cache->clock;
+
+    return victim->texel;
+}
+
+/* Drop the entries decoded from VRAM in a rectangle about to be written */
+void
+gpu_texcache_invalidate(struct gpu_texcache *cache,
+                        const struct gpu_rect *rect)
+{
+    struct gpu_texcache_entry *entry;
+
+    for (unsigned int i = 0; i < GPU_TEXCACHE_NR_ENTRIES; ++i) {
+        entry = &cache->entry[i];
+
+        if (!entry->valid) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j < entry->nr_sources; ++j) {
+            if (gpu_texcache_overlaps(&entry->source[j], rect)) {
+                entry->valid = false;
+                gpu_texcache_count(&cache->stats.invalidations);
+                break;
+            }
+        }
+    }
+}
+
+/* Transfers and copies wrap around both edges of VRAM */
+void
+gpu_texcache_invalidate_area(struct gpu_texcache *cache, int x, int y,
+                             int width, int height)
+{
+    struct gpu_rect rect;
+
+    for (unsigned int i = 0; i < 2; ++i) {
+        rect.y0 = i ? 0 : y;
+        rect.y1 = i ? y + height - GPU_VRAM_HEIGHT
+                    : MIN(y + height, GPU_VRAM_HEIGHT);
+
+        for (unsigned int j = 0; j < 2; ++j) {
+            rect.x0 = j ? 0 : x;
+            rect.x1 = j ? x + width - GPU_VRAM_WIDTH
+                        : MIN(x + width, GPU_VRAM_WIDTH);
+
+            if (rect.x0 < rect.x1 && rect.y0 < rect.y1) {
+                gpu_texcache_invalidate(cache, &rect);
+            }
+        }
+    }
+}
+
+void
+gpu_texcache_invalidate_all(struct gpu_texcache *cache)
+{
+    for (unsigned int i = 0; i < GPU_TEXCACHE_NR_ENTRIES; ++i) {
+        cache->entry[i].valid = false;
+    }
+}
+
+void
+gpu_texcache_stats(const struct gpu_texcache *cache,
+                   struct gpu_texcache_stats *stats)
+{
+    stats->hits = __atomic_load_n(&cache->stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&cache->stats.misses, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&cache->stats.evictions,
+                                       __ATOMIC_RELAXED);
+    stats->invalidations = __atomic_load_n(&cache->stats.invalidations,
+                                           __ATOMIC_RELAXED);
+}
@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gpu.h"
+#include "gpu_thread.h"
+#include "perf.h"
+#include "psx_machine.h"
+
+#define GPU_THREAD_RING_MASK    (GPU_THREAD_RING_SIZE - 1)
+#define GPU_THREAD_PUBLISH      256     /* Entries consumed between updates */
+
+static inline void
+gpu_thread_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Park the consumer until the producer queues more work or asks to quit */
+static void
+gpu_thread_wait(struct gpu_thread *thread, size_t tail)
+{
+    for (unsigned int i = 0; i < GPU_THREAD_SPIN; ++i) {
+        if (__atomic_load_n(&thread->head, __ATOMIC_ACQUIRE) != tail ||
+            __atomic_load_n(&thread->quit, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+
+        gpu_thread_relax();
+    }
+
+    pthread_mutex_lock(&thread->lock);
+    __atomic_store_n(&thread->consumer_waiting, true, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&thread->head, __ATOMIC_SEQ_CST) == tail &&
+           !thread->quit) {
+        pthread_cond_wait(&thread->wake, &thread->lock);
+    }
+
+    __atomic_store_n(&thread->consumer_waiting, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&thread->lock);
+}
+
+static void *
+gpu_thread_main(void *arg)
+{
+    struct psx_machine *psx = arg;
+    struct gpu_thread *thread = &psx->gpu.thread;
+    size_t head, tail;
+    uint64_t entry;
+
+    tail = thread->tail;
+
+    for (;;) {
+        head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            /* Drained, release a producer blocked in gpu_thread_sync */
+            if (__atomic_load_n(&thread->producer_waiting, __ATOMIC_SEQ_CST)) {
+                pthread_mutex_lock(&thread->lock);
+                pthread_cond_broadcast(&thread->idle);
+                pthread_mutex_unlock(&thread->lock);
+            }
+
+            if (__atomic_load_n(&thread->quit, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+
+            gpu_thread_wait(thread, tail);
+            continue;
+        }
+
+        while (tail != head) {
+            entry = thread->ring[tail & GPU_THREAD_RING_MASK];
+            gpu_process(psx, entry >> 32, (uint32_t)entry);
+
+            if (!(++tail % GPU_THREAD_PUBLISH)) {
+                __atomic_store_n(&thread->tail, tail, __ATOMIC_RELEASE);
+            }
+        }
+
+        __atomic_store_n(&thread->tail, tail, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+void
+gpu_thread_setup(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    thread->head = thread->tail = thread->tail_cache = 0;
+    thread->running = false;
+
+    pthread_mutex_init(&thread->lock, NULL);
+    pthread_cond_init(&thread->wake, NULL);
+    pthread_cond_init(&thread->idle, NULL);
+}
+
+void
+gpu_thread_shutdown(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    gpu_thread_stop(psx);
+
+    pthread_cond_destroy(&thread->idle);
+    pthread_cond_destroy(&thread->wake);
+    pthread_mutex_destroy(&thread->lock);
+}
+
+bool
+gpu_thread_start(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    if (thread->running) {
+        return true;
+    }
+
+    thread->head = thread->tail = thread->tail_cache = 0;
+    thread->quit = false;
+    thread->irq = false;
+    thread->irq_pending = false;
+    thread->consumer_waiting = false;
+    thread->producer_waiting = false;
+
+    if (pthread_create(&thread->thread, NULL, gpu_thread_main, psx)) {
+        printf("gpu_thread: warning: unable to start gpu thread\n");
+        return false;
+    }
+
+    thread->running = true;
+    return true;
+}
+
+void
+gpu_thread_stop(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+
+    if (!thread->running) {
+        return;
+    }
+
+    gpu_thread_sync(psx);
+
+    pthread_mutex_lock(&thread->lock);
+    __atomic_store_n(&thread->quit, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&thread->wake);
+    pthread_mutex_unlock(&thread->lock);
+
+    pthread_join(thread->thread, NULL);
+    thread->running = false;
+}
+
+bool
+gpu_thread_running(struct psx_machine *psx)
+{
+    return psx->gpu.thread.running;
+}
+
+void
+gpu_thread_push(struct psx_machine *psx, enum gpu_port port, uint32_t value)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+    size_t head = thread->head;
+
+    assert(thread->running);
+
+    if (head - thread->tail_cache == GPU_THREAD_RING_SIZE) {
+        thread->tail_cache = __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE);
+
+        if (head - thread->tail_cache == GPU_THREAD_RING_SIZE) {
+            gpu_thread_sync(psx);
+        }
+    }
+
+    /* Only GP0(1Fh) raises an IRQ, anything else that looks like it is a
+     * harmless extra synchronisation at vblank */
+    if (port == GPU_PORT_GP0 && (value >> 24) == 0x1f) {
+        thread->irq_pending = true;
+    }
+
+    thread->ring[head & GPU_THREAD_RING_MASK] = (uint64_t)port << 32 | value;
+    __atomic_store_n(&thread->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&thread->consumer_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&thread->lock);
+        pthread_cond_signal(&thread->wake);
+        pthread_mutex_unlock(&thread->lock);
+    }
+}
+
+/* Wait until the GPU thread has executed everything queued so far */
+void
+gpu_thread_sync(struct psx_machine *psx)
+{
+    struct gpu_thread *thread = &psx->gpu.thread;
+    size_t head = thread->head;
+
+    if (!thread->running) {
+        return;
+    }
+
+    thread->irq_pending = false;
+    thread->tail_cache = __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE);
+
+    if (thread->tail_cache == head) {
+        return;
+    }
+
+    PERF_BEGIN(psx, PERF_SECTION_GPU);
+
+    pthread_mutex_lock(&thread->lock);
+    __atomic_store_n(&thread->producer_waiting, true, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&thread->tail, __ATOMIC_SEQ_CST) != head) {
+        pthread_cond_wait(&thread->idle, &thread->lock);
+    }
+
+    __atomic_store_n(&thread->producer_waiting, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&thread->lock);
+
+    thread->tail_cache = head;
+
+    PERF_END(psx, PERF_SECTION_GPU);
+}
@@ -0,0 +1,960 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gte.h"
+#include "macros.h"
+#include "psx_machine.h"
+#include "state.h"
+
+/* The MAC1-3 accumulators are 44 bits wide */
+#define GTE_MAC_MIN             (-(INT64_C(1) << 43))
+#define GTE_MAC_MAX             ((INT64_C(1) << 43) - 1)
+
+#define GTE_SF(x)               ((x) & (1 << 19) ? 12 : 0)
+#define GTE_LM(x)               (((x) >> 10) & 0x1)
+#define GTE_MX(x)               (((x) >> 17) & 0x3)
+#define GTE_V(x)                (((x) >> 15) & 0x3)
+#define GTE_CV(x)               (((x) >> 13) & 0x3)
+#define GTE_COMMAND(x)          ((x) & 0x3f)
+
+static const char *GTE_ISA_NAMES[GTE_NR_ISAS] = {
+    "scalar", "sse4.1", "avx2"
+};
+
+static const int32_t GTE_ZERO[3];
+
+static enum gte_isa gte_isa = GTE_SCALAR;
+static gte_matvec_kernel gte_matvec_selected = gte_matvec_scalar;
+
+/* Reciprocal seeds of the Newton-Raphson division done by RTPS/RTPT */
+static uint8_t gte_unr[0x101];
+
+static pthread_once_t gte_once = PTHREAD_ONCE_INIT;
+
+static inline int64_t
+gte_wrap44(int64_t value)
+{
+    return (int64_t)((uint64_t)value << 20) >> 20;
+}
+
+uint32_t
+gte_matvec_scalar(const int16_t m[3][3], const int32_t t[3],
+                  const int16_t v[3], int64_t result[3])
+{
+    uint32_t flags;
+    int64_t sum;
+
+    flags = 0;
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        sum = (int64_t)t[i] * 0x1000;
+
+        for (unsigned int j = 0; j < 3; ++j) {
+            sum += (int32_t)m[i][j] * v[j];
+
+            if (sum > GTE_MAC_MAX) {
+                flags |= GTE_FLAG_MAC_POS(i + 1);
+            } else if (sum < GTE_MAC_MIN) {
+                flags |= GTE_FLAG_MAC_NEG(i + 1);
+            }
+
+            sum = gte_wrap44(sum);
+        }
+
+        result[i] = sum;
+    }
+
+    return flags;
+}
+
+static int64_t
+gte_check_mac(struct gte *gte, unsigned int i, int64_t value)
+{
+    if (value > GTE_MAC_MAX) {
+        gte->flag |= GTE_FLAG_MAC_POS(i);
+    } else if (value < GTE_MAC_MIN) {
+        gte->flag |= GTE_FLAG_MAC_NEG(i);
+    }
+
+    return gte_wrap44(value);
+}
+
+static void
+gte_check_mac0(struct gte *gte, int64_t value)
+{
+    if (value > INT32_MAX) {
+        gte->flag |= GTE_FLAG_MAC0_POS;
+    } else if (value < INT32_MIN) {
+        gte->flag |= GTE_FLAG_MAC0_NEG;
+    }
+}
+
+static void
+gte_set_mac0(struct gte *gte, int64_t value)
+{
+    gte_check_mac0(gte, value);
+    gte->mac[0] = (int32_t)value;
+}
+
+static void
+gte_set_ir0(struct gte *gte, int64_t value)
+{
+    if (value < 0 || value > 0x1000) {
+        gte->flag |= GTE_FLAG_IR0;
+        value = value < 0 ? 0 : 0x1000;
+    }
+
+    gte->ir[0] = value;
+}
+
+static void
+gte_set_ir(struct gte *gte, unsigned int i, int64_t value, bool lm)
+{
+    const int64_t min = lm ? 0 : -0x8000;
+
+    if (value < min || value > 0x7fff) {
+        gte->flag |= GTE_FLAG_IR(i);
+        value = value < min ? min : 0x7fff;
+    }
+
+    gte->ir[i] = value;
+}
+
+/* The value must already have been checked against 44 bits */
+static void
+gte_set_mac_ir(struct gte *gte, unsigned int i, int64_t value,
+               unsigned int shift, bool lm)
+{
+    gte->mac[i] = (int32_t)(value >> shift);
+    gte_set_ir(gte, i, gte->mac[i], lm);
+}
+
+static void
+gte_set_otz(struct gte *gte, int64_t value)
+{
+    if (value < 0 || value > 0xffff) {
+        gte->flag |= GTE_FLAG_SZ;
+        value = value < 0 ? 0 : 0xffff;
+    }
+
+    gte->otz = value;
+}
+
+static void
+gte_push_sz(struct gte *gte, int64_t value)
+{
+    if (value < 0 || value > 0xffff) {
+        gte->flag |= GTE_FLAG_SZ;
+        value = value < 0 ? 0 : 0xffff;
+    }
+
+    gte->sz[0] = gte->sz[1];
+    gte->sz[1] = gte->sz[2];
+    gte->sz[2] = gte->sz[3];
+    gte->sz[3] = value;
+}
+
+static void
+gte_push_sxy(struct gte *gte, int32_t x, int32_t y)
+{
+    if (x < -0x400 || x > 0x3ff) {
+        gte->flag |= GTE_FLAG_SX;
+        x = x < -0x400 ? -0x400 : 0x3ff;
+    }
+
+    if (y < -0x400 || y > 0x3ff) {
+        gte->flag |= GTE_FLAG_SY;
+        y = y < -0x400 ? -0x400 : 0x3ff;
+    }
+
+    memmove(gte->sxy[0], gte->sxy[1], sizeof(gte->sxy[0]) * 2);
+    gte->sxy[2][0] = x;
+    gte->sxy[2][1] = y;
+}
+
+/* Colour FIFO = [MAC1/16, MAC2/16, MAC3/16, CODE] */
+static void
+gte_push_color(struct gte *gte)
+{
+    int32_t c;
+
+    memmove(gte->rgb[0], gte->rgb[1], sizeof(gte->rgb[0]) * 2);
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        c = gte->mac[i + 1] >> 4;
+
+        if (c < 0 || c > 0xff) {
+            gte->flag |= GTE_FLAG_COLOR(i);
+            c = c < 0 ? 0 : 0xff;
+        }
+
+        gte->rgb[2][i] = c;
+    }
+
+    gte->rgb[2][3] = gte->rgbc[3];
+}
+
+/* [IR1, IR2, IR3] = [MAC1, MAC2, MAC3] = (t * 1000h + m * v) SAR sf */
+static void
+gte_matvec(struct gte *gte, const int16_t m[3][3], const int32_t t[3],
+           const int16_t v[3], unsigned int shift, bool lm)
+{
+    int64_t result[3];
+
+    gte->flag |= gte_matvec_selected(m, t, v, result);
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        gte_set_mac_ir(gte, i + 1, result[i], shift, lm);
+    }
+}
+
+/*
+ * MVMVA with the far colour vector: the translation and first column only
+ * set flags, through IR saturation without lm, and are then dropped.
+ */
+static void
+gte_matvec_far_color(struct gte *gte, const int16_t m[3][3],
+                     const int16_t v[3], unsigned int shift, bool lm)
+{
+    const int32_t *fc = gte->vector[GTE_VECTOR_FAR_COLOR];
+    int64_t value;
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        value = gte_check_mac(gte, i + 1, (int64_t)fc[i] * 0x1000 +
+                                          (int32_t)m[i][0] * v[0]);
+        gte_set_ir(gte, i + 1, (int32_t)(value >> shift), false);
+
+        value = gte_check_mac(gte, i + 1, (int32_t)m[i][1] * v[1]);
+        value = gte_check_mac(gte, i + 1, value + (int32_t)m[i][2] * v[2]);
+        gte_set_mac_ir(gte, i + 1, value, shift, lm);
+    }
+}
+
+static void
+gte_ir_vector(const struct gte *gte, int16_t v[3])
+{
+    v[0] = gte->ir[1];
+    v[1] = gte->ir[2];
+    v[2] = gte->ir[3];
+}
+
+/* [IR1, IR2, IR3] = [MAC1, MAC2, MAC3] = (BK * 1000h + LCM * IR) SAR sf */
+static void
+gte_light_color(struct gte *gte, unsigned int shift, bool lm)
+{
+    int16_t ir[3];
+
+    gte_ir_vector(gte, ir);
+    gte_matvec(gte, gte->matrix[GTE_MATRIX_COLOR],
+               gte->vector[GTE_VECTOR_BACKGROUND], ir, shift, lm);
+}
+
+/* [MAC1, MAC2, MAC3] = MAC + (FC - MAC) * IR0, then SAR sf */
+static void
+gte_interpolate(struct gte *gte, const int64_t mac[3], unsigned int shift,
+                bool lm)
+{
+    const int32_t *fc = gte->vector[GTE_VECTOR_FAR_COLOR];
+    int64_t value;
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        value = gte_check_mac(gte, i + 1, (int64_t)fc[i] * 0x1000 - mac[i]);
+        gte_set_ir(gte, i + 1, (int32_t)(value >> shift), false);
+    }
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        value = gte_check_mac(gte, i + 1,
+                              (int32_t)gte->ir[i + 1] * gte->ir[0] + mac[i]);
+        gte_set_mac_ir(gte, i + 1, value, shift, lm);
+    }
+}
+
+/* [MAC1, MAC2, MAC3] = [R * IR1, G * IR2, B * IR3] SHL 4 */
+static void
+gte_color_ir(const struct gte *gte, int64_t mac[3])
+{
+    for (unsigned int i = 0; i < 3; ++i) {
+        mac[i] = ((int64_t)gte->rgbc[i] * gte->ir[i + 1]) << 4;
+    }
+}
+
+static uint32_t
+gte_divide(struct gte *gte)
+{
+    uint32_t n, d, u;
+    unsigned int z;
+
+    if (gte->h >= gte->sz[3] * 2) {
+        gte->flag |= GTE_FLAG_DIVIDE;
+        return 0x1ffff;
+    }
+
+    z = __builtin_clz(gte->sz[3]) - 16;
+    n = (uint32_t)gte->h << z;
+    d = (uint32_t)gte->sz[3] << z;
+    u = gte_unr[(d - 0x7fc0) >> 7] + 0x101;
+    d = (0x2000080 - d * u) >> 8;
+    d = (0x80 + d * u) >> 8;
+
+    return MIN(((uint64_t)n * d + 0x8000) >> 16, (uint64_t)0x1ffff);
+}
+
+/* Perspective transformation of one vertex */
+static void
+gte_rtp(struct gte *gte, const int16_t v[3], unsigned int shift, bool lm,
+        bool last)
+{
+    int64_t result[3], sx, sy, sz;
+    int32_t div;
+
+    gte->flag |= gte_matvec_selected(gte->matrix[GTE_MATRIX_ROTATION],
+                                     gte->vector[GTE_VECTOR_TRANSLATION], v,
+                                     result);
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        gte->mac[i + 1] = (int32_t)(result[i] >> shift);
+    }
+
+    gte_set_ir(gte, 1, gte->mac[1], lm);
+    gte_set_ir(gte, 2, gte->mac[2], lm);
+
+    /* Without sf, IR3 is clamped from MAC3 but flagged from MAC3 SAR 12 */
+    if (shift) {
+        gte_set_ir(gte, 3, gte->mac[3], lm);
+    } else {
+        if (result[2] >> 12 < -0x8000 || result[2] >> 12 > 0x7fff) {
+            gte->flag |= GTE_FLAG_IR(3);
+        }
+
+        gte->ir[3] = MAX(MIN(gte->mac[3], 0x7fff), lm ? 0 : -0x8000);
+    }
+
+    gte_push_sz(gte, result[2] >> 12);
+
+    div = gte_divide(gte);
+
+    sx = (int64_t)div * gte->ir[1] + gte->ofx;
+    sy = (int64_t)div * gte->ir[2] + gte->ofy;
+
+    gte_check_mac0(gte, sx);
+    gte_check_mac0(gte, sy);
+    gte_push_sxy(gte, sx >> 16, sy >> 16);
+
+    if (last) {
+        sz = (int64_t)div * gte->dqa + gte->dqb;
+        gte_set_mac0(gte, sz);
+        gte_set_ir0(gte, sz >> 12);
+    }
+}
+
+static void
+gte_nclip(struct gte *gte)
+{
+    const int16_t (*s)[2] = gte->sxy;
+
+    gte_set_mac0(gte, (int64_t)s[0][0] * s[1][1] + s[1][0] * s[2][1] +
+                      s[2][0] * s[0][1] - s[0][0] * s[2][1] -
+                      s[1][0] * s[0][1] - s[2][0] * s[1][1]);
+}
+
+/* Outer product of IR with the rotation matrix diagonal */
+static void
+gte_op(struct gte *gte, unsigned int shift, bool lm)
+{
+    const int16_t (*rt)[3] = gte->matrix[GTE_MATRIX_ROTATION];
+    int32_t ir1, ir2, ir3;
+
+    ir1 = gte->ir[1];
+    ir2 = gte->ir[2];
+    ir3 = gte->ir[3];
+
+    gte_set_mac_ir(gte, 1, gte_check_mac(gte, 1, (int64_t)ir3 * rt[1][1] -
+                                                 (int64_t)ir2 * rt[2][2]),
+                   shift, lm);
+    gte_set_mac_ir(gte, 2, gte_check_mac(gte, 2, (int64_t)ir1 * rt[2][2] -
+                                                 (int64_t)ir3 * rt[0][0]),
+                   shift, lm);
+    gte_set_mac_ir(gte, 3, gte_check_mac(gte, 3, (int64_t)ir2 * rt[0][0] -
+                                                 (int64_t)ir1 * rt[1][1]),
+                   shift, lm);
+}
+
+static void
+gte_dpcs(struct gte *gte, const uint8_t color[4], unsigned int shift,
+         bool lm)
+{
+    int64_t mac[3];
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        mac[i] = (int64_t)color[i] << 16;
+    }
+
+    gte_interpolate(gte, mac, shift, lm);
+    gte_push_color(gte);
+}
+
+static void
+gte_intpl(struct gte *gte, unsigned int shift, bool lm)
+{
+    int64_t mac[3];
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        mac[i] = (int64_t)gte->ir[i + 1] << 12;
+    }
+
+    gte_interpolate(gte, mac, shift, lm);
+    gte_push_color(gte);
+}
+
+static void
+gte_mvmva(struct gte *gte, uint32_t instruction, unsigned int shift, bool lm)
+{
+    const int16_t (*rt)[3] = gte->matrix[GTE_MATRIX_ROTATION];
+    int16_t m[3][3], v[3];
+    unsigned int mx, vx, cv;
+
+    mx = GTE_MX(instruction);
+    vx = GTE_V(instruction);
+    cv = GTE_CV(instruction);
+
+    /* The fourth matrix is garbage that some games rely on anyway */
+    if (mx < GTE_NR_MATRICES) {
+        memcpy(m, gte->matrix[mx], sizeof(m));
+    } else {
+        m[0][0] = -(gte->rgbc[0] << 4);
+        m[0][1] = gte->rgbc[0] << 4;
+        m[0][2] = gte->ir[0];
+
+        for (unsigned int j = 0; j < 3; ++j) {
+            m[1][j] = rt[0][2];
+            m[2][j] = rt[1][1];
+        }
+    }
+
+    if (vx < 3) {
+        memcpy(v, gte->v[vx], sizeof(v));
+    } else {
+        gte_ir_vector(gte, v);
+    }
+
+    if (cv == GTE_VECTOR_FAR_COLOR) {
+        gte_matvec_far_color(gte, m, v, shift, lm);
+    } else {
+        gte_matvec(gte, m, cv < GTE_NR_VECTORS ? gte->vector[cv] : GTE_ZERO,
+                   v, shift, lm);
+    }
+}
+
+/* Normal colour with optional colour multiplication and depth cueing */
+static void
+gte_nc(struct gte *gte, const int16_t v[3], unsigned int shift, bool lm,
+       bool color, bool depth)
+{
+    int64_t mac[3];
+
+    gte_matvec(gte, gte->matrix[GTE_MATRIX_LIGHT], GTE_ZERO, v, shift, lm);
+    gte_light_color(gte, shift, lm);
+
+    if (depth) {
+        gte_color_ir(gte, mac);
+        gte_interpolate(gte, mac, shift, lm);
+    } else if (color) {
+        gte_color_ir(gte, mac);
+
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_set_mac_ir(gte, i + 1, mac[i], shift, lm);
+        }
+    }
+
+    gte_push_color(gte);
+}
+
+static void
+gte_cc(struct gte *gte, unsigned int shift, bool lm, bool depth)
+{
+    int64_t mac[3];
+
+    gte_light_color(gte, shift, lm);
+    gte_color_ir(gte, mac);
+
+    if (depth) {
+        gte_interpolate(gte, mac, shift, lm);
+    } else {
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_set_mac_ir(gte, i + 1, mac[i], shift, lm);
+        }
+    }
+
+    gte_push_color(gte);
+}
+
+static void
+gte_dcpl(struct gte *gte, unsigned int shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_color_ir(gte, mac);
+    gte_interpolate(gte, mac, shift, lm);
+    gte_push_color(gte);
+}
+
+static void
+gte_sqr(struct gte *gte, unsigned int shift, bool lm)
+{
+    int64_t value;
+
+    for (unsigned int i = 1; i < 4; ++i) {
+        value = (int32_t)gte->ir[i] * gte->ir[i];
+        gte_set_mac_ir(gte, i, value, shift, lm);
+    }
+}
+
+static void
+gte_avsz(struct gte *gte, int16_t zsf, uint32_t sum)
+{
+    int64_t value;
+
+    value = (int64_t)zsf * sum;
+
+    gte_set_mac0(gte, value);
+    gte_set_otz(gte, value >> 12);
+}
+
+/* General purpose interpolation, GPL adds to the previous MAC values */
+static void
+gte_gp(struct gte *gte, unsigned int shift, bool lm, bool base)
+{
+    int64_t value;
+
+    for (unsigned int i = 1; i < 4; ++i) {
+        value = base ? (int64_t)gte->mac[i] << shift : 0;
+        value = gte_check_mac(gte, i,
+                              value + (int32_t)gte->ir[i] * gte->ir[0]);
+        gte_set_mac_ir(gte, i, value, shift, lm);
+    }
+
+    gte_push_color(gte);
+}
+
+/* Process-wide, so machines created later don't rewrite what others read */
+static void
+gte_setup_once(void)
+{
+    int value;
+
+    for (unsigned int i = 0; i < sizeof(gte_unr); ++i) {
+        value = (0x40000 / (i + 0x100) + 1) / 2 - 0x101;
+        gte_unr[i] = MAX(value, 0);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        gte_isa = GTE_AVX2;
+        gte_matvec_selected = gte_matvec_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        gte_isa = GTE_SSE41;
+        gte_matvec_selected = gte_matvec_sse41;
+    }
+#endif
+}
+
+void
+gte_setup(struct psx_machine *psx)
+{
+    pthread_once(&gte_once, gte_setup_once);
+    gte_hard_reset(psx);
+}
+
+void
+gte_hard_reset(struct psx_machine *psx)
+{
+    memset(&psx->gte, 0, sizeof(psx->gte));
+}
+
+const char *
+gte_isa_name(enum gte_isa isa)
+{
+    assert(isa < GTE_NR_ISAS);
+
+    return GTE_ISA_NAMES[isa];
+}
+
+enum gte_isa
+gte_selected(void)
+{
+    return gte_isa;
+}
+
+static uint32_t
+gte_pack16(int16_t lo, int16_t hi)
+{
+    return (uint16_t)lo | ((uint32_t)(uint16_t)hi << 16);
+}
+
+static uint32_t
+gte_pack8(const uint8_t c[4])
+{
+    return c[0] | (c[1] << 8) | (c[2] << 16) | ((uint32_t)c[3] << 24);
+}
+
+static void
+gte_unpack8(uint8_t c[4], uint32_t value)
+{
+    for (unsigned int i = 0; i < 4; ++i) {
+        c[i] = value >> (i * 8);
+    }
+}
+
+uint32_t
+gte_read_data(struct psx_machine *psx, unsigned int reg)
+{
+    struct gte *gte = &psx->gte;
+    uint32_t value;
+    int c;
+
+    assert(reg < GTE_NR_REGISTERS);
+
+    switch (reg) {
+    case 0:
+    case 2:
+    case 4:
+        return gte_pack16(gte->v[reg / 2][0], gte->v[reg / 2][1]);
+    case 1:
+    case 3:
+    case 5:
+        return (int32_t)gte->v[reg / 2][2];
+    case 6:
+        return gte_pack8(gte->rgbc);
+    case 7:
+        return gte->otz;
+    case 8 ... 11:
+        return (int32_t)gte->ir[reg - 8];
+    case 12 ... 14:
+        return gte_pack16(gte->sxy[reg - 12][0], gte->sxy[reg - 12][1]);
+    case 15:
+        return gte_pack16(gte->sxy[2][0], gte->sxy[2][1]);
+    case 16 ... 19:
+        return gte->sz[reg - 16];
+    case 20 ... 22:
+        return gte_pack8(gte->rgb[reg - 20]);
+    case 23:
+        return gte->res1;
+    case 24 ... 27:
+        return gte->mac[reg - 24];
+    case 28:
+    case 29:
+        /* IRGB reads back as ORGB, IR1-3 converted to 5:5:5 */
+        value = 0;
+
+        for (unsigned int i = 0; i < 3; ++i) {
+            c = gte->ir[i + 1] >> 7;
+            value |= MAX(MIN(c, 0x1f), 0) << (i * 5);
+        }
+
+        return value;
+    case 30:
+        return gte->lzcs;
+    default:
+        return gte->lzcr;
+    }
+}
+
+void
+gte_write_data(struct psx_machine *psx, unsigned int reg, uint32_t value)
+{
+    struct gte *gte = &psx->gte;
+    uint32_t bits;
+
+    assert(reg < GTE_NR_REGISTERS);
+
+    switch (reg) {
+    case 0:
+    case 2:
+    case 4:
+        gte->v[reg / 2][0] = value;
+        gte->v[reg / 2][1] = value >> 16;
+        break;
+    case 1:
+    case 3:
+    case 5:
+        gte->v[reg / 2][2] = value;
+        break;
+    case 6:
+        gte_unpack8(gte->rgbc, value);
+        break;
+    case 7:
+        gte->otz = value;
+        break;
+    case 8 ... 11:
+        gte->ir[reg - 8] = value;
+        break;
+    case 12 ... 14:
+        gte->sxy[reg - 12][0] = value;
+        gte->sxy[reg - 12][1] = value >> 16;
+        break;
+    case 15:
+        /* SXYP pushes onto the FIFO */
+        memmove(gte->sxy[0], gte->sxy[1], sizeof(gte->sxy[0]) * 2);
+        gte->sxy[2][0] = value;
+        gte->sxy[2][1] = value >> 16;
+        break;
+    case 16 ... 19:
+        gte->sz[reg - 16] = value;
+        break;
+    case 20 ... 22:
+        gte_unpack8(gte->rgb[reg - 20], value);
+        break;
+    case 23:
+        gte->res1 = value;
+        break;
+    case 24 ... 27:
+        gte->mac[reg - 24] = value;
+        break;
+    case 28:
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte->ir[i + 1] = ((value >> (i * 5)) & 0x1f) << 7;
+        }
+
+        break;
+    case 30:
+        /* LZCR counts the leading bits equal to the sign bit */
+        gte->lzcs = value;
+        bits = (int32_t)value < 0 ? ~value : value;
+        gte->lzcr = bits ? __builtin_clz(bits) : 32;
+        break;
+    default:
+        /* ORGB and LZCR are read-only */
+        break;
+    }
+}
+
+uint32_t
+gte_read_control(struct psx_machine *psx, unsigned int reg)
+{
+    struct gte *gte = &psx->gte;
+    const int16_t *m;
+
+    assert(reg < GTE_NR_REGISTERS);
+
+    switch (reg) {
+    case 0 ... 4:
+    case 8 ... 12:
+    case 16 ... 20:
+        m = &gte->matrix[reg / 8][0][0];
+        reg %= 8;
+
+        return reg == 4 ? (uint32_t)(int32_t)m[8]
+                        : gte_pack16(m[reg * 2], m[reg * 2 + 1]);
+    case 5 ... 7:
+    case 13 ... 15:
+    case 21 ... 23:
+        return gte->vector[reg / 8][reg % 8 - 5];
+    case 24:
+        return gte->ofx;
+    case 25:
+        return gte->ofy;
+    case 26:
+        /* H is unsigned, but reads back sign-extended */
+        return (int32_t)(int16_t)gte->h;
+    case 27:
+        return (int32_t)gte->dqa;
+    case 28:
+        return gte->dqb;
+    case 29:
+        return (int32_t)gte->zsf3;
+    case 30:
+        return (int32_t)gte->zsf4;
+    default:
+        return gte->flag;
+    }
+}
+
+void
+gte_write_control(struct psx_machine *psx, unsigned int reg, uint32_t value)
+{
+    struct gte *gte = &psx->gte;
+    int16_t *m;
+
+    assert(reg < GTE_NR_REGISTERS);
+
+    switch (reg) {
+    case 0 ... 4:
+    case 8 ... 12:
+    case 16 ... 20:
+        m = &gte->matrix[reg / 8][0][0];
+        reg %= 8;
+
+        if (reg == 4) {
+            m[8] = value;
+        } else {
+            m[reg * 2] = value;
+            m[reg * 2 + 1] = value >> 16;
+        }
+
+        break;
+    case 5 ... 7:
+    case 13 ... 15:
+    case 21 ... 23:
+        gte->vector[reg / 8][reg % 8 - 5] = value;
+        break;
+    case 24:
+        gte->ofx = value;
+        break;
+    case 25:
+        gte->ofy = value;
+        break;
+    case 26:
+        gte->h = value;
+        break;
+    case 27:
+        gte->dqa = value;
+        break;
+    case 28:
+        gte->dqb = value;
+        break;
+    case 29:
+        gte->zsf3 = value;
+        break;
+    case 30:
+        gte->zsf4 = value;
+        break;
+    default:
+        gte->flag = value & 0x7ffff000;
+
+        if (gte->flag & GTE_FLAG_ERROR_MASK) {
+            gte->flag |= GTE_FLAG_ERROR;
+        }
+
+        break;
+    }
+}
+
+/* Command timings are not modelled, every command completes at once */
+void
+gte_execute(struct psx_machine *psx, uint32_t instruction)
+{
+    struct gte *gte = &psx->gte;
+    unsigned int shift;
+    bool lm;
+
+    shift = GTE_SF(instruction);
+    lm = GTE_LM(instruction);
+
+    gte->flag = 0;
+
+    switch (GTE_COMMAND(instruction)) {
+    case 0x01:
+        gte_rtp(gte, gte->v[0], shift, lm, true);
+        break;
+    case 0x06:
+        gte_nclip(gte);
+        break;
+    case 0x0c:
+        gte_op(gte, shift, lm);
+        break;
+    case 0x10:
+        gte_dpcs(gte, gte->rgbc, shift, lm);
+        break;
+    case 0x11:
+        gte_intpl(gte, shift, lm);
+        break;
+    case 0x12:
+        gte_mvmva(gte, instruction, shift, lm);
+        break;
+    case 0x13:
+        gte_nc(gte, gte->v[0], shift, lm, true, true);
+        break;
+    case 0x14:
+        gte_cc(gte, shift, lm, true);
+        break;
+    case 0x16:
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_nc(gte, gte->v[i], shift, lm, true, true);
+        }
+
+        break;
+    case 0x1b:
+        gte_nc(gte, gte->v[0], shift, lm, true, false);
+        break;
+    case 0x1c:
+        gte_cc(gte, shift, lm, false);
+        break;
+    case 0x1e:
+        gte_nc(gte, gte->v[0], shift, lm, false, false);
+        break;
+    case 0x20:
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_nc(gte, gte->v[i], shift, lm, false, false);
+        }
+
+        break;
+    case 0x28:
+        gte_sqr(gte, shift, lm);
+        break;
+    case 0x29:
+        gte_dcpl(gte, shift, lm);
+        break;
+    case 0x2a:
+        /* Each pass interpolates the oldest FIFO entry, then pushes */
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_dpcs(gte, gte->rgb[0], shift, lm);
+        }
+
+        break;
+    case 0x2d:
+        gte_avsz(gte, gte->zsf3, gte->sz[1] + gte->sz[2] + gte->sz[3]);
+        break;
+    case 0x2e:
+        gte_avsz(gte, gte->zsf4,
+                 gte->sz[0] + gte->sz[1] + gte->sz[2] + gte->sz[3]);
+        break;
+    case 0x30:
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_rtp(gte, gte->v[i], shift, lm, i == 2);
+        }
+
+        break;
+    case 0x3d:
+        gte_gp(gte, shift, lm, false);
+        break;
+    case 0x3e:
+        gte_gp(gte, shift, lm, true);
+        break;
+    case 0x3f:
+        for (unsigned int i = 0; i < 3; ++i) {
+            gte_nc(gte, gte->v[i], shift, lm, true, false);
+        }
+
+        break;
+    default:
+        printf("gte: error: unknown command 0x%08x\n", instruction);
+        PANIC;
+        break;
+    }
+
+    if (gte->flag & GTE_FLAG_ERROR_MASK) {
+        gte->flag |= GTE_FLAG_ERROR;
+    }
+}
+
+void
+gte_save_state(struct psx_machine *psx, struct state *state)
+{
+    state_begin_section(state, STATE_SECTION_GTE);
+    state_write(state, &psx->gte, sizeof(psx->gte));
+    state_end_section(state);
+}
+
+void
+gte_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (state_find_section(state, STATE_SECTION_GTE)) {
+        state_read(state, &psx->gte, sizeof(psx->gte));
+    }
+}
@@ -0,0 +1,71 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "gte.h"
+
+/* Sign-extends the low 44 bits of each 64-bit lane */
+static inline __m256i
+gte_avx2_wrap44(__m256i value)
+{
+    const __m256i mask = _mm256_set1_epi64x((INT64_C(1) << 44) - 1);
+    const __m256i sign = _mm256_set1_epi64x(INT64_C(1) << 43);
+
+    value = _mm256_xor_si256(_mm256_and_si256(value, mask), sign);
+    return _mm256_sub_epi64(value, sign);
+}
+
+/* One row per 64-bit lane, the fourth lane is unused */
+uint32_t
+gte_matvec_avx2(const int16_t m[3][3], const int32_t t[3],
+                const int16_t v[3], int64_t result[3])
+{
+    __m256i sum, wrapped;
+    __m128i product;
+    unsigned int positive, negative, overflow, sign;
+    int64_t lanes[4];
+    uint32_t flags;
+
+    sum = _mm256_setr_epi64x((int64_t)t[0] * 0x1000, (int64_t)t[1] * 0x1000,
+                             (int64_t)t[2] * 0x1000, 0);
+
+    positive = 0;
+    negative = 0;
+
+    for (unsigned int j = 0; j < 3; ++j) {
+        product = _mm_mullo_epi32(_mm_setr_epi32(m[0][j], m[1][j], m[2][j], 0),
+                                  _mm_set1_epi32(v[j]));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(product));
+
+        wrapped = gte_avx2_wrap44(sum);
+        overflow = ~_mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(wrapped, sum)));
+        sign = _mm256_movemask_pd(_mm256_castsi256_pd(sum));
+
+        positive |= overflow & ~sign;
+        negative |= overflow & sign;
+        sum = wrapped;
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+
+    flags = 0;
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        result[i] = lanes[i];
+
+        if (positive & (1 << i)) {
+            flags |= GTE_FLAG_MAC_POS(i + 1);
+        }
+
+        if (negative & (1 << i)) {
+            flags |= GTE_FLAG_MAC_NEG(i + 1);
+        }
+    }
+
+    return flags;
+}
+
+#endif
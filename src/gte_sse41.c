@@ -0,0 +1,82 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+
+#include <smmintrin.h>
+
+#include "gte.h"
+
+/* Sign-extends the low 44 bits of each 64-bit lane */
+static inline __m128i
+gte_sse41_wrap44(__m128i value)
+{
+    const __m128i mask = _mm_set1_epi64x((INT64_C(1) << 44) - 1);
+    const __m128i sign = _mm_set1_epi64x(INT64_C(1) << 43);
+
+    value = _mm_xor_si128(_mm_and_si128(value, mask), sign);
+    return _mm_sub_epi64(value, sign);
+}
+
+/* Wraps the lanes, noting the direction of any that overflowed */
+static inline void
+gte_sse41_check(__m128i *sum, unsigned int *positive, unsigned int *negative,
+                unsigned int shift)
+{
+    __m128i wrapped;
+    unsigned int overflow, sign;
+
+    wrapped = gte_sse41_wrap44(*sum);
+    overflow = ~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(wrapped,
+                                                                 *sum)));
+    sign = _mm_movemask_pd(_mm_castsi128_pd(*sum));
+
+    *positive |= (overflow & ~sign & 3) << shift;
+    *negative |= (overflow & sign & 3) << shift;
+    *sum = wrapped;
+}
+
+/* Rows 0 and 1 in one vector and row 2 in the low lane of another */
+uint32_t
+gte_matvec_sse41(const int16_t m[3][3], const int32_t t[3],
+                 const int16_t v[3], int64_t result[3])
+{
+    __m128i lo, hi, product;
+    unsigned int positive, negative;
+    uint32_t flags;
+
+    lo = _mm_set_epi64x((int64_t)t[1] * 0x1000, (int64_t)t[0] * 0x1000);
+    hi = _mm_set_epi64x(0, (int64_t)t[2] * 0x1000);
+
+    positive = 0;
+    negative = 0;
+
+    for (unsigned int j = 0; j < 3; ++j) {
+        product = _mm_mullo_epi32(_mm_setr_epi32(m[0][j], m[1][j], m[2][j], 0),
+                                  _mm_set1_epi32(v[j]));
+
+        lo = _mm_add_epi64(lo, _mm_cvtepi32_epi64(product));
+        hi = _mm_add_epi64(hi, _mm_cvtepi32_epi64(_mm_srli_si128(product, 8)));
+
+        gte_sse41_check(&lo, &positive, &negative, 0);
+        gte_sse41_check(&hi, &positive, &negative, 2);
+    }
+
+    _mm_storeu_si128((__m128i *)result, lo);
+    _mm_storel_epi64((__m128i *)&result[2], hi);
+
+    flags = 0;
+
+    for (unsigned int i = 0; i < 3; ++i) {
+        if (positive & (1 << i)) {
+            flags |= GTE_FLAG_MAC_POS(i + 1);
+        }
+
+        if (negative & (1 << i)) {
+            flags |= GTE_FLAG_MAC_NEG(i + 1);
+        }
+    }
+
+    return flags;
+}
+
+#endif
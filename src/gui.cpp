@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 
+#include <GL/gl3w.h>
 #include <SDL2/SDL.h>
 
 #include <imgui/imgui.h>
@@ -14,25 +15,43 @@
 #include <imgui/imgui_memory_editor.h>
 
 extern "C" {
+#include "gpu.h"
 #include "gui.h"
+#include "perf.h"
 #include "psx.h"
 #include "r3000.h"
 #include "r3000_disassembler.h"
+#include "replay.h"
+#include "rewind.h"
 #include "spu.h"
+#include "window.h"
 }
 
+#define GUI_PERF_HISTORY        120
+#define GUI_FRAME_MS            (1000.0f / 60.0f)
+
 struct gui_state {
+    struct psx_machine *psx;
+
     bool quit;
     bool step;
 
     bool cont;
     bool cont_prev;
 
+    bool rewinding;
+    size_t rewind_size;
+
+    unsigned int run_ahead;         /* Frames, or 0 when off */
+
     bool debug_cpu;
     bool debug_ram;
     bool debug_bios;
     bool debug_sram;
     bool debug_tty;
+    bool debug_perf;
+    bool debug_vram;
+    bool debug_texcache;
 
     bool disasm_lock;
     bool disasm_lock_jump;
@@ -43,6 +62,12 @@ struct gui_state {
 
     bool modify_disasm;
     uint32_t modify_disasm_address;
+
+    uint64_t perf_frames;
+    float perf_history[GUI_PERF_HISTORY];
+    int perf_history_offset;
+
+    GLuint vram_texture;
 };
 
 static struct gui_state gui_state;
@@ -53,6 +78,9 @@ static MemoryEditor gui_memedit_sram;
 
 static std::vector<std::string> gui_tty_entries;
 
+static uint32_t gui_vram_rgba[GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT];
+static uint16_t gui_ahead_vram[GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT];
+
 void
 gui_setup(SDL_Window *window, SDL_GLContext context)
 {
@@ -68,6 +96,7 @@ gui_setup(SDL_Window *window, SDL_GLContext context)
 
     gui_state = {};
     gui_state.cont = true;
+    gui_state.rewind_size = REWIND_DEFAULT_SIZE;
 
     gui_memedit_ram.OptShowOptions = false;
     gui_memedit_ram.OptShowDataPreview = false;
@@ -78,9 +107,19 @@ gui_setup(SDL_Window *window, SDL_GLContext context)
     gui_memedit_bios.OptUpperCaseHex = false;
 }
 
+void
+gui_attach(struct psx_machine *psx)
+{
+    gui_state.psx = psx;
+}
+
 void
 gui_shutdown(void)
 {
+    if (gui_state.vram_texture) {
+        glDeleteTextures(1, &gui_state.vram_texture);
+    }
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
@@ -90,6 +129,13 @@ void
 gui_process_event(SDL_Event event)
 {
     ImGui_ImplSDL2_ProcessEvent(&event);
+
+    /* Rewind while backspace is held, unless a text field has focus */
+    if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) &&
+        event.key.keysym.sym == SDLK_BACKSPACE) {
+        gui_state.rewinding = event.type == SDL_KEYDOWN &&
+                              !ImGui::GetIO().WantCaptureKeyboard;
+    }
 }
 
 static void
@@ -102,7 +148,7 @@ gui_render_debug_cpu_actions(void)
     ImGui::BeginChild("Actions", ImVec2(235, 30));
 
     if (ImGui::Button("Reset", ImVec2(70, 25))) {
-        psx_soft_reset();
+        psx_soft_reset(gui_state.psx);
     }
 
     ImGui::SameLine();
@@ -122,7 +168,7 @@ gui_render_debug_cpu_actions(void)
         gui_state.cont = false;
         gui_state.disasm_lock = false;
 
-        psx_step();
+        psx_step(gui_state.psx);
     }
 
     ImGui::EndChild();
@@ -158,9 +204,10 @@ gui_render_modify_register(void)
 
         if (enter || button) {
             if(reg == 0) {
-                r3000_debug_force_pc(strtoul(value, NULL, 16));
+                r3000_debug_force_pc(gui_state.psx, strtoul(value, NULL, 16));
             } else {
-                r3000_write_reg(reg, strtoul(value, NULL, 16));
+                r3000_debug_write_reg(gui_state.psx, reg,
+                                      strtoul(value, NULL, 16));
             }
 
             gui_state.modify_register = false;
@@ -211,7 +258,7 @@ gui_render_modify_disasm(void)
         button = ImGui::Button("Set");
 
         if (enter || button) {
-            r3000_debug_write_memory32(address, strtoul(value, NULL, 16));
+            r3000_debug_write_memory32(gui_state.psx, address, strtoul(value, NULL, 16));
 
             gui_state.modify_disasm = false;
             value[0] = '\0';
@@ -252,10 +299,10 @@ gui_render_debug_cpu_register(unsigned int i)
 
     if (i == 0) {
         name = "$pc";
-        value = r3000_read_pc();
+        value = r3000_read_pc(gui_state.psx);
     } else {
         name = r3000_register_name(i);
-        value = r3000_read_reg(i);
+        value = r3000_read_reg(gui_state.psx, i);
     }
 
     snprintf(text, sizeof(text), "%s: 0x%08x", name, value);
@@ -287,7 +334,7 @@ gui_format_disassembly(char *buffer, size_t n, uint32_t address)
     uint32_t instruction;
     char buf[n];
 
-    instruction = r3000_debug_read_memory32(address);
+    instruction = r3000_debug_read_memory32(gui_state.psx, address);
 
     r3000_disassembler_disassemble(buf, sizeof(buf), instruction, address);
     snprintf(buffer, n, "0x%08x: %08x %s", address, instruction, buf);
@@ -299,7 +346,7 @@ gui_render_debug_cpu_disasm_instruction(uint32_t address)
     uint32_t pc;
     char disassembly[64];
 
-    pc = r3000_read_pc();
+    pc = r3000_read_pc(gui_state.psx);
 
     if (address == pc) {
         ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(255, 99, 71, 255));
@@ -334,7 +381,7 @@ gui_render_debug_cpu_disasm_window(void)
     size = ImVec2(400, ImGui::GetFontSize() * 32);
 
     address = gui_state.disasm_lock ? gui_state.disasm_lock_address
-                                      : r3000_read_pc();
+                                      : r3000_read_pc(gui_state.psx);
 
     ImGui::BeginChild("Disassembly", size, true);
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 1));
@@ -383,8 +430,8 @@ gui_render_debug_interrupts(void)
     uint32_t istat, imask;
     char istat_string[12], imask_string[12];
 
-    istat = psx_debug_read_memory32(PSX_INTERRUPT_STATUS);
-    imask = psx_debug_read_memory32(PSX_INTERRUPT_MASK);
+    istat = psx_debug_read_memory32(gui_state.psx, PSX_INTERRUPT_STATUS);
+    imask = psx_debug_read_memory32(gui_state.psx, PSX_INTERRUPT_MASK);
 
     for (int i = 0; i < 11; ++i) {
         istat_string[i] = ((istat >> i) & 0x1) ? interrupt_flags[i] : '-';
@@ -473,9 +520,259 @@ gui_render_debug_tty(void)
     ImGui::End();
 }
 
+#ifdef PSX_PERF
+static void
+gui_render_debug_perf_counters(void)
+{
+    const struct perf_frame *frame;
+    uint64_t frames, total_ns;
+    float frame_ms, fraction;
+
+    frame = perf_last_frame(gui_state.psx);
+    frames = perf_frames(gui_state.psx);
+    frame_ms = frame->frame_ns / 1e6f;
+
+    if (frames != gui_state.perf_frames) {
+        gui_state.perf_frames = frames;
+        gui_state.perf_history[gui_state.perf_history_offset] = frame_ms;
+        gui_state.perf_history_offset =
+            (gui_state.perf_history_offset + 1) % GUI_PERF_HISTORY;
+    }
+
+    ImGui::Text("Frame:        %.2f ms (%.0f%% of budget)", frame_ms,
+                100.0f * frame_ms / GUI_FRAME_MS);
+    ImGui::Text("Instructions: %llu (%.1f MIPS)",
+                (unsigned long long)frame->instructions,
+                frame->frame_ns ? 1e3 * frame->instructions / frame->frame_ns
+                                : 0.0);
+    ImGui::Text("Cycles:       %llu", (unsigned long long)frame->cycles);
+
+    ImGui::PlotLines("##history", gui_state.perf_history, GUI_PERF_HISTORY,
+                     gui_state.perf_history_offset, "ms per frame", 0.0f,
+                     2.0f * GUI_FRAME_MS, ImVec2(0, 60));
+
+    ImGui::Separator();
+
+    total_ns = 0;
+
+    for (int i = 0; i < PERF_NR_SECTIONS; ++i) {
+        total_ns += frame->section_ns[i];
+    }
+
+    for (int i = 0; i < PERF_NR_SECTIONS; ++i) {
+        fraction = total_ns ? (float)frame->section_ns[i] / total_ns : 0.0f;
+
+        ImGui::Text("%-4s %6.2f ms", perf_section_name((enum perf_section)i),
+                    frame->section_ns[i] / 1e6f);
+        ImGui::SameLine();
+        ImGui::ProgressBar(fraction, ImVec2(160, 0));
+    }
+
+    ImGui::Separator();
+
+    for (int i = 0; i < PERF_NR_REGIONS; ++i) {
+        ImGui::Text("%-5s %10llu accesses",
+                    perf_region_name((enum perf_region)i),
+                    (unsigned long long)frame->bus[i]);
+    }
+}
+#endif
+
+static void
+gui_render_debug_perf(void)
+{
+    struct window_audio_stats audio;
+    ImGuiWindowFlags flags;
+
+    flags = ImGuiWindowFlags_AlwaysAutoResize;
+    ImGui::Begin("Performance", &gui_state.debug_perf, flags);
+
+#ifdef PSX_PERF
+    gui_render_debug_perf_counters();
+#else
+    ImGui::Text("Counters disabled, rebuild with PERF=1");
+#endif
+
+    ImGui::Separator();
+
+    window_audio_stats(&audio);
+
+    ImGui::Text("Audio buffer");
+    ImGui::SameLine();
+    ImGui::ProgressBar(audio.usage, ImVec2(160, 0));
+    ImGui::Text("Latency %.1f ms, rate ratio %.5f", audio.latency,
+                audio.ratio);
+    ImGui::Text("Underruns %llu, overruns %llu",
+                (unsigned long long)audio.underruns,
+                (unsigned long long)audio.overruns);
+
+    ImGui::End();
+}
+
+static void
+gui_render_debug_vram(void)
+{
+    const uint16_t *vram;
+    uint16_t pixel;
+    uint32_t r, g, b;
+
+    if (!gui_state.vram_texture) {
+        glGenTextures(1, &gui_state.vram_texture);
+        glBindTexture(GL_TEXTURE_2D, gui_state.vram_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    /* Show where run-ahead got to, unless the machine isn't running */
+    if (gui_state.run_ahead && gui_state.cont && !gui_should_rewind()) {
+        vram = gui_ahead_vram;
+    } else {
+        vram = gpu_debug_vram(gui_state.psx);
+    }
+
+    /* Expand 15bpp to RGBA8, the mask bit would otherwise become alpha */
+
+    for (size_t i = 0; i < GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT; ++i) {
+        pixel = vram[i];
+        r = (pixel & 0x1f) << 3;
+        g = ((pixel >> 5) & 0x1f) << 3;
+        b = ((pixel >> 10) & 0x1f) << 3;
+        gui_vram_rgba[i] = 0xff000000 | b << 16 | g << 8 | r;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, gui_state.vram_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, GPU_VRAM_WIDTH, GPU_VRAM_HEIGHT,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, gui_vram_rgba);
+
+    ImGui::Begin("VRAM", &gui_state.debug_vram,
+                 ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Image((ImTextureID)(intptr_t)gui_state.vram_texture,
+                 ImVec2(GPU_VRAM_WIDTH, GPU_VRAM_HEIGHT));
+    ImGui::End();
+}
+
+static void
+gui_render_debug_texcache(void)
+{
+    struct gpu_texcache_stats stats;
+    uint64_t lookups;
+
+    gpu_debug_texcache(gui_state.psx, &stats);
+    lookups = stats.hits + stats.misses;
+
+    ImGui::Begin("Texture Cache", &gui_state.debug_texcache,
+                 ImGuiWindowFlags_AlwaysAutoResize);
+
+    ImGui::Text("Hits          %12llu", (unsigned long long)stats.hits);
+    ImGui::Text("Misses        %12llu", (unsigned long long)stats.misses);
+    ImGui::Text("Evictions     %12llu", (unsigned long long)stats.evictions);
+    ImGui::Text("Invalidations %12llu",
+                (unsigned long long)stats.invalidations);
+
+    ImGui::Separator();
+
+    ImGui::Text("Hit rate");
+    ImGui::SameLine();
+    ImGui::ProgressBar(lookups ? (float)stats.hits / lookups : 0.0f,
+                       ImVec2(160, 0));
+
+    ImGui::End();
+}
+
+static void
+gui_render_rewind_menu(void)
+{
+    static const size_t sizes[] = { 64, 256, 1024 };
+    struct rewind_stats stats;
+    bool enabled;
+    char label[16];
+
+    enabled = rewind_enabled(gui_state.psx);
+
+    if (ImGui::MenuItem("Enabled", NULL, &enabled)) {
+        if (enabled) {
+            rewind_enable(gui_state.psx, gui_state.rewind_size);
+        } else {
+            rewind_disable(gui_state.psx);
+        }
+    }
+
+    if (ImGui::BeginMenu("Buffer")) {
+        for (size_t size : sizes) {
+            snprintf(label, sizeof(label), "%zu MiB", size);
+
+            if (ImGui::MenuItem(label, NULL,
+                                gui_state.rewind_size == MEGABYTES(size))) {
+                gui_state.rewind_size = MEGABYTES(size);
+
+                /* Restarts the history at the current frame */
+                if (enabled) {
+                    rewind_enable(gui_state.psx, gui_state.rewind_size);
+                }
+            }
+        }
+
+        ImGui::EndMenu();
+    }
+
+    ImGui::Separator();
+
+    rewind_stats(gui_state.psx, &stats);
+
+    ImGui::Text("Hold Backspace to rewind");
+    ImGui::Text("%.1f s held, %.1f of %.1f MiB",
+                stats.frames / 60.0f, stats.used / 1048576.0f,
+                stats.capacity / 1048576.0f);
+}
+
+/* Named after the wall clock time, in the working directory */
+static void
+gui_render_record_menu_item(void)
+{
+    std::time_t now;
+    char path[64];
+
+    if (replay_mode(gui_state.psx) == REPLAY_RECORDING) {
+        if (ImGui::MenuItem("Stop Recording", NULL)) {
+            replay_stop(gui_state.psx);
+        }
+
+        return;
+    }
+
+    if (ImGui::MenuItem("Start Recording", NULL)) {
+        now = std::time(nullptr);
+        strftime(path, sizeof(path), "psx-%Y%m%d-%H%M%S.replay",
+                 localtime(&now));
+        replay_record(gui_state.psx, path);
+    }
+}
+
+static void
+gui_render_run_ahead_menu(void)
+{
+    char label[16];
+
+    if (ImGui::MenuItem("Off", NULL, gui_state.run_ahead == 0)) {
+        gui_state.run_ahead = 0;
+    }
+
+    for (unsigned int i = 1; i <= PSX_MAX_RUN_AHEAD; ++i) {
+        snprintf(label, sizeof(label), "%u frame%s", i, i > 1 ? "s" : "");
+
+        if (ImGui::MenuItem(label, NULL, gui_state.run_ahead == i)) {
+            gui_state.run_ahead = i;
+        }
+    }
+}
+
 void
 gui_render(SDL_Window *window)
 {
+    bool recording;
+
+    PERF_BEGIN(gui_state.psx, PERF_SECTION_GUI);
+
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplSDL2_NewFrame(window);
     ImGui::NewFrame();
@@ -483,25 +780,43 @@ gui_render(SDL_Window *window)
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("File")) {
             if (ImGui::MenuItem("Soft Reset", NULL)) {
-                psx_soft_reset();
+                psx_soft_reset(gui_state.psx);
             }
 
             if (ImGui::MenuItem("Hard Reset", NULL)) {
-                psx_hard_reset();
+                psx_hard_reset(gui_state.psx);
             }
 
             ImGui::Separator();
 
+            gui_render_record_menu_item();
+
+            ImGui::Separator();
+
             ImGui::MenuItem("Quit", "ESC", &gui_state.quit);
             ImGui::EndMenu();
         }
 
+        if (ImGui::BeginMenu("Rewind")) {
+            gui_render_rewind_menu();
+            ImGui::EndMenu();
+        }
+
+        if (ImGui::BeginMenu("Run-Ahead")) {
+            gui_render_run_ahead_menu();
+            ImGui::EndMenu();
+        }
+
         if (ImGui::BeginMenu("Debug")) {
             ImGui::MenuItem("CPU", NULL, &gui_state.debug_cpu);
             ImGui::MenuItem("RAM", NULL, &gui_state.debug_ram);
             ImGui::MenuItem("BIOS", NULL, &gui_state.debug_bios);
             ImGui::MenuItem("SPU RAM", NULL, &gui_state.debug_sram);
             ImGui::MenuItem("TTY", NULL, &gui_state.debug_tty);
+            ImGui::MenuItem("VRAM", NULL, &gui_state.debug_vram);
+            ImGui::MenuItem("Texture Cache", NULL,
+                            &gui_state.debug_texcache);
+            ImGui::MenuItem("Performance", NULL, &gui_state.debug_perf);
             ImGui::EndMenu();
         }
 
@@ -512,22 +827,40 @@ gui_render(SDL_Window *window)
         gui_render_debug_cpu();
     }
 
+    /* Edits straight into memory would go unrecorded */
+    recording = replay_mode(gui_state.psx) == REPLAY_RECORDING;
+    gui_memedit_ram.ReadOnly = recording;
+    gui_memedit_bios.ReadOnly = recording;
+    gui_memedit_sram.ReadOnly = recording;
+
     if (gui_state.debug_ram) {
-        gui_memedit_ram.DrawWindow("Memory", psx_debug_ram(), PSX_RAM_SIZE);
+        gui_memedit_ram.DrawWindow("Memory", psx_debug_ram(gui_state.psx), PSX_RAM_SIZE);
     }
 
     if (gui_state.debug_bios) {
-        gui_memedit_bios.DrawWindow("BIOS", psx_debug_bios(), PSX_BIOS_SIZE);
+        gui_memedit_bios.DrawWindow("BIOS", psx_debug_bios(gui_state.psx), PSX_BIOS_SIZE);
     }
 
     if (gui_state.debug_sram) {
-        gui_memedit_sram.DrawWindow("SPU RAM", spu_debug_ram(), SPU_RAM_SIZE);
+        gui_memedit_sram.DrawWindow("SPU RAM", spu_debug_ram(gui_state.psx), SPU_RAM_SIZE);
     }
 
     if (gui_state.debug_tty) {
         gui_render_debug_tty();
     }
 
+    if (gui_state.debug_perf) {
+        gui_render_debug_perf();
+    }
+
+    if (gui_state.debug_vram) {
+        gui_render_debug_vram();
+    }
+
+    if (gui_state.debug_texcache) {
+        gui_render_debug_texcache();
+    }
+
     if (gui_state.modify_register) {
         gui_render_modify_register();
     }
@@ -537,12 +870,16 @@ gui_render(SDL_Window *window)
     }
 
     ImGui::Render();
+
+    PERF_END(gui_state.psx, PERF_SECTION_GUI);
 }
 
 void
 gui_draw(void)
 {
+    PERF_BEGIN(gui_state.psx, PERF_SECTION_GUI);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    PERF_END(gui_state.psx, PERF_SECTION_GUI);
 }
 
 
@@ -577,3 +914,21 @@ gui_should_continue(void)
 {
     return gui_state.cont;
 }
+
+bool
+gui_should_rewind(void)
+{
+    /* Going back would leave the recording describing another timeline */
+    return gui_state.rewinding && rewind_enabled(gui_state.psx) &&
+           replay_mode(gui_state.psx) != REPLAY_RECORDING;
+}
+
+/* Call after each frame the machine runs */
+void
+gui_run_ahead(void)
+{
+    if (gui_state.run_ahead &&
+        !psx_run_ahead(gui_state.psx, gui_state.run_ahead, gui_ahead_vram)) {
+        gui_state.run_ahead = 0;
+    }
+}
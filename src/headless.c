@@ -0,0 +1,459 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpu.h"
+#include "perf.h"
+#include "psx.h"
+#include "r3000_jit.h"
+#include "replay.h"
+#include "rewind.h"
+#include "scheduler.h"
+
+#define HEADLESS_DEFAULT_FRAMES 600
+#define HEADLESS_REFRESH_RATE   60
+
+struct headless {
+    const char *pattern;
+    bool matched;
+
+    FILE *audio;
+    uint64_t audio_samples;
+};
+
+/* Where run-ahead leaves its frames, which nothing displays */
+static uint16_t headless_ahead_vram[GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT];
+
+static void
+headless_tty(void *opaque, const char *str, size_t len)
+{
+    struct headless *headless = opaque;
+
+    (void)len;
+    printf("tty: %s\n", str);
+
+    if (headless->pattern && strstr(str, headless->pattern)) {
+        headless->matched = true;
+    }
+}
+
+static void
+headless_audio(void *opaque, int16_t *samples, size_t amount)
+{
+    struct headless *headless = opaque;
+
+    /* Raw interleaved s16 stereo, or dropped when not capturing */
+    if (headless->audio) {
+        fwrite(samples, sizeof(int16_t), amount, headless->audio);
+    }
+
+    headless->audio_samples += amount;
+}
+
+/* Raw little endian 1024x512 15bpp, as the GPU stores it */
+static bool
+headless_dump_vram(struct psx_machine *psx, const char *path)
+{
+    const uint16_t *vram = gpu_debug_vram(psx);
+    size_t written;
+    FILE *fp;
+
+    fp = fopen(path, "wb");
+
+    if (!fp) {
+        perror("headless: error: unable to open vram dump");
+        return false;
+    }
+
+    written = fwrite(vram, sizeof(uint16_t), GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT,
+                     fp);
+    fclose(fp);
+
+    if (written != GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT) {
+        printf("headless: error: short write to %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+headless_save_state(struct psx_machine *psx, const char *path)
+{
+    size_t size;
+    void *buffer;
+    FILE *fp;
+    bool ok;
+
+    size = psx_state_size(psx, 0);
+    buffer = malloc(size);
+
+    if (!buffer || !psx_save_state(psx, buffer, size, 0)) {
+        printf("headless: error: unable to save state\n");
+        free(buffer);
+        return false;
+    }
+
+    fp = fopen(path, "wb");
+
+    if (!fp) {
+        perror("headless: error: unable to open state");
+        free(buffer);
+        return false;
+    }
+
+    ok = fwrite(buffer, 1, size, fp) == size;
+    fclose(fp);
+    free(buffer);
+
+    if (!ok) {
+        printf("headless: error: short write to %s\n", path);
+    }
+
+    return ok;
+}
+
+static bool
+headless_load_state(struct psx_machine *psx, const char *path)
+{
+    size_t size;
+    void *buffer;
+    FILE *fp;
+    bool ok;
+
+    fp = fopen(path, "rb");
+
+    if (!fp) {
+        perror("headless: error: unable to open state");
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    buffer = malloc(size);
+    ok = buffer && fread(buffer, 1, size, fp) == size &&
+         psx_load_state(psx, buffer, size);
+
+    fclose(fp);
+    free(buffer);
+
+    if (!ok) {
+        printf("headless: error: unable to load state from %s\n", path);
+    }
+
+    return ok;
+}
+
+static void
+headless_usage(void)
+{
+    printf("usage: psx_emu_headless [--cpu=interp|jit] [--frames=N] "
+           "[--until=PATTERN]\n"
+           "                        [--exe=PSEXE] [--audio=FILE] "
+           "[--perf=CSV]\n"
+           "                        [--gpu-thread=on|off] [--gpu-threads=N] "
+           "[--vram=FILE]\n"
+           "                        [--load-state=FILE] [--save-state=FILE]\n"
+           "                        [--rewind=MB] [--rewind-back=N] "
+           "[--run-ahead=N]\n"
+           "                        [--record=FILE] [--replay=FILE] bios\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct headless headless = { NULL, false, NULL, 0 };
+    const struct psx_host host = { headless_tty, headless_audio, &headless };
+    const char *bios_path, *exe_path, *audio_path, *perf_path, *vram_path;
+    const char *load_path, *save_path, *record_path, *replay_path;
+    unsigned long rewind_size, rewind_back, run_ahead;
+    struct rewind_stats rewind;
+    struct replay_stats replay;
+    long gpu_threads;
+    int gpu_thread;
+    enum replay_status status;
+    struct psx_machine *psx;
+    unsigned long frames, frame;
+    uint64_t start, cycles;
+    double elapsed;
+    FILE *perf;
+    enum psx_cpu cpu;
+    char *end;
+
+    bios_path = exe_path = audio_path = perf_path = vram_path = NULL;
+    load_path = save_path = record_path = replay_path = NULL;
+    rewind_size = rewind_back = run_ahead = 0;
+    gpu_threads = -1;
+    gpu_thread = -1;
+    perf = NULL;
+    frames = 0;
+    status = REPLAY_END;
+    cpu = PSX_CPU_INTERPRETER;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--cpu=interp")) {
+            cpu = PSX_CPU_INTERPRETER;
+        } else if (!strcmp(argv[i], "--cpu=jit")) {
+            cpu = PSX_CPU_JIT;
+        } else if (!strncmp(argv[i], "--frames=", 9)) {
+            frames = strtoul(argv[i] + 9, &end, 0);
+
+            if (*end || !frames) {
+                headless_usage();
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--until=", 8)) {
+            headless.pattern = argv[i] + 8;
+        } else if (!strncmp(argv[i], "--exe=", 6)) {
+            exe_path = argv[i] + 6;
+        } else if (!strncmp(argv[i], "--audio=", 8)) {
+            audio_path = argv[i] + 8;
+        } else if (!strncmp(argv[i], "--perf=", 7)) {
+            perf_path = argv[i] + 7;
+        } else if (!strcmp(argv[i], "--gpu-thread=on")) {
+            gpu_thread = 1;
+        } else if (!strcmp(argv[i], "--gpu-thread=off")) {
+            gpu_thread = 0;
+        } else if (!strncmp(argv[i], "--gpu-threads=", 14)) {
+            gpu_threads = strtol(argv[i] + 14, &end, 0);
+
+            if (*end || gpu_threads < 0) {
+                headless_usage();
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--vram=", 7)) {
+            vram_path = argv[i] + 7;
+        } else if (!strncmp(argv[i], "--load-state=", 13)) {
+            load_path = argv[i] + 13;
+        } else if (!strncmp(argv[i], "--save-state=", 13)) {
+            save_path = argv[i] + 13;
+        } else if (!strncmp(argv[i], "--rewind=", 9)) {
+            rewind_size = strtoul(argv[i] + 9, &end, 0);
+
+            if (*end || !rewind_size) {
+                headless_usage();
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--rewind-back=", 14)) {
+            rewind_back = strtoul(argv[i] + 14, &end, 0);
+
+            if (*end) {
+                headless_usage();
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--run-ahead=", 12)) {
+            run_ahead = strtoul(argv[i] + 12, &end, 0);
+
+            if (*end || run_ahead > PSX_MAX_RUN_AHEAD) {
+                headless_usage();
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--record=", 9)) {
+            record_path = argv[i] + 9;
+        } else if (!strncmp(argv[i], "--replay=", 9)) {
+            replay_path = argv[i] + 9;
+        } else if (!bios_path && argv[i][0] != '-') {
+            bios_path = argv[i];
+        } else {
+            bios_path = NULL;
+            break;
+        }
+    }
+
+    if (!bios_path || (record_path && replay_path)) {
+        headless_usage();
+        return 1;
+    }
+
+    /* A replay runs to the end of its log unless told otherwise */
+    if (!frames) {
+        frames = replay_path ? ULONG_MAX : HEADLESS_DEFAULT_FRAMES;
+    }
+
+    if (audio_path) {
+        headless.audio = fopen(audio_path, "wb");
+
+        if (!headless.audio) {
+            perror("headless: error: unable to open audio capture");
+            return 1;
+        }
+    }
+
+    if (perf_path) {
+#ifdef PSX_PERF
+        perf = fopen(perf_path, "w");
+
+        if (!perf) {
+            perror("headless: error: unable to open perf output");
+            return 1;
+        }
+
+        perf_csv_header(perf);
+#else
+        printf("headless: error: perf counters disabled, "
+               "rebuild with PERF=1\n");
+        return 1;
+#endif
+    }
+
+    if (cpu == PSX_CPU_JIT && !r3000_jit_supported()) {
+        printf("headless: warning: jit unsupported on this host, "
+               "using interpreter\n");
+        cpu = PSX_CPU_INTERPRETER;
+    }
+
+    psx = psx_create(bios_path);
+    psx_set_host(psx, &host);
+    gpu_use_host_cpus(psx);
+
+    if (gpu_thread >= 0 && !gpu_set_threaded(psx, gpu_thread)) {
+        printf("headless: warning: unable to start gpu thread\n");
+    }
+
+    if (gpu_threads >= 0) {
+        gpu_set_workers(psx, gpu_threads);
+    }
+
+    if (exe_path && !psx_load_exe(psx, exe_path)) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    if (load_path && !headless_load_state(psx, load_path)) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    if (!psx_set_cpu(psx, cpu)) {
+        printf("headless: warning: unable to start jit, using interpreter\n");
+        psx_set_cpu(psx, PSX_CPU_INTERPRETER);
+    }
+
+    if (rewind_size && !rewind_enable(psx, MEGABYTES(rewind_size))) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    if ((record_path && !replay_record(psx, record_path)) ||
+        (replay_path && !replay_play(psx, replay_path))) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    /* No frame pacing, the host runs the machine as fast as it can */
+    start = perf_now();
+    cycles = scheduler_now(psx);
+
+    for (frame = 0; frame < frames && !headless.matched; ++frame) {
+        if (replay_path) {
+            /* Only frames count, anything else in the log is applied */
+            do {
+                status = replay_next(psx);
+            } while (status == REPLAY_INPUT);
+
+            if (status != REPLAY_FRAME) {
+                break;
+            }
+        } else {
+            psx_run_frame(psx);
+        }
+
+        rewind_push(psx);
+
+        if (run_ahead && !psx_run_ahead(psx, run_ahead, headless_ahead_vram)) {
+            psx_destroy(psx);
+            return 1;
+        }
+
+#ifdef PSX_PERF
+        if (perf) {
+            perf_csv_write(psx, perf);
+        }
+#endif
+    }
+
+    elapsed = (perf_now() - start) / 1e9;
+    cycles = scheduler_now(psx) - cycles;
+
+    printf("headless: info: %lu frames in %.3f s, %.1f fps, "
+           "%.1f%% of real time\n", frame, elapsed, frame / elapsed,
+           100.0 * frame / HEADLESS_REFRESH_RATE / elapsed);
+    printf("headless: info: %llu cycles, %.2f MHz emulated\n",
+           (unsigned long long)cycles, cycles / elapsed / 1e6);
+    printf("headless: info: %llu audio samples %s\n",
+           (unsigned long long)headless.audio_samples,
+           headless.audio ? "captured" : "discarded");
+
+    if (headless.pattern) {
+        printf("headless: info: pattern \"%s\" %s\n", headless.pattern,
+               headless.matched ? "found" : "not found");
+    }
+
+    replay_stats(psx, &replay);
+    replay_stop(psx);
+
+    if (record_path) {
+        printf("headless: info: recorded %llu frames to %s\n",
+               (unsigned long long)replay.frames, record_path);
+    }
+
+    if (replay_path) {
+        printf("headless: info: replayed %llu frames, %llu hashes matched\n",
+               (unsigned long long)replay.frames,
+               (unsigned long long)replay.hashes);
+    }
+
+    if (rewind_enabled(psx)) {
+        rewind_stats(psx, &rewind);
+
+        printf("headless: info: rewind holds %u frames, %.1f s, "
+               "in %.1f of %.1f MiB\n", rewind.frames,
+               (double)rewind.frames / HEADLESS_REFRESH_RATE,
+               rewind.used / 1048576.0, rewind.capacity / 1048576.0);
+
+        start = perf_now();
+
+        frame = 0;
+
+        while (frame < rewind_back && rewind_step(psx)) {
+            ++frame;
+        }
+
+        if (frame) {
+            printf("headless: info: rewound %lu frames in %.3f ms\n", frame,
+                   (perf_now() - start) / 1e6);
+        }
+    }
+
+    if (vram_path && !headless_dump_vram(psx, vram_path)) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    if (save_path && !headless_save_state(psx, save_path)) {
+        psx_destroy(psx);
+        return 1;
+    }
+
+    psx_destroy(psx);
+
+    if (headless.audio) {
+        fclose(headless.audio);
+    }
+
+    if (perf) {
+        fclose(perf);
+    }
+
+    if (status == REPLAY_DESYNC) {
+        return 3;
+    }
+
+    return headless.pattern && !headless.matched ? 2 : 0;
+}
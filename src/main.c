@@ -1,28 +1,86 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "gpu.h"
 #include "gui.h"
 #include "psx.h"
+#include "r3000_jit.h"
+#include "rewind.h"
 #include "window.h"
 
+static void
+main_tty(void *opaque, const char *str, size_t len)
+{
+    (void)opaque;
+    gui_add_tty_entry(str, len);
+}
+
+static void
+main_audio(void *opaque, int16_t *samples, size_t amount)
+{
+    (void)opaque;
+    window_audio_write_samples(samples, amount);
+}
+
 int
 main(int argc, char **argv)
 {
-    if (argc != 2) {
-        printf("usage: psx_emu bios\n");
+    const struct psx_host host = { main_tty, main_audio, NULL };
+    struct psx_machine *psx;
+    const char *bios_path;
+    enum psx_cpu cpu;
+
+    bios_path = NULL;
+    cpu = PSX_CPU_INTERPRETER;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--cpu=interp")) {
+            cpu = PSX_CPU_INTERPRETER;
+        } else if (!strcmp(argv[i], "--cpu=jit")) {
+            cpu = PSX_CPU_JIT;
+        } else if (!bios_path && argv[i][0] != '-') {
+            bios_path = argv[i];
+        } else {
+            bios_path = NULL;
+            break;
+        }
+    }
+
+    if (!bios_path) {
+        printf("usage: psx_emu [--cpu=interp|jit] bios\n");
         return 1;
     }
 
+    if (cpu == PSX_CPU_JIT && !r3000_jit_supported()) {
+        printf("main: warning: jit unsupported on this host, using interpreter\n");
+        cpu = PSX_CPU_INTERPRETER;
+    }
+
     if (!window_setup()) {
         return 1;
     }
 
-    psx_setup(argv[1]);
+    psx = psx_create(bios_path);
+    psx_set_host(psx, &host);
+    gpu_use_host_cpus(psx);
+    gui_attach(psx);
+
+    if (!psx_set_cpu(psx, cpu)) {
+        printf("main: warning: unable to start jit, using interpreter\n");
+        psx_set_cpu(psx, PSX_CPU_INTERPRETER);
+    }
 
     window_audio_pause(false);
 
     for (;;) {
-        if (gui_should_continue()) {
-            psx_run_frame();
+        if (gui_should_rewind()) {
+            rewind_step(psx);
+        } else if (gui_should_continue()) {
+            psx_run_frame(psx);
+            rewind_push(psx);
+            gui_run_ahead();
         }
 
         if (window_update() || gui_should_quit()) {
@@ -34,7 +92,7 @@ main(int argc, char **argv)
 
     printf("main: info: shutting down\n");
 
-    psx_shutdown();
+    psx_destroy(psx);
     window_shutdown();
 
     return 0;
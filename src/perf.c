@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "perf.h"
+#include "psx_machine.h"
+#include "scheduler.h"
+
+static const char *PERF_SECTION_NAMES[PERF_NR_SECTIONS] = {
+    "cpu", "spu", "dma", "gpu", "gui"
+};
+
+static const char *PERF_REGION_NAMES[PERF_NR_REGIONS] = {
+    "ram", "bios", "io", "other"
+};
+
+/* Monotonic host time in nanoseconds */
+uint64_t
+perf_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return counter.QuadPart / frequency.QuadPart * 1000000000ull +
+           counter.QuadPart % frequency.QuadPart * 1000000000ull /
+           frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+const char *
+perf_section_name(enum perf_section section)
+{
+    assert(section < PERF_NR_SECTIONS);
+
+    return PERF_SECTION_NAMES[section];
+}
+
+const char *
+perf_region_name(enum perf_region region)
+{
+    assert(region < PERF_NR_REGIONS);
+
+    return PERF_REGION_NAMES[region];
+}
+
+#ifdef PSX_PERF
+
+void
+perf_frame_begin(struct psx_machine *psx)
+{
+    /* GUI time between frames is kept and charged to this frame */
+    psx->perf.frame_start = perf_now();
+    psx->perf.frame_timestamp = scheduler_now(psx);
+}
+
+void
+perf_frame_end(struct psx_machine *psx)
+{
+    struct perf_frame *frame = &psx->perf.current;
+    uint64_t other;
+
+    frame->frame_ns = perf_now() - psx->perf.frame_start;
+    frame->cycles = scheduler_now(psx) - psx->perf.frame_timestamp;
+
+    /* Whatever is not attributed to a device was spent running the CPU */
+    other = frame->section_ns[PERF_SECTION_SPU] +
+            frame->section_ns[PERF_SECTION_DMA] +
+            frame->section_ns[PERF_SECTION_GPU];
+    frame->section_ns[PERF_SECTION_CPU] =
+        frame->frame_ns > other ? frame->frame_ns - other : 0;
+
+    psx->perf.last = *frame;
+    psx->perf.frames++;
+
+    memset(frame, 0, sizeof(*frame));
+}
+
+void
+perf_section_begin(struct psx_machine *psx, enum perf_section section)
+{
+    assert(section < PERF_NR_SECTIONS);
+
+    psx->perf.section_start[section] = perf_now();
+}
+
+void
+perf_section_end(struct psx_machine *psx, enum perf_section section)
+{
+    assert(section < PERF_NR_SECTIONS);
+
+    psx->perf.current.section_ns[section] +=
+        perf_now() - psx->perf.section_start[section];
+}
+
+const struct perf_frame *
+perf_last_frame(struct psx_machine *psx)
+{
+    return &psx->perf.last;
+}
+
+uint64_t
+perf_frames(struct psx_machine *psx)
+{
+    return psx->perf.frames;
+}
+
+void
+perf_csv_header(FILE *fp)
+{
+    fprintf(fp, "frame,instructions,cycles,frame_ns");
+
+    for (size_t i = 0; i < PERF_NR_SECTIONS; ++i) {
+        fprintf(fp, ",%s_ns", PERF_SECTION_NAMES[i]);
+    }
+
+    for (size_t i = 0; i < PERF_NR_REGIONS; ++i) {
+        fprintf(fp, ",bus_%s", PERF_REGION_NAMES[i]);
+    }
+
+    fprintf(fp, "\n");
+}
+
+void
+perf_csv_write(struct psx_machine *psx, FILE *fp)
+{
+    const struct perf_frame *frame = &psx->perf.last;
+
+    fprintf(fp, "%llu,%llu,%llu,%llu", (unsigned long long)psx->perf.frames,
+            (unsigned long long)frame->instructions,
+            (unsigned long long)frame->cycles,
+            (unsigned long long)frame->frame_ns);
+
+    for (size_t i = 0; i < PERF_NR_SECTIONS; ++i) {
+        fprintf(fp, ",%llu", (unsigned long long)frame->section_ns[i]);
+    }
+
+    for (size_t i = 0; i < PERF_NR_REGIONS; ++i) {
+        fprintf(fp, ",%llu", (unsigned long long)frame->bus[i]);
+    }
+
+    fprintf(fp, "\n");
+}
+
+#endif /* PSX_PERF */
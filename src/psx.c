@@ -8,16 +8,27 @@
 
 #include "dma.h"
 #include "exp2.h"
+#include "gpu.h"
 #include "macros.h"
+#include "perf.h"
 #include "psx.h"
+#include "psexe.h"
+#include "psx_machine.h"
 #include "r3000.h"
+#include "r3000_cache.h"
+#include "r3000_idle.h"
 #include "r3000_interpreter.h"
+#include "r3000_jit.h"
+#include "replay.h"
+#include "rewind.h"
+#include "scheduler.h"
 #include "spu.h"
+#include "state.h"
+#include "timer.h"
 #include "util.h"
 
 #define PSX_FORCE_TTY
 
-#define PSX_REFRESH_RATE        60
 
 #define PSX_EXP1_SIZE           MEGABYTES(8)
 #define PSX_MEMCTRL_SIZE        0x24
@@ -27,9 +38,6 @@
 #define PSX_SPU_SIZE            KILOBYTES(1)
 #define PSX_EXP2_SIZE           KILOBYTES(8)
 
-#define PSX_RAM_START           0x00000000
-#define PSX_RAM_END             PSX_RAM_START + PSX_RAM_SIZE
-
 #define PSX_EXP1_START          0x1f000000
 #define PSX_EXP1_END            PSX_EXP1_START + PSX_EXP1_SIZE
 
@@ -49,7 +57,6 @@
 
 #define PSX_GPUREAD             0x1f801810
 #define PSX_GP0                 0x1f801810
-#define PSX_GPUSTAT             0x1f801814
 #define PSX_GP1                 0x1f801814
 
 #define PSX_SPU_START           0x1f801c00
@@ -58,25 +65,57 @@
 #define PSX_EXP2_START          0x1f802000
 #define PSX_EXP2_END            PSX_EXP2_START + PSX_EXP2_SIZE
 
-#define PSX_BIOS_START          0x1fc00000
-#define PSX_BIOS_END            PSX_BIOS_START + PSX_BIOS_SIZE
-
 #define PSX_CACHECTRL           0xfffe0130
 
-struct psx {
-    void *bios;
-    void *ram;
+/* I/O ports and EXP2, dispatched by word through PSX_IO_DEVICES */
+#define PSX_IO_START            PSX_MEMCTRL_START
+#define PSX_IO_SIZE             (PSX_EXP2_END - PSX_IO_START)
+
+#define PSX_IO_RANGE(start, end)                                             \
+    [((start) - PSX_IO_START) >> 2 ... ((end) - 1 - PSX_IO_START) >> 2]
+#define PSX_IO_WORD(address)    [((address) - PSX_IO_START) >> 2]
+
+#define PSX_NR_SEGMENTS         3
 
-    struct {
-        uint32_t status;
-        uint32_t mask;
-    } interrupt;
+#define PSX_SHELL_ENTRY         0x80030000
+#define PSX_SHELL_TIMEOUT       (R3000_FREQ * 10)
+
+/* Bases of KUSEG, KSEG0 and KSEG1, which all mirror physical memory */
+static const uint32_t PSX_SEGMENTS[PSX_NR_SEGMENTS] = {
+    0x00000000, 0x80000000, 0xa0000000
+};
+
+enum psx_io {
+    PSX_IO_NONE,
+    PSX_IO_MEMCTRL,
+    PSX_IO_MEMCTRL2,
+    PSX_IO_INTERRUPT_STATUS,
+    PSX_IO_INTERRUPT_MASK,
+    PSX_IO_DMA,
+    PSX_IO_TIMER,
+    PSX_IO_CDROM,
+    PSX_IO_GP0,                 /* GPUREAD when read */
+    PSX_IO_GP1,                 /* GPUSTAT when read */
+    PSX_IO_SPU,
+    PSX_IO_EXP2
 };
 
-static struct psx psx;
+static const uint8_t PSX_IO_DEVICES[PSX_IO_SIZE >> 2] = {
+    PSX_IO_RANGE(PSX_MEMCTRL_START, PSX_MEMCTRL_END) = PSX_IO_MEMCTRL,
+    PSX_IO_WORD(PSX_MEMCTRL2) = PSX_IO_MEMCTRL2,
+    PSX_IO_WORD(PSX_INTERRUPT_STATUS) = PSX_IO_INTERRUPT_STATUS,
+    PSX_IO_WORD(PSX_INTERRUPT_MASK) = PSX_IO_INTERRUPT_MASK,
+    PSX_IO_RANGE(PSX_DMA_START, PSX_DMA_END) = PSX_IO_DMA,
+    PSX_IO_RANGE(PSX_TIMER_START, PSX_TIMER_END) = PSX_IO_TIMER,
+    PSX_IO_RANGE(PSX_CDROM_START, PSX_CDROM_END) = PSX_IO_CDROM,
+    PSX_IO_WORD(PSX_GP0) = PSX_IO_GP0,
+    PSX_IO_WORD(PSX_GP1) = PSX_IO_GP1,
+    PSX_IO_RANGE(PSX_SPU_START, PSX_SPU_END) = PSX_IO_SPU,
+    PSX_IO_RANGE(PSX_EXP2_START, PSX_EXP2_END) = PSX_IO_EXP2
+};
 
 static void
-psx_load_bios(const char *bios_path)
+psx_load_bios(struct psx_machine *psx, const char *bios_path)
 {
     FILE *fp;
     size_t read_size;
@@ -88,7 +127,7 @@ psx_load_bios(const char *bios_path)
         PANIC;
     }
 
-    read_size = fread(psx.bios, 1, PSX_BIOS_SIZE, fp);
+    read_size = fread(psx->bios, 1, PSX_BIOS_SIZE, fp);
 
     if (read_size != PSX_BIOS_SIZE) {
         printf("psx: error: unexpected bios size %I64u bytes\n", read_size);
@@ -98,329 +137,803 @@ psx_load_bios(const char *bios_path)
     fclose(fp);
 }
 
+static bool
+psx_exe_range_valid(uint32_t address, uint32_t size)
+{
+    address = r3000_translate_virtaddr(address);
+
+    return address < PSX_RAM_END && size <= PSX_RAM_END - address;
+}
+
+static void
+psx_map_write_page(struct psx_machine *psx, uint32_t address, uint8_t *host)
+{
+    for (size_t i = 0; i < PSX_NR_SEGMENTS; ++i) {
+        psx->pages.write[(PSX_SEGMENTS[i] + address) >> PSX_PAGE_SHIFT] = host;
+    }
+}
+
 static void
-psx_reset_memory(void)
+psx_map_mmio(struct psx_machine *psx, uint32_t start, uint32_t size,
+             enum psx_mmio mmio)
 {
-    assert(psx.ram);
-    memset(psx.ram, 0, PSX_RAM_SIZE);
+    uint32_t page;
 
-    psx.interrupt.status = 0;
-    psx.interrupt.mask = 0;
+    for (uint32_t offset = 0; offset < size; offset += PSX_PAGE_SIZE) {
+        for (size_t i = 0; i < PSX_NR_SEGMENTS; ++i) {
+            page = (PSX_SEGMENTS[i] + start + offset) >> PSX_PAGE_SHIFT;
+            psx->pages.mmio[page] = mmio;
+        }
+    }
 }
 
-void
-psx_setup(const char *bios_path)
+static void
+psx_map_pages(struct psx_machine *psx, uint32_t start, uint32_t size,
+              uint8_t *host, bool writable)
+{
+    uint32_t address, page;
+
+    assert(!(start & PSX_PAGE_MASK));
+    assert(!(size & PSX_PAGE_MASK));
+
+    for (uint32_t offset = 0; offset < size; offset += PSX_PAGE_SIZE) {
+        address = start + offset;
+
+        for (size_t i = 0; i < PSX_NR_SEGMENTS; ++i) {
+            page = (PSX_SEGMENTS[i] + address) >> PSX_PAGE_SHIFT;
+            psx->pages.read[page] = host + offset;
+        }
+
+        psx_map_write_page(psx, address, writable ? host + offset : NULL);
+    }
+
+    psx_map_mmio(psx, start, size, writable ? PSX_MMIO_RAM : PSX_MMIO_BIOS);
+}
+
+static void
+psx_reset_memory(struct psx_machine *psx)
+{
+    memset(psx->ram, 0, PSX_RAM_SIZE);
+    rewind_mark_range(psx, REWIND_RAM, 0, PSX_RAM_SIZE);
+
+    r3000_cache_invalidate_range(psx, PSX_RAM_START, PSX_RAM_SIZE);
+
+    psx->interrupt.status = 0;
+    psx->interrupt.mask = 0;
+}
+
+static void
+psx_vblank(struct psx_machine *psx, uint64_t timestamp)
+{
+    gpu_vblank(psx);
+    timer_vblank(psx);
+
+    psx_assert_irq(psx, PSX_INTERRUPT_VBLANK);
+    psx->frame_done = true;
+
+    scheduler_schedule(psx, SCHEDULER_EVENT_VBLANK,
+                       timestamp + PSX_CYCLES_PER_FRAME, psx_vblank);
+}
+
+struct psx_machine *
+psx_create(const char *bios_path)
 {
-    dma_setup();
-    exp2_setup();
-    r3000_setup();
-    spu_setup();
+    struct psx_machine *psx;
+
+    psx = calloc(1, sizeof(*psx));
+
+    if (!psx) {
+        printf("psx: error: unable to allocate machine\n");
+        PANIC;
+    }
+
+    scheduler_setup(psx);
+    dma_setup(psx);
+    exp2_setup(psx);
+    gpu_setup(psx);
+    gte_setup(psx);
+    r3000_setup(psx);
+    r3000_cache_setup(psx);
+    r3000_idle_setup(psx);
+    spu_setup(psx);
+    timer_setup(psx);
 
-    psx.bios = malloc(PSX_BIOS_SIZE);
-    psx.ram = malloc(PSX_RAM_SIZE);
+    psx->cpu = PSX_CPU_INTERPRETER;
 
-    assert(psx.bios);
-    assert(psx.ram);
+    scheduler_register(psx, SCHEDULER_EVENT_VBLANK, psx_vblank);
+    scheduler_schedule(psx, SCHEDULER_EVENT_VBLANK,
+                       scheduler_now(psx) + PSX_CYCLES_PER_FRAME, psx_vblank);
 
-    memset(psx.bios, 0, PSX_BIOS_SIZE);
+    psx_map_pages(psx, PSX_RAM_START, PSX_RAM_SIZE, psx->ram, true);
+    psx_map_pages(psx, PSX_BIOS_START, PSX_BIOS_SIZE, psx->bios, false);
 
-    psx_reset_memory();
-    psx_load_bios(bios_path);
+    psx_map_mmio(psx, PSX_EXP1_START, PSX_EXP1_SIZE, PSX_MMIO_EXP1);
+    psx_map_mmio(psx, PSX_IO_START & ~PSX_PAGE_MASK, PSX_PAGE_SIZE,
+                 PSX_MMIO_IO);
+    psx->pages.mmio[PSX_CACHECTRL >> PSX_PAGE_SHIFT] = PSX_MMIO_CACHECTRL;
+
+    psx_reset_memory(psx);
+    psx_load_bios(psx, bios_path);
 
 #ifdef PSX_FORCE_TTY /* Patch BIOS to enable TTY output */
-    ((uint32_t *)psx.bios)[0x1bc3] = 0x24010001; /* ADDIU $at, $zero, 0x1 */
-    ((uint32_t *)psx.bios)[0x1bc5] = 0xaf81a9c0; /* SW $at, -0x5640($gp) */
+    ((uint32_t *)psx->bios)[0x1bc3] = 0x24010001; /* ADDIU $at, $zero, 0x1 */
+    ((uint32_t *)psx->bios)[0x1bc5] = 0xaf81a9c0; /* SW $at, -0x5640($gp) */
 #endif
+
+    return psx;
 }
 
 void
-psx_shutdown(void)
+psx_destroy(struct psx_machine *psx)
 {
-    assert(psx.bios);
-    assert(psx.ram);
+    assert(psx);
 
-    free(psx.bios);
-    free(psx.ram);
+    r3000_idle_dump_stats(psx);
 
-    spu_shutdown();
+    replay_stop(psx);
+
+    gpu_shutdown(psx);
+    r3000_cache_shutdown(psx);
+    r3000_jit_shutdown(psx);
+    rewind_shutdown(psx);
+
+    free(psx);
 }
 
 void
-psx_soft_reset(void)
+psx_set_host(struct psx_machine *psx, const struct psx_host *host)
 {
-    dma_soft_reset();
-    r3000_soft_reset();
+    psx->host = *host;
 }
 
 void
-psx_hard_reset(void)
+psx_soft_reset(struct psx_machine *psx)
 {
-    dma_hard_reset();
-    r3000_hard_reset();
-    spu_hard_reset();
+    replay_log(psx, REPLAY_EVENT_SOFT_RESET, 0, 0, NULL, 0);
 
-    psx_reset_memory();
+    dma_soft_reset(psx);
+    r3000_soft_reset(psx);
 }
 
 void
-psx_step(void)
+psx_hard_reset(struct psx_machine *psx)
 {
-    r3000_interpreter_execute();
-    spu_step();
-    spu_step();
+    replay_log(psx, REPLAY_EVENT_HARD_RESET, 0, 0, NULL, 0);
+
+    dma_hard_reset(psx);
+    gpu_hard_reset(psx);
+    gte_hard_reset(psx);
+    r3000_hard_reset(psx);
+    spu_hard_reset(psx);
+    timer_hard_reset(psx);
+
+    psx_reset_memory(psx);
 }
 
-void
-psx_run_frame(void)
+bool
+psx_set_cpu(struct psx_machine *psx, enum psx_cpu cpu)
 {
-    for (int i = 0; i < R3000_IPS / PSX_REFRESH_RATE; ++i) {
-        psx_step();
+    if (cpu == PSX_CPU_JIT && !r3000_jit_setup(psx)) {
+        return false;
     }
 
-    psx_assert_irq(PSX_INTERRUPT_VBLANK);
+    /* Both backends share the block cache */
+    r3000_cache_flush(psx);
+
+    psx->cpu = cpu;
+    return true;
 }
 
-void
-psx_assert_irq(enum psx_interrupt i)
+static void
+psx_execute_step(struct psx_machine *psx)
 {
-    psx.interrupt.status |= i;
-    r3000_assert_irq(psx.interrupt.status & psx.interrupt.mask);
+    r3000_interpreter_execute(psx);
+    PERF_INSTRUCTIONS(psx, 1);
+
+    scheduler_advance(psx, R3000_INSTRUCTION_CYC);
+    scheduler_run(psx);
 }
 
-uint8_t
-psx_read_memory8(uint32_t address)
+void
+psx_step(struct psx_machine *psx)
 {
-    uint32_t offset;
+    replay_log_step(psx);
+    psx_execute_step(psx);
+}
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint8_t);
-        return ((uint8_t *)psx.ram)[offset];
+static void
+psx_execute_frame(struct psx_machine *psx)
+{
+    unsigned int executed;
+
+    psx->frame_done = false;
+
+    while (!psx->frame_done) {
+        /* Run the CPU freely until the next device event is due */
+        while (scheduler_now(psx) < scheduler_next_deadline(psx)) {
+            switch (psx->cpu) {
+            case PSX_CPU_JIT:
+                executed = r3000_jit_execute(psx);
+                break;
+            default:
+                executed = r3000_interpreter_execute_block(psx);
+                break;
+            }
+
+            scheduler_advance(psx, executed * R3000_INSTRUCTION_CYC);
+            PERF_INSTRUCTIONS(psx, executed);
+        }
+
+        scheduler_run(psx);
     }
+}
 
-    if (between(address, PSX_EXP1_START, PSX_EXP1_END)) {
-        printf("psx: info: read from exp1 register at 0x%08x\n", address);
-        return 0;
-    }
+void
+psx_run_frame(struct psx_machine *psx)
+{
+    replay_log_frame(psx);
 
-    if (between(address, PSX_CDROM_START, PSX_CDROM_END)) {
-        printf("psx: info: read from cdrom register at 0x%08x\n", address);
-        return 0;
+    PERF_FRAME_BEGIN(psx);
+    psx_execute_frame(psx);
+    PERF_FRAME_END(psx);
+}
+
+/*
+ * Runs frames past the current one with the host's audio and TTY muted,
+ * copies out the VRAM the last of them leaves for display, then returns to
+ * the current frame through the rewind keyframe. Call after rewind_push, so
+ * the keyframe doesn't skip a frame of history. The speculative frames are
+ * left out of the perf counters, which only see frames that are kept.
+ */
+bool
+psx_run_ahead(struct psx_machine *psx, unsigned int frames, uint16_t *vram)
+{
+    struct perf_frame perf;
+    struct psx_host host;
+
+    assert(frames && frames <= PSX_MAX_RUN_AHEAD);
+
+    if (!rewind_capture(psx)) {
+        return false;
     }
 
-    if (between(address, PSX_EXP2_START, PSX_EXP2_END)) {
-        return exp2_read8(address);
+    host = psx->host;
+    psx->host.tty = NULL;
+    psx->host.audio = NULL;
+    PERF_FRAME_SAVE(psx, perf);
+
+    for (unsigned int i = 0; i < frames; ++i) {
+        psx_execute_frame(psx);
     }
 
-    if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
-        offset = (address - PSX_BIOS_START) / sizeof(uint8_t);
-        return ((uint8_t *)psx.bios)[offset];
+    memcpy(vram, gpu_debug_vram(psx), sizeof(psx->gpu.vram));
+
+    psx->host = host;
+    PERF_FRAME_RESTORE(psx, perf);
+    rewind_restore(psx);
+
+    return true;
+}
+
+static const char *PSX_STATE_SECTIONS[STATE_NR_SECTIONS] = {
+    "r3000", "scheduler", "psx", "ram", "bios", "dma", "exp2", "gpu", "gte",
+    "spu", "timer"
+};
+
+static void
+psx_save_sections(struct psx_machine *psx, struct state *state)
+{
+    r3000_save_state(psx, state);
+    scheduler_save_state(psx, state);
+
+    state_begin_section(state, STATE_SECTION_PSX);
+    state_write(state, &psx->interrupt, sizeof(psx->interrupt));
+    state_end_section(state);
+
+    if (!(state->flags & STATE_NO_MEMORY)) {
+        state_begin_section(state, STATE_SECTION_RAM);
+        state_write(state, psx->ram, PSX_RAM_SIZE);
+        state_end_section(state);
+
+        /* Includes any patches applied at load */
+        state_begin_section(state, STATE_SECTION_BIOS);
+        state_write(state, psx->bios, PSX_BIOS_SIZE);
+        state_end_section(state);
     }
 
-    printf("psx: error: unknown read address 0x%08x\n", address);
-    PANIC;
+    dma_save_state(psx, state);
+    exp2_save_state(psx, state);
+    gpu_save_state(psx, state);
+    gte_save_state(psx, state);
+    spu_save_state(psx, state);
+    timer_save_state(psx, state);
+}
 
-    return 0;
+size_t
+psx_state_size(struct psx_machine *psx, uint32_t flags)
+{
+    struct state state;
+
+    state_begin_write(&state, NULL, 0, flags);
+    psx_save_sections(psx, &state);
+
+    return state_end_write(&state);
 }
 
-uint16_t
-psx_read_memory16(uint32_t address)
+/* Returns the size of the state, or 0 if the buffer is too small */
+size_t
+psx_save_state(struct psx_machine *psx, void *buffer, size_t size,
+               uint32_t flags)
 {
-    uint32_t offset;
+    struct state state;
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint16_t);
-        return ((uint16_t *)psx.ram)[offset];
+    state_begin_write(&state, buffer, size, flags);
+    psx_save_sections(psx, &state);
+
+    return state_end_write(&state);
+}
+
+bool
+psx_load_state(struct psx_machine *psx, const void *buffer, size_t size)
+{
+    struct state state, layout;
+
+    if (!state_begin_read(&state, buffer, size)) {
+        return false;
     }
 
-    if (address == PSX_INTERRUPT_STATUS) {
-        return psx.interrupt.status;
+    /* Check every section against this build before touching anything */
+    state_begin_write(&layout, NULL, 0, state.flags);
+    psx_save_sections(psx, &layout);
+
+    for (unsigned int i = 0; i < STATE_NR_SECTIONS; ++i) {
+        if (state.sizes[i] != layout.sizes[i]) {
+            printf("psx: error: state section %s is %u bytes, expected %u\n",
+                   PSX_STATE_SECTIONS[i], state.sizes[i], layout.sizes[i]);
+            return false;
+        }
     }
 
-    if (address == PSX_INTERRUPT_MASK) {
-        return psx.interrupt.mask;
+    r3000_load_state(psx, &state);
+    scheduler_load_state(psx, &state);
+
+    if (state_find_section(&state, STATE_SECTION_PSX)) {
+        state_read(&state, &psx->interrupt, sizeof(psx->interrupt));
     }
 
-    if (between(address, PSX_SPU_START, PSX_SPU_END)) {
-        return spu_read16(address);
+    if (!(state.flags & STATE_NO_MEMORY)) {
+        if (state_find_section(&state, STATE_SECTION_RAM)) {
+            state_read(&state, psx->ram, PSX_RAM_SIZE);
+            rewind_mark_range(psx, REWIND_RAM, 0, PSX_RAM_SIZE);
+        }
+
+        if (state_find_section(&state, STATE_SECTION_BIOS)) {
+            state_read(&state, psx->bios, PSX_BIOS_SIZE);
+        }
     }
 
-    printf("psx: error: unknown read address 0x%08x\n", address);
-    PANIC;
+    dma_load_state(psx, &state);
+    exp2_load_state(psx, &state);
+    gpu_load_state(psx, &state);
+    gte_load_state(psx, &state);
+    spu_load_state(psx, &state);
+    timer_load_state(psx, &state);
 
-    return 0;
+    assert(!state.error);
+
+    /* Translated code may no longer match memory, states without it leave
+     * the caller to invalidate what it restores */
+    if (!(state.flags & STATE_NO_MEMORY)) {
+        r3000_cache_flush(psx);
+    }
+    psx->frame_done = false;
+
+    return true;
 }
 
-uint32_t
-psx_read_memory32(uint32_t address)
+/* Boots the BIOS far enough to take a PS-EXE image, then starts it */
+bool
+psx_load_exe_data(struct psx_machine *psx, const void *data, size_t size)
 {
-    uint32_t offset;
+    struct psexe header;
+    uint32_t text, bss, sp;
+    uint64_t deadline;
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint32_t);
-        return ((uint32_t *)psx.ram)[offset];
+    if (size < PSEXE_SIZE) {
+        printf("psx: error: exe is not a ps-exe\n");
+        return false;
     }
 
-    if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
-        offset = (address - PSX_BIOS_START) / sizeof(uint32_t);
-        return ((uint32_t *)psx.bios)[offset];
+    memcpy(&header, data, PSEXE_SIZE);
+
+    if (memcmp(header.id, "PS-X EXE", sizeof(header.id))) {
+        printf("psx: error: exe is not a ps-exe\n");
+        return false;
     }
 
-    if (address == PSX_INTERRUPT_STATUS) {
-        return psx.interrupt.status;
+    if (!psx_exe_range_valid(header.text_address, header.text_size) ||
+        !psx_exe_range_valid(header.bss_address, header.bss_size)) {
+        printf("psx: error: exe does not fit in ram\n");
+        return false;
     }
 
-    if (address == PSX_INTERRUPT_MASK) {
-        return psx.interrupt.mask;
+    if (size - PSEXE_SIZE < header.text_size) {
+        printf("psx: error: exe is truncated\n");
+        return false;
     }
 
-    if (between(address, PSX_DMA_START, PSX_DMA_END)) {
-        return dma_read32(address);
+    replay_log(psx, REPLAY_EVENT_EXE, 0, 0, data, size);
+
+    /* Let the BIOS initialise the kernel before it would start the shell */
+    deadline = scheduler_now(psx) + PSX_SHELL_TIMEOUT;
+
+    while (psx->r3000.pc != PSX_SHELL_ENTRY) {
+        if (scheduler_now(psx) >= deadline) {
+            printf("psx: error: bios did not reach the shell\n");
+            return false;
+        }
+
+        psx_execute_step(psx);
     }
 
-    if (between(address, PSX_TIMER_START, PSX_TIMER_END)) {
-        printf("psx: info: read from timer register at 0x%08x\n", address);
-        return 0;
+    text = r3000_translate_virtaddr(header.text_address);
+    bss = r3000_translate_virtaddr(header.bss_address);
+
+    memcpy(psx->ram + text, (const uint8_t *)data + PSEXE_SIZE,
+           header.text_size);
+    memset(psx->ram + bss, 0, header.bss_size);
+
+    r3000_cache_invalidate_range(psx, text, header.text_size);
+    r3000_cache_invalidate_range(psx, bss, header.bss_size);
+
+    rewind_mark_range(psx, REWIND_RAM, text, header.text_size);
+    rewind_mark_range(psx, REWIND_RAM, bss, header.bss_size);
+
+    r3000_write_reg(psx, 28, header.gp); /* $gp */
+
+    if (header.stack_address) {
+        sp = header.stack_address + header.stack_size;
+        r3000_write_reg(psx, 29, sp); /* $sp */
+        r3000_write_reg(psx, 30, sp); /* $fp */
     }
 
-    if (address == PSX_GPUREAD) {
-        printf("psx: info: read from gpuread\n");
-        return 0;
+    r3000_set_pc(psx, header.pc);
+    return true;
+}
+
+bool
+psx_load_exe(struct psx_machine *psx, const char *exe_path)
+{
+    uint8_t *data;
+    long size;
+    bool ok;
+    FILE *fp;
+
+    fp = fopen(exe_path, "rb");
+
+    if (!fp) {
+        perror("psx: error: unable to load exe");
+        return false;
     }
 
-    if (address == PSX_GPUSTAT) {
-        //printf("psx: info: read from gpustat\n");
-        return 0x1c000000;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    data = size > 0 ? malloc(size) : NULL;
+
+    if (!data || fread(data, 1, size, fp) != (size_t)size) {
+        printf("psx: error: unable to read %s\n", exe_path);
+        free(data);
+        fclose(fp);
+        return false;
     }
 
-    printf("psx: error: unknown read address 0x%08x\n", address);
-    PANIC;
+    fclose(fp);
 
-    return 0;
+    ok = psx_load_exe_data(psx, data, size);
+    free(data);
+
+    return ok;
 }
 
 void
-psx_write_memory8(uint32_t address, uint8_t value)
+psx_assert_irq(struct psx_machine *psx, enum psx_interrupt i)
 {
-    uint32_t offset;
+    psx->interrupt.status |= i;
+    r3000_assert_irq(psx, psx->interrupt.status & psx->interrupt.mask);
+}
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint8_t);
-        ((uint8_t *)psx.ram)[offset] = value;
-        return;
+static enum psx_io
+psx_io_device(uint32_t address)
+{
+    if (address - PSX_IO_START >= PSX_IO_SIZE) {
+        return PSX_IO_NONE;
     }
 
-    if (between(address, PSX_CDROM_START, PSX_CDROM_END)) {
-        printf("psx: info: write to cdrom register at 0x%08x\n", address);
-        return;
-    }
+    return PSX_IO_DEVICES[(address - PSX_IO_START) >> 2];
+}
 
-    if (between(address, PSX_EXP2_START, PSX_EXP2_END)) {
-        exp2_write8(address, value);
-        return;
+/* Stores into a protected page only reach the block cache if they hit code */
+static void
+psx_write_ram(struct psx_machine *psx, uint32_t address)
+{
+    uint32_t page, bit;
+
+    page = address >> PSX_PAGE_SHIFT;
+    bit = (address & PSX_PAGE_MASK) >> PSX_CODE_PAGE_SHIFT;
+
+    if (psx->pages.code[page] & 1 << bit) {
+        r3000_cache_invalidate(psx, address);
     }
 
-    printf("psx: error: unknown write address 0x%08x\n", address);
-    PANIC;
+    REWIND_MARK(psx, REWIND_RAM, address);
 }
 
-void
-psx_write_memory16(uint32_t address, uint16_t value)
+uint8_t
+psx_read_memory8(struct psx_machine *psx, uint32_t address)
 {
-    uint32_t offset;
+    uint8_t *page;
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint16_t);
-        ((uint16_t *)psx.ram)[offset] = value;
-        return;
-    }
+    /* Physical addresses are identity mapped through KUSEG */
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
 
-    if (address == PSX_INTERRUPT_STATUS) {
-        psx.interrupt.status &= value;
-        r3000_assert_irq(psx.interrupt.status & psx.interrupt.mask);
-        return;
+    if (page) {
+        return page[address & PSX_PAGE_MASK];
     }
 
-    if (address == PSX_INTERRUPT_MASK) {
-        psx.interrupt.mask |= value;
-        r3000_assert_irq(psx.interrupt.status & psx.interrupt.mask);
-        return;
+    switch (psx->pages.mmio[address >> PSX_PAGE_SHIFT]) {
+    case PSX_MMIO_EXP1:
+        printf("psx: info: read from exp1 register at 0x%08x\n", address);
+        return 0;
+    case PSX_MMIO_IO:
+        switch (psx_io_device(address)) {
+        case PSX_IO_CDROM:
+            printf("psx: info: read from cdrom register at 0x%08x\n",
+                   address);
+            return 0;
+        case PSX_IO_EXP2:
+            return exp2_read8(address);
+        default:
+            break;
+        }
+
+        break;
+    default:
+        break;
     }
 
-    if (between(address, PSX_TIMER_START, PSX_TIMER_END)) {
-        printf("psx: info: write to timer register at 0x%08x\n", address);
-        return;
+    printf("psx: error: unknown read address 0x%08x\n", address);
+    PANIC;
+
+    return 0;
+}
+
+uint16_t
+psx_read_memory16(struct psx_machine *psx, uint32_t address)
+{
+    uint8_t *page;
+
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        return *(uint16_t *)(page + (address & PSX_PAGE_MASK));
     }
 
-    if (between(address, PSX_SPU_START, PSX_SPU_END)) {
-        spu_write16(address, value);
-        return;
+    if (psx->pages.mmio[address >> PSX_PAGE_SHIFT] == PSX_MMIO_IO) {
+        switch (psx_io_device(address)) {
+        case PSX_IO_INTERRUPT_STATUS:
+            return psx->interrupt.status;
+        case PSX_IO_INTERRUPT_MASK:
+            return psx->interrupt.mask;
+        case PSX_IO_TIMER:
+            return timer_read(psx, address);
+        case PSX_IO_SPU:
+            return spu_read16(psx, address);
+        default:
+            break;
+        }
     }
 
-    printf("psx: error: unknown write address 0x%08x\n", address);
+    printf("psx: error: unknown read address 0x%08x\n", address);
     PANIC;
+
+    return 0;
 }
 
-void
-psx_write_memory32(uint32_t address, uint32_t value)
+uint32_t
+psx_read_memory32(struct psx_machine *psx, uint32_t address)
 {
-    uint32_t offset;
+    uint8_t *page;
 
-    if (between(address, PSX_RAM_START, PSX_RAM_END)) {
-        offset = (address - PSX_RAM_START) / sizeof(uint32_t);
-        ((uint32_t *)psx.ram)[offset] = value;
-        return;
-    }
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
 
-    if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
-        printf("psx: error: write to bios at 0x%08x\n", address);
-        PANIC;
+    if (page) {
+        return *(uint32_t *)(page + (address & PSX_PAGE_MASK));
     }
 
-    if (between(address, PSX_MEMCTRL_START, PSX_MEMCTRL_END)) {
-        printf("psx: info: write to memctrl register at 0x%08x\n", address);
-        return;
+    if (psx->pages.mmio[address >> PSX_PAGE_SHIFT] == PSX_MMIO_IO) {
+        switch (psx_io_device(address)) {
+        case PSX_IO_INTERRUPT_STATUS:
+            return psx->interrupt.status;
+        case PSX_IO_INTERRUPT_MASK:
+            return psx->interrupt.mask;
+        case PSX_IO_DMA:
+            return dma_read32(psx, address);
+        case PSX_IO_TIMER:
+            return timer_read(psx, address);
+        case PSX_IO_GP0:
+            return gpu_read(psx);
+        case PSX_IO_GP1:
+            return gpu_status(psx);
+        default:
+            break;
+        }
     }
 
-    if (address == PSX_MEMCTRL2) {
-        printf("psx: info: write to ram_size register\n");
-        return;
-    }
+    printf("psx: error: unknown read address 0x%08x\n", address);
+    PANIC;
 
-    if (address == PSX_INTERRUPT_STATUS) {
-        psx.interrupt.status &= value;
-        r3000_assert_irq(psx.interrupt.status & psx.interrupt.mask);
-        return;
-    }
+    return 0;
+}
 
-    if (address == PSX_INTERRUPT_MASK) {
-        psx.interrupt.mask = value;
-        r3000_assert_irq(psx.interrupt.status & psx.interrupt.mask);
+void
+psx_write_memory8(struct psx_machine *psx, uint32_t address, uint8_t value)
+{
+    uint8_t *page;
+
+    /* Pages holding translated code are left to the slow path below */
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        page[address & PSX_PAGE_MASK] = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
         return;
     }
 
-    if (between(address, PSX_DMA_START, PSX_DMA_END)) {
-        dma_write32(address, value);
+    switch (psx->pages.mmio[address >> PSX_PAGE_SHIFT]) {
+    case PSX_MMIO_RAM:
+        psx->ram[address] = value;
+        psx_write_ram(psx, address);
         return;
+    case PSX_MMIO_IO:
+        switch (psx_io_device(address)) {
+        case PSX_IO_CDROM:
+            printf("psx: info: write to cdrom register at 0x%08x\n",
+                   address);
+            return;
+        case PSX_IO_EXP2:
+            exp2_write8(psx, address, value);
+            return;
+        default:
+            break;
+        }
+
+        break;
+    default:
+        break;
     }
 
-    if (between(address, PSX_TIMER_START, PSX_TIMER_END)) {
-        printf("psx: info: write to timer register at 0x%08x\n", address);
+    printf("psx: error: unknown write address 0x%08x\n", address);
+    PANIC;
+}
+
+void
+psx_write_memory16(struct psx_machine *psx, uint32_t address, uint16_t value)
+{
+    uint8_t *page;
+
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        *(uint16_t *)(page + (address & PSX_PAGE_MASK)) = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
         return;
     }
 
-    if (address == PSX_GP0) {
-        printf("psx: info: write to gp0\n");
+    switch (psx->pages.mmio[address >> PSX_PAGE_SHIFT]) {
+    case PSX_MMIO_RAM:
+        *(uint16_t *)(psx->ram + address) = value;
+        psx_write_ram(psx, address);
         return;
+    case PSX_MMIO_IO:
+        switch (psx_io_device(address)) {
+        case PSX_IO_INTERRUPT_STATUS:
+            psx->interrupt.status &= value;
+            r3000_assert_irq(psx,
+                             psx->interrupt.status & psx->interrupt.mask);
+            return;
+        case PSX_IO_INTERRUPT_MASK:
+            psx->interrupt.mask |= value;
+            r3000_assert_irq(psx,
+                             psx->interrupt.status & psx->interrupt.mask);
+            return;
+        case PSX_IO_TIMER:
+            timer_write(psx, address, value);
+            return;
+        case PSX_IO_SPU:
+            spu_write16(psx, address, value);
+            return;
+        default:
+            break;
+        }
+
+        break;
+    default:
+        break;
     }
 
-    if (address == PSX_GP1) {
-        printf("psx: info: write to gp1\n");
+    printf("psx: error: unknown write address 0x%08x\n", address);
+    PANIC;
+}
+
+void
+psx_write_memory32(struct psx_machine *psx, uint32_t address, uint32_t value)
+{
+    uint8_t *page;
+
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        *(uint32_t *)(page + (address & PSX_PAGE_MASK)) = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
         return;
     }
 
-    if (address == PSX_CACHECTRL) {
-        printf("psx: info: write to cachectrl register\n");
+    switch (psx->pages.mmio[address >> PSX_PAGE_SHIFT]) {
+    case PSX_MMIO_RAM:
+        *(uint32_t *)(psx->ram + address) = value;
+        psx_write_ram(psx, address);
         return;
+    case PSX_MMIO_BIOS:
+        printf("psx: error: write to bios at 0x%08x\n", address);
+        PANIC;
+        break;
+    case PSX_MMIO_IO:
+        switch (psx_io_device(address)) {
+        case PSX_IO_MEMCTRL:
+            printf("psx: info: write to memctrl register at 0x%08x\n",
+                   address);
+            return;
+        case PSX_IO_MEMCTRL2:
+            printf("psx: info: write to ram_size register\n");
+            return;
+        case PSX_IO_INTERRUPT_STATUS:
+            psx->interrupt.status &= value;
+            r3000_assert_irq(psx,
+                             psx->interrupt.status & psx->interrupt.mask);
+            return;
+        case PSX_IO_INTERRUPT_MASK:
+            psx->interrupt.mask = value;
+            r3000_assert_irq(psx,
+                             psx->interrupt.status & psx->interrupt.mask);
+            return;
+        case PSX_IO_DMA:
+            dma_write32(psx, address, value);
+            return;
+        case PSX_IO_TIMER:
+            timer_write(psx, address, value);
+            return;
+        case PSX_IO_GP0:
+            gpu_gp0(psx, value);
+            return;
+        case PSX_IO_GP1:
+            gpu_gp1(psx, value);
+            return;
+        default:
+            break;
+        }
+
+        break;
+    case PSX_MMIO_CACHECTRL:
+        if (address == PSX_CACHECTRL) {
+            printf("psx: info: write to cachectrl register\n");
+            return;
+        }
+
+        break;
+    default:
+        break;
     }
 
     printf("psx: error: unknown write address 0x%08x\n", address);
@@ -428,75 +941,121 @@ psx_write_memory32(uint32_t address, uint32_t value)
 }
 
 uint8_t
-psx_debug_read_memory8(uint32_t address)
+psx_debug_read_memory8(struct psx_machine *psx, uint32_t address)
 {
     uint32_t offset;
 
     if (between(address, PSX_RAM_START, PSX_RAM_END)) {
         offset = (address - PSX_RAM_START) / sizeof(uint8_t);
-        return ((uint8_t *)psx.ram)[offset];
+        return ((uint8_t *)psx->ram)[offset];
     }
 
     if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
         offset = (address - PSX_BIOS_START) / sizeof(uint8_t);
-        return ((uint8_t *)psx.bios)[offset];
+        return ((uint8_t *)psx->bios)[offset];
     }
 
     return 0;
 }
 
 uint32_t
-psx_debug_read_memory32(uint32_t address)
+psx_debug_read_memory32(struct psx_machine *psx, uint32_t address)
 {
     uint32_t offset;
 
     if (between(address, PSX_RAM_START, PSX_RAM_END)) {
         offset = (address - PSX_RAM_START) / sizeof(uint32_t);
-        return ((uint32_t *)psx.ram)[offset];
+        return ((uint32_t *)psx->ram)[offset];
     }
 
     if (address == PSX_INTERRUPT_STATUS) {
-        return psx.interrupt.status;
+        return psx->interrupt.status;
     }
 
     if (address == PSX_INTERRUPT_MASK) {
-        return psx.interrupt.mask;
+        return psx->interrupt.mask;
     }
 
     if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
         offset = (address - PSX_BIOS_START) / sizeof(uint32_t);
-        return ((uint32_t *)psx.bios)[offset];
+        return ((uint32_t *)psx->bios)[offset];
     }
 
     return 0;
 }
 
 void
-psx_debug_write_memory32(uint32_t address, uint32_t value)
+psx_debug_write_memory32(struct psx_machine *psx, uint32_t address,
+                         uint32_t value)
 {
     uint32_t offset;
 
+    replay_log(psx, REPLAY_EVENT_WRITE_MEMORY32, address, value, NULL, 0);
+
     if (between(address, PSX_RAM_START, PSX_RAM_END)) {
         offset = (address - PSX_RAM_START) / sizeof(uint32_t);
-        ((uint32_t *)psx.ram)[offset] = value;
+        ((uint32_t *)psx->ram)[offset] = value;
+        r3000_cache_invalidate(psx, address);
+        REWIND_MARK(psx, REWIND_RAM, address - PSX_RAM_START);
         return;
     }
 
     if (between(address, PSX_BIOS_START, PSX_BIOS_END)) {
         offset = (address - PSX_BIOS_START) / sizeof(uint32_t);
-        ((uint32_t *)psx.bios)[offset] = value;
+        ((uint32_t *)psx->bios)[offset] = value;
+        r3000_cache_invalidate(psx, address);
         return;
     }
 }
 
+/*
+ * Takes the direct store path away from the page holding a code page of RAM,
+ * which then only sends stores to the block cache if they land on code.
+ */
+void
+psx_protect_page(struct psx_machine *psx, uint32_t address)
+{
+    uint32_t page, bit;
+
+    if (!between(address, PSX_RAM_START, PSX_RAM_END)) {
+        return;
+    }
+
+    page = address >> PSX_PAGE_SHIFT;
+    bit = (address & PSX_PAGE_MASK) >> PSX_CODE_PAGE_SHIFT;
+
+    psx->pages.code[page] |= 1 << bit;
+    psx_map_write_page(psx, address & ~PSX_PAGE_MASK, NULL);
+}
+
+void
+psx_unprotect_page(struct psx_machine *psx, uint32_t address)
+{
+    uint32_t page, bit;
+
+    if (!between(address, PSX_RAM_START, PSX_RAM_END)) {
+        return;
+    }
+
+    page = address >> PSX_PAGE_SHIFT;
+    bit = (address & PSX_PAGE_MASK) >> PSX_CODE_PAGE_SHIFT;
+
+    psx->pages.code[page] &= ~(1 << bit);
+
+    if (!psx->pages.code[page]) {
+        psx_map_write_page(psx, address & ~PSX_PAGE_MASK,
+                           psx->pages.read[page]);
+    }
+}
+
 uint8_t *
-psx_debug_ram(void)
+psx_debug_ram(struct psx_machine *psx)
 {
-    return psx.ram;
+    return psx->ram;
 }
 
 uint8_t *
-psx_debug_bios(void)
+psx_debug_bios(struct psx_machine *psx)
 {
-    return psx.bios;
+    return psx->bios;
 }
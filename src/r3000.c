@@ -3,8 +3,13 @@
 #include <string.h>
 
 #include "macros.h"
+#include "perf.h"
 #include "psx.h"
+#include "psx_machine.h"
 #include "r3000.h"
+#include "replay.h"
+#include "rewind.h"
+#include "state.h"
 
 #define R3000_RESET_VECTOR      0xbfc00000
 #define R3000_EXCEPTION_VECTOR0 0x80000080
@@ -67,131 +72,140 @@ static const uint32_t R3000_VIRTADDR_MASKS[8] = {
     0xffffffff, 0xffffffff                              /* KSEG2 */
 };
 
-struct r3000 {
-    uint32_t pc, current_pc, next_pc;
-    uint32_t gpr[R3000_NR_REGISTERS];
-
-    bool branch, branch_delay;
+static bool
+r3000_cop0_interrupts_enabled(struct psx_machine *psx)
+{
+    return psx->r3000.cop0.sr & R3000_COP0_SR_IEC;
+}
 
-    struct {
-        uint32_t sr;
-        uint32_t cause;
-        uint32_t epc;
-    } cop0;
-};
+static bool
+r3000_cop0_interrupt_pending(struct psx_machine *psx)
+{
+    return psx->r3000.cop0.sr & psx->r3000.cop0.cause & R3000_COP0_IP;
+}
 
-static struct r3000 r3000;
+static void
+r3000_update_interrupt(struct psx_machine *psx)
+{
+    psx->r3000.interrupt = r3000_cop0_interrupts_enabled(psx)
+                      && r3000_cop0_interrupt_pending(psx);
+}
 
 static uint32_t
-r3000_cop0_sr_read(void)
+r3000_cop0_sr_read(struct psx_machine *psx)
 {
-    return r3000.cop0.sr;
+    return psx->r3000.cop0.sr;
 }
 
 static void
-r3000_cop0_sr_write(uint32_t value)
+r3000_cop0_sr_write(struct psx_machine *psx, uint32_t value)
 {
     printf("cop0: info: writing 0x%08x to sr\n", value);
 
-    r3000.cop0.sr = value;
+    psx->r3000.cop0.sr = value;
+    r3000_update_interrupt(psx);
 }
 
 static bool
-r3000_cop0_sr_isc(void)
+r3000_cop0_sr_isc(struct psx_machine *psx)
 {
-    return r3000.cop0.sr & R3000_COP0_SR_ISC;
+    return psx->r3000.cop0.sr & R3000_COP0_SR_ISC;
 }
 
 static uint32_t
-r3000_cop0_cause_read(void)
+r3000_cop0_cause_read(struct psx_machine *psx)
 {
-    return r3000.cop0.cause;
+    return psx->r3000.cop0.cause;
 }
 
 static void
-r3000_cop0_cause_write(uint32_t value)
+r3000_cop0_cause_write(struct psx_machine *psx, uint32_t value)
 {
     printf("cop0: info: writing 0x%08x to cause\n", value);
 
-    r3000.cop0.cause &= ~R3000_COP0_CAUSE_IP_W;
-    r3000.cop0.cause |= (value & R3000_COP0_CAUSE_IP_W);
+    psx->r3000.cop0.cause &= ~R3000_COP0_CAUSE_IP_W;
+    psx->r3000.cop0.cause |= (value & R3000_COP0_CAUSE_IP_W);
+    r3000_update_interrupt(psx);
 }
 
 static uint32_t
-r3000_cop0_epc_read(void)
+r3000_cop0_epc_read(struct psx_machine *psx)
 {
-    return r3000.cop0.epc;
+    return psx->r3000.cop0.epc;
 }
 
 static void
-r3000_cop0_soft_reset(uint32_t epc)
+r3000_cop0_soft_reset(struct psx_machine *psx, uint32_t epc)
 {
-    r3000.cop0.sr |= R3000_COP0_SR_BEV;         /* Set 'Boot Exception Vectors' flag */
-    r3000.cop0.sr |= R3000_COP0_SR_TS;          /* Set 'TLB Shutdown' flag */
-    r3000.cop0.sr &= ~R3000_COP0_SR_KUC;        /* Set processor to kernel mode */
-    r3000.cop0.sr &= ~R3000_COP0_SR_IEC;        /* Disable interrupts */
+    struct r3000 *r3000 = &psx->r3000;
 
-    r3000.cop0.epc = epc;
-}
+    r3000->cop0.sr |= R3000_COP0_SR_BEV;         /* Set 'Boot Exception Vectors' flag */
+    r3000->cop0.sr |= R3000_COP0_SR_TS;          /* Set 'TLB Shutdown' flag */
+    r3000->cop0.sr &= ~R3000_COP0_SR_KUC;        /* Set processor to kernel mode */
+    r3000->cop0.sr &= ~R3000_COP0_SR_IEC;        /* Disable interrupts */
 
-static void
-r3000_cop0_hard_reset(void)
-{
-    r3000.cop0.sr = 0;
-    r3000.cop0.cause = 0;
-    r3000.cop0.epc = 0;
+    r3000->cop0.epc = epc;
+
+    r3000_update_interrupt(psx);
 }
 
 static void
-r3000_cop0_assert_irq(bool state)
+r3000_cop0_hard_reset(struct psx_machine *psx)
 {
-    r3000.cop0.cause &= ~R3000_COP0_CAUSE_IRQ;
-    r3000.cop0.cause |= state ? R3000_COP0_CAUSE_IRQ : 0;
-}
+    psx->r3000.cop0.sr = 0;
+    psx->r3000.cop0.cause = 0;
+    psx->r3000.cop0.epc = 0;
 
-static bool
-r3000_cop0_interrupts_enabled(void)
-{
-    return r3000.cop0.sr & R3000_COP0_SR_IEC;
+    r3000_update_interrupt(psx);
 }
 
-static bool
-r3000_cop0_interrupt_pending(void)
+static void
+r3000_cop0_assert_irq(struct psx_machine *psx, bool state)
 {
-    return r3000.cop0.sr & r3000.cop0.cause & R3000_COP0_IP;
+    psx->r3000.cop0.cause &= ~R3000_COP0_CAUSE_IRQ;
+    psx->r3000.cop0.cause |= state ? R3000_COP0_CAUSE_IRQ : 0;
+
+    r3000_update_interrupt(psx);
 }
 
 static uint32_t
-r3000_cop0_exception(enum R3000Exception e, bool branch_delay, uint32_t epc)
+r3000_cop0_exception(struct psx_machine *psx, enum R3000Exception e,
+                     bool branch_delay, uint32_t epc)
 {
+    struct r3000 *r3000 = &psx->r3000;
     uint32_t prev_ex_blk;
 
-    prev_ex_blk = r3000.cop0.sr & R3000_COP0_SR_EX_BLK;         /* Backup previous exception block */
+    prev_ex_blk = r3000->cop0.sr & R3000_COP0_SR_EX_BLK;         /* Backup previous exception block */
 
-    r3000.cop0.sr &= ~R3000_COP0_SR_EX_BLK;                     /* Clear exception block */
-    r3000.cop0.sr |= (prev_ex_blk << 2) & R3000_COP0_SR_EX_BLK; /* Shift exception block */
+    r3000->cop0.sr &= ~R3000_COP0_SR_EX_BLK;                     /* Clear exception block */
+    r3000->cop0.sr |= (prev_ex_blk << 2) & R3000_COP0_SR_EX_BLK; /* Shift exception block */
 
-    r3000.cop0.cause &= ~R3000_COP0_CAUSE_BD;                   /* Clear BD bit */
-    r3000.cop0.cause |= branch_delay ? R3000_COP0_CAUSE_BD : 0; /* Set new BD bit */
+    r3000->cop0.cause &= ~R3000_COP0_CAUSE_BD;                   /* Clear BD bit */
+    r3000->cop0.cause |= branch_delay ? R3000_COP0_CAUSE_BD : 0; /* Set new BD bit */
 
-    r3000.cop0.cause &= ~R3000_COP0_CAUSE_EX;                   /* Clear excode */
-    r3000.cop0.cause |= e << 2;                                 /* Set new excode */
+    r3000->cop0.cause &= ~R3000_COP0_CAUSE_EX;                   /* Clear excode */
+    r3000->cop0.cause |= e << 2;                                 /* Set new excode */
 
-    r3000.cop0.epc = epc;
+    r3000->cop0.epc = epc;
 
-    return (r3000.cop0.sr & R3000_COP0_SR_BEV) ? R3000_EXCEPTION_VECTOR1
-                                                 : R3000_EXCEPTION_VECTOR0;
+    r3000_update_interrupt(psx);
+
+    return (r3000->cop0.sr & R3000_COP0_SR_BEV) ? R3000_EXCEPTION_VECTOR1
+                                                : R3000_EXCEPTION_VECTOR0;
 }
 
 static void
-r3000_cop0_exit_exception(void)
+r3000_cop0_exit_exception(struct psx_machine *psx)
 {
+    struct r3000 *r3000 = &psx->r3000;
     uint32_t prev_ex_blk;
 
-    prev_ex_blk = r3000.cop0.sr & R3000_COP0_SR_EX_BLK;         /* Backup previous exception block */
+    prev_ex_blk = r3000->cop0.sr & R3000_COP0_SR_EX_BLK;         /* Backup previous exception block */
+
+    r3000->cop0.sr &= ~R3000_COP0_SR_EX_BLK;                     /* Clear exception block */
+    r3000->cop0.sr |= (prev_ex_blk >> 2) & R3000_COP0_SR_EX_BLK; /* Shift exception block */
 
-    r3000.cop0.sr &= ~R3000_COP0_SR_EX_BLK;                     /* Clear exception block */
-    r3000.cop0.sr |= (prev_ex_blk >> 2) & R3000_COP0_SR_EX_BLK; /* Shift exception block */
+    r3000_update_interrupt(psx);
 }
 
 const char *
@@ -211,94 +225,111 @@ r3000_cop0_register_name(unsigned int reg)
 }
 
 void
-r3000_setup(void)
+r3000_setup(struct psx_machine *psx)
 {
-    r3000_hard_reset();
+    r3000_hard_reset(psx);
 }
 
 void
-r3000_soft_reset(void)
+r3000_soft_reset(struct psx_machine *psx)
 {
-    r3000_cop0_soft_reset(r3000.current_pc);
+    r3000_cop0_soft_reset(psx, psx->r3000.current_pc);
 
-    r3000.pc = r3000.current_pc = R3000_RESET_VECTOR;
-    r3000.next_pc = r3000.pc + 4;
+    psx->r3000.pc = psx->r3000.current_pc = R3000_RESET_VECTOR;
+    psx->r3000.next_pc = psx->r3000.pc + 4;
 
-    r3000.branch = r3000.branch_delay = false;
+    psx->r3000.branch = psx->r3000.branch_delay = false;
 }
 
 void
-r3000_hard_reset(void)
+r3000_hard_reset(struct psx_machine *psx)
 {
-    r3000_cop0_hard_reset();
+    r3000_cop0_hard_reset(psx);
 
-    memset(r3000.gpr, 0, sizeof(r3000.gpr));
+    memset(psx->r3000.gpr, 0, sizeof(psx->r3000.gpr));
 
-    r3000_soft_reset();
+    r3000_soft_reset(psx);
 }
 
 void
-r3000_assert_irq(bool state)
+r3000_assert_irq(struct psx_machine *psx, bool state)
 {
-    r3000_cop0_assert_irq(state);
+    r3000_cop0_assert_irq(psx, state);
 }
 
 void
-r3000_exception(enum R3000Exception e)
+r3000_exception(struct psx_machine *psx, enum R3000Exception e)
 {
+    struct r3000 *r3000 = &psx->r3000;
     uint32_t epc, vector;
 
     printf("r3000: info: entering exception 0x%x\n", e);
 
-    epc = r3000.branch_delay ? r3000.current_pc - 4 : r3000.current_pc;
-    vector = r3000_cop0_exception(e, r3000.branch_delay, epc);
+    epc = r3000->branch_delay ? r3000->current_pc - 4 : r3000->current_pc;
+    vector = r3000_cop0_exception(psx, e, r3000->branch_delay, epc);
 
-    r3000.pc = vector;
-    r3000.next_pc = r3000.pc + 4;
+    r3000->pc = vector;
+    r3000->next_pc = r3000->pc + 4;
 }
 
 void
-r3000_exit_exception(void)
+r3000_exit_exception(struct psx_machine *psx)
 {
-    r3000_cop0_exit_exception();
+    r3000_cop0_exit_exception(psx);
 }
 
 uint32_t
-r3000_read_pc(void)
+r3000_read_pc(struct psx_machine *psx)
 {
-    return r3000.pc;
+    return psx->r3000.pc;
 }
 
 uint32_t
-r3000_read_next_pc(void)
+r3000_read_current_pc(struct psx_machine *psx)
 {
-    return r3000.next_pc;
+    return psx->r3000.current_pc;
+}
+
+uint32_t
+r3000_read_next_pc(struct psx_machine *psx)
+{
+    return psx->r3000.next_pc;
+}
+
+void
+r3000_jump(struct psx_machine *psx, uint32_t address)
+{
+    psx->r3000.branch = true;
+    psx->r3000.next_pc = address;
 }
 
 void
-r3000_jump(uint32_t address)
+r3000_branch(struct psx_machine *psx, uint32_t offset)
 {
-    r3000.branch = true;
-    r3000.next_pc = address;
+    psx->r3000.branch = true;
+    psx->r3000.next_pc = psx->r3000.pc + offset;
 }
 
+/* Restarts execution at an address, outside of any branch */
 void
-r3000_branch(uint32_t offset)
+r3000_set_pc(struct psx_machine *psx, uint32_t address)
 {
-    r3000.branch = true;
-    r3000.next_pc = r3000.pc + offset;
+    psx->r3000.pc = psx->r3000.current_pc = address;
+    psx->r3000.next_pc = psx->r3000.pc + 4;
+
+    psx->r3000.branch = psx->r3000.branch_delay = false;
 }
 
 uint32_t
-r3000_read_reg(unsigned int reg)
+r3000_read_reg(struct psx_machine *psx, unsigned int reg)
 {
     assert(reg < R3000_NR_REGISTERS);
 
-    return r3000.gpr[reg];
+    return psx->r3000.gpr[reg];
 }
 
 void
-r3000_write_reg(unsigned int reg, uint32_t value)
+r3000_write_reg(struct psx_machine *psx, unsigned int reg, uint32_t value)
 {
     assert(reg < R3000_NR_REGISTERS);
 
@@ -306,21 +337,21 @@ r3000_write_reg(unsigned int reg, uint32_t value)
         return;
     }
 
-    r3000.gpr[reg] = value;
+    psx->r3000.gpr[reg] = value;
 }
 
 uint32_t
-r3000_cop0_read(unsigned int reg)
+r3000_cop0_read(struct psx_machine *psx, unsigned int reg)
 {
     assert(reg < R3000_NR_REGISTERS);
 
     switch (reg) {
     case 12:
-        return r3000_cop0_sr_read();
+        return r3000_cop0_sr_read(psx);
     case 13:
-        return r3000_cop0_cause_read();
+        return r3000_cop0_cause_read(psx);
     case 14:
-        return r3000_cop0_epc_read();
+        return r3000_cop0_epc_read(psx);
     default:
         PANIC;
         break;
@@ -330,7 +361,7 @@ r3000_cop0_read(unsigned int reg)
 }
 
 void
-r3000_cop0_write(unsigned int reg, uint32_t value)
+r3000_cop0_write(struct psx_machine *psx, unsigned int reg, uint32_t value)
 {
     assert(reg < R3000_NR_REGISTERS);
 
@@ -348,10 +379,10 @@ r3000_cop0_write(unsigned int reg, uint32_t value)
     case 11:
         break;
     case 12:
-        r3000_cop0_sr_write(value);
+        r3000_cop0_sr_write(psx, value);
         break;
     case 13:
-        r3000_cop0_cause_write(value);
+        r3000_cop0_cause_write(psx, value);
         break;
     default:
         PANIC;
@@ -359,7 +390,7 @@ r3000_cop0_write(unsigned int reg, uint32_t value)
     }
 }
 
-static uint32_t
+uint32_t
 r3000_translate_virtaddr(uint32_t address)
 {
     uint32_t mask;
@@ -368,28 +399,52 @@ r3000_translate_virtaddr(uint32_t address)
     return address & mask;
 }
 
+bool
+r3000_interrupt_deliverable(struct psx_machine *psx)
+{
+    return psx->r3000.interrupt;
+}
+
+bool
+r3000_advance_pc(struct psx_machine *psx)
+{
+    psx->r3000.current_pc = psx->r3000.pc;
+    psx->r3000.pc = psx->r3000.next_pc;
+    psx->r3000.next_pc += 4;
+
+    psx->r3000.branch_delay = psx->r3000.branch;
+    psx->r3000.branch = false;
+
+    if (psx->r3000.interrupt) {
+        r3000_exception(psx, R3000_EXCEPTION_INTERRUPT);
+        printf("r3000: info: interrupt triggered\n");
+        return false;
+    }
+
+    return true;
+}
+
 uint32_t
-r3000_read_code(void)
+r3000_read_code(struct psx_machine *psx)
 {
     uint32_t result;
+    uint8_t *page;
 
-    if (r3000.pc & 0x3) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_LOAD);
+    if (psx->r3000.pc & 0x3) {
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
         return 0;
     }
 
-    result = psx_read_memory32(r3000_translate_virtaddr(r3000.pc));
+    page = psx->pages.read[psx->r3000.pc >> PSX_PAGE_SHIFT];
 
-    r3000.current_pc = r3000.pc;
-    r3000.pc = r3000.next_pc;
-    r3000.next_pc += 4;
-
-    r3000.branch_delay = r3000.branch;
-    r3000.branch = false;
+    if (page) {
+        result = *(uint32_t *)(page + (psx->r3000.pc & PSX_PAGE_MASK));
+    } else {
+        result = psx_read_memory32(psx,
+                                   r3000_translate_virtaddr(psx->r3000.pc));
+    }
 
-    if (r3000_cop0_interrupts_enabled() && r3000_cop0_interrupt_pending()) {
-        r3000_exception(R3000_EXCEPTION_INTERRUPT);
-        printf("r3000: info: interrupt triggered\n");
+    if (!r3000_advance_pc(psx)) {
         return 0;
     }
 
@@ -397,90 +452,179 @@ r3000_read_code(void)
 }
 
 uint8_t
-r3000_read_memory8(uint32_t address)
+r3000_read_memory8(struct psx_machine *psx, uint32_t address)
 {
-    if (r3000_cop0_sr_isc()) {
+    uint8_t *page;
+
+    if (r3000_cop0_sr_isc(psx)) {
         return 0;
     }
 
-    return psx_read_memory8(r3000_translate_virtaddr(address));
+    PERF_BUS(psx, address);
+
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        return page[address & PSX_PAGE_MASK];
+    }
+
+    return psx_read_memory8(psx, r3000_translate_virtaddr(address));
 }
 
 uint16_t
-r3000_read_memory16(uint32_t address)
+r3000_read_memory16(struct psx_machine *psx, uint32_t address)
 {
+    uint8_t *page;
+
     assert(!(address & 0x1));
 
-    if (r3000_cop0_sr_isc()) {
+    if (r3000_cop0_sr_isc(psx)) {
         return 0;
     }
 
-    return psx_read_memory16(r3000_translate_virtaddr(address));
+    PERF_BUS(psx, address);
+
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        return *(uint16_t *)(page + (address & PSX_PAGE_MASK));
+    }
+
+    return psx_read_memory16(psx, r3000_translate_virtaddr(address));
 }
 
 uint32_t
-r3000_read_memory32(uint32_t address)
+r3000_read_memory32(struct psx_machine *psx, uint32_t address)
 {
+    uint8_t *page;
+
     assert(!(address & 0x3));
 
-    if (r3000_cop0_sr_isc()) {
+    if (r3000_cop0_sr_isc(psx)) {
         return 0;
     }
 
-    return psx_read_memory32(r3000_translate_virtaddr(address));
+    PERF_BUS(psx, address);
+
+    page = psx->pages.read[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        return *(uint32_t *)(page + (address & PSX_PAGE_MASK));
+    }
+
+    return psx_read_memory32(psx, r3000_translate_virtaddr(address));
 }
 
 void
-r3000_write_memory8(uint32_t address, uint8_t value)
+r3000_write_memory8(struct psx_machine *psx, uint32_t address, uint8_t value)
 {
-    if (r3000_cop0_sr_isc()) {
+    uint8_t *page;
+
+    if (r3000_cop0_sr_isc(psx)) {
         return;
     }
 
-    psx_write_memory8(r3000_translate_virtaddr(address), value);
+    PERF_BUS(psx, address);
+
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        page[address & PSX_PAGE_MASK] = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
+        return;
+    }
+
+    psx_write_memory8(psx, r3000_translate_virtaddr(address), value);
 }
 
 void
-r3000_write_memory16(uint32_t address, uint16_t value)
+r3000_write_memory16(struct psx_machine *psx, uint32_t address, uint16_t value)
 {
+    uint8_t *page;
+
     assert(!(address & 0x1));
 
-    if (r3000_cop0_sr_isc()) {
+    if (r3000_cop0_sr_isc(psx)) {
         return;
     }
 
-    psx_write_memory16(r3000_translate_virtaddr(address), value);
+    PERF_BUS(psx, address);
+
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        *(uint16_t *)(page + (address & PSX_PAGE_MASK)) = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
+        return;
+    }
+
+    psx_write_memory16(psx, r3000_translate_virtaddr(address), value);
 }
 
 void
-r3000_write_memory32(uint32_t address, uint32_t value)
+r3000_write_memory32(struct psx_machine *psx, uint32_t address, uint32_t value)
 {
+    uint8_t *page;
+
     assert(!(address & 0x3));
 
-    if (r3000_cop0_sr_isc()) {
+    if (r3000_cop0_sr_isc(psx)) {
         return;
     }
 
-    psx_write_memory32(r3000_translate_virtaddr(address), value);
+    PERF_BUS(psx, address);
+
+    page = psx->pages.write[address >> PSX_PAGE_SHIFT];
+
+    if (page) {
+        *(uint32_t *)(page + (address & PSX_PAGE_MASK)) = value;
+        REWIND_MARK(psx, REWIND_RAM, address & (PSX_RAM_SIZE - 1));
+        return;
+    }
+
+    psx_write_memory32(psx, r3000_translate_virtaddr(address), value);
 }
 
 void
-r3000_debug_force_pc(uint32_t address)
+r3000_debug_force_pc(struct psx_machine *psx, uint32_t address)
 {
-    r3000.pc = r3000.current_pc = address;
-    r3000.next_pc = r3000.pc + 4;
+    replay_log(psx, REPLAY_EVENT_FORCE_PC, address, 0, NULL, 0);
+    r3000_set_pc(psx, address);
+}
 
-    r3000.branch = r3000.branch_delay = false;
+void
+r3000_debug_write_reg(struct psx_machine *psx, unsigned int reg,
+                      uint32_t value)
+{
+    replay_log(psx, REPLAY_EVENT_WRITE_REG, reg, value, NULL, 0);
+    r3000_write_reg(psx, reg, value);
 }
 
 uint32_t
-r3000_debug_read_memory32(uint32_t address)
+r3000_debug_read_memory32(struct psx_machine *psx, uint32_t address)
+{
+    return psx_debug_read_memory32(psx, r3000_translate_virtaddr(address));
+}
+
+void
+r3000_debug_write_memory32(struct psx_machine *psx, uint32_t address,
+                           uint32_t value)
 {
-    return psx_debug_read_memory32(r3000_translate_virtaddr(address));
+    psx_debug_write_memory32(psx, r3000_translate_virtaddr(address), value);
 }
 
 void
-r3000_debug_write_memory32(uint32_t address, uint32_t value)
+r3000_save_state(struct psx_machine *psx, struct state *state)
 {
-    psx_debug_write_memory32(r3000_translate_virtaddr(address), value);
+    state_begin_section(state, STATE_SECTION_R3000);
+    state_write(state, &psx->r3000, sizeof(psx->r3000));
+    state_end_section(state);
+}
+
+void
+r3000_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (state_find_section(state, STATE_SECTION_R3000)) {
+        state_read(state, &psx->r3000, sizeof(psx->r3000));
+    }
 }
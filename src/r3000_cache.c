@@ -0,0 +1,235 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000_cache.h"
+
+static void
+r3000_cache_region_setup(struct r3000_cache_region *region, uint32_t start,
+                         uint32_t size, struct r3000_block **lookup,
+                         struct r3000_block **pages, unsigned int *code)
+{
+    region->start = start;
+    region->size = size;
+
+    region->lookup = lookup;
+    region->pages = pages;
+    region->code = code;
+
+    memset(lookup, 0, size / sizeof(uint32_t) * sizeof(*lookup));
+    memset(pages, 0, size / R3000_CACHE_PAGE_SIZE * sizeof(*pages));
+    memset(code, 0, size / PSX_CODE_PAGE_SIZE * sizeof(*code));
+}
+
+static struct r3000_cache_region *
+r3000_cache_find_region(struct psx_machine *psx, uint32_t address)
+{
+    struct r3000_cache_region *region;
+
+    for (size_t i = 0; i < R3000_CACHE_NR_REGIONS; ++i) {
+        region = &psx->r3000_cache.region[i];
+
+        if (address - region->start < region->size) {
+            return region;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Stores to code pages must take the slow path, which invalidates blocks. A
+ * block can only run over into the next page by its delay slot.
+ */
+static void
+r3000_cache_protect(struct psx_machine *psx, struct r3000_cache_region *region,
+                    struct r3000_block *block, bool protect)
+{
+    size_t first, last;
+
+    first = (block->address - region->start) / PSX_CODE_PAGE_SIZE;
+    last = (block->address + block->size - 1 - region->start) /
+           PSX_CODE_PAGE_SIZE;
+
+    for (size_t page = first; page <= last; ++page) {
+        if (protect && region->code[page]++ == 0) {
+            psx_protect_page(psx, region->start + page * PSX_CODE_PAGE_SIZE);
+        }
+
+        if (!protect && --region->code[page] == 0) {
+            psx_unprotect_page(psx,
+                               region->start + page * PSX_CODE_PAGE_SIZE);
+        }
+    }
+}
+
+static void
+r3000_cache_discard(struct psx_machine *psx, struct r3000_cache_region *region,
+                    struct r3000_block *block)
+{
+    region->lookup[(block->address - region->start) / sizeof(uint32_t)] = NULL;
+    r3000_cache_protect(psx, region, block, false);
+
+    block->valid = false;
+    block->next = psx->r3000_cache.garbage;
+    psx->r3000_cache.garbage = block;
+}
+
+static void
+r3000_cache_invalidate_page(struct psx_machine *psx,
+                            struct r3000_cache_region *region, size_t page,
+                            uint32_t start, uint32_t end)
+{
+    struct r3000_block **link, *block;
+
+    link = &region->pages[page];
+
+    while ((block = *link)) {
+        if (block->address >= end || block->address + block->size <= start) {
+            link = &block->next;
+            continue;
+        }
+
+        *link = block->next;
+        r3000_cache_discard(psx, region, block);
+    }
+}
+
+static void
+r3000_cache_invalidate_span(struct psx_machine *psx, uint32_t start,
+                            uint32_t end)
+{
+    struct r3000_cache_region *region;
+    size_t first, last;
+
+    region = r3000_cache_find_region(psx, start);
+
+    if (!region || end <= start) {
+        return;
+    }
+
+    end = MIN(end - region->start, region->size) + region->start;
+    first = (start - region->start) / R3000_CACHE_PAGE_SIZE;
+    last = (end - 1 - region->start) / R3000_CACHE_PAGE_SIZE;
+
+    /* Blocks may run over into the following page, but never further */
+    if (first != 0) {
+        first--;
+    }
+
+    for (size_t page = first; page <= last; ++page) {
+        if (region->pages[page]) {
+            r3000_cache_invalidate_page(psx, region, page, start, end);
+        }
+    }
+}
+
+void
+r3000_cache_setup(struct psx_machine *psx)
+{
+    struct r3000_cache *cache = &psx->r3000_cache;
+
+    r3000_cache_region_setup(&cache->region[0], PSX_RAM_START, PSX_RAM_SIZE,
+                             cache->ram_lookup, cache->ram_pages,
+                             cache->ram_code);
+    r3000_cache_region_setup(&cache->region[1], PSX_BIOS_START, PSX_BIOS_SIZE,
+                             cache->bios_lookup, cache->bios_pages,
+                             cache->bios_code);
+
+    psx->r3000_cache.garbage = NULL;
+}
+
+void
+r3000_cache_shutdown(struct psx_machine *psx)
+{
+    r3000_cache_flush(psx);
+    r3000_cache_collect(psx);
+}
+
+bool
+r3000_cache_cacheable(struct psx_machine *psx, uint32_t address)
+{
+    return r3000_cache_find_region(psx, address) != NULL;
+}
+
+struct r3000_block *
+r3000_cache_lookup(struct psx_machine *psx, uint32_t address)
+{
+    struct r3000_cache_region *region;
+
+    region = r3000_cache_find_region(psx, address);
+
+    if (!region) {
+        return NULL;
+    }
+
+    return region->lookup[(address - region->start) / sizeof(uint32_t)];
+}
+
+void
+r3000_cache_insert(struct psx_machine *psx, struct r3000_block *block)
+{
+    struct r3000_cache_region *region;
+    size_t page, index;
+
+    assert(block);
+
+    region = r3000_cache_find_region(psx, block->address);
+    assert(region);
+
+    page = (block->address - region->start) / R3000_CACHE_PAGE_SIZE;
+    index = (block->address - region->start) / sizeof(uint32_t);
+
+    assert(!region->lookup[index]);
+
+    block->valid = true;
+    block->next = region->pages[page];
+
+    region->pages[page] = block;
+    region->lookup[index] = block;
+
+    r3000_cache_protect(psx, region, block, true);
+}
+
+void
+r3000_cache_collect(struct psx_machine *psx)
+{
+    struct r3000_block *block;
+
+    while ((block = psx->r3000_cache.garbage)) {
+        psx->r3000_cache.garbage = block->next;
+        free(block);
+    }
+}
+
+void
+r3000_cache_invalidate(struct psx_machine *psx, uint32_t address)
+{
+    address &= ~0x3;
+
+    r3000_cache_invalidate_span(psx, address, address + sizeof(uint32_t));
+}
+
+void
+r3000_cache_invalidate_range(struct psx_machine *psx, uint32_t address,
+                             uint32_t size)
+{
+    r3000_cache_invalidate_span(psx, address, address + size);
+}
+
+void
+r3000_cache_flush(struct psx_machine *psx)
+{
+    struct r3000_cache_region *region;
+
+    for (size_t i = 0; i < R3000_CACHE_NR_REGIONS; ++i) {
+        region = &psx->r3000_cache.region[i];
+        r3000_cache_invalidate_range(psx, region->start, region->size);
+    }
+}
@@ -896,6 +896,65 @@ r3000_disassembler_cop0(char *buf, size_t n, uint32_t instruction)
     }
 }
 
+static void
+r3000_disassembler_cop2(char *buf, size_t n, uint32_t instruction)
+{
+    static const char *names[8] = {
+        "MFC2", NULL, "CFC2", NULL, "MTC2", NULL, "CTC2", NULL
+    };
+    const char *name, *rt;
+
+    if (instruction & (1 << 25)) {
+        snprintf(buf, n, "COP2 0x%07x", instruction & 0x1ffffff);
+        return;
+    }
+
+    name = R3000_RS(instruction) < 8 ? names[R3000_RS(instruction)] : NULL;
+
+    if (!name) {
+        snprintf(buf, n, "UNKNOWN");
+        return;
+    }
+
+    rt = r3000_register_name(R3000_RT(instruction));
+
+    snprintf(buf, n, "%s %s, $%u", name, rt, R3000_RD(instruction));
+}
+
+static void
+r3000_disassembler_lwc2(char *buf, size_t n, uint32_t instruction)
+{
+    const char *rs;
+    uint32_t offset, offset_abs;
+    char *offset_sign;
+
+    rs = r3000_register_name(R3000_RS(instruction));
+    offset = R3000_IMM_SE(instruction);
+
+    offset_sign = HEX_SIGN_32(offset);
+    offset_abs = HEX_ABS_32(offset);
+
+    snprintf(buf, n, "LWC2 $%u, %s0x%x(%s)", R3000_RT(instruction),
+             offset_sign, offset_abs, rs);
+}
+
+static void
+r3000_disassembler_swc2(char *buf, size_t n, uint32_t instruction)
+{
+    const char *rs;
+    uint32_t offset, offset_abs;
+    char *offset_sign;
+
+    rs = r3000_register_name(R3000_RS(instruction));
+    offset = R3000_IMM_SE(instruction);
+
+    offset_sign = HEX_SIGN_32(offset);
+    offset_abs = HEX_ABS_32(offset);
+
+    snprintf(buf, n, "SWC2 $%u, %s0x%x(%s)", R3000_RT(instruction),
+             offset_sign, offset_abs, rs);
+}
+
 void
 r3000_disassembler_disassemble(char *buf, size_t n, uint32_t instruction,
                                uint32_t address)
@@ -957,6 +1016,9 @@ r3000_disassembler_disassemble(char *buf, size_t n, uint32_t instruction,
     case 0x10:
         r3000_disassembler_cop0(buf, n, instruction);
         break;
+    case 0x12:
+        r3000_disassembler_cop2(buf, n, instruction);
+        break;
     case 0x20:
         r3000_disassembler_lb(buf, n, instruction);
         break;
@@ -993,6 +1055,12 @@ r3000_disassembler_disassemble(char *buf, size_t n, uint32_t instruction,
     case 0x2e:
         r3000_disassembler_swr(buf, n, instruction);
         break;
+    case 0x32:
+        r3000_disassembler_lwc2(buf, n, instruction);
+        break;
+    case 0x3a:
+        r3000_disassembler_swc2(buf, n, instruction);
+        break;
     default:
         snprintf(buf, n, "UNKNOWN");
         break;
@@ -0,0 +1,302 @@
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000.h"
+#include "r3000_idle.h"
+#include "scheduler.h"
+
+#define R3000_IDLE_MAX_LENGTH   16
+
+#define R3000_IDLE_REG(x)       (1ull << (x))
+
+/*
+ * Registers read and written by an instruction which may appear in an idle
+ * loop. Anything with side effects other than register writes is rejected.
+ */
+static bool
+r3000_idle_registers(uint32_t instruction, uint64_t *reads, uint64_t *writes)
+{
+    unsigned int rs, rt, rd;
+
+    rs = R3000_RS(instruction);
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
+
+    *reads = 0;
+    *writes = 0;
+
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        switch (R3000_FUNC(instruction)) {
+        case 0x00:
+        case 0x02:
+        case 0x03:
+            *reads = R3000_IDLE_REG(rt);
+            *writes = R3000_IDLE_REG(rd);
+            break;
+        case 0x04:
+        case 0x06:
+        case 0x07:
+        case 0x21:
+        case 0x23:
+        case 0x24 ... 0x27:
+        case 0x2a:
+        case 0x2b:
+            *reads = R3000_IDLE_REG(rs) | R3000_IDLE_REG(rt);
+            *writes = R3000_IDLE_REG(rd);
+            break;
+        default:
+            return false;
+        }
+
+        break;
+    case 0x01:
+        /* Linking variants write $ra */
+        if ((rt & 0x1e) == 0x10) {
+            return false;
+        }
+
+        *reads = R3000_IDLE_REG(rs);
+        break;
+    case 0x04:
+    case 0x05:
+        *reads = R3000_IDLE_REG(rs) | R3000_IDLE_REG(rt);
+        break;
+    case 0x06:
+    case 0x07:
+        *reads = R3000_IDLE_REG(rs);
+        break;
+    case 0x09 ... 0x0e:
+    case 0x20:
+    case 0x21:
+    case 0x23:
+    case 0x24:
+    case 0x25:
+        *reads = R3000_IDLE_REG(rs);
+        *writes = R3000_IDLE_REG(rt);
+        break;
+    case 0x0f:
+        *writes = R3000_IDLE_REG(rt);
+        break;
+    default:
+        return false;
+    }
+
+    *reads &= ~R3000_IDLE_REG(0);
+    *writes &= ~R3000_IDLE_REG(0);
+
+    return true;
+}
+
+/*
+ * Loads may read memory, or registers which have no side effects and only
+ * change through scheduled events. FIFOs change on every read and the root
+ * counters on every cycle, so loops polling them are run as they are.
+ */
+static bool
+r3000_idle_load_allowed(struct psx_machine *psx, uint32_t address)
+{
+    if (psx->pages.read[address >> PSX_PAGE_SHIFT]) {
+        return true;
+    }
+
+    switch (r3000_translate_virtaddr(address) & ~0x3) {
+    case PSX_INTERRUPT_STATUS:
+    case PSX_INTERRUPT_MASK:
+    case PSX_GPUSTAT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Checks the addresses the loop just loaded from, found from registers no
+ * later instruction of the loop writes. Returns the first one not allowed
+ * through load.
+ */
+static bool
+r3000_idle_loads_allowed(struct psx_machine *psx, uint32_t address,
+                         unsigned int length, uint32_t *load)
+{
+    uint32_t instructions[R3000_IDLE_MAX_LENGTH];
+    uint64_t reads, writes, later;
+    unsigned int rs;
+
+    for (unsigned int i = 0; i < length; ++i) {
+        instructions[i] = r3000_debug_read_memory32(psx, address + i * 4);
+    }
+
+    later = 0;
+
+    for (unsigned int i = length; i-- > 0;) {
+        switch (R3000_OPCODE(instructions[i])) {
+        case 0x20 ... 0x25:
+            rs = R3000_RS(instructions[i]);
+            *load = r3000_read_reg(psx, rs) + R3000_IMM_SE(instructions[i]);
+
+            if ((later & R3000_IDLE_REG(rs)) ||
+                !r3000_idle_load_allowed(psx, *load)) {
+                return false;
+            }
+
+            break;
+        }
+
+        r3000_idle_registers(instructions[i], &reads, &writes);
+        later |= writes;
+    }
+
+    return true;
+}
+
+static struct r3000_idle_loop *
+r3000_idle_find_loop(struct psx_machine *psx, uint32_t address)
+{
+    struct r3000_idle_loop *loop;
+
+    for (size_t i = 0; i < psx->r3000_idle.nr_loops; ++i) {
+        if (psx->r3000_idle.loop[i].address == address) {
+            return &psx->r3000_idle.loop[i];
+        }
+    }
+
+    if (psx->r3000_idle.nr_loops == R3000_IDLE_MAX_LOOPS) {
+        return NULL;
+    }
+
+    loop = &psx->r3000_idle.loop[psx->r3000_idle.nr_loops++];
+
+    loop->address = address;
+    loop->skips = 0;
+    loop->cycles = 0;
+    loop->refused = 0;
+    loop->load = 0;
+
+    return loop;
+}
+
+void
+r3000_idle_setup(struct psx_machine *psx)
+{
+    memset(&psx->r3000_idle, 0, sizeof(psx->r3000_idle));
+}
+
+void
+r3000_idle_dump_stats(struct psx_machine *psx)
+{
+    const struct r3000_idle_loop *loop;
+
+    for (size_t i = 0; i < psx->r3000_idle.nr_loops; ++i) {
+        loop = &psx->r3000_idle.loop[i];
+
+        printf("r3000_idle: info: loop at 0x%08x skipped %" PRIu64
+               " times, %" PRIu64 " cycles\n",
+               loop->address, loop->skips, loop->cycles);
+
+        if (loop->refused) {
+            printf("r3000_idle: info: loop at 0x%08x run %" PRIu64
+                   " times for loading from 0x%08x\n",
+                   loop->address, loop->refused, loop->load);
+        }
+    }
+}
+
+/*
+ * A block is an idle loop if it branches back to its own start and each
+ * iteration only depends on memory and registers the loop never writes.
+ * Until a scheduled event changes memory or raises an interrupt, every
+ * iteration then does the same thing.
+ */
+bool
+r3000_idle_detect(const uint32_t *instructions, unsigned int length)
+{
+    uint64_t reads, writes, carried, written;
+    unsigned int branch;
+    int32_t offset;
+
+    if (length < 2 || length > R3000_IDLE_MAX_LENGTH) {
+        return false;
+    }
+
+    /* The branch back is the second to last instruction */
+    branch = length - 2;
+
+    switch (R3000_OPCODE(instructions[branch])) {
+    case 0x01:
+    case 0x04 ... 0x07:
+        break;
+    default:
+        return false;
+    }
+
+    offset = (int32_t)R3000_IMM_SE(instructions[branch]) * 4 + 4;
+
+    if (offset != -(int32_t)(branch * 4)) {
+        return false;
+    }
+
+    carried = 0;
+    written = 0;
+
+    for (unsigned int i = 0; i < length; ++i) {
+        if (!r3000_idle_registers(instructions[i], &reads, &writes)) {
+            return false;
+        }
+
+        carried |= reads & ~written;
+        written |= writes;
+    }
+
+    return !(carried & written);
+}
+
+/*
+ * Called after an idle loop has run one iteration and is about to repeat.
+ * Returns the number of instructions to account for, including the iteration
+ * just executed, so that the CPU catches up with the next scheduled event.
+ */
+unsigned int
+r3000_idle_skip(struct psx_machine *psx, uint32_t address, unsigned int length)
+{
+    struct r3000_idle_loop *loop;
+    uint64_t now, deadline, cycles, iterations;
+    uint32_t load;
+
+    now = scheduler_now(psx);
+    deadline = scheduler_next_deadline(psx);
+    cycles = length * R3000_INSTRUCTION_CYC;
+
+    if (deadline == UINT64_MAX || now + cycles >= deadline) {
+        return length;
+    }
+
+    loop = r3000_idle_find_loop(psx, address);
+
+    if (!r3000_idle_loads_allowed(psx, address, length, &load)) {
+        if (loop) {
+            loop->refused++;
+            loop->load = load;
+        }
+
+        return length;
+    }
+
+    iterations = (deadline - now - 1) / cycles;
+    iterations = MIN(iterations, (uint64_t)(UINT_MAX / length - 1));
+
+    if (loop) {
+        loop->skips++;
+        loop->cycles += iterations * cycles;
+    }
+
+    return length * (iterations + 1);
+}
@@ -1,14 +1,124 @@
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "gte.h"
 #include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
 #include "r3000.h"
+#include "r3000_cache.h"
 #include "r3000_disassembler.h"
+#include "r3000_idle.h"
 #include "r3000_interpreter.h"
 #include "util.h"
 
+#define R3000_INTERPRETER_MAX_BLOCK_SIZE    64
+
+enum r3000_interpreter_kind {
+    R3000_OP_END,
+    R3000_OP_NOP,
+    R3000_OP_SLL,
+    R3000_OP_SRL,
+    R3000_OP_SRA,
+    R3000_OP_SLLV,
+    R3000_OP_SRLV,
+    R3000_OP_SRAV,
+    R3000_OP_MFHI,
+    R3000_OP_MTHI,
+    R3000_OP_MFLO,
+    R3000_OP_MTLO,
+    R3000_OP_MULT,
+    R3000_OP_MULTU,
+    R3000_OP_DIV,
+    R3000_OP_DIVU,
+    R3000_OP_ADD,
+    R3000_OP_ADDU,
+    R3000_OP_SUB,
+    R3000_OP_SUBU,
+    R3000_OP_AND,
+    R3000_OP_OR,
+    R3000_OP_XOR,
+    R3000_OP_NOR,
+    R3000_OP_SLT,
+    R3000_OP_SLTU,
+    R3000_OP_ADDI,
+    R3000_OP_ADDIU,
+    R3000_OP_SLTI,
+    R3000_OP_SLTIU,
+    R3000_OP_ANDI,
+    R3000_OP_ORI,
+    R3000_OP_XORI,
+    R3000_OP_LUI,
+    R3000_OP_LB,
+    R3000_OP_LH,
+    R3000_OP_LW,
+    R3000_OP_LBU,
+    R3000_OP_LHU,
+    R3000_OP_SB,
+    R3000_OP_SH,
+    R3000_OP_SW,
+    R3000_OP_BCOND,
+    R3000_OP_J,
+    R3000_OP_JAL,
+    R3000_OP_BEQ,
+    R3000_OP_BNE,
+    R3000_OP_BLEZ,
+    R3000_OP_BGTZ,
+    R3000_OP_JR,
+    R3000_OP_JALR,
+    R3000_OP_FALLBACK,          /* Calls the handler of the instruction */
+    R3000_OP_FALLBACK_CHECK,    /* As above, for stores and COP0 writes */
+    R3000_NR_OPS
+};
+
+#define R3000_OP_IS_BRANCH(x)   ((x) >= R3000_OP_BCOND && (x) <= R3000_OP_JALR)
+
+/*
+ * Pre-decoded instruction. Destination registers which are $zero are replaced
+ * by R3000_REGISTER_SCRATCH, so that register writes need no check.
+ */
+struct r3000_interpreter_op {
+    const void *handler;        /* Label within r3000_interpreter_execute_block */
+    r3000_interpreter_handler fallback;
+
+    uint32_t instruction;
+    uint32_t imm;               /* Extended immediate, shift or branch offset */
+
+    uint8_t kind;
+    uint8_t rs, rt, rd;
+
+    bool delay_slot;
+};
+
+struct r3000_interpreter_block {
+    struct r3000_block base;
+
+    unsigned int length;
+    struct r3000_interpreter_op ops[];  /* Terminated by R3000_OP_END */
+};
+
+static void
+r3000_interpreter_nop(struct psx_machine *psx, uint32_t instruction)
+{
+    (void)psx;
+    (void)instruction;
+}
+
 static void
-r3000_interpreter_bcond(uint32_t instruction)
+r3000_interpreter_unknown(struct psx_machine *psx, uint32_t instruction)
+{
+    (void)psx;
+
+    printf("r3000_interpreter: error: unknown instruction 0x%08x\n",
+           instruction);
+    PANIC;
+}
+
+static void
+r3000_interpreter_bcond(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     uint32_t offset;
@@ -19,43 +129,45 @@ r3000_interpreter_bcond(uint32_t instruction)
     rt = R3000_RT(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    s = r3000_read_reg(rs);
+    s = r3000_read_reg(psx, rs);
 
     branch = (s ^ ((int32_t)(rt << 31))) < 0;
     link = (rt & 0x1e) == 0x10;
 
     if (link) {
-        r3000_write_reg(31, r3000_read_next_pc());
+        r3000_write_reg(psx, 31, r3000_read_next_pc(psx));
     }
 
     if (branch) {
-        r3000_branch(offset << 2);
+        r3000_branch(psx, offset << 2);
     }
 }
 
 static void
-r3000_interpreter_j(uint32_t instruction, uint32_t address)
+r3000_interpreter_j(struct psx_machine *psx, uint32_t instruction)
 {
-    uint32_t target;
+    uint32_t target, address;
 
     target = R3000_TARGET(instruction);
+    address = r3000_read_current_pc(psx);
 
-    r3000_jump((address & 0xf0000000) | (target << 2));
+    r3000_jump(psx, (address & 0xf0000000) | (target << 2));
 }
 
 static void
-r3000_interpreter_jal(uint32_t instruction, uint32_t address)
+r3000_interpreter_jal(struct psx_machine *psx, uint32_t instruction)
 {
-    uint32_t target;
+    uint32_t target, address;
 
     target = R3000_TARGET(instruction);
+    address = r3000_read_current_pc(psx);
 
-    r3000_write_reg(31, r3000_read_next_pc());
-    r3000_jump((address & 0xf0000000) | (target << 2));
+    r3000_write_reg(psx, 31, r3000_read_next_pc(psx));
+    r3000_jump(psx, (address & 0xf0000000) | (target << 2));
 }
 
 static void
-r3000_interpreter_beq(uint32_t instruction)
+r3000_interpreter_beq(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     uint32_t offset;
@@ -64,13 +176,13 @@ r3000_interpreter_beq(uint32_t instruction)
     rt = R3000_RT(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    if (r3000_read_reg(rs) == r3000_read_reg(rt)) {
-        r3000_branch(offset << 2);
+    if (r3000_read_reg(psx, rs) == r3000_read_reg(psx, rt)) {
+        r3000_branch(psx, offset << 2);
     }
 }
 
 static void
-r3000_interpreter_bne(uint32_t instruction)
+r3000_interpreter_bne(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     uint32_t offset;
@@ -79,13 +191,13 @@ r3000_interpreter_bne(uint32_t instruction)
     rt = R3000_RT(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    if (r3000_read_reg(rs) != r3000_read_reg(rt)) {
-        r3000_branch(offset << 2);
+    if (r3000_read_reg(psx, rs) != r3000_read_reg(psx, rt)) {
+        r3000_branch(psx, offset << 2);
     }
 }
 
 static void
-r3000_interpreter_blez(uint32_t instruction)
+r3000_interpreter_blez(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs;
     uint32_t offset;
@@ -93,13 +205,13 @@ r3000_interpreter_blez(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    if (((int32_t)r3000_read_reg(rs)) <= 0) {
-        r3000_branch(offset << 2);
+    if (((int32_t)r3000_read_reg(psx, rs)) <= 0) {
+        r3000_branch(psx, offset << 2);
     }
 }
 
 static void
-r3000_interpreter_bgtz(uint32_t instruction)
+r3000_interpreter_bgtz(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs;
     uint32_t offset;
@@ -107,13 +219,13 @@ r3000_interpreter_bgtz(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    if (((int32_t)r3000_read_reg(rs)) > 0) {
-        r3000_branch(offset << 2);
+    if (((int32_t)r3000_read_reg(psx, rs)) > 0) {
+        r3000_branch(psx, offset << 2);
     }
 }
 
 static void
-r3000_interpreter_addi(uint32_t instruction)
+r3000_interpreter_addi(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t s, imm, result;
@@ -121,20 +233,21 @@ r3000_interpreter_addi(uint32_t instruction)
     rt = R3000_RT(instruction);
     rs = R3000_RS(instruction);
 
-    s = r3000_read_reg(rs);
+    s = r3000_read_reg(psx, rs);
     imm = R3000_IMM_SE(instruction);
 
     result = s + imm;
 
     if (overflow_u32(s, imm, result)) {
-        r3000_exception(R3000_EXCEPTION_OVERFLOW);
+        r3000_exception(psx, R3000_EXCEPTION_OVERFLOW);
+        return;
     }
 
-    r3000_write_reg(rt, result);
+    r3000_write_reg(psx, rt, result);
 }
 
 static void
-r3000_interpreter_addiu(uint32_t instruction)
+r3000_interpreter_addiu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t imm;
@@ -143,11 +256,11 @@ r3000_interpreter_addiu(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM_SE(instruction);
 
-    r3000_write_reg(rt, r3000_read_reg(rs) + imm);
+    r3000_write_reg(psx, rt, r3000_read_reg(psx, rs) + imm);
 }
 
 static void
-r3000_interpreter_slti(uint32_t instruction)
+r3000_interpreter_slti(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     int32_t imm;
@@ -156,11 +269,11 @@ r3000_interpreter_slti(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM_SE(instruction);
 
-    r3000_write_reg(rt, ((int32_t)r3000_read_reg(rs)) < imm);
+    r3000_write_reg(psx, rt, ((int32_t)r3000_read_reg(psx, rs)) < imm);
 }
 
 static void
-r3000_interpreter_sltiu(uint32_t instruction)
+r3000_interpreter_sltiu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t imm;
@@ -169,11 +282,11 @@ r3000_interpreter_sltiu(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM_SE(instruction);
 
-    r3000_write_reg(rt, r3000_read_reg(rs) < imm);
+    r3000_write_reg(psx, rt, r3000_read_reg(psx, rs) < imm);
 }
 
 static void
-r3000_interpreter_andi(uint32_t instruction)
+r3000_interpreter_andi(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t imm;
@@ -182,11 +295,11 @@ r3000_interpreter_andi(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM(instruction);
 
-    r3000_write_reg(rt, r3000_read_reg(rs) & imm);
+    r3000_write_reg(psx, rt, r3000_read_reg(psx, rs) & imm);
 }
 
 static void
-r3000_interpreter_ori(uint32_t instruction)
+r3000_interpreter_ori(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t imm;
@@ -195,11 +308,11 @@ r3000_interpreter_ori(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM(instruction);
 
-    r3000_write_reg(rt, r3000_read_reg(rs) | imm);
+    r3000_write_reg(psx, rt, r3000_read_reg(psx, rs) | imm);
 }
 
 static void
-r3000_interpreter_xori(uint32_t instruction)
+r3000_interpreter_xori(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t imm;
@@ -208,11 +321,11 @@ r3000_interpreter_xori(uint32_t instruction)
     rs = R3000_RS(instruction);
     imm = R3000_IMM(instruction);
 
-    r3000_write_reg(rt, r3000_read_reg(rs) ^ imm);
+    r3000_write_reg(psx, rt, r3000_read_reg(psx, rs) ^ imm);
 }
 
 static void
-r3000_interpreter_lui(uint32_t instruction)
+r3000_interpreter_lui(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt;
     uint32_t imm;
@@ -220,11 +333,11 @@ r3000_interpreter_lui(uint32_t instruction)
     rt = R3000_RT(instruction);
     imm = R3000_IMM(instruction);
 
-    r3000_write_reg(rt, imm << 16);
+    r3000_write_reg(psx, rt, imm << 16);
 }
 
 static void
-r3000_interpreter_lb(uint32_t instruction)
+r3000_interpreter_lb(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, value;
@@ -233,13 +346,13 @@ r3000_interpreter_lb(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    value = (int8_t)r3000_read_memory8(r3000_read_reg(rs) + offset);
+    value = (int8_t)r3000_read_memory8(psx, r3000_read_reg(psx, rs) + offset);
 
-    r3000_write_reg(rt, value);
+    r3000_write_reg(psx, rt, value);
 }
 
 static void
-r3000_interpreter_lh(uint32_t instruction)
+r3000_interpreter_lh(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address, value;
@@ -248,20 +361,20 @@ r3000_interpreter_lh(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
     if (address & 0x1) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_LOAD);
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
         return;
     }
 
-    value = (int16_t)r3000_read_memory16(address);
+    value = (int16_t)r3000_read_memory16(psx, address);
 
-    r3000_write_reg(rt, value);
+    r3000_write_reg(psx, rt, value);
 }
 
 static void
-r3000_interpreter_lwl(uint32_t instruction)
+r3000_interpreter_lwl(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address, current, aligned, value;
@@ -270,10 +383,10 @@ r3000_interpreter_lwl(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
-    current = r3000_read_reg(rt);
-    aligned = r3000_read_memory32(address & ~0x3);
+    current = r3000_read_reg(psx, rt);
+    aligned = r3000_read_memory32(psx, address & ~0x3);
 
     switch (address & 0x3) {
     case 0x0:
@@ -290,11 +403,11 @@ r3000_interpreter_lwl(uint32_t instruction)
         break;
     }
 
-    r3000_write_reg(rt, value);
+    r3000_write_reg(psx, rt, value);
 }
 
 static void
-r3000_interpreter_lw(uint32_t instruction)
+r3000_interpreter_lw(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address;
@@ -303,18 +416,18 @@ r3000_interpreter_lw(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset; 
+    address = r3000_read_reg(psx, rs) + offset; 
 
     if (address & 0x3) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_LOAD);
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
         return;
     }
 
-    r3000_write_reg(rt, r3000_read_memory32(address));
+    r3000_write_reg(psx, rt, r3000_read_memory32(psx, address));
 }
 
 static void
-r3000_interpreter_lbu(uint32_t instruction)
+r3000_interpreter_lbu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset;
@@ -323,11 +436,12 @@ r3000_interpreter_lbu(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    r3000_write_reg(rt, r3000_read_memory8(r3000_read_reg(rs) + offset));
+    r3000_write_reg(psx, rt,
+                    r3000_read_memory8(psx, r3000_read_reg(psx, rs) + offset));
 }
 
 static void
-r3000_interpreter_lhu(uint32_t instruction)
+r3000_interpreter_lhu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address;
@@ -336,17 +450,18 @@ r3000_interpreter_lhu(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
     if (address & 0x1) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_LOAD);
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
+        return;
     }
 
-    r3000_write_reg(rt, r3000_read_memory16(address));
+    r3000_write_reg(psx, rt, r3000_read_memory16(psx, address));
 }
 
 static void
-r3000_interpreter_lwr(uint32_t instruction)
+r3000_interpreter_lwr(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address, current, aligned, value;
@@ -355,10 +470,10 @@ r3000_interpreter_lwr(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
-    current = r3000_read_reg(rt);
-    aligned = r3000_read_memory32(address & ~0x3);
+    current = r3000_read_reg(psx, rt);
+    aligned = r3000_read_memory32(psx, address & ~0x3);
 
     switch (address & 0x3) {
     case 0x0:
@@ -375,11 +490,11 @@ r3000_interpreter_lwr(uint32_t instruction)
         break;
     }
 
-    r3000_write_reg(rt, value);
+    r3000_write_reg(psx, rt, value);
 }
 
 static void
-r3000_interpreter_sb(uint32_t instruction)
+r3000_interpreter_sb(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset;
@@ -388,11 +503,12 @@ r3000_interpreter_sb(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    r3000_write_memory8(r3000_read_reg(rs) + offset, r3000_read_reg(rt));
+    r3000_write_memory8(psx, r3000_read_reg(psx, rs) + offset,
+                        r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_sh(uint32_t instruction)
+r3000_interpreter_sh(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address;
@@ -401,18 +517,18 @@ r3000_interpreter_sh(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
     if (address & 0x1) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_STORE);
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_STORE);
         return;
     }
 
-    r3000_write_memory16(address, r3000_read_reg(rt));
+    r3000_write_memory16(psx, address, r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_swl(uint32_t instruction)
+r3000_interpreter_swl(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address, current, value;
@@ -421,10 +537,10 @@ r3000_interpreter_swl(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
-    current = r3000_read_memory32(address & ~0x3);
-    value = r3000_read_reg(rt);
+    current = r3000_read_memory32(psx, address & ~0x3);
+    value = r3000_read_reg(psx, rt);
    
     switch (address & 0x3) {
     case 0x0:
@@ -438,11 +554,11 @@ r3000_interpreter_swl(uint32_t instruction)
         break;
     }
 
-    r3000_write_memory32(address & ~0x3, value);
+    r3000_write_memory32(psx, address & ~0x3, value);
 }
 
 static void
-r3000_interpreter_sw(uint32_t instruction)
+r3000_interpreter_sw(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address;
@@ -451,18 +567,18 @@ r3000_interpreter_sw(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
     if (address & 0x3) {
-        r3000_exception(R3000_EXCEPTION_ADDRESS_STORE);
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_STORE);
         return;
     }
 
-    r3000_write_memory32(address, r3000_read_reg(rt));
+    r3000_write_memory32(psx, address, r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_swr(uint32_t instruction)
+r3000_interpreter_swr(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rs;
     uint32_t offset, address, current, value;
@@ -471,10 +587,10 @@ r3000_interpreter_swr(uint32_t instruction)
     rs = R3000_RS(instruction);
     offset = R3000_IMM_SE(instruction);
 
-    address = r3000_read_reg(rs) + offset;
+    address = r3000_read_reg(psx, rs) + offset;
 
-    current = r3000_read_memory32(address & ~0x3);
-    value = r3000_read_reg(rt);
+    current = r3000_read_memory32(psx, address & ~0x3);
+    value = r3000_read_reg(psx, rt);
    
     switch (address & 0x3) {
     case 0x1:
@@ -488,11 +604,11 @@ r3000_interpreter_swr(uint32_t instruction)
         break;
     }
 
-    r3000_write_memory32(address & ~0x3, value);
+    r3000_write_memory32(psx, address & ~0x3, value);
 }
 
 static void
-r3000_interpreter_sll(uint32_t instruction)
+r3000_interpreter_sll(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, shift;
 
@@ -500,11 +616,11 @@ r3000_interpreter_sll(uint32_t instruction)
     rt = R3000_RT(instruction);
     shift = R3000_SHIFT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rt) << shift);
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rt) << shift);
 }
 
 static void
-r3000_interpreter_srl(uint32_t instruction)
+r3000_interpreter_srl(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, shift;
 
@@ -512,11 +628,11 @@ r3000_interpreter_srl(uint32_t instruction)
     rt = R3000_RT(instruction);
     shift = R3000_SHIFT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rt) >> shift);
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rt) >> shift);
 }
 
 static void
-r3000_interpreter_sra(uint32_t instruction)
+r3000_interpreter_sra(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, shift;
 
@@ -524,11 +640,11 @@ r3000_interpreter_sra(uint32_t instruction)
     rt = R3000_RT(instruction);
     shift = R3000_SHIFT(instruction);
 
-    r3000_write_reg(rd, (int32_t)r3000_read_reg(rt) >> shift);
+    r3000_write_reg(psx, rd, (int32_t)r3000_read_reg(psx, rt) >> shift);
 }
 
 static void
-r3000_interpreter_sllv(uint32_t instruction)
+r3000_interpreter_sllv(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, rs;
 
@@ -536,11 +652,12 @@ r3000_interpreter_sllv(uint32_t instruction)
     rt = R3000_RT(instruction);
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rt) << r3000_read_reg(rs));
+    r3000_write_reg(psx, rd,
+                    r3000_read_reg(psx, rt) << r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_srlv(uint32_t instruction)
+r3000_interpreter_srlv(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, rs;
 
@@ -548,11 +665,12 @@ r3000_interpreter_srlv(uint32_t instruction)
     rt = R3000_RT(instruction);
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rt) >> r3000_read_reg(rs));
+    r3000_write_reg(psx, rd,
+                    r3000_read_reg(psx, rt) >> r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_srav(uint32_t instruction)
+r3000_interpreter_srav(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rt, rs;
 
@@ -560,90 +678,91 @@ r3000_interpreter_srav(uint32_t instruction)
     rt = R3000_RT(instruction);
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(rd, (int32_t)r3000_read_reg(rt) >> r3000_read_reg(rs));
+    r3000_write_reg(psx, rd, (int32_t)r3000_read_reg(psx, rt)
+                             >> r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_jr(uint32_t instruction)
+r3000_interpreter_jr(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs;
 
     rs = R3000_RS(instruction);
 
-    r3000_jump(r3000_read_reg(rs));
+    r3000_jump(psx, r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_jalr(uint32_t instruction)
+r3000_interpreter_jalr(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs;
 
     rd = R3000_RD(instruction);
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(rd, r3000_read_next_pc());
+    r3000_write_reg(psx, rd, r3000_read_next_pc(psx));
 
-    r3000_jump(r3000_read_reg(rs));
+    r3000_jump(psx, r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_syscall(uint32_t instruction)
+r3000_interpreter_syscall(struct psx_machine *psx, uint32_t instruction)
 {
     (void)instruction;
 
-    r3000_exception(R3000_EXCEPTION_SYSCALL);
+    r3000_exception(psx, R3000_EXCEPTION_SYSCALL);
 }
 
 static void
-r3000_interpreter_break(uint32_t instruction)
+r3000_interpreter_break(struct psx_machine *psx, uint32_t instruction)
 {
     (void)instruction;
 
-    r3000_exception(R3000_EXCEPTION_BREAKPOINT);
+    r3000_exception(psx, R3000_EXCEPTION_BREAKPOINT);
 }
 
 static void
-r3000_interpreter_mfhi(uint32_t instruction)
+r3000_interpreter_mfhi(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd;
 
     rd = R3000_RD(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(R3000_REGISTER_HI));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, R3000_REGISTER_HI));
 }
 
 static void
-r3000_interpreter_mthi(uint32_t instruction)
+r3000_interpreter_mthi(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs;
 
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(R3000_REGISTER_HI, r3000_read_reg(rs));
+    r3000_write_reg(psx, R3000_REGISTER_HI, r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_mflo(uint32_t instruction)
+r3000_interpreter_mflo(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd;
 
     rd = R3000_RD(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(R3000_REGISTER_LO));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, R3000_REGISTER_LO));
 }
 
 static void
-r3000_interpreter_mtlo(uint32_t instruction)
+r3000_interpreter_mtlo(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs;
 
     rs = R3000_RS(instruction);
 
-    r3000_write_reg(R3000_REGISTER_LO, r3000_read_reg(rs));
+    r3000_write_reg(psx, R3000_REGISTER_LO, r3000_read_reg(psx, rs));
 }
 
 static void
-r3000_interpreter_mult(uint32_t instruction)
+r3000_interpreter_mult(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     int64_t a, b;
@@ -652,17 +771,17 @@ r3000_interpreter_mult(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    a = (int32_t)r3000_read_reg(rs);
-    b = (int32_t)r3000_read_reg(rt);
+    a = (int32_t)r3000_read_reg(psx, rs);
+    b = (int32_t)r3000_read_reg(psx, rt);
 
     result = a * b;
 
-    r3000_write_reg(R3000_REGISTER_HI, result >> 32);
-    r3000_write_reg(R3000_REGISTER_LO, result);
+    r3000_write_reg(psx, R3000_REGISTER_HI, result >> 32);
+    r3000_write_reg(psx, R3000_REGISTER_LO, result);
 }
 
 static void
-r3000_interpreter_multu(uint32_t instruction)
+r3000_interpreter_multu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     uint64_t result;
@@ -670,14 +789,14 @@ r3000_interpreter_multu(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    result = r3000_read_reg(rs) * r3000_read_reg(rt);
+    result = (uint64_t)r3000_read_reg(psx, rs) * r3000_read_reg(psx, rt);
 
-    r3000_write_reg(R3000_REGISTER_HI, result >> 32);
-    r3000_write_reg(R3000_REGISTER_LO, result);
+    r3000_write_reg(psx, R3000_REGISTER_HI, result >> 32);
+    r3000_write_reg(psx, R3000_REGISTER_LO, result);
 }
 
 static void
-r3000_interpreter_div(uint32_t instruction)
+r3000_interpreter_div(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     int32_t n, d;
@@ -685,23 +804,23 @@ r3000_interpreter_div(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    n = r3000_read_reg(rs);
-    d = r3000_read_reg(rt);
+    n = r3000_read_reg(psx, rs);
+    d = r3000_read_reg(psx, rt);
 
     if (d == 0) {
-        r3000_write_reg(R3000_REGISTER_HI, n);
-        r3000_write_reg(R3000_REGISTER_LO, n >= 0 ? -1 : 1);
+        r3000_write_reg(psx, R3000_REGISTER_HI, n);
+        r3000_write_reg(psx, R3000_REGISTER_LO, n >= 0 ? -1 : 1);
     } else if (n == INT32_MIN && d == -1) {
-        r3000_write_reg(R3000_REGISTER_HI, 0);
-        r3000_write_reg(R3000_REGISTER_LO, INT32_MIN);
+        r3000_write_reg(psx, R3000_REGISTER_HI, 0);
+        r3000_write_reg(psx, R3000_REGISTER_LO, INT32_MIN);
     } else {
-        r3000_write_reg(R3000_REGISTER_HI, n % d);
-        r3000_write_reg(R3000_REGISTER_LO, n / d);
+        r3000_write_reg(psx, R3000_REGISTER_HI, n % d);
+        r3000_write_reg(psx, R3000_REGISTER_LO, n / d);
     }
 }
 
 static void
-r3000_interpreter_divu(uint32_t instruction)
+r3000_interpreter_divu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rs, rt;
     uint32_t n, d;
@@ -709,20 +828,20 @@ r3000_interpreter_divu(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    n = r3000_read_reg(rs);
-    d = r3000_read_reg(rt);
+    n = r3000_read_reg(psx, rs);
+    d = r3000_read_reg(psx, rt);
 
     if (d == 0) {
-        r3000_write_reg(R3000_REGISTER_HI, n);
-        r3000_write_reg(R3000_REGISTER_LO, -1);
+        r3000_write_reg(psx, R3000_REGISTER_HI, n);
+        r3000_write_reg(psx, R3000_REGISTER_LO, -1);
     } else {
-        r3000_write_reg(R3000_REGISTER_HI, n % d);
-        r3000_write_reg(R3000_REGISTER_LO, n / d);
+        r3000_write_reg(psx, R3000_REGISTER_HI, n % d);
+        r3000_write_reg(psx, R3000_REGISTER_LO, n / d);
     }
 }
 
 static void
-r3000_interpreter_add(uint32_t instruction)
+r3000_interpreter_add(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
     uint32_t s, t, result;
@@ -731,20 +850,21 @@ r3000_interpreter_add(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    s = r3000_read_reg(rs);
-    t = r3000_read_reg(rt);
+    s = r3000_read_reg(psx, rs);
+    t = r3000_read_reg(psx, rt);
 
     result = s + t;
 
     if (overflow_u32(s, t, result)) {
-        r3000_exception(R3000_EXCEPTION_OVERFLOW);
+        r3000_exception(psx, R3000_EXCEPTION_OVERFLOW);
+        return;
     }
 
-    r3000_write_reg(rd, result);
+    r3000_write_reg(psx, rd, result);
 }
 
 static void
-r3000_interpreter_addu(uint32_t instruction)
+r3000_interpreter_addu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -752,11 +872,11 @@ r3000_interpreter_addu(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) + r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) + r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_sub(uint32_t instruction)
+r3000_interpreter_sub(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
     uint32_t s, t, result;
@@ -765,20 +885,21 @@ r3000_interpreter_sub(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    s = r3000_read_reg(rs);
-    t = r3000_read_reg(rt);
+    s = r3000_read_reg(psx, rs);
+    t = r3000_read_reg(psx, rt);
 
     result = s - t;
 
     if (overflow_u32(s, t, result)) {
-        r3000_exception(R3000_EXCEPTION_OVERFLOW);
+        r3000_exception(psx, R3000_EXCEPTION_OVERFLOW);
+        return;
     }
 
-    r3000_write_reg(rd, result);
+    r3000_write_reg(psx, rd, result);
 }
 
 static void
-r3000_interpreter_subu(uint32_t instruction)
+r3000_interpreter_subu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -786,11 +907,11 @@ r3000_interpreter_subu(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) - r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) - r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_and(uint32_t instruction)
+r3000_interpreter_and(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -798,11 +919,11 @@ r3000_interpreter_and(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) & r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) & r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_or(uint32_t instruction)
+r3000_interpreter_or(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -810,11 +931,11 @@ r3000_interpreter_or(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) | r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) | r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_xor(uint32_t instruction)
+r3000_interpreter_xor(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -822,11 +943,11 @@ r3000_interpreter_xor(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) ^ r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) ^ r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_nor(uint32_t instruction)
+r3000_interpreter_nor(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -834,11 +955,12 @@ r3000_interpreter_nor(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, ~(r3000_read_reg(rs) | r3000_read_reg(rt)));
+    r3000_write_reg(psx, rd,
+                    ~(r3000_read_reg(psx, rs) | r3000_read_reg(psx, rt)));
 }
 
 static void
-r3000_interpreter_slt(uint32_t instruction)
+r3000_interpreter_slt(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
     uint32_t result;
@@ -847,13 +969,14 @@ r3000_interpreter_slt(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    result = (int32_t)r3000_read_reg(rs) < (int32_t)r3000_read_reg(rt);
+    result = (int32_t)r3000_read_reg(psx, rs)
+             < (int32_t)r3000_read_reg(psx, rt);
 
-    r3000_write_reg(rd, result);
+    r3000_write_reg(psx, rd, result);
 }
 
 static void
-r3000_interpreter_sltu(uint32_t instruction)
+r3000_interpreter_sltu(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rd, rs, rt;
 
@@ -861,267 +984,1023 @@ r3000_interpreter_sltu(uint32_t instruction)
     rs = R3000_RS(instruction);
     rt = R3000_RT(instruction);
 
-    r3000_write_reg(rd, r3000_read_reg(rs) < r3000_read_reg(rt));
+    r3000_write_reg(psx, rd, r3000_read_reg(psx, rs) < r3000_read_reg(psx, rt));
 }
 
-static void
-r3000_interpreter_special(uint32_t instruction)
+static r3000_interpreter_handler
+r3000_interpreter_decode_special(uint32_t instruction)
 {
     switch (R3000_FUNC(instruction)) {
     case 0x00:
-        r3000_interpreter_sll(instruction);
-        break;
+        return r3000_interpreter_sll;
     case 0x02:
-        r3000_interpreter_srl(instruction);
-        break;
+        return r3000_interpreter_srl;
     case 0x03:
-        r3000_interpreter_sra(instruction);
-        break;
+        return r3000_interpreter_sra;
     case 0x04:
-        r3000_interpreter_sllv(instruction);
-        break;
+        return r3000_interpreter_sllv;
     case 0x06:
-        r3000_interpreter_srlv(instruction);
-        break;
+        return r3000_interpreter_srlv;
     case 0x07:
-        r3000_interpreter_srav(instruction);
-        break;
+        return r3000_interpreter_srav;
     case 0x08:
-        r3000_interpreter_jr(instruction);
-        break;
+        return r3000_interpreter_jr;
     case 0x09:
-        r3000_interpreter_jalr(instruction);
-        break;
+        return r3000_interpreter_jalr;
     case 0x0c:
-        r3000_interpreter_syscall(instruction);
-        break;
+        return r3000_interpreter_syscall;
     case 0x0d:
-        r3000_interpreter_break(instruction);
-        break;
+        return r3000_interpreter_break;
     case 0x10:
-        r3000_interpreter_mfhi(instruction);
-        break;
+        return r3000_interpreter_mfhi;
     case 0x11:
-        r3000_interpreter_mthi(instruction);
-        break;
+        return r3000_interpreter_mthi;
     case 0x12:
-        r3000_interpreter_mflo(instruction);
-        break;
+        return r3000_interpreter_mflo;
     case 0x13:
-        r3000_interpreter_mtlo(instruction);
-        break;
+        return r3000_interpreter_mtlo;
     case 0x18:
-        r3000_interpreter_mult(instruction);
-        break;
+        return r3000_interpreter_mult;
     case 0x19:
-        r3000_interpreter_multu(instruction);
-        break;
+        return r3000_interpreter_multu;
     case 0x1a:
-        r3000_interpreter_div(instruction);
-        break;
+        return r3000_interpreter_div;
     case 0x1b:
-        r3000_interpreter_divu(instruction);
-        break;
+        return r3000_interpreter_divu;
     case 0x20:
-        r3000_interpreter_add(instruction);
-        break;
+        return r3000_interpreter_add;
     case 0x21:
-        r3000_interpreter_addu(instruction);
-        break;
+        return r3000_interpreter_addu;
     case 0x22:
-        r3000_interpreter_sub(instruction);
-        break;
+        return r3000_interpreter_sub;
     case 0x23:
-        r3000_interpreter_subu(instruction);
-        break;
+        return r3000_interpreter_subu;
     case 0x24:
-        r3000_interpreter_and(instruction);
-        break;
+        return r3000_interpreter_and;
     case 0x25:
-        r3000_interpreter_or(instruction);
-        break;
+        return r3000_interpreter_or;
     case 0x26:
-        r3000_interpreter_xor(instruction);
-        break;
+        return r3000_interpreter_xor;
     case 0x27:
-        r3000_interpreter_nor(instruction);
-        break;
+        return r3000_interpreter_nor;
     case 0x2a:
-        r3000_interpreter_slt(instruction);
-        break;
+        return r3000_interpreter_slt;
     case 0x2b:
-        r3000_interpreter_sltu(instruction);
-        break;
+        return r3000_interpreter_sltu;
     default:
-        printf("r3000_interpreter: error: unknown instruction 0x%08x\n",
-               instruction);
-        PANIC;
-        break;
+        return r3000_interpreter_unknown;
     }
 }
 
 static void
-r3000_interpreter_mfc0(uint32_t instruction)
+r3000_interpreter_mfc0(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rd;
 
     rt = R3000_RT(instruction);
     rd = R3000_RD(instruction);
 
-    r3000_write_reg(rt, r3000_cop0_read(rd));
+    r3000_write_reg(psx, rt, r3000_cop0_read(psx, rd));
 }
 
 static void
-r3000_interpreter_mtc0(uint32_t instruction)
+r3000_interpreter_mtc0(struct psx_machine *psx, uint32_t instruction)
 {
     unsigned int rt, rd;
 
     rt = R3000_RT(instruction);
     rd = R3000_RD(instruction);
 
-    r3000_cop0_write(rd, r3000_read_reg(rt));
+    r3000_cop0_write(psx, rd, r3000_read_reg(psx, rt));
 }
 
 static void
-r3000_interpreter_rfe(uint32_t instruction)
+r3000_interpreter_rfe(struct psx_machine *psx, uint32_t instruction)
 {
     (void)instruction;
 
-    r3000_exit_exception();
+    r3000_exit_exception(psx);
 }
 
 static void
-r3000_interpreter_cop0(uint32_t instruction)
+r3000_interpreter_unknown_cop0(struct psx_machine *psx, uint32_t instruction)
+{
+    (void)psx;
+
+    printf("r3000_interpreter: error: unknown cop0 instruction 0x%08x\n",
+           instruction);
+    PANIC;
+}
+
+static r3000_interpreter_handler
+r3000_interpreter_decode_cop0(uint32_t instruction)
 {
     switch (R3000_RS(instruction)) {
     case 0x00:
-        r3000_interpreter_mfc0(instruction);
-        break;
+        return r3000_interpreter_mfc0;
     case 0x04:
-        r3000_interpreter_mtc0(instruction);
-        break;
+        return r3000_interpreter_mtc0;
     case 0x10:
-        r3000_interpreter_rfe(instruction);
-        break;
+        return r3000_interpreter_rfe;
     default:
-        printf("r3000_interpreter: error: unknown cop0 instruction 0x%08x\n",
-               instruction);
-        PANIC;
-        break;
+        return r3000_interpreter_unknown_cop0;
     }
 }
 
-void r3000_interpreter_execute(void)
+static void
+r3000_interpreter_mfc2(struct psx_machine *psx, uint32_t instruction)
 {
-    uint32_t pc;
-    uint32_t instruction;
+    unsigned int rt, rd;
 
-    //char disasm_buf[64];
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
 
-    pc = r3000_read_pc();
-    instruction = r3000_read_code();
+    r3000_write_reg(psx, rt, gte_read_data(psx, rd));
+}
 
-    //r3000_disassembler_disassemble(disasm_buf, sizeof(disasm_buf),
-    //                               instruction, pc);
+static void
+r3000_interpreter_cfc2(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rt, rd;
 
-    //printf("0x%08x: %s\n", pc, disasm_buf);
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
 
-    if (instruction == 0) {
+    r3000_write_reg(psx, rt, gte_read_control(psx, rd));
+}
+
+static void
+r3000_interpreter_mtc2(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rt, rd;
+
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
+
+    gte_write_data(psx, rd, r3000_read_reg(psx, rt));
+}
+
+static void
+r3000_interpreter_ctc2(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rt, rd;
+
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
+
+    gte_write_control(psx, rd, r3000_read_reg(psx, rt));
+}
+
+static void
+r3000_interpreter_cop2(struct psx_machine *psx, uint32_t instruction)
+{
+    gte_execute(psx, instruction);
+}
+
+static void
+r3000_interpreter_unknown_cop2(struct psx_machine *psx, uint32_t instruction)
+{
+    (void)psx;
+
+    printf("r3000_interpreter: error: unknown cop2 instruction 0x%08x\n",
+           instruction);
+    PANIC;
+}
+
+static r3000_interpreter_handler
+r3000_interpreter_decode_cop2(uint32_t instruction)
+{
+    /* Bit 25 set makes the rest of the instruction a GTE command */
+    if (instruction & (1 << 25)) {
+        return r3000_interpreter_cop2;
+    }
+
+    switch (R3000_RS(instruction)) {
+    case 0x00:
+        return r3000_interpreter_mfc2;
+    case 0x02:
+        return r3000_interpreter_cfc2;
+    case 0x04:
+        return r3000_interpreter_mtc2;
+    case 0x06:
+        return r3000_interpreter_ctc2;
+    default:
+        return r3000_interpreter_unknown_cop2;
+    }
+}
+
+static void
+r3000_interpreter_lwc2(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rt, rs;
+    uint32_t offset, address;
+
+    rt = R3000_RT(instruction);
+    rs = R3000_RS(instruction);
+    offset = R3000_IMM_SE(instruction);
+
+    address = r3000_read_reg(psx, rs) + offset;
+
+    if (address & 0x3) {
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
+        return;
+    }
+
+    gte_write_data(psx, rt, r3000_read_memory32(psx, address));
+}
+
+static void
+r3000_interpreter_swc2(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rt, rs;
+    uint32_t offset, address;
+
+    rt = R3000_RT(instruction);
+    rs = R3000_RS(instruction);
+    offset = R3000_IMM_SE(instruction);
+
+    address = r3000_read_reg(psx, rs) + offset;
+
+    if (address & 0x3) {
+        r3000_exception(psx, R3000_EXCEPTION_ADDRESS_STORE);
         return;
     }
 
+    r3000_write_memory32(psx, address, gte_read_data(psx, rt));
+}
+
+r3000_interpreter_handler
+r3000_interpreter_decode(uint32_t instruction)
+{
+    if (instruction == 0) {
+        return r3000_interpreter_nop;
+    }
+
     switch (R3000_OPCODE(instruction)) {
     case 0x00:
-        r3000_interpreter_special(instruction);
-        break;
+        return r3000_interpreter_decode_special(instruction);
     case 0x01:
-        r3000_interpreter_bcond(instruction);
-        break;
+        return r3000_interpreter_bcond;
     case 0x02:
-        r3000_interpreter_j(instruction, pc);
-        break;
+        return r3000_interpreter_j;
     case 0x03:
-        r3000_interpreter_jal(instruction, pc);
-        break;
+        return r3000_interpreter_jal;
     case 0x04:
-        r3000_interpreter_beq(instruction);
-        break;
+        return r3000_interpreter_beq;
     case 0x05:
-        r3000_interpreter_bne(instruction);
-        break;
+        return r3000_interpreter_bne;
     case 0x06:
-        r3000_interpreter_blez(instruction);
-        break;
+        return r3000_interpreter_blez;
     case 0x07:
-        r3000_interpreter_bgtz(instruction);
-        break;
+        return r3000_interpreter_bgtz;
     case 0x08:
-        r3000_interpreter_addi(instruction);
-        break;
+        return r3000_interpreter_addi;
     case 0x09:
-        r3000_interpreter_addiu(instruction);
-        break;
+        return r3000_interpreter_addiu;
     case 0x0a:
-        r3000_interpreter_slti(instruction);
-        break;
+        return r3000_interpreter_slti;
     case 0x0b:
-        r3000_interpreter_sltiu(instruction);
-        break;
+        return r3000_interpreter_sltiu;
     case 0x0c:
-        r3000_interpreter_andi(instruction);
-        break;
+        return r3000_interpreter_andi;
     case 0x0d:
-        r3000_interpreter_ori(instruction);
-        break;
+        return r3000_interpreter_ori;
     case 0x0e:
-        r3000_interpreter_xori(instruction);
-        break;
+        return r3000_interpreter_xori;
     case 0x0f:
-        r3000_interpreter_lui(instruction);
-        break;
+        return r3000_interpreter_lui;
     case 0x10:
-        r3000_interpreter_cop0(instruction);
-        break;
+        return r3000_interpreter_decode_cop0(instruction);
+    case 0x12:
+        return r3000_interpreter_decode_cop2(instruction);
     case 0x20:
-        r3000_interpreter_lb(instruction);
-        break;
+        return r3000_interpreter_lb;
     case 0x21:
-        r3000_interpreter_lh(instruction);
-        break;
+        return r3000_interpreter_lh;
     case 0x22:
-        r3000_interpreter_lwl(instruction);
-        break;
+        return r3000_interpreter_lwl;
     case 0x23:
-        r3000_interpreter_lw(instruction);
-        break;
+        return r3000_interpreter_lw;
     case 0x24:
-        r3000_interpreter_lbu(instruction);
-        break;
+        return r3000_interpreter_lbu;
     case 0x25:
-        r3000_interpreter_lhu(instruction);
-        break;
+        return r3000_interpreter_lhu;
     case 0x26:
-        r3000_interpreter_lwr(instruction);
-        break;
+        return r3000_interpreter_lwr;
     case 0x28:
-        r3000_interpreter_sb(instruction);
-        break;
+        return r3000_interpreter_sb;
     case 0x29:
-        r3000_interpreter_sh(instruction);
-        break;
+        return r3000_interpreter_sh;
     case 0x2a:
-        r3000_interpreter_swl(instruction);
-        break;
+        return r3000_interpreter_swl;
     case 0x2b:
-        r3000_interpreter_sw(instruction);
-        break;
+        return r3000_interpreter_sw;
     case 0x2e:
-        r3000_interpreter_swr(instruction);
+        return r3000_interpreter_swr;
+    case 0x32:
+        return r3000_interpreter_lwc2;
+    case 0x3a:
+        return r3000_interpreter_swc2;
+    default:
+        return r3000_interpreter_unknown;
+    }
+}
+
+static bool
+r3000_interpreter_is_block_end(r3000_interpreter_handler handler)
+{
+    return handler == r3000_interpreter_syscall
+           || handler == r3000_interpreter_break
+           || handler == r3000_interpreter_rfe
+           || handler == r3000_interpreter_unknown
+           || handler == r3000_interpreter_unknown_cop0
+           || handler == r3000_interpreter_unknown_cop2;
+}
+
+static unsigned int
+r3000_interpreter_dest(unsigned int reg)
+{
+    return reg == 0 ? R3000_REGISTER_SCRATCH : reg;
+}
+
+static enum r3000_interpreter_kind
+r3000_interpreter_predecode_special(uint32_t instruction)
+{
+    switch (R3000_FUNC(instruction)) {
+    case 0x00:
+        return R3000_OP_SLL;
+    case 0x02:
+        return R3000_OP_SRL;
+    case 0x03:
+        return R3000_OP_SRA;
+    case 0x04:
+        return R3000_OP_SLLV;
+    case 0x06:
+        return R3000_OP_SRLV;
+    case 0x07:
+        return R3000_OP_SRAV;
+    case 0x08:
+        return R3000_OP_JR;
+    case 0x09:
+        return R3000_OP_JALR;
+    case 0x10:
+        return R3000_OP_MFHI;
+    case 0x11:
+        return R3000_OP_MTHI;
+    case 0x12:
+        return R3000_OP_MFLO;
+    case 0x13:
+        return R3000_OP_MTLO;
+    case 0x18:
+        return R3000_OP_MULT;
+    case 0x19:
+        return R3000_OP_MULTU;
+    case 0x1a:
+        return R3000_OP_DIV;
+    case 0x1b:
+        return R3000_OP_DIVU;
+    case 0x20:
+        return R3000_OP_ADD;
+    case 0x21:
+        return R3000_OP_ADDU;
+    case 0x22:
+        return R3000_OP_SUB;
+    case 0x23:
+        return R3000_OP_SUBU;
+    case 0x24:
+        return R3000_OP_AND;
+    case 0x25:
+        return R3000_OP_OR;
+    case 0x26:
+        return R3000_OP_XOR;
+    case 0x27:
+        return R3000_OP_NOR;
+    case 0x2a:
+        return R3000_OP_SLT;
+    case 0x2b:
+        return R3000_OP_SLTU;
+    default:
+        return R3000_OP_FALLBACK;
+    }
+}
+
+static enum r3000_interpreter_kind
+r3000_interpreter_predecode_kind(uint32_t instruction)
+{
+    if (instruction == 0) {
+        return R3000_OP_NOP;
+    }
+
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        return r3000_interpreter_predecode_special(instruction);
+    case 0x01:
+        return R3000_OP_BCOND;
+    case 0x02:
+        return R3000_OP_J;
+    case 0x03:
+        return R3000_OP_JAL;
+    case 0x04:
+        return R3000_OP_BEQ;
+    case 0x05:
+        return R3000_OP_BNE;
+    case 0x06:
+        return R3000_OP_BLEZ;
+    case 0x07:
+        return R3000_OP_BGTZ;
+    case 0x08:
+        return R3000_OP_ADDI;
+    case 0x09:
+        return R3000_OP_ADDIU;
+    case 0x0a:
+        return R3000_OP_SLTI;
+    case 0x0b:
+        return R3000_OP_SLTIU;
+    case 0x0c:
+        return R3000_OP_ANDI;
+    case 0x0d:
+        return R3000_OP_ORI;
+    case 0x0e:
+        return R3000_OP_XORI;
+    case 0x0f:
+        return R3000_OP_LUI;
+    case 0x10:
+    case 0x2a:
+    case 0x2e:
+    case 0x3a:
+        return R3000_OP_FALLBACK_CHECK;
+    case 0x20:
+        return R3000_OP_LB;
+    case 0x21:
+        return R3000_OP_LH;
+    case 0x23:
+        return R3000_OP_LW;
+    case 0x24:
+        return R3000_OP_LBU;
+    case 0x25:
+        return R3000_OP_LHU;
+    case 0x28:
+        return R3000_OP_SB;
+    case 0x29:
+        return R3000_OP_SH;
+    case 0x2b:
+        return R3000_OP_SW;
+    default:
+        return R3000_OP_FALLBACK;
+    }
+}
+
+static void
+r3000_interpreter_predecode(struct r3000_interpreter_op *op,
+                            uint32_t instruction, bool delay_slot)
+{
+    unsigned int rt;
+
+    rt = R3000_RT(instruction);
+
+    op->handler = NULL;
+    op->fallback = r3000_interpreter_decode(instruction);
+    op->instruction = instruction;
+    op->kind = r3000_interpreter_predecode_kind(instruction);
+    op->rs = R3000_RS(instruction);
+    op->rt = rt;
+    op->rd = r3000_interpreter_dest(R3000_RD(instruction));
+    op->delay_slot = delay_slot;
+
+    switch (op->kind) {
+    case R3000_OP_SLL:
+    case R3000_OP_SRL:
+    case R3000_OP_SRA:
+        op->imm = R3000_SHIFT(instruction);
+        break;
+    case R3000_OP_ANDI:
+    case R3000_OP_ORI:
+    case R3000_OP_XORI:
+        op->imm = R3000_IMM(instruction);
+        op->rt = r3000_interpreter_dest(rt);
+        break;
+    case R3000_OP_LUI:
+        op->imm = R3000_IMM(instruction) << 16;
+        op->rt = r3000_interpreter_dest(rt);
+        break;
+    case R3000_OP_ADDI:
+    case R3000_OP_ADDIU:
+    case R3000_OP_SLTI:
+    case R3000_OP_SLTIU:
+    case R3000_OP_LB:
+    case R3000_OP_LH:
+    case R3000_OP_LW:
+    case R3000_OP_LBU:
+    case R3000_OP_LHU:
+        op->imm = R3000_IMM_SE(instruction);
+        op->rt = r3000_interpreter_dest(rt);
+        break;
+    case R3000_OP_BCOND:
+        /* rt holds the condition, rd the link register if any */
+        op->imm = (R3000_IMM_SE(instruction) << 2) + 4;
+        op->rt = rt & 0x1;
+        op->rd = (rt & 0x1e) == 0x10 ? 31 : R3000_REGISTER_SCRATCH;
+        break;
+    case R3000_OP_J:
+    case R3000_OP_JAL:
+        op->imm = R3000_TARGET(instruction) << 2;
+        break;
+    case R3000_OP_BEQ:
+    case R3000_OP_BNE:
+    case R3000_OP_BLEZ:
+    case R3000_OP_BGTZ:
+        op->imm = (R3000_IMM_SE(instruction) << 2) + 4;
         break;
     default:
-        printf("r3000_interpreter: error: unknown instruction 0x%08x\n",
-               instruction);
-        PANIC;
+        op->imm = R3000_IMM_SE(instruction);
         break;
+    }
+}
+
+static struct r3000_interpreter_block *
+r3000_interpreter_compile(struct psx_machine *psx, uint32_t address)
+{
+    struct r3000_interpreter_op ops[R3000_INTERPRETER_MAX_BLOCK_SIZE + 1];
+    uint32_t instructions[R3000_INTERPRETER_MAX_BLOCK_SIZE + 1];
+    struct r3000_interpreter_block *block;
+    uint32_t instruction;
+    unsigned int length;
+    bool delay_slot;
+
+    length = 0;
+    delay_slot = false;
+
+    for (;;) {
+        instruction = psx_debug_read_memory32(psx, address + length * 4);
+        r3000_interpreter_predecode(&ops[length], instruction, delay_slot);
+        instructions[length++] = instruction;
+
+        if (delay_slot) {
+            /* Branches in delay slots are left to single stepping */
+            if (R3000_OP_IS_BRANCH(ops[length - 1].kind)) {
+                length -= 2;
+            }
+
+            break;
+        }
+
+        /* Branches always take their delay slot with them */
+        if (R3000_OP_IS_BRANCH(ops[length - 1].kind)) {
+            delay_slot = true;
+            continue;
+        }
+
+        if (r3000_interpreter_is_block_end(ops[length - 1].fallback)) {
+            break;
+        }
+
+        if (length == R3000_INTERPRETER_MAX_BLOCK_SIZE) {
+            break;
+        }
+
+        if ((address + length * 4) % R3000_CACHE_PAGE_SIZE == 0) {
+            break;
+        }
+    }
+
+    if (length == 0) {
+        return NULL;
+    }
+
+    block = malloc(sizeof(*block) + (length + 1) * sizeof(block->ops[0]));
+    assert(block);
+
+    block->base.address = address;
+    block->base.size = length * 4;
+    block->base.idle = r3000_idle_detect(instructions, length);
+    block->length = length;
+
+    for (unsigned int i = 0; i < length; ++i) {
+        block->ops[i] = ops[i];
+    }
+
+    block->ops[length].kind = R3000_OP_END;
+
+    return block;
+}
+
+/* Brings the architectural pc state up to date before leaving the block */
+static void
+r3000_interpreter_sync(struct r3000 *r3000, uint32_t address, bool delay_slot)
+{
+    r3000->current_pc = address;
+    r3000->pc = address + 4;
+    r3000->next_pc = address + 8;
+    r3000->branch_delay = delay_slot;
+}
+
+void
+r3000_interpreter_execute(struct psx_machine *psx)
+{
+    uint32_t instruction;
+
+    //char disasm_buf[64];
+
+    instruction = r3000_read_code(psx);
+
+    //r3000_disassembler_disassemble(disasm_buf, sizeof(disasm_buf),
+    //                               instruction, r3000_read_current_pc(psx));
+
+    //printf("0x%08x: %s\n", r3000_read_current_pc(psx), disasm_buf);
+
+    if (instruction == 0) {
+        return;
+    }
+
+    r3000_interpreter_decode(instruction)(psx, instruction);
+}
+
+unsigned int
+r3000_interpreter_execute_block(struct psx_machine *psx)
+{
+    static const void *labels[R3000_NR_OPS] = {
+        [R3000_OP_END] = &&op_end,
+        [R3000_OP_NOP] = &&op_nop,
+        [R3000_OP_SLL] = &&op_sll,
+        [R3000_OP_SRL] = &&op_srl,
+        [R3000_OP_SRA] = &&op_sra,
+        [R3000_OP_SLLV] = &&op_sllv,
+        [R3000_OP_SRLV] = &&op_srlv,
+        [R3000_OP_SRAV] = &&op_srav,
+        [R3000_OP_MFHI] = &&op_mfhi,
+        [R3000_OP_MTHI] = &&op_mthi,
+        [R3000_OP_MFLO] = &&op_mflo,
+        [R3000_OP_MTLO] = &&op_mtlo,
+        [R3000_OP_MULT] = &&op_mult,
+        [R3000_OP_MULTU] = &&op_multu,
+        [R3000_OP_DIV] = &&op_div,
+        [R3000_OP_DIVU] = &&op_divu,
+        [R3000_OP_ADD] = &&op_add,
+        [R3000_OP_ADDU] = &&op_addu,
+        [R3000_OP_SUB] = &&op_sub,
+        [R3000_OP_SUBU] = &&op_subu,
+        [R3000_OP_AND] = &&op_and,
+        [R3000_OP_OR] = &&op_or,
+        [R3000_OP_XOR] = &&op_xor,
+        [R3000_OP_NOR] = &&op_nor,
+        [R3000_OP_SLT] = &&op_slt,
+        [R3000_OP_SLTU] = &&op_sltu,
+        [R3000_OP_ADDI] = &&op_addi,
+        [R3000_OP_ADDIU] = &&op_addiu,
+        [R3000_OP_SLTI] = &&op_slti,
+        [R3000_OP_SLTIU] = &&op_sltiu,
+        [R3000_OP_ANDI] = &&op_andi,
+        [R3000_OP_ORI] = &&op_ori,
+        [R3000_OP_XORI] = &&op_xori,
+        [R3000_OP_LUI] = &&op_lui,
+        [R3000_OP_LB] = &&op_lb,
+        [R3000_OP_LH] = &&op_lh,
+        [R3000_OP_LW] = &&op_lw,
+        [R3000_OP_LBU] = &&op_lbu,
+        [R3000_OP_LHU] = &&op_lhu,
+        [R3000_OP_SB] = &&op_sb,
+        [R3000_OP_SH] = &&op_sh,
+        [R3000_OP_SW] = &&op_sw,
+        [R3000_OP_BCOND] = &&op_bcond,
+        [R3000_OP_J] = &&op_j,
+        [R3000_OP_JAL] = &&op_jal,
+        [R3000_OP_BEQ] = &&op_beq,
+        [R3000_OP_BNE] = &&op_bne,
+        [R3000_OP_BLEZ] = &&op_blez,
+        [R3000_OP_BGTZ] = &&op_bgtz,
+        [R3000_OP_JR] = &&op_jr,
+        [R3000_OP_JALR] = &&op_jalr,
+        [R3000_OP_FALLBACK] = &&op_fallback,
+        [R3000_OP_FALLBACK_CHECK] = &&op_fallback
     };
+
+    struct r3000 *r3000;
+    struct r3000_interpreter_block *block;
+    const struct r3000_interpreter_op *op;
+    uint32_t *gpr;
+    uint32_t base, address, next, value;
+    uint64_t result;
+    int32_t n, d;
+
+#define OP_INDEX        ((unsigned int)(op - block->ops))
+#define OP_ADDRESS      (base + OP_INDEX * 4)
+#define NEXT            goto *(++op)->handler
+
+    r3000_cache_collect(psx);
+
+    r3000 = &psx->r3000;
+    base = r3000->pc;
+    address = r3000_translate_virtaddr(base);
+
+    /* Pending delay slots and interrupts are left to single stepping */
+    if ((base & 0x3) || r3000->branch || r3000->interrupt
+        || !r3000_cache_cacheable(psx, address)) {
+        r3000_interpreter_execute(psx);
+        return 1;
+    }
+
+    block = (struct r3000_interpreter_block *)r3000_cache_lookup(psx, address);
+
+    if (!block) {
+        block = r3000_interpreter_compile(psx, address);
+
+        if (!block) {
+            r3000_interpreter_execute(psx);
+            return 1;
+        }
+
+        for (unsigned int i = 0; i <= block->length; ++i) {
+            block->ops[i].handler = labels[block->ops[i].kind];
+        }
+
+        r3000_cache_insert(psx, &block->base);
+    }
+
+    gpr = r3000->gpr;
+    next = base + block->length * 4;
+
+    op = block->ops;
+    goto *op->handler;
+
+op_nop:
+    NEXT;
+op_sll:
+    gpr[op->rd] = gpr[op->rt] << op->imm;
+    NEXT;
+op_srl:
+    gpr[op->rd] = gpr[op->rt] >> op->imm;
+    NEXT;
+op_sra:
+    gpr[op->rd] = (int32_t)gpr[op->rt] >> op->imm;
+    NEXT;
+op_sllv:
+    gpr[op->rd] = gpr[op->rt] << (gpr[op->rs] & 0x1f);
+    NEXT;
+op_srlv:
+    gpr[op->rd] = gpr[op->rt] >> (gpr[op->rs] & 0x1f);
+    NEXT;
+op_srav:
+    gpr[op->rd] = (int32_t)gpr[op->rt] >> (gpr[op->rs] & 0x1f);
+    NEXT;
+op_mfhi:
+    gpr[op->rd] = gpr[R3000_REGISTER_HI];
+    NEXT;
+op_mthi:
+    gpr[R3000_REGISTER_HI] = gpr[op->rs];
+    NEXT;
+op_mflo:
+    gpr[op->rd] = gpr[R3000_REGISTER_LO];
+    NEXT;
+op_mtlo:
+    gpr[R3000_REGISTER_LO] = gpr[op->rs];
+    NEXT;
+op_mult:
+    result = (int64_t)(int32_t)gpr[op->rs] * (int32_t)gpr[op->rt];
+    gpr[R3000_REGISTER_HI] = result >> 32;
+    gpr[R3000_REGISTER_LO] = result;
+    NEXT;
+op_multu:
+    result = (uint64_t)gpr[op->rs] * gpr[op->rt];
+    gpr[R3000_REGISTER_HI] = result >> 32;
+    gpr[R3000_REGISTER_LO] = result;
+    NEXT;
+op_div:
+    n = gpr[op->rs];
+    d = gpr[op->rt];
+
+    if (d == 0) {
+        gpr[R3000_REGISTER_HI] = n;
+        gpr[R3000_REGISTER_LO] = n >= 0 ? -1 : 1;
+    } else if (n == INT32_MIN && d == -1) {
+        gpr[R3000_REGISTER_HI] = 0;
+        gpr[R3000_REGISTER_LO] = INT32_MIN;
+    } else {
+        gpr[R3000_REGISTER_HI] = n % d;
+        gpr[R3000_REGISTER_LO] = n / d;
+    }
+
+    NEXT;
+op_divu:
+    if (gpr[op->rt] == 0) {
+        gpr[R3000_REGISTER_HI] = gpr[op->rs];
+        gpr[R3000_REGISTER_LO] = -1;
+    } else {
+        value = gpr[op->rs];
+        gpr[R3000_REGISTER_HI] = value % gpr[op->rt];
+        gpr[R3000_REGISTER_LO] = value / gpr[op->rt];
+    }
+
+    NEXT;
+op_add:
+    value = gpr[op->rs] + gpr[op->rt];
+
+    if (overflow_u32(gpr[op->rs], gpr[op->rt], value)) {
+        goto overflow;
+    }
+
+    gpr[op->rd] = value;
+    NEXT;
+op_addu:
+    gpr[op->rd] = gpr[op->rs] + gpr[op->rt];
+    NEXT;
+op_sub:
+    value = gpr[op->rs] - gpr[op->rt];
+
+    if (overflow_u32(gpr[op->rs], gpr[op->rt], value)) {
+        goto overflow;
+    }
+
+    gpr[op->rd] = value;
+    NEXT;
+op_subu:
+    gpr[op->rd] = gpr[op->rs] - gpr[op->rt];
+    NEXT;
+op_and:
+    gpr[op->rd] = gpr[op->rs] & gpr[op->rt];
+    NEXT;
+op_or:
+    gpr[op->rd] = gpr[op->rs] | gpr[op->rt];
+    NEXT;
+op_xor:
+    gpr[op->rd] = gpr[op->rs] ^ gpr[op->rt];
+    NEXT;
+op_nor:
+    gpr[op->rd] = ~(gpr[op->rs] | gpr[op->rt]);
+    NEXT;
+op_slt:
+    gpr[op->rd] = (int32_t)gpr[op->rs] < (int32_t)gpr[op->rt];
+    NEXT;
+op_sltu:
+    gpr[op->rd] = gpr[op->rs] < gpr[op->rt];
+    NEXT;
+op_addi:
+    value = gpr[op->rs] + op->imm;
+
+    if (overflow_u32(gpr[op->rs], op->imm, value)) {
+        goto overflow;
+    }
+
+    gpr[op->rt] = value;
+    NEXT;
+op_addiu:
+    gpr[op->rt] = gpr[op->rs] + op->imm;
+    NEXT;
+op_slti:
+    gpr[op->rt] = (int32_t)gpr[op->rs] < (int32_t)op->imm;
+    NEXT;
+op_sltiu:
+    gpr[op->rt] = gpr[op->rs] < op->imm;
+    NEXT;
+op_andi:
+    gpr[op->rt] = gpr[op->rs] & op->imm;
+    NEXT;
+op_ori:
+    gpr[op->rt] = gpr[op->rs] | op->imm;
+    NEXT;
+op_xori:
+    gpr[op->rt] = gpr[op->rs] ^ op->imm;
+    NEXT;
+op_lui:
+    gpr[op->rt] = op->imm;
+    NEXT;
+op_lb:
+    gpr[op->rt] = (int8_t)r3000_read_memory8(psx, gpr[op->rs] + op->imm);
+    NEXT;
+op_lh:
+    value = gpr[op->rs] + op->imm;
+
+    if (value & 0x1) {
+        goto address_load;
+    }
+
+    gpr[op->rt] = (int16_t)r3000_read_memory16(psx, value);
+    NEXT;
+op_lw:
+    value = gpr[op->rs] + op->imm;
+
+    if (value & 0x3) {
+        goto address_load;
+    }
+
+    gpr[op->rt] = r3000_read_memory32(psx, value);
+    NEXT;
+op_lbu:
+    gpr[op->rt] = r3000_read_memory8(psx, gpr[op->rs] + op->imm);
+    NEXT;
+op_lhu:
+    value = gpr[op->rs] + op->imm;
+
+    if (value & 0x1) {
+        goto address_load;
+    }
+
+    gpr[op->rt] = r3000_read_memory16(psx, value);
+    NEXT;
+op_sb:
+    r3000_write_memory8(psx, gpr[op->rs] + op->imm, gpr[op->rt]);
+    goto store_check;
+op_sh:
+    value = gpr[op->rs] + op->imm;
+
+    if (value & 0x1) {
+        goto address_store;
+    }
+
+    r3000_write_memory16(psx, value, gpr[op->rt]);
+    goto store_check;
+op_sw:
+    value = gpr[op->rs] + op->imm;
+
+    if (value & 0x3) {
+        goto address_store;
+    }
+
+    r3000_write_memory32(psx, value, gpr[op->rt]);
+    goto store_check;
+op_bcond:
+    value = ((int32_t)gpr[op->rs] < 0) ^ op->rt;
+    gpr[op->rd] = OP_ADDRESS + 8;
+    next = value ? OP_ADDRESS + op->imm : OP_ADDRESS + 8;
+    NEXT;
+op_j:
+    next = (OP_ADDRESS & 0xf0000000) | op->imm;
+    NEXT;
+op_jal:
+    gpr[31] = OP_ADDRESS + 8;
+    next = (OP_ADDRESS & 0xf0000000) | op->imm;
+    NEXT;
+op_beq:
+    next = gpr[op->rs] == gpr[op->rt] ? OP_ADDRESS + op->imm : OP_ADDRESS + 8;
+    NEXT;
+op_bne:
+    next = gpr[op->rs] != gpr[op->rt] ? OP_ADDRESS + op->imm : OP_ADDRESS + 8;
+    NEXT;
+op_blez:
+    next = (int32_t)gpr[op->rs] <= 0 ? OP_ADDRESS + op->imm : OP_ADDRESS + 8;
+    NEXT;
+op_bgtz:
+    next = (int32_t)gpr[op->rs] > 0 ? OP_ADDRESS + op->imm : OP_ADDRESS + 8;
+    NEXT;
+op_jr:
+    next = gpr[op->rs];
+    NEXT;
+op_jalr:
+    /* The link is written before the target is read */
+    gpr[op->rd] = OP_ADDRESS + 8;
+    next = gpr[op->rs];
+    NEXT;
+op_fallback:
+    r3000_interpreter_sync(r3000, OP_ADDRESS, op->delay_slot);
+    op->fallback(psx, op->instruction);
+
+    /* An exception has already redirected the pc to its vector */
+    if (r3000->pc != OP_ADDRESS + 4) {
+        return OP_INDEX + 1;
+    }
+
+    if (op->kind == R3000_OP_FALLBACK_CHECK) {
+        goto store_check;
+    }
+
+    NEXT;
+store_check:
+    /* Delay slots end the block anyway */
+    if (op->delay_slot) {
+        NEXT;
+    }
+
+    /* Leave if the block overwrote itself or an interrupt became pending */
+    if (!block->base.valid || r3000->interrupt) {
+        r3000_interpreter_sync(r3000, OP_ADDRESS, false);
+        return OP_INDEX + 1;
+    }
+
+    NEXT;
+overflow:
+    r3000_interpreter_sync(r3000, OP_ADDRESS, op->delay_slot);
+    r3000_exception(psx, R3000_EXCEPTION_OVERFLOW);
+    return OP_INDEX + 1;
+address_load:
+    r3000_interpreter_sync(r3000, OP_ADDRESS, op->delay_slot);
+    r3000_exception(psx, R3000_EXCEPTION_ADDRESS_LOAD);
+    return OP_INDEX + 1;
+address_store:
+    r3000_interpreter_sync(r3000, OP_ADDRESS, op->delay_slot);
+    r3000_exception(psx, R3000_EXCEPTION_ADDRESS_STORE);
+    return OP_INDEX + 1;
+op_end:
+    r3000->current_pc = base + (block->length - 1) * 4;
+    r3000->pc = next;
+    r3000->next_pc = next + 4;
+    r3000->branch_delay = false;
+
+    if (block->base.idle && next == base) {
+        return r3000_idle_skip(psx, base, block->length);
+    }
+
+    return block->length;
+
+#undef OP_INDEX
+#undef OP_ADDRESS
+#undef NEXT
 }
@@ -0,0 +1,916 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000.h"
+#include "r3000_cache.h"
+#include "r3000_idle.h"
+#include "r3000_interpreter.h"
+#include "r3000_jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define R3000_JIT_X86_64
+#endif
+
+#define R3000_JIT_BUFFER_SIZE       MEGABYTES(16)
+#define R3000_JIT_MAX_BLOCK_SIZE    64
+#define R3000_JIT_MAX_BLOCK_CODE    KILOBYTES(16)
+
+#define R3000_JIT_STACK_SIZE        40 /* Keeps the stack 16-byte aligned */
+
+#define R3000_JIT_OFFSET(x)         offsetof(struct psx_machine, r3000.x)
+#define R3000_JIT_GPR(x)            (R3000_JIT_OFFSET(gpr) + (x) * sizeof(uint32_t))
+
+enum x86_reg {
+    X86_EAX,
+    X86_ECX,
+    X86_EDX,
+    X86_EBX,
+    X86_ESP,
+    X86_EBP,
+    X86_ESI,
+    X86_EDI
+};
+
+#ifdef _WIN32
+#define R3000_JIT_ARG0              X86_ECX
+#define R3000_JIT_ARG1              X86_EDX
+#else
+#define R3000_JIT_ARG0              X86_EDI
+#define R3000_JIT_ARG1              X86_ESI
+#endif
+
+enum x86_cond {
+    X86_COND_B = 0x2,
+    X86_COND_E = 0x4,
+    X86_COND_NE = 0x5,
+    X86_COND_L = 0xc,
+    X86_COND_GE = 0xd,
+    X86_COND_LE = 0xe,
+    X86_COND_G = 0xf
+};
+
+/* Opcodes of the 'op r32, r/m32' forms, shifted right by 3 they give /digit */
+enum x86_alu {
+    X86_ALU_ADD = 0x03,
+    X86_ALU_OR = 0x0b,
+    X86_ALU_AND = 0x23,
+    X86_ALU_SUB = 0x2b,
+    X86_ALU_XOR = 0x33,
+    X86_ALU_CMP = 0x3b
+};
+
+enum x86_shift {
+    X86_SHIFT_SHL = 4,
+    X86_SHIFT_SHR = 5,
+    X86_SHIFT_SAR = 7
+};
+
+typedef unsigned int (*r3000_jit_code)(struct psx_machine *psx);
+
+struct r3000_jit_block {
+    struct r3000_block base;
+
+    uint32_t vaddr;
+    r3000_jit_code code;
+};
+
+static void
+r3000_jit_emit8(struct psx_machine *psx, uint8_t value)
+{
+    *psx->r3000_jit.ptr++ = value;
+}
+
+static void
+r3000_jit_emit32(struct psx_machine *psx, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        r3000_jit_emit8(psx, value >> (i * 8));
+    }
+}
+
+static void
+r3000_jit_emit64(struct psx_machine *psx, uint64_t value)
+{
+    r3000_jit_emit32(psx, value);
+    r3000_jit_emit32(psx, value >> 32);
+}
+
+/* ModRM for [rbx + disp32], the pinned context pointer */
+static void
+r3000_jit_emit_ctx(struct psx_machine *psx, unsigned int reg, size_t offset)
+{
+    r3000_jit_emit8(psx, 0x80 | (reg << 3) | X86_EBX);
+    r3000_jit_emit32(psx, offset);
+}
+
+static void
+r3000_jit_emit_load(struct psx_machine *psx, enum x86_reg reg, size_t offset)
+{
+    r3000_jit_emit8(psx, 0x8b);
+    r3000_jit_emit_ctx(psx, reg, offset);
+}
+
+static void
+r3000_jit_emit_store(struct psx_machine *psx, enum x86_reg reg, size_t offset)
+{
+    r3000_jit_emit8(psx, 0x89);
+    r3000_jit_emit_ctx(psx, reg, offset);
+}
+
+static void
+r3000_jit_emit_store_imm(struct psx_machine *psx, size_t offset, uint32_t value)
+{
+    r3000_jit_emit8(psx, 0xc7);
+    r3000_jit_emit_ctx(psx, 0, offset);
+    r3000_jit_emit32(psx, value);
+}
+
+static void
+r3000_jit_emit_store_imm8(struct psx_machine *psx, size_t offset, uint8_t value)
+{
+    r3000_jit_emit8(psx, 0xc6);
+    r3000_jit_emit_ctx(psx, 0, offset);
+    r3000_jit_emit8(psx, value);
+}
+
+static void
+r3000_jit_emit_cmp_imm(struct psx_machine *psx, size_t offset, uint32_t value)
+{
+    r3000_jit_emit8(psx, 0x81);
+    r3000_jit_emit_ctx(psx, X86_ALU_CMP >> 3, offset);
+    r3000_jit_emit32(psx, value);
+}
+
+static void
+r3000_jit_emit_alu(struct psx_machine *psx, enum x86_alu op, enum x86_reg reg,
+                   size_t offset)
+{
+    r3000_jit_emit8(psx, op);
+    r3000_jit_emit_ctx(psx, reg, offset);
+}
+
+static void
+r3000_jit_emit_alu_imm(struct psx_machine *psx, enum x86_alu op,
+                       enum x86_reg reg, uint32_t value)
+{
+    r3000_jit_emit8(psx, 0x81);
+    r3000_jit_emit8(psx, 0xc0 | ((op >> 3) << 3) | reg);
+    r3000_jit_emit32(psx, value);
+}
+
+static void
+r3000_jit_emit_shift_imm(struct psx_machine *psx, enum x86_shift op,
+                         enum x86_reg reg, uint8_t amount)
+{
+    r3000_jit_emit8(psx, 0xc1);
+    r3000_jit_emit8(psx, 0xc0 | (op << 3) | reg);
+    r3000_jit_emit8(psx, amount);
+}
+
+static void
+r3000_jit_emit_shift_cl(struct psx_machine *psx, enum x86_shift op,
+                        enum x86_reg reg)
+{
+    r3000_jit_emit8(psx, 0xd3);
+    r3000_jit_emit8(psx, 0xc0 | (op << 3) | reg);
+}
+
+static void
+r3000_jit_emit_mov_imm(struct psx_machine *psx, enum x86_reg reg,
+                       uint32_t value)
+{
+    r3000_jit_emit8(psx, 0xb8 + reg);
+    r3000_jit_emit32(psx, value);
+}
+
+static void
+r3000_jit_emit_not(struct psx_machine *psx, enum x86_reg reg)
+{
+    r3000_jit_emit8(psx, 0xf7);
+    r3000_jit_emit8(psx, 0xd0 | reg);
+}
+
+/* setcc al; movzx eax, al */
+static void
+r3000_jit_emit_setcc(struct psx_machine *psx, enum x86_cond cond)
+{
+    r3000_jit_emit8(psx, 0x0f);
+    r3000_jit_emit8(psx, 0x90 | cond);
+    r3000_jit_emit8(psx, 0xc0);
+
+    r3000_jit_emit8(psx, 0x0f);
+    r3000_jit_emit8(psx, 0xb6);
+    r3000_jit_emit8(psx, 0xc0);
+}
+
+/* ebp = cond ? taken : not_taken */
+static void
+r3000_jit_emit_select(struct psx_machine *psx, enum x86_cond cond,
+                      uint32_t taken, uint32_t not_taken)
+{
+    r3000_jit_emit_mov_imm(psx, X86_EBP, not_taken);
+    r3000_jit_emit_mov_imm(psx, X86_ECX, taken);
+
+    r3000_jit_emit8(psx, 0x0f);
+    r3000_jit_emit8(psx, 0x40 | cond);
+    r3000_jit_emit8(psx, 0xc0 | (X86_EBP << 3) | X86_ECX);
+}
+
+/* edx:eax = eax * [rbx + offset], signed or unsigned */
+static void
+r3000_jit_emit_mul(struct psx_machine *psx, bool sign, size_t offset)
+{
+    r3000_jit_emit8(psx, 0xf7);
+    r3000_jit_emit_ctx(psx, sign ? 5 : 4, offset);
+}
+
+static void
+r3000_jit_emit_call(struct psx_machine *psx, const void *function)
+{
+    r3000_jit_emit8(psx, 0x48);
+    r3000_jit_emit8(psx, 0xb8);
+    r3000_jit_emit64(psx, (uintptr_t)function);
+
+    r3000_jit_emit8(psx, 0xff);
+    r3000_jit_emit8(psx, 0xd0);
+}
+
+static uint8_t *
+r3000_jit_emit_jcc(struct psx_machine *psx, enum x86_cond cond)
+{
+    r3000_jit_emit8(psx, 0x0f);
+    r3000_jit_emit8(psx, 0x80 | cond);
+    r3000_jit_emit32(psx, 0);
+
+    return psx->r3000_jit.ptr;
+}
+
+static void
+r3000_jit_patch(struct psx_machine *psx, uint8_t *jump)
+{
+    int32_t displacement;
+
+    displacement = psx->r3000_jit.ptr - jump;
+
+    for (int i = 0; i < 4; ++i) {
+        jump[i - 4] = displacement >> (i * 8);
+    }
+}
+
+static void
+r3000_jit_emit_prologue(struct psx_machine *psx)
+{
+    r3000_jit_emit8(psx, 0x53);                     /* push rbx */
+    r3000_jit_emit8(psx, 0x55);                     /* push rbp */
+
+    r3000_jit_emit8(psx, 0x48);                     /* sub rsp, imm8 */
+    r3000_jit_emit8(psx, 0x83);
+    r3000_jit_emit8(psx, 0xec);
+    r3000_jit_emit8(psx, R3000_JIT_STACK_SIZE);
+
+    r3000_jit_emit8(psx, 0x48);                     /* mov rbx, arg0 */
+    r3000_jit_emit8(psx, 0x89);
+    r3000_jit_emit8(psx, 0xc0 | (R3000_JIT_ARG0 << 3) | X86_EBX);
+}
+
+static void
+r3000_jit_emit_return(struct psx_machine *psx, unsigned int count)
+{
+    r3000_jit_emit_mov_imm(psx, X86_EAX, count);
+
+    r3000_jit_emit8(psx, 0x48);                     /* add rsp, imm8 */
+    r3000_jit_emit8(psx, 0x83);
+    r3000_jit_emit8(psx, 0xc4);
+    r3000_jit_emit8(psx, R3000_JIT_STACK_SIZE);
+
+    r3000_jit_emit8(psx, 0x5d);                     /* pop rbp */
+    r3000_jit_emit8(psx, 0x5b);                     /* pop rbx */
+    r3000_jit_emit8(psx, 0xc3);                     /* ret */
+}
+
+static void
+r3000_jit_emit_exit(struct psx_machine *psx, uint32_t pc, unsigned int count)
+{
+    r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(pc), pc);
+    r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(next_pc), pc + 4);
+    r3000_jit_emit_return(psx, count);
+}
+
+static bool
+r3000_jit_is_branch(uint32_t instruction)
+{
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        return R3000_FUNC(instruction) == 0x08 || R3000_FUNC(instruction) == 0x09;
+    case 0x01 ... 0x07:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool
+r3000_jit_is_block_end(uint32_t instruction)
+{
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        return R3000_FUNC(instruction) == 0x0c || R3000_FUNC(instruction) == 0x0d;
+    case 0x10:
+        return R3000_RS(instruction) == 0x10;
+    default:
+        return false;
+    }
+}
+
+static bool
+r3000_jit_is_store(uint32_t instruction)
+{
+    switch (R3000_OPCODE(instruction)) {
+    case 0x28 ... 0x2e:
+    case 0x3a:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Stores and COP0 writes may make an interrupt deliverable */
+static bool
+r3000_jit_may_raise_irq(uint32_t instruction)
+{
+    return R3000_OPCODE(instruction) == 0x10 || r3000_jit_is_store(instruction);
+}
+
+/* Leaves the guest branch destination in ebp for the end of the block */
+static void
+r3000_jit_emit_branch(struct psx_machine *psx, uint32_t instruction,
+                      uint32_t address)
+{
+    unsigned int rs, rt, rd;
+    uint32_t target, next;
+
+    rs = R3000_RS(instruction);
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
+
+    target = address + 4 + (R3000_IMM_SE(instruction) << 2);
+    next = address + 8;
+
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        /* Like the interpreter, JALR links before reading its target */
+        if (R3000_FUNC(instruction) == 0x09 && rd != 0) {
+            r3000_jit_emit_store_imm(psx, R3000_JIT_GPR(rd), next);
+        }
+
+        r3000_jit_emit_load(psx, X86_EBP, R3000_JIT_GPR(rs));
+        break;
+    case 0x01:
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu_imm(psx, X86_ALU_CMP, X86_EAX, 0);
+        r3000_jit_emit_select(psx, (rt & 0x1) ? X86_COND_GE : X86_COND_L,
+                              target, next);
+
+        if ((rt & 0x1e) == 0x10) {
+            r3000_jit_emit_store_imm(psx, R3000_JIT_GPR(31), next);
+        }
+
+        break;
+    case 0x02:
+    case 0x03:
+        if (R3000_OPCODE(instruction) == 0x03) {
+            r3000_jit_emit_store_imm(psx, R3000_JIT_GPR(31), next);
+        }
+
+        target = (address & 0xf0000000) | (R3000_TARGET(instruction) << 2);
+        r3000_jit_emit_mov_imm(psx, X86_EBP, target);
+        break;
+    case 0x04:
+    case 0x05:
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu(psx, X86_ALU_CMP, X86_EAX, R3000_JIT_GPR(rt));
+        r3000_jit_emit_select(psx,
+                              R3000_OPCODE(instruction) == 0x04 ? X86_COND_E
+                                                                : X86_COND_NE,
+                              target, next);
+        break;
+    case 0x06:
+    case 0x07:
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu_imm(psx, X86_ALU_CMP, X86_EAX, 0);
+        r3000_jit_emit_select(psx,
+                              R3000_OPCODE(instruction) == 0x06 ? X86_COND_LE
+                                                                : X86_COND_G,
+                              target, next);
+        break;
+    default:
+        PANIC;
+        break;
+    }
+}
+
+/* sll/sllv, srl/srlv and sra/srav differ only in the low two function bits */
+static enum x86_shift
+r3000_jit_shift_op(uint32_t instruction)
+{
+    switch (R3000_FUNC(instruction) & 0x3) {
+    case 0x0:
+        return X86_SHIFT_SHL;
+    case 0x2:
+        return X86_SHIFT_SHR;
+    default:
+        return X86_SHIFT_SAR;
+    }
+}
+
+static bool
+r3000_jit_emit_special(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rs, rt, rd, shift;
+    enum x86_alu op;
+
+    rs = R3000_RS(instruction);
+    rt = R3000_RT(instruction);
+    rd = R3000_RD(instruction);
+    shift = R3000_SHIFT(instruction);
+
+    switch (R3000_FUNC(instruction)) {
+    case 0x00:
+    case 0x02:
+    case 0x03:
+        if (rd == 0) {
+            return true;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rt));
+
+        if (shift) {
+            r3000_jit_emit_shift_imm(psx, r3000_jit_shift_op(instruction),
+                                     X86_EAX, shift);
+        }
+
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rd));
+        return true;
+    case 0x04:
+    case 0x06:
+    case 0x07:
+        if (rd == 0) {
+            return true;
+        }
+
+        r3000_jit_emit_load(psx, X86_ECX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rt));
+        r3000_jit_emit_shift_cl(psx, r3000_jit_shift_op(instruction), X86_EAX);
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rd));
+        return true;
+    case 0x10:
+    case 0x12:
+        if (rd == 0) {
+            return true;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX,
+                            R3000_JIT_GPR(R3000_FUNC(instruction) == 0x10
+                                          ? R3000_REGISTER_HI
+                                          : R3000_REGISTER_LO));
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rd));
+        return true;
+    case 0x11:
+    case 0x13:
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_store(psx, X86_EAX,
+                             R3000_JIT_GPR(R3000_FUNC(instruction) == 0x11
+                                           ? R3000_REGISTER_HI
+                                           : R3000_REGISTER_LO));
+        return true;
+    case 0x18:
+    case 0x19:
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_mul(psx, R3000_FUNC(instruction) == 0x18,
+                           R3000_JIT_GPR(rt));
+        r3000_jit_emit_store(psx, X86_EDX, R3000_JIT_GPR(R3000_REGISTER_HI));
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(R3000_REGISTER_LO));
+        return true;
+    case 0x21:
+    case 0x23:
+    case 0x24:
+    case 0x25:
+    case 0x26:
+    case 0x27:
+        if (rd == 0) {
+            return true;
+        }
+
+        switch (R3000_FUNC(instruction)) {
+        case 0x21:
+            op = X86_ALU_ADD;
+            break;
+        case 0x23:
+            op = X86_ALU_SUB;
+            break;
+        case 0x24:
+            op = X86_ALU_AND;
+            break;
+        case 0x26:
+            op = X86_ALU_XOR;
+            break;
+        default:
+            op = X86_ALU_OR;
+            break;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu(psx, op, X86_EAX, R3000_JIT_GPR(rt));
+
+        if (R3000_FUNC(instruction) == 0x27) {
+            r3000_jit_emit_not(psx, X86_EAX);
+        }
+
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rd));
+        return true;
+    case 0x2a:
+    case 0x2b:
+        if (rd == 0) {
+            return true;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu(psx, X86_ALU_CMP, X86_EAX, R3000_JIT_GPR(rt));
+        r3000_jit_emit_setcc(psx, R3000_FUNC(instruction) == 0x2a
+                                  ? X86_COND_L : X86_COND_B);
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rd));
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool
+r3000_jit_emit_native(struct psx_machine *psx, uint32_t instruction)
+{
+    unsigned int rs, rt;
+    uint32_t imm, imm_se;
+    enum x86_alu op;
+
+    rs = R3000_RS(instruction);
+    rt = R3000_RT(instruction);
+    imm = R3000_IMM(instruction);
+    imm_se = R3000_IMM_SE(instruction);
+
+    switch (R3000_OPCODE(instruction)) {
+    case 0x00:
+        return r3000_jit_emit_special(psx, instruction);
+    case 0x09:
+    case 0x0c:
+    case 0x0d:
+    case 0x0e:
+        if (rt == 0) {
+            return true;
+        }
+
+        switch (R3000_OPCODE(instruction)) {
+        case 0x09:
+            op = X86_ALU_ADD;
+            break;
+        case 0x0c:
+            op = X86_ALU_AND;
+            break;
+        case 0x0d:
+            op = X86_ALU_OR;
+            break;
+        default:
+            op = X86_ALU_XOR;
+            break;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu_imm(psx, op, X86_EAX,
+                               op == X86_ALU_ADD ? imm_se : imm);
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rt));
+        return true;
+    case 0x0a:
+    case 0x0b:
+        if (rt == 0) {
+            return true;
+        }
+
+        r3000_jit_emit_load(psx, X86_EAX, R3000_JIT_GPR(rs));
+        r3000_jit_emit_alu_imm(psx, X86_ALU_CMP, X86_EAX, imm_se);
+        r3000_jit_emit_setcc(psx, R3000_OPCODE(instruction) == 0x0a
+                                  ? X86_COND_L : X86_COND_B);
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_GPR(rt));
+        return true;
+    case 0x0f:
+        if (rt != 0) {
+            r3000_jit_emit_store_imm(psx, R3000_JIT_GPR(rt), imm << 16);
+        }
+
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Everything else, including COP0 and anything that may raise an exception */
+static void
+r3000_jit_emit_fallback(struct psx_machine *psx, struct r3000_jit_block *block,
+                        uint32_t instruction, uint32_t address,
+                        unsigned int count, bool delay_slot)
+{
+    uint8_t *skip;
+
+    r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(current_pc), address);
+    r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(pc), address + 4);
+    r3000_jit_emit_store_imm8(psx, R3000_JIT_OFFSET(branch_delay), delay_slot);
+
+    r3000_jit_emit8(psx, 0x48);                     /* mov arg0, rbx */
+    r3000_jit_emit8(psx, 0x89);
+    r3000_jit_emit8(psx, 0xc0 | (X86_EBX << 3) | R3000_JIT_ARG0);
+
+    r3000_jit_emit_mov_imm(psx, R3000_JIT_ARG1, instruction);
+    r3000_jit_emit_call(psx, r3000_interpreter_decode(instruction));
+
+    /* An exception has already redirected the pc to its vector */
+    r3000_jit_emit_cmp_imm(psx, R3000_JIT_OFFSET(pc), address + 4);
+    skip = r3000_jit_emit_jcc(psx, X86_COND_E);
+    r3000_jit_emit_return(psx, count);
+    r3000_jit_patch(psx, skip);
+
+    /* Delay slots end the block, so there is nothing left to skip */
+    if (delay_slot) {
+        return;
+    }
+
+    /* Stop if the store has overwritten the rest of this block */
+    if (r3000_jit_is_store(instruction)) {
+        r3000_jit_emit8(psx, 0x48);                 /* mov rax, imm64 */
+        r3000_jit_emit8(psx, 0xb8);
+        r3000_jit_emit64(psx, (uintptr_t)&block->base.valid);
+
+        r3000_jit_emit8(psx, 0x80);                 /* cmp byte [rax], 0 */
+        r3000_jit_emit8(psx, 0x38);
+        r3000_jit_emit8(psx, 0x00);
+
+        skip = r3000_jit_emit_jcc(psx, X86_COND_NE);
+        r3000_jit_emit_exit(psx, address + 4, count);
+        r3000_jit_patch(psx, skip);
+    }
+
+    /* Interrupts are taken by the dispatcher before the next instruction */
+    if (r3000_jit_may_raise_irq(instruction)) {
+        r3000_jit_emit8(psx, 0x80);                 /* cmp byte [rbx + disp32], 0 */
+        r3000_jit_emit_ctx(psx, X86_ALU_CMP >> 3, R3000_JIT_OFFSET(interrupt));
+        r3000_jit_emit8(psx, 0x00);
+
+        skip = r3000_jit_emit_jcc(psx, X86_COND_E);
+        r3000_jit_emit_exit(psx, address + 4, count);
+        r3000_jit_patch(psx, skip);
+    }
+}
+
+static unsigned int
+r3000_jit_scan(struct psx_machine *psx, uint32_t address,
+               uint32_t *instructions)
+{
+    unsigned int length;
+    bool delay_slot;
+
+    length = 0;
+    delay_slot = false;
+
+    for (;;) {
+        instructions[length] = psx_debug_read_memory32(psx,
+                                                       address + length * 4);
+        length++;
+
+        if (delay_slot) {
+            /* Branches in delay slots are left to the interpreter */
+            if (r3000_jit_is_branch(instructions[length - 1])) {
+                length -= 2;
+            }
+
+            break;
+        }
+
+        if (r3000_jit_is_branch(instructions[length - 1])) {
+            delay_slot = true;
+            continue;
+        }
+
+        if (r3000_jit_is_block_end(instructions[length - 1])) {
+            break;
+        }
+
+        if (length == R3000_JIT_MAX_BLOCK_SIZE) {
+            break;
+        }
+
+        if ((address + length * 4) % R3000_CACHE_PAGE_SIZE == 0) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+static struct r3000_jit_block *
+r3000_jit_compile(struct psx_machine *psx, uint32_t vaddr, uint32_t address)
+{
+    uint32_t instructions[R3000_JIT_MAX_BLOCK_SIZE + 1];
+    struct r3000_jit_block *block;
+    unsigned int length;
+    uint32_t instruction, pc;
+    bool branch, delay_slot;
+
+    length = r3000_jit_scan(psx, address, instructions);
+
+    if (length == 0) {
+        return NULL;
+    }
+
+    if (psx->r3000_jit.used + R3000_JIT_MAX_BLOCK_CODE
+        > R3000_JIT_BUFFER_SIZE) {
+        printf("r3000_jit: info: code buffer full, flushing\n");
+
+        r3000_cache_flush(psx);
+        psx->r3000_jit.used = 0;
+    }
+
+    block = malloc(sizeof(*block));
+    assert(block);
+
+    block->base.address = address;
+    block->base.size = length * 4;
+    block->base.idle = r3000_idle_detect(instructions, length);
+    block->vaddr = vaddr;
+    block->code = (r3000_jit_code)(psx->r3000_jit.buffer + psx->r3000_jit.used);
+
+    psx->r3000_jit.ptr = psx->r3000_jit.buffer + psx->r3000_jit.used;
+
+    r3000_jit_emit_prologue(psx);
+
+    branch = false;
+
+    for (unsigned int i = 0; i < length; ++i) {
+        instruction = instructions[i];
+        pc = vaddr + i * 4;
+        delay_slot = branch;
+
+        if (r3000_jit_is_branch(instruction)) {
+            r3000_jit_emit_branch(psx, instruction, pc);
+            branch = true;
+            continue;
+        }
+
+        if (!r3000_jit_emit_native(psx, instruction)) {
+            r3000_jit_emit_fallback(psx, block, instruction, pc, i + 1,
+                                    delay_slot);
+        }
+    }
+
+    pc = vaddr + (length - 1) * 4;
+
+    if (branch) {
+        r3000_jit_emit_store(psx, X86_EBP, R3000_JIT_OFFSET(pc));
+
+        r3000_jit_emit8(psx, 0x8d);                 /* lea eax, [rbp + 4] */
+        r3000_jit_emit8(psx, 0x45);
+        r3000_jit_emit8(psx, 0x04);
+
+        r3000_jit_emit_store(psx, X86_EAX, R3000_JIT_OFFSET(next_pc));
+    } else {
+        r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(pc), pc + 4);
+        r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(next_pc), pc + 8);
+    }
+
+    r3000_jit_emit_store_imm(psx, R3000_JIT_OFFSET(current_pc), pc);
+    r3000_jit_emit_return(psx, length);
+
+    psx->r3000_jit.used = psx->r3000_jit.ptr - psx->r3000_jit.buffer;
+    assert(psx->r3000_jit.used <= R3000_JIT_BUFFER_SIZE);
+
+    return block;
+}
+
+bool
+r3000_jit_supported(void)
+{
+#ifdef R3000_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+r3000_jit_setup(struct psx_machine *psx)
+{
+    if (!r3000_jit_supported()) {
+        printf("r3000_jit: error: unsupported host architecture\n");
+        return false;
+    }
+
+    if (psx->r3000_jit.buffer) {
+        return true;
+    }
+
+#ifdef _WIN32
+    psx->r3000_jit.buffer = VirtualAlloc(NULL, R3000_JIT_BUFFER_SIZE,
+                                         MEM_COMMIT | MEM_RESERVE,
+                                         PAGE_EXECUTE_READWRITE);
+#else
+    psx->r3000_jit.buffer = mmap(NULL, R3000_JIT_BUFFER_SIZE,
+                                 PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (psx->r3000_jit.buffer == MAP_FAILED) {
+        psx->r3000_jit.buffer = NULL;
+    }
+#endif
+
+    if (!psx->r3000_jit.buffer) {
+        printf("r3000_jit: error: unable to allocate code buffer\n");
+        return false;
+    }
+
+    psx->r3000_jit.used = 0;
+    return true;
+}
+
+void
+r3000_jit_shutdown(struct psx_machine *psx)
+{
+    if (!psx->r3000_jit.buffer) {
+        return;
+    }
+
+#ifdef _WIN32
+    VirtualFree(psx->r3000_jit.buffer, 0, MEM_RELEASE);
+#else
+    munmap(psx->r3000_jit.buffer, R3000_JIT_BUFFER_SIZE);
+#endif
+
+    psx->r3000_jit.buffer = NULL;
+}
+
+unsigned int
+r3000_jit_execute(struct psx_machine *psx)
+{
+    struct r3000 *r3000;
+    struct r3000_jit_block *block;
+    uint32_t pc, address;
+    unsigned int count;
+
+    r3000_cache_collect(psx);
+
+    r3000 = &psx->r3000;
+    pc = r3000->pc;
+    address = r3000_translate_virtaddr(pc);
+
+    /* Pending delay slots and interrupts are left to the interpreter */
+    if ((pc & 0x3) || r3000->branch || r3000->interrupt
+        || !r3000_cache_cacheable(psx, address)) {
+        r3000_interpreter_execute(psx);
+        return 1;
+    }
+
+    block = (struct r3000_jit_block *)r3000_cache_lookup(psx, address);
+
+    /* Jump targets depend on the segment the block was compiled for */
+    if (block && block->vaddr != pc) {
+        r3000_cache_invalidate(psx, address);
+        block = NULL;
+    }
+
+    if (!block) {
+        block = r3000_jit_compile(psx, pc, address);
+
+        if (!block) {
+            r3000_interpreter_execute(psx);
+            return 1;
+        }
+
+        r3000_cache_insert(psx, &block->base);
+    }
+
+    count = block->code(psx);
+
+    if (block->base.idle && r3000->pc == pc) {
+        return r3000_idle_skip(psx, pc, count);
+    }
+
+    return count;
+}
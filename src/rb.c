@@ -9,18 +9,23 @@
 
 bool
 rb_init(struct rb *rb, size_t length) {
+    size_t size;
+
     assert(rb);
+    assert(length);
+
+    for (size = 1; size < length; size <<= 1) {
+    }
 
-    rb->buffer = malloc(length);
+    rb->buffer = malloc(size);
 
     if (!rb->buffer) {
         return false;
     }
 
-    rb->length = length;
-    rb->head = 0;
-    rb->tail = 0;
-    rb->count = 0;
+    rb->length = size;
+    rb->mask = size - 1;
+    rb_clear(rb);
     return true;
 }
 
@@ -33,6 +38,7 @@ rb_free(struct rb *rb)
     free(rb->buffer);
 }
 
+/* Only safe while neither side is using the ring */
 void
 rb_clear(struct rb *rb)
 {
@@ -40,52 +46,150 @@ rb_clear(struct rb *rb)
 
     rb->head = 0;
     rb->tail = 0;
-    rb->count = 0;
+    rb->overruns = 0;
+    rb->underruns = 0;
 }
 
-size_t
-rb_read(struct rb *rb, void *dest, size_t amount)
+/* Copies in at most two pieces, split where the buffer wraps */
+static void
+rb_copy_in(struct rb *rb, size_t position, const void *src, size_t amount)
 {
-    size_t bytes_read;
+    size_t offset, first;
 
-    assert(rb);
-    assert(dest);
+    offset = position & rb->mask;
+    first = MIN(amount, rb->length - offset);
+
+    memcpy(rb->buffer + offset, src, first);
+    memcpy(rb->buffer, (const uint8_t *)src + first, amount - first);
+}
+
+static void
+rb_copy_out(struct rb *rb, size_t position, void *dest, size_t amount)
+{
+    size_t offset, first;
+
+    offset = position & rb->mask;
+    first = MIN(amount, rb->length - offset);
+
+    memcpy(dest, rb->buffer + offset, first);
+    memcpy((uint8_t *)dest + first, rb->buffer, amount - first);
+}
+
+/* Reads up to amount bytes, rounded down to a multiple of unit */
+static size_t
+rb_read_units(struct rb *rb, void *dest, size_t amount, size_t unit)
+{
+    size_t head, tail, bytes_read;
+
+    tail = rb->tail;
+    head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
 
-    bytes_read = MIN(rb->count, amount);
+    bytes_read = MIN(head - tail, amount);
+    bytes_read -= bytes_read % unit;
 
-    for (size_t i = 0; i < bytes_read; ++i) {
-        ((uint8_t *)dest)[i] = ((uint8_t *)rb->buffer)[(rb->tail + i) % rb->length];
+    if (bytes_read < amount) {
+        __atomic_store_n(&rb->underruns, rb->underruns + 1, __ATOMIC_RELAXED);
     }
 
-    rb->tail = (rb->tail + bytes_read) % rb->length;
-    rb->count -= bytes_read;
+    rb_copy_out(rb, tail, dest, bytes_read);
+    __atomic_store_n(&rb->tail, tail + bytes_read, __ATOMIC_RELEASE);
 
     return bytes_read;
 }
 
+static size_t
+rb_write_units(struct rb *rb, const void *src, size_t amount, size_t unit)
+{
+    size_t head, tail, bytes_written;
+
+    head = rb->head;
+    tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+
+    bytes_written = MIN(rb->length - (head - tail), amount);
+    bytes_written -= bytes_written % unit;
+
+    if (bytes_written < amount) {
+        __atomic_store_n(&rb->overruns, rb->overruns + 1, __ATOMIC_RELAXED);
+    }
+
+    rb_copy_in(rb, head, src, bytes_written);
+    __atomic_store_n(&rb->head, head + bytes_written, __ATOMIC_RELEASE);
+
+    return bytes_written;
+}
+
 size_t
-rb_write(struct rb *rb, const void *src, size_t amount)
+rb_read(struct rb *rb, void *dest, size_t amount)
 {
-    size_t bytes_written;
+    assert(rb);
+    assert(dest);
 
+    return rb_read_units(rb, dest, amount, 1);
+}
+
+size_t
+rb_write(struct rb *rb, const void *src, size_t amount)
+{
     assert(rb);
     assert(src);
 
-    bytes_written = MIN(rb->length - rb->count, amount);
+    return rb_write_units(rb, src, amount, 1);
+}
 
-    for (size_t i = 0; i < bytes_written; ++i) {
-        ((uint8_t *)rb->buffer)[(rb->head + i) % rb->length] = ((uint8_t *)src)[i];
-    }
+/* Frame variants never split a left/right pair */
+size_t
+rb_read_frames(struct rb *rb, int16_t *frames, size_t nr_frames)
+{
+    assert(rb);
+    assert(frames);
 
-    rb->head = (rb->head + bytes_written) % rb->length;
-    rb->count += bytes_written;
+    return rb_read_units(rb, frames, nr_frames * RB_FRAME_SIZE,
+                         RB_FRAME_SIZE) / RB_FRAME_SIZE;
+}
 
-    return bytes_written;
+size_t
+rb_write_frames(struct rb *rb, const int16_t *frames, size_t nr_frames)
+{
+    assert(rb);
+    assert(frames);
+
+    return rb_write_units(rb, frames, nr_frames * RB_FRAME_SIZE,
+                          RB_FRAME_SIZE) / RB_FRAME_SIZE;
+}
+
+/* Bytes queued, exact from either side and a snapshot from anywhere else */
+size_t
+rb_count(struct rb *rb)
+{
+    size_t head, tail;
+
+    assert(rb);
+
+    tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+
+    return MIN(head - tail, rb->length);
 }
 
 float rb_usage(struct rb *rb)
 {
     assert(rb);
 
-    return (float)rb->count / (float)rb->length;
+    return (float)rb_count(rb) / (float)rb->length;
+}
+
+uint64_t
+rb_overruns(struct rb *rb)
+{
+    assert(rb);
+
+    return __atomic_load_n(&rb->overruns, __ATOMIC_RELAXED);
+}
+
+uint64_t
+rb_underruns(struct rb *rb)
+{
+    assert(rb);
+
+    return __atomic_load_n(&rb->underruns, __ATOMIC_RELAXED);
 }
@@ -0,0 +1,386 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000.h"
+#include "replay.h"
+#include "scheduler.h"
+
+static const char *REPLAY_EVENT_NAMES[REPLAY_NR_EVENTS] = {
+    "frames", "steps", "hash", "soft reset", "hard reset", "register write",
+    "pc write", "memory write", "exe"
+};
+
+static void
+replay_close(struct psx_machine *psx)
+{
+    if (psx->replay.fp) {
+        fclose(psx->replay.fp);
+    }
+
+    psx->replay.fp = NULL;
+    psx->replay.mode = REPLAY_OFF;
+}
+
+static void
+replay_write_event(struct psx_machine *psx, enum replay_event_type type,
+                   uint64_t timestamp, uint32_t arg0, uint32_t arg1,
+                   const void *payload, uint32_t size)
+{
+    struct replay_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.size = size;
+    event.timestamp = timestamp;
+    event.arg[0] = arg0;
+    event.arg[1] = arg1;
+
+    if (fwrite(&event, sizeof(event), 1, psx->replay.fp) != 1 ||
+        fwrite(payload, 1, size, psx->replay.fp) != size) {
+        printf("replay: error: unable to write log, recording stopped\n");
+        replay_close(psx);
+    }
+}
+
+static void
+replay_flush_run(struct psx_machine *psx)
+{
+    struct replay *replay = &psx->replay;
+
+    if (replay->run_count) {
+        replay_write_event(psx, replay->run, replay->run_timestamp,
+                           replay->run_count, 0, NULL, 0);
+        replay->run_count = 0;
+    }
+}
+
+static void
+replay_log_run(struct psx_machine *psx, enum replay_event_type type)
+{
+    struct replay *replay = &psx->replay;
+
+    if (replay->run_count && replay->run != type) {
+        replay_flush_run(psx);
+    }
+
+    if (!replay->run_count) {
+        replay->run = type;
+        replay->run_timestamp = scheduler_now(psx);
+    }
+
+    ++replay->run_count;
+}
+
+static void
+replay_log_hash(struct psx_machine *psx)
+{
+    uint64_t hash = replay_hash(psx);
+
+    replay_log(psx, REPLAY_EVENT_HASH, hash, hash >> 32, NULL, 0);
+}
+
+/* FNV-1a over words, enough to notice any divergence */
+uint64_t
+replay_hash(struct psx_machine *psx)
+{
+    const uint8_t *r3000 = (const uint8_t *)&psx->r3000;
+    uint64_t hash, word;
+
+    hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < PSX_RAM_SIZE; i += sizeof(word)) {
+        memcpy(&word, psx->ram + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+
+    for (size_t i = 0; i < sizeof(psx->r3000); ++i) {
+        hash = (hash ^ r3000[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+bool
+replay_record(struct psx_machine *psx, const char *path)
+{
+    struct replay_header header;
+    size_t size;
+    void *state;
+    bool ok;
+
+    replay_stop(psx);
+
+    size = psx_state_size(psx, 0);
+    state = malloc(size);
+
+    if (!state || !psx_save_state(psx, state, size, 0)) {
+        printf("replay: error: unable to save initial state\n");
+        free(state);
+        return false;
+    }
+
+    psx->replay.fp = fopen(path, "wb");
+
+    if (!psx->replay.fp) {
+        perror("replay: error: unable to open log");
+        free(state);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.state_size = size;
+
+    ok = fwrite(&header, sizeof(header), 1, psx->replay.fp) == 1 &&
+         fwrite(state, 1, size, psx->replay.fp) == size;
+    free(state);
+
+    if (!ok) {
+        printf("replay: error: short write to %s\n", path);
+        replay_close(psx);
+        return false;
+    }
+
+    psx->replay.mode = REPLAY_RECORDING;
+    psx->replay.frames = 0;
+    psx->replay.run_count = 0;
+
+    return true;
+}
+
+bool
+replay_play(struct psx_machine *psx, const char *path)
+{
+    struct replay_header header;
+    void *state;
+    bool ok;
+
+    replay_stop(psx);
+
+    psx->replay.fp = fopen(path, "rb");
+
+    if (!psx->replay.fp) {
+        perror("replay: error: unable to open log");
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, psx->replay.fp) != 1 ||
+        memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic))) {
+        printf("replay: error: %s is not a replay log\n", path);
+        replay_close(psx);
+        return false;
+    }
+
+    if (header.version != REPLAY_VERSION) {
+        printf("replay: error: version %u, expected %u\n", header.version,
+               REPLAY_VERSION);
+        replay_close(psx);
+        return false;
+    }
+
+    state = malloc(header.state_size);
+    ok = state &&
+         fread(state, 1, header.state_size, psx->replay.fp) ==
+         header.state_size &&
+         psx_load_state(psx, state, header.state_size);
+    free(state);
+
+    if (!ok) {
+        printf("replay: error: unable to load initial state\n");
+        replay_close(psx);
+        return false;
+    }
+
+    psx->replay.mode = REPLAY_PLAYING;
+    psx->replay.frames = 0;
+    psx->replay.hashes = 0;
+    psx->replay.run_count = 0;
+
+    return true;
+}
+
+void
+replay_stop(struct psx_machine *psx)
+{
+    /* End with a hash, so playback checks the last stretch too */
+    if (psx->replay.mode == REPLAY_RECORDING) {
+        replay_log_hash(psx);
+    }
+
+    replay_close(psx);
+}
+
+enum replay_mode
+replay_mode(struct psx_machine *psx)
+{
+    return psx->replay.mode;
+}
+
+void
+replay_stats(struct psx_machine *psx, struct replay_stats *stats)
+{
+    stats->frames = psx->replay.frames;
+    stats->hashes = psx->replay.hashes;
+}
+
+static enum replay_status
+replay_desync(struct psx_machine *psx, const char *what)
+{
+    printf("replay: error: %s at cycle %llu, frame %llu\n", what,
+           (unsigned long long)scheduler_now(psx),
+           (unsigned long long)psx->replay.frames);
+
+    replay_close(psx);
+    return REPLAY_DESYNC;
+}
+
+static enum replay_status
+replay_run_frame(struct psx_machine *psx)
+{
+    psx_run_frame(psx);
+    ++psx->replay.frames;
+
+    return REPLAY_FRAME;
+}
+
+/* Plays the log back by a frame, or by one other event */
+enum replay_status
+replay_next(struct psx_machine *psx)
+{
+    struct replay *replay = &psx->replay;
+    struct replay_event event;
+    uint64_t hash;
+    void *payload;
+    bool ok;
+
+    if (replay->mode != REPLAY_PLAYING) {
+        return REPLAY_END;
+    }
+
+    if (replay->run_count) {
+        --replay->run_count;
+        return replay_run_frame(psx);
+    }
+
+    if (fread(&event, sizeof(event), 1, replay->fp) != 1) {
+        replay_close(psx);
+        return REPLAY_END;
+    }
+
+    if (event.type >= REPLAY_NR_EVENTS) {
+        return replay_desync(psx, "unknown event");
+    }
+
+    if (event.timestamp != scheduler_now(psx)) {
+        printf("replay: error: %s logged at cycle %llu\n",
+               REPLAY_EVENT_NAMES[event.type],
+               (unsigned long long)event.timestamp);
+        return replay_desync(psx, "reached");
+    }
+
+    switch (event.type) {
+    case REPLAY_EVENT_FRAMES:
+        if (!event.arg[0]) {
+            return REPLAY_INPUT;
+        }
+
+        replay->run = REPLAY_EVENT_FRAMES;
+        replay->run_count = event.arg[0] - 1;
+        return replay_run_frame(psx);
+    case REPLAY_EVENT_STEPS:
+        for (uint32_t i = 0; i < event.arg[0]; ++i) {
+            psx_step(psx);
+        }
+        break;
+    case REPLAY_EVENT_HASH:
+        hash = replay_hash(psx);
+
+        if ((uint32_t)hash != event.arg[0] ||
+            (uint32_t)(hash >> 32) != event.arg[1]) {
+            return replay_desync(psx, "hash mismatch");
+        }
+
+        ++replay->hashes;
+        break;
+    case REPLAY_EVENT_SOFT_RESET:
+        psx_soft_reset(psx);
+        break;
+    case REPLAY_EVENT_HARD_RESET:
+        psx_hard_reset(psx);
+        break;
+    case REPLAY_EVENT_WRITE_REG:
+        r3000_debug_write_reg(psx, event.arg[0], event.arg[1]);
+        break;
+    case REPLAY_EVENT_FORCE_PC:
+        r3000_debug_force_pc(psx, event.arg[0]);
+        break;
+    case REPLAY_EVENT_WRITE_MEMORY32:
+        psx_debug_write_memory32(psx, event.arg[0], event.arg[1]);
+        break;
+    case REPLAY_EVENT_EXE:
+        payload = malloc(event.size);
+        ok = payload &&
+             fread(payload, 1, event.size, replay->fp) == event.size &&
+             psx_load_exe_data(psx, payload, event.size);
+        free(payload);
+
+        if (!ok) {
+            return replay_desync(psx, "exe failed to load");
+        }
+
+        return REPLAY_INPUT;
+    }
+
+    /* Payloads of events that don't use them are skipped */
+    if (event.size && fseek(replay->fp, event.size, SEEK_CUR)) {
+        return replay_desync(psx, "truncated event");
+    }
+
+    return REPLAY_INPUT;
+}
+
+void
+replay_log_frame(struct psx_machine *psx)
+{
+    if (psx->replay.mode != REPLAY_RECORDING) {
+        return;
+    }
+
+    if (psx->replay.frames && !(psx->replay.frames % REPLAY_HASH_INTERVAL)) {
+        replay_log_hash(psx);
+    }
+
+    replay_log_run(psx, REPLAY_EVENT_FRAMES);
+    ++psx->replay.frames;
+}
+
+void
+replay_log_step(struct psx_machine *psx)
+{
+    if (psx->replay.mode == REPLAY_RECORDING) {
+        replay_log_run(psx, REPLAY_EVENT_STEPS);
+    }
+}
+
+void
+replay_log(struct psx_machine *psx, enum replay_event_type type,
+           uint32_t arg0, uint32_t arg1, const void *payload, uint32_t size)
+{
+    if (psx->replay.mode != REPLAY_RECORDING) {
+        return;
+    }
+
+    replay_flush_run(psx);
+
+    if (psx->replay.mode == REPLAY_RECORDING) {
+        replay_write_event(psx, type, scheduler_now(psx), arg0, arg1, payload,
+                           size);
+    }
+}
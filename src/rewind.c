@@ -0,0 +1,476 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000_cache.h"
+#include "rewind.h"
+#include "state.h"
+
+#define REWIND_BLOCK_WORDS      (REWIND_BLOCK_SIZE / sizeof(uint32_t))
+
+/* A changed block, followed by size bytes of runs */
+struct rewind_block {
+    uint8_t region;
+    uint8_t pad;
+    uint16_t index;
+    uint32_t size;
+};
+
+/* Old contents of count words, skip words on from the previous run */
+struct rewind_run {
+    uint16_t skip;
+    uint16_t count;
+};
+
+/* Largest encoding of one block, with every other word changed or all */
+#define REWIND_BLOCK_MAX        (sizeof(struct rewind_block) +               \
+                                 sizeof(struct rewind_run) +                 \
+                                 REWIND_BLOCK_SIZE)
+
+static uint8_t *
+rewind_memory(struct psx_machine *psx, enum rewind_region region)
+{
+    switch (region) {
+    case REWIND_RAM:
+        return psx->ram;
+    case REWIND_SPU_RAM:
+        return psx->spu.ram;
+    default:
+        return psx->rewind.core;
+    }
+}
+
+void
+rewind_mark_range(struct psx_machine *psx, enum rewind_region region,
+                  uint32_t offset, uint32_t size)
+{
+    assert(region < REWIND_CORE);
+
+    if (!size) {
+        return;
+    }
+
+    for (uint32_t block = offset & ~(REWIND_BLOCK_SIZE - 1);
+         block < offset + size; block += REWIND_BLOCK_SIZE) {
+        REWIND_MARK(psx, region, block);
+    }
+}
+
+static void
+rewind_ring_write(struct rewind *rw, size_t offset, const void *data,
+                  size_t size)
+{
+    size_t first;
+
+    offset %= rw->capacity;
+    first = MIN(size, rw->capacity - offset);
+
+    memcpy(rw->ring + offset, data, first);
+    memcpy(rw->ring, (const uint8_t *)data + first, size - first);
+}
+
+static void
+rewind_ring_read(struct rewind *rw, size_t offset, void *data, size_t size)
+{
+    size_t first;
+
+    offset %= rw->capacity;
+    first = MIN(size, rw->capacity - offset);
+
+    memcpy(data, rw->ring + offset, first);
+    memcpy((uint8_t *)data + first, rw->ring, size - first);
+}
+
+/* Appends the words of the shadow block that current differs from */
+static uint8_t *
+rewind_encode_block(uint8_t *out, enum rewind_region region, uint32_t index,
+                    uint32_t *shadow, const uint32_t *current)
+{
+    struct rewind_block block;
+    struct rewind_run run;
+    unsigned int i, end, last;
+    uint8_t *start;
+
+    if (!memcmp(shadow, current, REWIND_BLOCK_SIZE)) {
+        return out;
+    }
+
+    start = out;
+    out += sizeof(block);
+
+    for (i = last = 0; i < REWIND_BLOCK_WORDS; i = last = end) {
+        while (i < REWIND_BLOCK_WORDS && shadow[i] == current[i]) {
+            ++i;
+        }
+
+        if (i == REWIND_BLOCK_WORDS) {
+            break;
+        }
+
+        for (end = i + 1; end < REWIND_BLOCK_WORDS; ++end) {
+            if (shadow[end] == current[end]) {
+                break;
+            }
+        }
+
+        run.skip = i - last;
+        run.count = end - i;
+
+        memcpy(out, &run, sizeof(run));
+        memcpy(out + sizeof(run), shadow + i, run.count * sizeof(uint32_t));
+        memcpy(shadow + i, current + i, run.count * sizeof(uint32_t));
+
+        out += sizeof(run) + run.count * sizeof(uint32_t);
+    }
+
+    block.region = region;
+    block.pad = 0;
+    block.index = index;
+    block.size = out - start - sizeof(block);
+
+    memcpy(start, &block, sizeof(block));
+    return out;
+}
+
+/* Builds the delta back from this frame into scratch, returning its size */
+static size_t
+rewind_encode(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    uint32_t *shadow, *current;
+    uint64_t dirty;
+    uint32_t index;
+    uint8_t *out;
+    size_t size;
+
+    out = rw->scratch;
+
+    for (int region = 0; region < REWIND_CORE; ++region) {
+        for (int i = 0; i < REWIND_DIRTY_WORDS; ++i) {
+            dirty = rw->dirty[region][i];
+            rw->dirty[region][i] = 0;
+
+            while (dirty) {
+                index = i * 64 + __builtin_ctzll(dirty);
+                dirty &= dirty - 1;
+
+                shadow = (uint32_t *)(rw->shadow[region] +
+                                      index * REWIND_BLOCK_SIZE);
+                current = (uint32_t *)(rewind_memory(psx, region) +
+                                       index * REWIND_BLOCK_SIZE);
+
+                out = rewind_encode_block(out, region, index, shadow, current);
+            }
+        }
+    }
+
+    /* Nothing marks changes to registers or VRAM, so compare them all */
+    size = psx_save_state(psx, rw->core, rw->size[REWIND_CORE],
+                          STATE_NO_MEMORY);
+    assert(size);
+
+    for (index = 0; index < rw->size[REWIND_CORE] / REWIND_BLOCK_SIZE;
+         ++index) {
+        shadow = (uint32_t *)(rw->shadow[REWIND_CORE] +
+                              index * REWIND_BLOCK_SIZE);
+        current = (uint32_t *)(rw->core + index * REWIND_BLOCK_SIZE);
+
+        out = rewind_encode_block(out, REWIND_CORE, index, shadow, current);
+    }
+
+    return out - rw->scratch;
+}
+
+/* Moves the shadows back a frame, leaving the memories to be restored */
+static void
+rewind_apply(struct psx_machine *psx, size_t size)
+{
+    struct rewind *rw = &psx->rewind;
+    struct rewind_block block;
+    struct rewind_run run;
+    size_t offset, end;
+    uint8_t *shadow;
+    unsigned int i;
+
+    for (offset = 0; offset < size; offset = end) {
+        memcpy(&block, rw->scratch + offset, sizeof(block));
+        offset += sizeof(block);
+        end = offset + block.size;
+
+        assert(block.region < REWIND_NR_REGIONS);
+        shadow = rw->shadow[block.region] + block.index * REWIND_BLOCK_SIZE;
+
+        for (i = 0; offset < end; i += run.count) {
+            memcpy(&run, rw->scratch + offset, sizeof(run));
+            offset += sizeof(run);
+            i += run.skip;
+
+            memcpy(shadow + i * sizeof(uint32_t), rw->scratch + offset,
+                   run.count * sizeof(uint32_t));
+            offset += run.count * sizeof(uint32_t);
+        }
+
+        if (block.region != REWIND_CORE) {
+            REWIND_MARK(psx, block.region, block.index * REWIND_BLOCK_SIZE);
+        }
+    }
+}
+
+/* Allocates the keyframe the first time rewind or run-ahead needs it */
+static bool
+rewind_keyframe_setup(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    size_t core;
+
+    if (rw->shadow[REWIND_CORE]) {
+        return true;
+    }
+
+    core = psx_state_size(psx, STATE_NO_MEMORY);
+    core = (core + REWIND_BLOCK_SIZE - 1) & ~(size_t)(REWIND_BLOCK_SIZE - 1);
+
+    rw->size[REWIND_RAM] = PSX_RAM_SIZE;
+    rw->size[REWIND_SPU_RAM] = SPU_RAM_SIZE;
+    rw->size[REWIND_CORE] = core;
+
+    for (int region = 0; region < REWIND_NR_REGIONS; ++region) {
+        rw->shadow[region] = calloc(1, rw->size[region]);
+    }
+
+    rw->core = calloc(1, core);
+
+    if (!rw->shadow[REWIND_RAM] || !rw->shadow[REWIND_SPU_RAM] ||
+        !rw->shadow[REWIND_CORE] || !rw->core) {
+        printf("rewind: error: unable to allocate keyframe\n");
+        rewind_shutdown(psx);
+        return false;
+    }
+
+    /* Everything differs from the empty shadows */
+    rewind_mark_range(psx, REWIND_RAM, 0, PSX_RAM_SIZE);
+    rewind_mark_range(psx, REWIND_SPU_RAM, 0, SPU_RAM_SIZE);
+
+    return true;
+}
+
+/* Makes the machine as it is now the keyframe, without recording a delta */
+bool
+rewind_capture(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    uint64_t dirty;
+    uint32_t offset;
+
+    if (!rewind_keyframe_setup(psx)) {
+        return false;
+    }
+
+    for (int region = 0; region < REWIND_CORE; ++region) {
+        for (int i = 0; i < REWIND_DIRTY_WORDS; ++i) {
+            dirty = rw->dirty[region][i];
+            rw->dirty[region][i] = 0;
+
+            while (dirty) {
+                offset = (i * 64 + __builtin_ctzll(dirty)) * REWIND_BLOCK_SIZE;
+                dirty &= dirty - 1;
+
+                memcpy(rw->shadow[region] + offset,
+                       rewind_memory(psx, region) + offset, REWIND_BLOCK_SIZE);
+            }
+        }
+    }
+
+    psx_save_state(psx, rw->shadow[REWIND_CORE], rw->size[REWIND_CORE],
+                   STATE_NO_MEMORY);
+
+    return true;
+}
+
+/* Brings the machine back to the keyframe */
+void
+rewind_restore(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    uint64_t dirty;
+    uint32_t offset;
+    bool ok;
+
+    assert(rw->shadow[REWIND_CORE]);
+
+    for (int region = 0; region < REWIND_CORE; ++region) {
+        for (int i = 0; i < REWIND_DIRTY_WORDS; ++i) {
+            dirty = rw->dirty[region][i];
+            rw->dirty[region][i] = 0;
+
+            while (dirty) {
+                offset = (i * 64 + __builtin_ctzll(dirty)) * REWIND_BLOCK_SIZE;
+                dirty &= dirty - 1;
+
+                memcpy(rewind_memory(psx, region) + offset,
+                       rw->shadow[region] + offset, REWIND_BLOCK_SIZE);
+
+                /* Code translated from other blocks is still good */
+                if (region == REWIND_RAM) {
+                    r3000_cache_invalidate_range(psx, PSX_RAM_START + offset,
+                                                 REWIND_BLOCK_SIZE);
+                }
+            }
+        }
+    }
+
+    ok = psx_load_state(psx, rw->shadow[REWIND_CORE], rw->size[REWIND_CORE]);
+    assert(ok);
+    (void)ok;
+}
+
+bool
+rewind_enable(struct psx_machine *psx, size_t capacity)
+{
+    struct rewind *rw = &psx->rewind;
+    size_t blocks;
+
+    rewind_disable(psx);
+
+    if (!rewind_keyframe_setup(psx)) {
+        return false;
+    }
+
+    blocks = 0;
+
+    for (int region = 0; region < REWIND_NR_REGIONS; ++region) {
+        blocks += rw->size[region] / REWIND_BLOCK_SIZE;
+    }
+
+    rw->scratch = malloc(blocks * REWIND_BLOCK_MAX);
+    rw->ring = malloc(capacity);
+
+    if (!rw->scratch || !rw->ring) {
+        printf("rewind: error: unable to allocate %zu bytes\n", capacity);
+        rewind_disable(psx);
+        return false;
+    }
+
+    rw->capacity = capacity;
+
+    /* History starts from the current frame */
+    return rewind_capture(psx);
+}
+
+/* Drops the history, keeping the keyframe for run-ahead */
+void
+rewind_disable(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+
+    free(rw->scratch);
+    free(rw->ring);
+
+    rw->scratch = rw->ring = NULL;
+    rw->capacity = 0;
+    rw->head = rw->tail = 0;
+    rw->frames = 0;
+}
+
+void
+rewind_shutdown(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+
+    rewind_disable(psx);
+
+    for (int region = 0; region < REWIND_NR_REGIONS; ++region) {
+        free(rw->shadow[region]);
+        rw->shadow[region] = NULL;
+    }
+
+    free(rw->core);
+    rw->core = NULL;
+}
+
+bool
+rewind_enabled(struct psx_machine *psx)
+{
+    return psx->rewind.capacity;
+}
+
+/* Records the frame just run, call once per frame */
+void
+rewind_push(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    uint32_t size, oldest;
+
+    if (!rw->capacity) {
+        return;
+    }
+
+    size = rewind_encode(psx);
+
+    /* Too big to keep at all, so the history before it is gone */
+    if (size + 2 * sizeof(size) > rw->capacity) {
+        rw->tail = rw->head;
+        rw->frames = 0;
+        return;
+    }
+
+    while (rw->capacity - (rw->head - rw->tail) < size + 2 * sizeof(size)) {
+        rewind_ring_read(rw, rw->tail, &oldest, sizeof(oldest));
+        rw->tail += oldest + 2 * sizeof(oldest);
+        --rw->frames;
+    }
+
+    /* Sized at both ends, to drop the oldest and pop the newest */
+    rewind_ring_write(rw, rw->head, &size, sizeof(size));
+    rewind_ring_write(rw, rw->head + sizeof(size), rw->scratch, size);
+    rewind_ring_write(rw, rw->head + sizeof(size) + size, &size,
+                      sizeof(size));
+
+    rw->head += size + 2 * sizeof(size);
+    ++rw->frames;
+}
+
+/*
+ * Takes the machine back one frame, or to the oldest frame held. Returns
+ * false once there is nothing older.
+ */
+bool
+rewind_step(struct psx_machine *psx)
+{
+    struct rewind *rw = &psx->rewind;
+    uint32_t size;
+
+    if (!rw->capacity) {
+        return false;
+    }
+
+    if (!rw->frames) {
+        rewind_restore(psx);
+        return false;
+    }
+
+    rewind_ring_read(rw, rw->head - sizeof(size), &size, sizeof(size));
+    rw->head -= size + 2 * sizeof(size);
+    --rw->frames;
+
+    rewind_ring_read(rw, rw->head + sizeof(size), rw->scratch, size);
+    rewind_apply(psx, size);
+    rewind_restore(psx);
+
+    return true;
+}
+
+void
+rewind_stats(struct psx_machine *psx, struct rewind_stats *stats)
+{
+    stats->frames = psx->rewind.frames;
+    stats->used = psx->rewind.head - psx->rewind.tail;
+    stats->capacity = psx->rewind.capacity;
+}
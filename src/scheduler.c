@@ -0,0 +1,233 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macros.h"
+#include "psx_machine.h"
+#include "scheduler.h"
+#include "state.h"
+
+#define SCHEDULER_NOT_QUEUED    -1
+
+static bool
+scheduler_before(struct scheduler *scheduler, int a, int b)
+{
+    return scheduler->entry[scheduler->heap[a]].timestamp
+           < scheduler->entry[scheduler->heap[b]].timestamp;
+}
+
+static void
+scheduler_swap(struct scheduler *scheduler, int a, int b)
+{
+    enum scheduler_event e;
+
+    e = scheduler->heap[a];
+    scheduler->heap[a] = scheduler->heap[b];
+    scheduler->heap[b] = e;
+
+    scheduler->entry[scheduler->heap[a]].position = a;
+    scheduler->entry[scheduler->heap[b]].position = b;
+}
+
+static void
+scheduler_sift_up(struct scheduler *scheduler, int i)
+{
+    while (i > 0 && scheduler_before(scheduler, i, (i - 1) / 2)) {
+        scheduler_swap(scheduler, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+scheduler_sift_down(struct scheduler *scheduler, int i)
+{
+    int child;
+
+    for (;;) {
+        child = i * 2 + 1;
+
+        if (child >= scheduler->size) {
+            break;
+        }
+
+        if (child + 1 < scheduler->size
+            && scheduler_before(scheduler, child + 1, child)) {
+            child++;
+        }
+
+        if (!scheduler_before(scheduler, child, i)) {
+            break;
+        }
+
+        scheduler_swap(scheduler, i, child);
+        i = child;
+    }
+}
+
+static void
+scheduler_remove(struct scheduler *scheduler, int i)
+{
+    scheduler->entry[scheduler->heap[i]].position = SCHEDULER_NOT_QUEUED;
+    scheduler->size--;
+
+    if (i == scheduler->size) {
+        return;
+    }
+
+    scheduler->heap[i] = scheduler->heap[scheduler->size];
+    scheduler->entry[scheduler->heap[i]].position = i;
+
+    scheduler_sift_up(scheduler, i);
+    scheduler_sift_down(scheduler, i);
+}
+
+void
+scheduler_setup(struct psx_machine *psx)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+
+    scheduler->now = 0;
+    scheduler->size = 0;
+
+    for (int i = 0; i < SCHEDULER_NR_EVENTS; ++i) {
+        scheduler->entry[i].callback = NULL;
+        scheduler->entry[i].position = SCHEDULER_NOT_QUEUED;
+    }
+}
+
+uint64_t
+scheduler_now(struct psx_machine *psx)
+{
+    return psx->scheduler.now;
+}
+
+uint64_t
+scheduler_next_deadline(struct psx_machine *psx)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+
+    if (scheduler->size == 0) {
+        return UINT64_MAX;
+    }
+
+    return scheduler->entry[scheduler->heap[0]].timestamp;
+}
+
+void
+scheduler_advance(struct psx_machine *psx, uint64_t cycles)
+{
+    psx->scheduler.now += cycles;
+}
+
+void
+scheduler_run(struct psx_machine *psx)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+    struct scheduler_entry *entry;
+
+    while (scheduler_next_deadline(psx) <= scheduler->now) {
+        entry = &scheduler->entry[scheduler->heap[0]];
+        scheduler_remove(scheduler, 0);
+
+        /* Callbacks may schedule themselves again */
+        entry->callback(psx, entry->timestamp);
+    }
+}
+
+void
+scheduler_schedule(struct psx_machine *psx, enum scheduler_event e,
+                   uint64_t timestamp, scheduler_callback callback)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+    struct scheduler_entry *entry;
+
+    assert(e < SCHEDULER_NR_EVENTS);
+    assert(callback);
+
+    entry = &scheduler->entry[e];
+
+    entry->timestamp = timestamp;
+    entry->callback = callback;
+
+    if (entry->position == SCHEDULER_NOT_QUEUED) {
+        entry->position = scheduler->size;
+        scheduler->heap[scheduler->size++] = e;
+    }
+
+    scheduler_sift_up(scheduler, entry->position);
+    scheduler_sift_down(scheduler, entry->position);
+}
+
+void
+scheduler_cancel(struct psx_machine *psx, enum scheduler_event e)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+
+    assert(e < SCHEDULER_NR_EVENTS);
+
+    if (scheduler->entry[e].position != SCHEDULER_NOT_QUEUED) {
+        scheduler_remove(scheduler, scheduler->entry[e].position);
+    }
+}
+
+bool
+scheduler_pending(struct psx_machine *psx, enum scheduler_event e)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+
+    assert(e < SCHEDULER_NR_EVENTS);
+
+    return scheduler->entry[e].position != SCHEDULER_NOT_QUEUED;
+}
+
+/* Sets an event's callback without queueing it, so a loaded state can */
+void
+scheduler_register(struct psx_machine *psx, enum scheduler_event e,
+                   scheduler_callback callback)
+{
+    assert(e < SCHEDULER_NR_EVENTS);
+
+    psx->scheduler.entry[e].callback = callback;
+}
+
+/* Callbacks are host pointers, saved as NULL and kept from the machine */
+void
+scheduler_save_state(struct psx_machine *psx, struct state *state)
+{
+    struct scheduler scheduler = psx->scheduler;
+
+    for (int i = 0; i < SCHEDULER_NR_EVENTS; ++i) {
+        scheduler.entry[i].callback = NULL;
+    }
+
+    state_begin_section(state, STATE_SECTION_SCHEDULER);
+    state_write(state, &scheduler, sizeof(scheduler));
+    state_end_section(state);
+}
+
+void
+scheduler_load_state(struct psx_machine *psx, struct state *state)
+{
+    struct scheduler *scheduler = &psx->scheduler;
+    scheduler_callback callbacks[SCHEDULER_NR_EVENTS];
+
+    if (!state_find_section(state, STATE_SECTION_SCHEDULER)) {
+        return;
+    }
+
+    for (int i = 0; i < SCHEDULER_NR_EVENTS; ++i) {
+        callbacks[i] = scheduler->entry[i].callback;
+    }
+
+    state_read(state, scheduler, sizeof(*scheduler));
+
+    for (int i = 0; i < SCHEDULER_NR_EVENTS; ++i) {
+        scheduler->entry[i].callback = callbacks[i];
+    }
+
+    /* Every event that can be pending is registered at setup */
+    for (int i = 0; i < scheduler->size; ++i) {
+        assert(scheduler->entry[scheduler->heap[i]].callback);
+    }
+}
@@ -1,258 +1,189 @@
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "macros.h"
+#include "perf.h"
+#include "psx_machine.h"
+#include "rewind.h"
+#include "scheduler.h"
 #include "spu.h"
+#include "spu_mix.h"
+#include "state.h"
 #include "util.h"
-#include "window.h"
 
 #define SPU_CYCLES_PER_TICK             768
 
-#define SPU_SAMPLE_BUFFER_SIZE          256
-#define SPU_FIFO_SIZE                   32
-
 #define SPU_CONTROL_TRANSFER_MODE       0x30
 #define SPU_CONTROL_ENABLE              0x8000
 
 #define SPU_STATUS_MODE                 0x3f
 #define SPU_STATUS_DMA_REQUEST          0x80
 
-#define SPU_VOICE_NR_SAMPLES            28
-
 #define SPU_VOICE_SUSTAIN_LEVEL         0xf
-#define SPU_VOICE_DECAY_SHIFT           0xf0
-#define SPU_VOICE_ATTACK_STEP           0x300
-#define SPU_VOICE_ATTACK_SHIFT          0x7c00
 #define SPU_VOICE_ATTACK_MODE           0x8000
-#define SPU_VOICE_RELEASE_SHIFT         0x1f0000
 #define SPU_VOICE_RELEASE_MODE          0x200000
-#define SPU_VOICE_SUSTAIN_STEP          0xc00000
-#define SPU_VOICE_SUSTAIN_SHIFT         0x1f000000
 #define SPU_VOICE_SUSTAIN_DIRECTION     0x40000000
 #define SPU_VOICE_SUSTAIN_MODE          0x80000000
 
-struct volume {
-    union {
-        struct {
-            int16_t left;
-            int16_t right;
-        };
-        uint32_t both;
-    };
-};
-
-enum spu_voice_state {
-    SPU_VOICE_STATE_DISABLED,
-    SPU_VOICE_STATE_ATTACK,
-    SPU_VOICE_STATE_DECAY,
-    SPU_VOICE_STATE_SUSTAIN,
-    SPU_VOICE_STATE_RELEASE
-};
-
-struct spu_voice {
-    enum spu_voice_state state;
-    uint32_t pitch_counter;
-
-    struct volume volume;
-
-    uint16_t sample_rate;
-
-    uint32_t start_address;
-    uint32_t repeat_address;
-    uint32_t current_address;
+/* 7-bit rates, the shift in bits 2-6 and the step in bits 0-1 */
+#define SPU_VOICE_ATTACK_RATE(x)        (((x) >> 8) & 0x7f)
+#define SPU_VOICE_DECAY_RATE(x)         ((((x) >> 4) & 0xf) << 2)
+#define SPU_VOICE_SUSTAIN_RATE(x)       (((x) >> 22) & 0x7f)
+#define SPU_VOICE_RELEASE_RATE(x)       ((((x) >> 16) & 0x1f) << 2)
 
-    uint32_t adsr;
-    int16_t adsr_current_volume;
-    size_t adsr_cycles;
+#define SPU_ADSR_NR_RATES               128
 
-    int16_t sample_buffer[SPU_VOICE_NR_SAMPLES];
-    int16_t prev_sample[2];
-
-    bool reset;
+/* Samples between envelope steps, and the increasing/decreasing step */
+struct spu_adsr_rate {
+    uint32_t cycles;
+    int32_t step[2];
 };
 
-enum spu_voice_adsr_mode {
-    SPU_VOICE_ADSR_MODE_LINEAR,
-    SPU_VOICE_ADSR_MODE_EXPONENTIAL,
-};
+/* Shared by every machine, and filled in by the first one */
+static struct spu_adsr_rate spu_adsr_rates[SPU_ADSR_NR_RATES];
+static pthread_once_t spu_adsr_once = PTHREAD_ONCE_INIT;
 
-enum spu_voice_adsr_direction {
-    SPU_VOICE_ADSR_DIRECTION_INCREASE,
-    SPU_VOICE_ADSR_DIRECTION_DECREASE,
-};
-
-static enum spu_voice_adsr_mode
-spu_voice_adsr_mode(const struct spu_voice *voice)
+static void
+spu_adsr_setup(void)
 {
-    switch (voice->state) {
-    case SPU_VOICE_STATE_ATTACK:
-        return voice->adsr & SPU_VOICE_ATTACK_MODE;
-    case SPU_VOICE_STATE_DECAY:
-        return SPU_VOICE_ADSR_MODE_EXPONENTIAL;
-    case SPU_VOICE_STATE_SUSTAIN:
-        return voice->adsr & SPU_VOICE_SUSTAIN_MODE;
-    case SPU_VOICE_STATE_RELEASE:
-        return voice->adsr & SPU_VOICE_RELEASE_MODE;
-    default:
-        return false;
-    }
-}
+    unsigned int shift;
 
-static enum spu_voice_adsr_direction
-spu_voice_adsr_direction(const struct spu_voice *voice)
-{
-    switch (voice->state) {
-    case SPU_VOICE_STATE_ATTACK:
-        return SPU_VOICE_ADSR_DIRECTION_INCREASE;
-    case SPU_VOICE_STATE_DECAY:
-        return SPU_VOICE_ADSR_DIRECTION_DECREASE;
-    case SPU_VOICE_STATE_SUSTAIN:
-        return voice->adsr & SPU_VOICE_SUSTAIN_DIRECTION;
-    case SPU_VOICE_STATE_RELEASE:
-        return SPU_VOICE_ADSR_DIRECTION_DECREASE;
-    default:
-        return false;
-    }
-}
+    for (unsigned int rate = 0; rate < SPU_ADSR_NR_RATES; ++rate) {
+        shift = rate >> 2;
 
-static unsigned int
-spu_voice_adsr_shift(const struct spu_voice *voice)
-{
-    switch (voice->state) {
-    case SPU_VOICE_STATE_ATTACK:
-        return (voice->adsr & SPU_VOICE_ATTACK_SHIFT) >> 10;
-    case SPU_VOICE_STATE_DECAY:
-        return (voice->adsr & SPU_VOICE_DECAY_SHIFT) >> 4;
-    case SPU_VOICE_STATE_SUSTAIN:
-        return (voice->adsr & SPU_VOICE_SUSTAIN_SHIFT) >> 24;
-    case SPU_VOICE_STATE_RELEASE:
-        return (voice->adsr & SPU_VOICE_RELEASE_SHIFT) >> 16;
-    default:
-        return 0;
+        spu_adsr_rates[rate].cycles = 1 << MAX(0, (int)shift - 11);
+        spu_adsr_rates[rate].step[0] = (7 - (int)(rate & 3)) <<
+                                       MAX(0, 11 - (int)shift);
+        spu_adsr_rates[rate].step[1] = (-8 + (int)(rate & 3)) <<
+                                       MAX(0, 11 - (int)shift);
     }
 }
 
-static int
-spu_voice_adsr_step(const struct spu_voice *voice)
+/*
+ * Loads the parameters of the current phase. Called on a phase change and
+ * when the ADSR registers are written, so that spu_voice_do_adsr only has to
+ * count down and step.
+ */
+static void
+spu_voice_adsr_load(struct spu_voice *voice)
 {
+    unsigned int rate;
+    bool decrease;
+
     switch (voice->state) {
     case SPU_VOICE_STATE_ATTACK:
-        return 7 - ((voice->adsr & SPU_VOICE_ATTACK_STEP) >> 8);
+        rate = SPU_VOICE_ATTACK_RATE(voice->adsr);
+        decrease = false;
+        voice->adsr_exponential = voice->adsr & SPU_VOICE_ATTACK_MODE;
+        voice->adsr_target = 0x7fff;
+        break;
     case SPU_VOICE_STATE_DECAY:
-        return -8;
+        rate = SPU_VOICE_DECAY_RATE(voice->adsr);
+        decrease = true;
+        voice->adsr_exponential = true;
+        voice->adsr_target = ((voice->adsr & SPU_VOICE_SUSTAIN_LEVEL) + 1) *
+                             0x800;
+        break;
     case SPU_VOICE_STATE_SUSTAIN:
-        if (spu_voice_adsr_direction(voice) == SPU_VOICE_ADSR_DIRECTION_INCREASE) {
-            return 7 - ((voice->adsr & SPU_VOICE_SUSTAIN_STEP) >> 22);
-        } else {
-            return -8 + ((voice->adsr & SPU_VOICE_SUSTAIN_STEP) >> 22);
-        }
+        /* Sustain lasts until key off, its target is out of reach */
+        rate = SPU_VOICE_SUSTAIN_RATE(voice->adsr);
+        decrease = voice->adsr & SPU_VOICE_SUSTAIN_DIRECTION;
+        voice->adsr_exponential = voice->adsr & SPU_VOICE_SUSTAIN_MODE;
+        voice->adsr_target = decrease ? INT32_MIN : INT32_MAX;
+        break;
     case SPU_VOICE_STATE_RELEASE:
-        return -8;
+        rate = SPU_VOICE_RELEASE_RATE(voice->adsr);
+        decrease = true;
+        voice->adsr_exponential = voice->adsr & SPU_VOICE_RELEASE_MODE;
+        voice->adsr_target = 0;
+        break;
     default:
-        return 0;
+        rate = 0;
+        decrease = false;
+        voice->adsr_exponential = false;
+        voice->adsr_target = INT32_MAX;
+        break;
     }
-}
-
-static int16_t
-spu_voice_sustain_level(const struct spu_voice *voice)
-{
-    int16_t sustain_level;
 
-    sustain_level = voice->adsr & SPU_VOICE_SUSTAIN_LEVEL;
-    return (sustain_level + 1) * 0x800;
+    voice->adsr_decrease = decrease;
+    voice->adsr_rate_cycles = spu_adsr_rates[rate].cycles;
+    voice->adsr_step = spu_adsr_rates[rate].step[decrease];
 }
 
 static void
-spu_voice_do_adsr(struct spu_voice *voice)
+spu_voice_set_state(struct psx_machine *psx, unsigned int i,
+                    enum spu_voice_state state)
 {
-    enum spu_voice_state state;
-    int16_t sustain_level;
-
-    int shift_value, step_value;
-    enum spu_voice_adsr_mode mode;
-    enum spu_voice_adsr_direction direction;
-    int cycles, step;
-    int new_level;
+    struct spu_voice *voice = &psx->spu.voice[i];
 
-    state = voice->state;
-    sustain_level = spu_voice_sustain_level(voice);
-    mode = spu_voice_adsr_mode(voice);
-    direction = spu_voice_adsr_direction(voice);
+    voice->state = state;
+    voice->adsr_cycles = 0;
 
-    if (voice->adsr_cycles != 0) {
-        voice->adsr_cycles -= 1;
+    if (state == SPU_VOICE_STATE_DISABLED) {
+        psx->spu.active &= ~(1u << i);
+    } else {
+        psx->spu.active |= 1u << i;
     }
 
-    shift_value = spu_voice_adsr_shift(voice);
-    step_value = spu_voice_adsr_step(voice);
-
-    cycles = 1 << MAX(0, shift_value - 11);
-    step = step_value << MAX(0, 11 - shift_value);
+    spu_voice_adsr_load(voice);
+}
 
-    if (mode == SPU_VOICE_ADSR_MODE_EXPONENTIAL
-        && direction == SPU_VOICE_ADSR_DIRECTION_INCREASE
-        && voice->adsr_current_volume > 0x6000) {
-        cycles *= 4;
-    }
+static void
+spu_voice_do_adsr(struct psx_machine *psx, unsigned int i)
+{
+    struct spu_voice *voice = &psx->spu.voice[i];
+    int32_t *envelope = &psx->spu.voices.envelope[i];
+    uint32_t cycles;
+    int32_t step;
 
-    else if (mode == SPU_VOICE_ADSR_MODE_EXPONENTIAL
-             && direction == SPU_VOICE_ADSR_DIRECTION_DECREASE) {
-        step *= voice->adsr_current_volume / 0x8000;
+    if (voice->adsr_cycles > 1) {
+        voice->adsr_cycles -= 1;
+        return;
     }
 
-    if (voice->adsr_cycles == 0) {
-        voice->adsr_cycles = cycles;
-        
-        new_level = voice->adsr_current_volume + step;
-        voice->adsr_current_volume = clip_i32(new_level, 0, 0x7fff);
+    cycles = voice->adsr_rate_cycles;
+    step = voice->adsr_step;
 
-        if (state == SPU_VOICE_STATE_ATTACK
-            && voice->adsr_current_volume == 0x7fff) {
-            voice->state = SPU_VOICE_STATE_DECAY;
-            voice->adsr_cycles = 0;
-        }
-
-        else if (state == SPU_VOICE_STATE_DECAY
-                 && voice->adsr_current_volume <= sustain_level) {
-            voice->state = SPU_VOICE_STATE_SUSTAIN;
-            voice->adsr_cycles = 0;
+    /* Exponential increase slows down above 3/4, decrease scales by level */
+    if (voice->adsr_exponential) {
+        if (voice->adsr_decrease) {
+            step = (step * *envelope) >> 15;
+        } else if (*envelope > 0x6000) {
+            cycles *= 4;
         }
+    }
 
-        else if (state == SPU_VOICE_STATE_RELEASE
-                 && voice->adsr_current_volume == 0) {
-            voice->state = SPU_VOICE_STATE_DISABLED;
-            voice->adsr_cycles = 0;
+    voice->adsr_cycles = cycles;
+    *envelope = clip_i32(*envelope + step, 0, 0x7fff);
+
+    if (voice->adsr_decrease ? *envelope <= voice->adsr_target
+                             : *envelope >= voice->adsr_target) {
+        switch (voice->state) {
+        case SPU_VOICE_STATE_ATTACK:
+            spu_voice_set_state(psx, i, SPU_VOICE_STATE_DECAY);
+            break;
+        case SPU_VOICE_STATE_DECAY:
+            spu_voice_set_state(psx, i, SPU_VOICE_STATE_SUSTAIN);
+            break;
+        case SPU_VOICE_STATE_RELEASE:
+            spu_voice_set_state(psx, i, SPU_VOICE_STATE_DISABLED);
+            break;
+        default:
+            break;
         }
     }
 }
 
-static uint32_t
-spu_voice_sample_index(const struct spu_voice *voice)
-{
-    return voice->pitch_counter >> 12;
-}
-
-static void
-spu_voice_set_sample_index(struct spu_voice *voice, uint32_t value)
-{
-    voice->pitch_counter &= 0xfff;
-    voice->pitch_counter |= value << 12;
-}
-
-static uint8_t
-spu_voice_interpolation_index(const struct spu_voice *voice)
-{
-    return voice->pitch_counter >> 4;
-}
-
 static uint16_t
-spu_voice_read16(struct spu_voice *voice, uint32_t offset)
+spu_voice_read16(struct psx_machine *psx, unsigned int i, uint32_t offset)
 {
     switch (offset & 0xf) {
     case 0xc:
-        return voice->adsr_current_volume;
+        return psx->spu.voices.envelope[i];
     }
 
     printf("spu: voice: error: read from unknown address 0x%x\n", offset);
@@ -262,17 +193,21 @@ spu_voice_read16(struct spu_voice *voice, uint32_t offset)
 }
 
 static void
-spu_voice_write16(struct spu_voice *voice, uint32_t offset, uint16_t value)
+spu_voice_write16(struct psx_machine *psx, unsigned int i, uint32_t offset,
+                  uint16_t value)
 {
+    struct spu_voice *voice = &psx->spu.voice[i];
+    struct spu_voices *voices = &psx->spu.voices;
+
     switch (offset & 0xf) {
     case 0x0:
-        voice->volume.left = (value & 0x7fff) * 2;
+        voices->volume_left[i] = (int16_t)((value & 0x7fff) * 2);
         return;
     case 0x2:
-        voice->volume.right = (value & 0x7fff) * 2;
+        voices->volume_right[i] = (int16_t)((value & 0x7fff) * 2);
         return;
     case 0x4:
-        voice->sample_rate = value;
+        voices->pitch_step[i] = MIN(value, 0x4000);
         return;
     case 0x6:
         voice->start_address = value * 8;
@@ -280,13 +215,15 @@ spu_voice_write16(struct spu_voice *voice, uint32_t offset, uint16_t value)
     case 0x8:
         voice->adsr &= 0xffff0000;
         voice->adsr |= value;
+        spu_voice_adsr_load(voice);
         return;
     case 0xa:
         voice->adsr &= 0xffff;
         voice->adsr |= value << 16;
+        spu_voice_adsr_load(voice);
         return;
     case 0xc:
-        voice->adsr_current_volume = value;
+        voices->envelope[i] = (int16_t)value;
         return;
     case 0xe:
         voice->repeat_address = value * 8;
@@ -298,19 +235,20 @@ spu_voice_write16(struct spu_voice *voice, uint32_t offset, uint16_t value)
 }
 
 static void
-spu_voice_key_on(struct spu_voice *voice)
+spu_voice_key_on(struct psx_machine *psx, unsigned int i)
 {
-    voice->state = SPU_VOICE_STATE_ATTACK;
-    voice->adsr_current_volume = 0;
-    voice->adsr_cycles = 0;
+    struct spu_voice *voice = &psx->spu.voice[i];
+
     voice->current_address = voice->start_address;
+    psx->spu.voices.envelope[i] = 0;
+
+    spu_voice_set_state(psx, i, SPU_VOICE_STATE_ATTACK);
 }
 
 static void
-spu_voice_key_off(struct spu_voice *voice)
+spu_voice_key_off(struct psx_machine *psx, unsigned int i)
 {
-    voice->state = SPU_VOICE_STATE_RELEASE;
-    voice->adsr_cycles = 0;
+    spu_voice_set_state(psx, i, SPU_VOICE_STATE_RELEASE);
 }
 
 enum spu_transfer_mode {
@@ -320,133 +258,99 @@ enum spu_transfer_mode {
     SPU_TRANSFER_MODE_DMA_READ
 };
 
-struct spu {
-    void *ram;
-
-    struct volume main_volume;
-    struct volume reverb_volume;
-    struct volume cd_volume;
-    struct volume external_volume;
-
-    uint32_t key_on;
-    uint32_t key_off;
-
-    uint16_t control;
-    uint16_t status;
-
-    struct {
-        uint32_t address;
-        uint32_t current_address;
-
-        uint16_t buffer[SPU_FIFO_SIZE];
-        size_t buffer_index;
-
-        uint16_t control;
-    } data_transfer;
-
-    struct spu_voice voice[SPU_NR_VOICES];
-
-    size_t counter;
-
-    int16_t samples[SPU_SAMPLE_BUFFER_SIZE];
-    size_t sample_index;
-};
-
-static struct spu spu;
-
 static uint16_t
-spu_memory_read16(uint32_t address)
+spu_memory_read16(struct psx_machine *psx, uint32_t address)
 {
     assert(address < SPU_RAM_SIZE);
 
-    return ((uint16_t *)spu.ram)[address / sizeof(uint16_t)];
+    return ((uint16_t *)psx->spu.ram)[address / sizeof(uint16_t)];
 }
 
 static void
-spu_memory_write16(uint32_t address, uint16_t value)
+spu_memory_write16(struct psx_machine *psx, uint32_t address, uint16_t value)
 {
     assert(address < SPU_RAM_SIZE);
 
-    ((uint16_t *)spu.ram)[address / sizeof(uint16_t)] = value;
+    ((uint16_t *)psx->spu.ram)[address / sizeof(uint16_t)] = value;
+    REWIND_MARK(psx, REWIND_SPU_RAM, address);
 }
 
 static void
-spu_fifo_push(uint16_t value)
+spu_fifo_push(struct psx_machine *psx, uint16_t value)
 {
-    if (spu.data_transfer.buffer_index >= SPU_FIFO_SIZE) {
+    struct spu *spu = &psx->spu;
+
+    if (spu->data_transfer.buffer_index >= SPU_FIFO_SIZE) {
         return;
     }
 
-    spu.data_transfer.buffer[spu.data_transfer.buffer_index++] = value;
+    spu->data_transfer.buffer[spu->data_transfer.buffer_index++] = value;
 }
 
 
 static enum spu_transfer_mode
-spu_transfer_mode(void)
+spu_transfer_mode(struct psx_machine *psx)
 {
-    return (spu.control & SPU_CONTROL_TRANSFER_MODE) >> 4;
+    return (psx->spu.control & SPU_CONTROL_TRANSFER_MODE) >> 4;
 }
 
 static void
-spu_update_status(void)
+spu_update_status(struct psx_machine *psx)
 {
     uint32_t address;
     uint16_t value;
 
-    spu.status &= ~SPU_STATUS_MODE;
-    spu.status |= spu.control & SPU_STATUS_MODE;
+    psx->spu.status &= ~SPU_STATUS_MODE;
+    psx->spu.status |= psx->spu.control & SPU_STATUS_MODE;
 
-    spu.status &= ~SPU_STATUS_DMA_REQUEST;
-    spu.status |= (spu.control & 0x20) ? SPU_STATUS_DMA_REQUEST : 0;
+    psx->spu.status &= ~SPU_STATUS_DMA_REQUEST;
+    psx->spu.status |= (psx->spu.control & 0x20) ? SPU_STATUS_DMA_REQUEST : 0;
 
-    if (spu_transfer_mode() == SPU_TRANSFER_MODE_MANUAL) {
-        for (size_t i = 0; i < spu.data_transfer.buffer_index; ++i) {
-            address = spu.data_transfer.current_address;
-            value = spu.data_transfer.buffer[i];
+    if (spu_transfer_mode(psx) == SPU_TRANSFER_MODE_MANUAL) {
+        for (size_t i = 0; i < psx->spu.data_transfer.buffer_index; ++i) {
+            address = psx->spu.data_transfer.current_address;
+            value = psx->spu.data_transfer.buffer[i];
 
-            spu_memory_write16(address, value);
+            spu_memory_write16(psx, address, value);
 
-            spu.data_transfer.current_address += 2;
+            psx->spu.data_transfer.current_address += 2;
         }
 
-        spu.data_transfer.buffer_index = 0;
+        psx->spu.data_transfer.buffer_index = 0;
     }
 }
 
 static void
-spu_update_key_on(void)
+spu_update_key_on(struct psx_machine *psx)
 {
     for (size_t i = 0; i < SPU_NR_VOICES; ++i) {
-        if (spu.key_on & (1 << i)) {
-            spu_voice_key_on(&spu.voice[i]);
+        if (psx->spu.key_on & (1 << i)) {
+            spu_voice_key_on(psx, i);
         }
     }
 
-    spu.key_on = 0;
+    psx->spu.key_on = 0;
 }
 
 static void
-spu_update_key_off(void)
+spu_update_key_off(struct psx_machine *psx)
 {
     for (size_t i = 0; i < SPU_NR_VOICES; ++i) {
-        if (spu.key_off & (1 << i)) {
-            spu_voice_key_off(&spu.voice[i]);
+        if (psx->spu.key_off & (1 << i)) {
+            spu_voice_key_off(psx, i);
         }
     }
 
-    spu.key_off = 0;
+    psx->spu.key_off = 0;
 }
 
 static void
-spu_voice_wrap_sample_index(struct spu_voice *voice)
+spu_voice_wrap_sample_index(struct psx_machine *psx, unsigned int i)
 {
-    uint32_t sample_index;
-
-    sample_index = spu_voice_sample_index(voice);
-    assert(sample_index >= SPU_VOICE_NR_SAMPLES);
-    sample_index -= SPU_VOICE_NR_SAMPLES;
+    uint32_t *pitch_counter = &psx->spu.voices.pitch_counter[i];
 
-    spu_voice_set_sample_index(voice, sample_index);
+    assert((*pitch_counter >> 12) >= SPU_VOICE_NR_SAMPLES);
+    *pitch_counter -= SPU_VOICE_NR_SAMPLES << 12;
 }
 
 static int16_t adpcm_filters[16][2] = {
@@ -458,14 +362,16 @@ static int16_t adpcm_filters[16][2] = {
 };
 
 static void
-spu_voice_decode_samples(struct spu_voice *voice)
+spu_voice_decode_samples(struct psx_machine *psx, unsigned int v)
 {
+    struct spu_voice *voice = &psx->spu.voice[v];
+    int16_t *sample_buffer = psx->spu.voices.sample_buffer[v];
     uint16_t header, samples;
     uint8_t flags, filter, shift;
 
     int32_t sample;
 
-    header = spu_memory_read16(voice->current_address);
+    header = spu_memory_read16(psx, voice->current_address);
     flags = header >> 8;
     filter = (header >> 4) & 0xf;
     shift = header & 0xf;
@@ -480,7 +386,7 @@ spu_voice_decode_samples(struct spu_voice *voice)
 
     for (int i = 0; i < 7; ++i) {
         voice->current_address += 2;
-        samples = spu_memory_read16(voice->current_address);
+        samples = spu_memory_read16(psx, voice->current_address);
 
         for (int j = 0; j < 4; ++j) {
             sample = (int16_t)(samples << 12);
@@ -491,7 +397,7 @@ spu_voice_decode_samples(struct spu_voice *voice)
 
             sample = clip_i32(sample, INT16_MIN, INT16_MAX);
 
-            voice->sample_buffer[i * 4 + j] = sample;
+            sample_buffer[i * 4 + j] = sample;
             voice->prev_sample[1] = voice->prev_sample[0];
             voice->prev_sample[0] = sample;
             samples >>= 4;
@@ -504,137 +410,161 @@ spu_voice_decode_samples(struct spu_voice *voice)
         voice->current_address = voice->repeat_address;
 
         if (!(flags & 0x2)) {
-            spu_voice_key_off(voice);
-            voice->adsr_current_volume = 0;
+            spu_voice_key_off(psx, v);
+            psx->spu.voices.envelope[v] = 0;
         }
     }
 }
 
-static float
-spu_voice_get_sample(const struct spu_voice *voice)
-{
-    uint32_t sample_index;
-
-    sample_index = spu_voice_sample_index(voice);
-
-    return i16_to_f32(voice->sample_buffer[sample_index]);
-}
-
 static void
-spu_tick(void)
+spu_tick(struct psx_machine *psx)
 {
-    struct spu_voice *voice;
-    float sample_left, sample_right, voice_sample;
+    uint32_t active, ended;
+    int32_t mix[2], left, right;
+    unsigned int i;
 
-    spu_update_status();
-    spu_update_key_on();
-    spu_update_key_off();
+    spu_update_status(psx);
+    spu_update_key_on(psx);
+    spu_update_key_off(psx);
 
-    sample_left = 0.0f;
-    sample_right = 0.0f;
+    for (active = psx->spu.active; active; active &= active - 1) {
+        spu_voice_do_adsr(psx, __builtin_ctz(active));
+    }
 
-    for (size_t i = 0; i < SPU_NR_VOICES; ++i) {
-        voice = &spu.voice[i];
+    ended = spu_mix(&psx->spu.voices, psx->spu.active, mix);
 
-        if (voice->state == SPU_VOICE_STATE_DISABLED) {
-            continue;
-        }
+    for (; ended; ended &= ended - 1) {
+        i = __builtin_ctz(ended);
 
-        spu_voice_do_adsr(voice);
+        spu_voice_wrap_sample_index(psx, i);
+        spu_voice_decode_samples(psx, i);
+    }
 
-        voice_sample = spu_voice_get_sample(voice);
-        voice_sample *= i16_to_f32(voice->adsr_current_volume);
+    left = clip_i32(mix[0], INT16_MIN, INT16_MAX);
+    right = clip_i32(mix[1], INT16_MIN, INT16_MAX);
 
-        sample_left += voice_sample * i16_to_f32(voice->volume.left);
-        sample_right += voice_sample * i16_to_f32(voice->volume.right);
+    left = (left * psx->spu.main_volume.left) >> 15;
+    right = (right * psx->spu.main_volume.right) >> 15;
 
-        voice->pitch_counter += MIN(voice->sample_rate, 0x4000);
+    left = clip_i32(left, INT16_MIN, INT16_MAX);
+    right = clip_i32(right, INT16_MIN, INT16_MAX);
 
-        if (spu_voice_sample_index(voice) >= SPU_VOICE_NR_SAMPLES) {
-            spu_voice_wrap_sample_index(voice);
-            spu_voice_decode_samples(voice);
+    psx->spu.samples[psx->spu.sample_index++] = left;
+    psx->spu.samples[psx->spu.sample_index++] = right;
+
+    if (psx->spu.sample_index >= SPU_SAMPLE_BUFFER_SIZE) {
+        if (psx->host.audio) {
+            psx->host.audio(psx->host.opaque, psx->spu.samples,
+                            SPU_SAMPLE_BUFFER_SIZE);
         }
+
+        psx->spu.sample_index = 0;
     }
+}
 
-    sample_left *= i16_to_f32(spu.main_volume.left);
-    sample_right *= i16_to_f32(spu.main_volume.right);
+static void spu_sync_event(struct psx_machine *psx, uint64_t timestamp);
 
-    sample_left = clip_f32(sample_left, -1.0f, 1.0f);
-    sample_right = clip_f32(sample_right, -1.0f, 1.0f);
+/*
+ * Samples are rendered in batches, only when the SPU is accessed or the
+ * sample buffer fills, so the deadline is the sample that fills it.
+ */
+static void
+spu_schedule(struct psx_machine *psx)
+{
+    uint64_t remaining;
 
-    spu.samples[spu.sample_index++] = f32_to_i16(sample_left);
-    spu.samples[spu.sample_index++] = f32_to_i16(sample_right);
+    remaining = (SPU_SAMPLE_BUFFER_SIZE - psx->spu.sample_index) / 2;
 
-    if (spu.sample_index >= SPU_SAMPLE_BUFFER_SIZE) {
-        window_audio_write_samples(spu.samples, SPU_SAMPLE_BUFFER_SIZE);
-        spu.sample_index = 0;
-    }
+    scheduler_schedule(psx, SCHEDULER_EVENT_SPU,
+                       psx->spu.timestamp +
+                       (remaining - 1) * SPU_CYCLES_PER_TICK,
+                       spu_sync_event);
 }
 
-void
-spu_setup(void)
+static void
+spu_sync_event(struct psx_machine *psx, uint64_t timestamp)
 {
-    spu.ram = malloc(SPU_RAM_SIZE);
-    assert(spu.ram);
+    (void)timestamp;
 
-    spu.counter = 0;
-    spu.data_transfer.buffer_index = 0;
-    spu.sample_index = 0;
+    spu_sync(psx);
+    spu_schedule(psx);
 }
 
+/* Renders every sample due up to now, one each 33868800 / 44100 cycles */
 void
-spu_shutdown(void)
+spu_sync(struct psx_machine *psx)
 {
-    assert(spu.ram);
-    free(spu.ram);
+    uint64_t now = scheduler_now(psx);
+
+    if (psx->spu.timestamp > now) {
+        return;
+    }
+
+    PERF_BEGIN(psx, PERF_SECTION_SPU);
+
+    while (psx->spu.timestamp <= now) {
+        spu_tick(psx);
+        psx->spu.timestamp += SPU_CYCLES_PER_TICK;
+    }
+
+    PERF_END(psx, PERF_SECTION_SPU);
 }
 
 void
-spu_hard_reset(void)
+spu_setup(struct psx_machine *psx)
 {
-    assert(spu.ram);
-    memset(spu.ram, 0, SPU_RAM_SIZE);
+    psx->spu.data_transfer.buffer_index = 0;
+    psx->spu.sample_index = 0;
+    psx->spu.timestamp = scheduler_now(psx);
+
+    pthread_once(&spu_adsr_once, spu_adsr_setup);
+    spu_mix_setup();
 
-    spu.counter = 0;
-    spu.data_transfer.buffer_index = 0;
+    spu_schedule(psx);
 }
 
 void
-spu_step(void)
+spu_hard_reset(struct psx_machine *psx)
 {
-    /* Tick the SPU every 33868800 / 44100 cycles */
-    if (spu.counter == 0) {
-        spu_tick();
+    memset(psx->spu.ram, 0, SPU_RAM_SIZE);
+    rewind_mark_range(psx, REWIND_SPU_RAM, 0, SPU_RAM_SIZE);
+
+    psx->spu.data_transfer.buffer_index = 0;
+
+    memset(psx->spu.voice, 0, sizeof(psx->spu.voice));
+    memset(&psx->spu.voices, 0, sizeof(psx->spu.voices));
+    psx->spu.active = 0;
+
+    for (unsigned int i = 0; i < SPU_NR_VOICES; ++i) {
+        spu_voice_adsr_load(&psx->spu.voice[i]);
     }
 
-    spu.counter = (spu.counter + 1) % SPU_CYCLES_PER_TICK;
+    psx->spu.timestamp = scheduler_now(psx);
+    spu_schedule(psx);
 }
 
-uint16_t spu_read16(uint32_t address)
+/* Accesses sync first, so they land between the same samples as before */
+uint16_t spu_read16(struct psx_machine *psx, uint32_t address)
 {
-    struct spu_voice *voice;
-    uint32_t offset;
+    spu_sync(psx);
 
     switch (address) {
     case 0x1f801c00 ... 0x1f801d7f:
-        voice = &spu.voice[(address >> 4) & 0x1f];
-        offset = address & 0xf;
-
-        return spu_voice_read16(voice, offset);
+        return spu_voice_read16(psx, (address >> 4) & 0x1f, address & 0xf);
     case 0x1f801d88:
-        return spu.key_on;
+        return psx->spu.key_on;
     case 0x1f801d8a:
-        return spu.key_on >> 16;
+        return psx->spu.key_on >> 16;
     case 0x1f801d8c:
-        return spu.key_off;
+        return psx->spu.key_off;
     case 0x1f801d8e:
-        return spu.key_off >> 16;
+        return psx->spu.key_off >> 16;
     case 0x1f801daa:
-        return spu.control;
+        return psx->spu.control;
     case 0x1f801dac:
-        return spu.data_transfer.control;
+        return psx->spu.data_transfer.control;
     case 0x1f801dae:
-        return spu.status;
+        return psx->spu.status;
     }
 
     printf("spu: error: read from unknown address 0x%08x\n", address);
@@ -643,45 +573,41 @@ uint16_t spu_read16(uint32_t address)
     return 0;
 }
 
-void spu_write16(uint32_t address, uint16_t value)
+void spu_write16(struct psx_machine *psx, uint32_t address, uint16_t value)
 {
-    struct spu_voice *voice;
-    uint32_t offset;
+    spu_sync(psx);
 
     switch (address) {
     case 0x1f801c00 ... 0x1f801d7f:
-        voice = &spu.voice[(address >> 4) & 0x1f];
-        offset = address & 0xf;
-
-        spu_voice_write16(voice, offset, value);
+        spu_voice_write16(psx, (address >> 4) & 0x1f, address & 0xf, value);
         return;
     case 0x1f801d80:
-        spu.main_volume.left = value;
+        psx->spu.main_volume.left = (value & 0x7fff) * 2;
         return;
     case 0x1f801d82:
-        spu.main_volume.right = value;
+        psx->spu.main_volume.right = (value & 0x7fff) * 2;
         return;
     case 0x1f801d84:
-        spu.reverb_volume.left = value;
+        psx->spu.reverb_volume.left = value;
         return;
     case 0x1f801d86:
-        spu.reverb_volume.right = value;
+        psx->spu.reverb_volume.right = value;
         return;
     case 0x1f801d88:
-        spu.key_on &= 0xffff0000;
-        spu.key_on |= value;
+        psx->spu.key_on &= 0xffff0000;
+        psx->spu.key_on |= value;
         return;
     case 0x1f801d8a:
-        spu.key_on &= 0xffff;
-        spu.key_on |= value << 16;
+        psx->spu.key_on &= 0xffff;
+        psx->spu.key_on |= value << 16;
         return;
     case 0x1f801d8c:
-        spu.key_off &= 0xffff0000;
-        spu.key_off |= value;
+        psx->spu.key_off &= 0xffff0000;
+        psx->spu.key_off |= value;
         return;
     case 0x1f801d8e:
-        spu.key_off &= 0xffff;
-        spu.key_off |= value << 16;
+        psx->spu.key_off &= 0xffff;
+        psx->spu.key_off |= value << 16;
         return;
     case 0x1f801d90:
         /* Voice PMON flags low */
@@ -705,29 +631,29 @@ void spu_write16(uint32_t address, uint16_t value)
         /* Reverb mBASE */
         return;
     case 0x1f801da6:
-        spu.data_transfer.address = value * 8;
-        spu.data_transfer.current_address = value * 8;
+        psx->spu.data_transfer.address = value * 8;
+        psx->spu.data_transfer.current_address = value * 8;
         return;
     case 0x1f801da8:
-        spu_fifo_push(value);
+        spu_fifo_push(psx, value);
         return;
     case 0x1f801daa:
-        spu.control = value;
+        psx->spu.control = value;
         return;
     case 0x1f801dac:
-        spu.data_transfer.control = value;
+        psx->spu.data_transfer.control = value;
         return;
     case 0x1f801db0:
-        spu.cd_volume.left = value;
+        psx->spu.cd_volume.left = value;
         return;
     case 0x1f801db2:
-        spu.cd_volume.right = value;
+        psx->spu.cd_volume.right = value;
         return;
     case 0x1f801db4:
-        spu.external_volume.left = value;
+        psx->spu.external_volume.left = value;
         return;
     case 0x1f801db6:
-        spu.external_volume.right = value;
+        psx->spu.external_volume.right = value;
         return;
     case 0x1f801dc0 ... 0x1f801dff:
         /* Reverb config registers */
@@ -738,8 +664,69 @@ void spu_write16(uint32_t address, uint16_t value)
     PANIC;
 }
 
+/* DMA words go straight to or from RAM, the transfer syncs once up front */
+uint32_t
+spu_dma_read32(struct psx_machine *psx)
+{
+    uint32_t address, value;
+
+    address = psx->spu.data_transfer.current_address;
+    value = spu_memory_read16(psx, address);
+    value |= spu_memory_read16(psx, (address + 2) & (SPU_RAM_SIZE - 1)) << 16;
+
+    psx->spu.data_transfer.current_address = (address + 4) &
+                                             (SPU_RAM_SIZE - 1);
+    return value;
+}
+
+void
+spu_dma_write32(struct psx_machine *psx, uint32_t value)
+{
+    uint32_t address;
+
+    address = psx->spu.data_transfer.current_address;
+    spu_memory_write16(psx, address, value);
+    spu_memory_write16(psx, (address + 2) & (SPU_RAM_SIZE - 1), value >> 16);
+
+    psx->spu.data_transfer.current_address = (address + 4) &
+                                             (SPU_RAM_SIZE - 1);
+}
+
 uint8_t *
-spu_debug_ram(void)
+spu_debug_ram(struct psx_machine *psx)
+{
+    return psx->spu.ram;
+}
+
+/* Everything after the sound RAM, which comes first */
+#define SPU_STATE_REGISTERS \
+    (sizeof(struct spu) - offsetof(struct spu, main_volume))
+
+void
+spu_save_state(struct psx_machine *psx, struct state *state)
+{
+    state_begin_section(state, STATE_SECTION_SPU);
+
+    if (state->flags & STATE_NO_MEMORY) {
+        state_write(state, &psx->spu.main_volume, SPU_STATE_REGISTERS);
+    } else {
+        state_write(state, &psx->spu, sizeof(psx->spu));
+    }
+
+    state_end_section(state);
+}
+
+void
+spu_load_state(struct psx_machine *psx, struct state *state)
 {
-    return spu.ram;
+    if (!state_find_section(state, STATE_SECTION_SPU)) {
+        return;
+    }
+
+    if (state->flags & STATE_NO_MEMORY) {
+        state_read(state, &psx->spu.main_volume, SPU_STATE_REGISTERS);
+    } else {
+        state_read(state, &psx->spu, sizeof(psx->spu));
+        rewind_mark_range(psx, REWIND_SPU_RAM, 0, SPU_RAM_SIZE);
+    }
 }
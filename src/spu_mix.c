@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spu_mix.h"
+
+static const char *SPU_MIX_ISA_NAMES[SPU_MIX_NR_ISAS] = {
+    "scalar", "sse4.1", "avx2"
+};
+
+static const spu_mix_kernel SPU_MIX_KERNELS[SPU_MIX_NR_ISAS] = {
+    spu_mix_scalar,
+#if defined(__x86_64__) || defined(__i386__)
+    spu_mix_sse41,
+    spu_mix_avx2
+#else
+    NULL,
+    NULL
+#endif
+};
+
+static enum spu_mix_isa spu_mix_isa = SPU_MIX_SCALAR;
+static spu_mix_kernel spu_mix_kernel_selected = spu_mix_scalar;
+static pthread_once_t spu_mix_once = PTHREAD_ONCE_INIT;
+
+uint32_t
+spu_mix_scalar(struct spu_voices *v, uint32_t active, int32_t out[2])
+{
+    int32_t left, right, sample;
+    uint32_t ended;
+    unsigned int i;
+
+    left = 0;
+    right = 0;
+    ended = 0;
+
+    while (active) {
+        i = __builtin_ctz(active);
+        active &= active - 1;
+
+        sample = v->sample_buffer[i][v->pitch_counter[i] >> 12];
+        sample = (sample * v->envelope[i]) >> 15;
+
+        left += (sample * v->volume_left[i]) >> 15;
+        right += (sample * v->volume_right[i]) >> 15;
+
+        v->pitch_counter[i] += v->pitch_step[i];
+
+        if ((v->pitch_counter[i] >> 12) >= SPU_VOICE_NR_SAMPLES) {
+            ended |= 1u << i;
+        }
+    }
+
+    out[0] = left;
+    out[1] = right;
+
+    return ended;
+}
+
+static void
+spu_mix_setup_once(void)
+{
+    if (spu_mix_supported(SPU_MIX_AVX2)) {
+        spu_mix_select(SPU_MIX_AVX2);
+    } else if (spu_mix_supported(SPU_MIX_SSE41)) {
+        spu_mix_select(SPU_MIX_SSE41);
+    } else {
+        spu_mix_select(SPU_MIX_SCALAR);
+    }
+}
+
+/* Only the first machine picks, the rest may already be mixing with it */
+void
+spu_mix_setup(void)
+{
+    pthread_once(&spu_mix_once, spu_mix_setup_once);
+}
+
+bool
+spu_mix_supported(enum spu_mix_isa isa)
+{
+    assert(isa < SPU_MIX_NR_ISAS);
+
+    switch (isa) {
+    case SPU_MIX_SCALAR:
+        return true;
+#if defined(__x86_64__) || defined(__i386__)
+    case SPU_MIX_SSE41:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.1");
+    case SPU_MIX_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+spu_mix_kernel
+spu_mix_get(enum spu_mix_isa isa)
+{
+    assert(isa < SPU_MIX_NR_ISAS);
+
+    return spu_mix_supported(isa) ? SPU_MIX_KERNELS[isa] : NULL;
+}
+
+const char *
+spu_mix_isa_name(enum spu_mix_isa isa)
+{
+    assert(isa < SPU_MIX_NR_ISAS);
+
+    return SPU_MIX_ISA_NAMES[isa];
+}
+
+bool
+spu_mix_select(enum spu_mix_isa isa)
+{
+    spu_mix_kernel kernel = spu_mix_get(isa);
+
+    if (!kernel) {
+        return false;
+    }
+
+    spu_mix_isa = isa;
+    spu_mix_kernel_selected = kernel;
+    return true;
+}
+
+enum spu_mix_isa
+spu_mix_selected(void)
+{
+    return spu_mix_isa;
+}
+
+uint32_t
+spu_mix(struct spu_voices *v, uint32_t active, int32_t out[2])
+{
+    return spu_mix_kernel_selected(v, active, out);
+}
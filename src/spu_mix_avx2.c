@@ -0,0 +1,88 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "spu_mix.h"
+
+#define SPU_MIX_AVX2_LANES      8
+
+static inline int32_t
+spu_mix_avx2_sum(__m256i value)
+{
+    __m128i half;
+
+    half = _mm_add_epi32(_mm256_castsi256_si128(value),
+                         _mm256_extracti128_si256(value, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+    return _mm_cvtsi128_si32(half);
+}
+
+/*
+ * Eight voices per vector. Samples are gathered 32 bits at a time from
+ * halfword offsets and sign-extended from the low half; the last sample of
+ * the last voice reads two bytes into the field that follows the buffers.
+ */
+uint32_t
+spu_mix_avx2(struct spu_voices *v, uint32_t active, int32_t out[2])
+{
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i rows = _mm256_setr_epi32(
+        0 * SPU_VOICE_BUFFER_SIZE, 1 * SPU_VOICE_BUFFER_SIZE,
+        2 * SPU_VOICE_BUFFER_SIZE, 3 * SPU_VOICE_BUFFER_SIZE,
+        4 * SPU_VOICE_BUFFER_SIZE, 5 * SPU_VOICE_BUFFER_SIZE,
+        6 * SPU_VOICE_BUFFER_SIZE, 7 * SPU_VOICE_BUFFER_SIZE);
+    const __m256i last = _mm256_set1_epi32(SPU_VOICE_NR_SAMPLES - 1);
+    __m256i left, right, mask, counter, sample, step, index;
+    uint32_t ended;
+    unsigned int b;
+
+    left = _mm256_setzero_si256();
+    right = _mm256_setzero_si256();
+    ended = 0;
+
+    for (b = 0; b < SPU_NR_VOICES; b += SPU_MIX_AVX2_LANES) {
+        if (!((active >> b) & 0xff)) {
+            continue;
+        }
+
+        mask = _mm256_and_si256(_mm256_set1_epi32(active >> b), bits);
+        mask = _mm256_cmpeq_epi32(mask, bits);
+
+        counter = _mm256_loadu_si256((const __m256i *)&v->pitch_counter[b]);
+        index = _mm256_add_epi32(_mm256_srli_epi32(counter, 12), rows);
+
+        sample = _mm256_mask_i32gather_epi32(
+            _mm256_setzero_si256(), (const int *)v->sample_buffer[b], index,
+            mask, 2);
+        sample = _mm256_srai_epi32(_mm256_slli_epi32(sample, 16), 16);
+
+        sample = _mm256_mullo_epi32(
+            sample, _mm256_loadu_si256((const __m256i *)&v->envelope[b]));
+        sample = _mm256_srai_epi32(sample, 15);
+
+        left = _mm256_add_epi32(left, _mm256_srai_epi32(_mm256_mullo_epi32(
+            sample, _mm256_loadu_si256((const __m256i *)&v->volume_left[b])),
+            15));
+        right = _mm256_add_epi32(right, _mm256_srai_epi32(_mm256_mullo_epi32(
+            sample, _mm256_loadu_si256((const __m256i *)&v->volume_right[b])),
+            15));
+
+        step = _mm256_loadu_si256((const __m256i *)&v->pitch_step[b]);
+        counter = _mm256_add_epi32(counter, _mm256_and_si256(step, mask));
+        _mm256_storeu_si256((__m256i *)&v->pitch_counter[b], counter);
+
+        index = _mm256_cmpgt_epi32(_mm256_srli_epi32(counter, 12), last);
+        index = _mm256_and_si256(index, mask);
+        ended |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(index)) << b;
+    }
+
+    out[0] = spu_mix_avx2_sum(left);
+    out[1] = spu_mix_avx2_sum(right);
+
+    return ended;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <stdint.h>
+
+#include <smmintrin.h>
+
+#include "spu_mix.h"
+
+#define SPU_MIX_SSE41_LANES     4
+
+static inline int32_t
+spu_mix_sse41_sum(__m128i value)
+{
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, 0x4e));
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, 0xb1));
+    return _mm_cvtsi128_si32(value);
+}
+
+/* Four voices per vector, samples fetched one lane at a time */
+uint32_t
+spu_mix_sse41(struct spu_voices *v, uint32_t active, int32_t out[2])
+{
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128i last = _mm_set1_epi32(SPU_VOICE_NR_SAMPLES - 1);
+    __m128i left, right, mask, counter, sample, step, index;
+    uint32_t ended;
+    unsigned int b;
+
+    left = _mm_setzero_si128();
+    right = _mm_setzero_si128();
+    ended = 0;
+
+    for (b = 0; b < SPU_NR_VOICES; b += SPU_MIX_SSE41_LANES) {
+        if (!((active >> b) & 0xf)) {
+            continue;
+        }
+
+        mask = _mm_and_si128(_mm_set1_epi32(active >> b), bits);
+        mask = _mm_cmpeq_epi32(mask, bits);
+
+        counter = _mm_loadu_si128((const __m128i *)&v->pitch_counter[b]);
+        index = _mm_srli_epi32(counter, 12);
+
+        /* Inactive voices still hold an index inside their buffer */
+        sample = _mm_setr_epi32(
+            v->sample_buffer[b + 0][_mm_extract_epi32(index, 0)],
+            v->sample_buffer[b + 1][_mm_extract_epi32(index, 1)],
+            v->sample_buffer[b + 2][_mm_extract_epi32(index, 2)],
+            v->sample_buffer[b + 3][_mm_extract_epi32(index, 3)]);
+
+        sample = _mm_mullo_epi32(
+            sample, _mm_loadu_si128((const __m128i *)&v->envelope[b]));
+        sample = _mm_and_si128(_mm_srai_epi32(sample, 15), mask);
+
+        left = _mm_add_epi32(left, _mm_srai_epi32(_mm_mullo_epi32(
+            sample, _mm_loadu_si128((const __m128i *)&v->volume_left[b])),
+            15));
+        right = _mm_add_epi32(right, _mm_srai_epi32(_mm_mullo_epi32(
+            sample, _mm_loadu_si128((const __m128i *)&v->volume_right[b])),
+            15));
+
+        step = _mm_loadu_si128((const __m128i *)&v->pitch_step[b]);
+        counter = _mm_add_epi32(counter, _mm_and_si128(step, mask));
+        _mm_storeu_si128((__m128i *)&v->pitch_counter[b], counter);
+
+        index = _mm_cmpgt_epi32(_mm_srli_epi32(counter, 12), last);
+        index = _mm_and_si128(index, mask);
+        ended |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(index)) << b;
+    }
+
+    out[0] = spu_mix_sse41_sum(left);
+    out[1] = spu_mix_sse41_sum(right);
+
+    return ended;
+}
+
+#endif
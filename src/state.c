@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "state.h"
+
+#define STATE_PAD(x)    (((x) + STATE_ALIGN - 1) & ~(size_t)(STATE_ALIGN - 1))
+
+void
+state_begin_write(struct state *state, void *buffer, size_t size,
+                  uint32_t flags)
+{
+    memset(state, 0, sizeof(*state));
+
+    state->buffer = buffer;
+    state->size = buffer ? size : SIZE_MAX;
+    state->flags = flags;
+    state->offset = STATE_PAD(sizeof(struct state_header));
+
+    if (state->offset > state->size) {
+        state->error = true;
+    } else if (buffer) {
+        /* Padding after the header too, so states compare byte for byte */
+        memset(buffer, 0, state->offset);
+    }
+}
+
+/* Returns the size of the state, or 0 if it didn't fit */
+size_t
+state_end_write(struct state *state)
+{
+    struct state_header header;
+
+    if (state->error || state->offset > UINT32_MAX) {
+        return 0;
+    }
+
+    if (state->buffer) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+        header.version = STATE_VERSION;
+        header.size = state->offset;
+        header.flags = state->flags;
+
+        memcpy(state->buffer, &header, sizeof(header));
+    }
+
+    return state->offset;
+}
+
+void
+state_begin_section(struct state *state, enum state_section section)
+{
+    struct state_section_header header;
+
+    assert(section < STATE_NR_SECTIONS);
+
+    state->section = state->offset;
+    state->id = section;
+
+    if (state->error ||
+        state->size - state->offset < sizeof(struct state_section_header)) {
+        state->error = true;
+        return;
+    }
+
+    if (state->buffer) {
+        memset(&header, 0, sizeof(header));
+        header.id = section;
+        memcpy(state->buffer + state->offset, &header, sizeof(header));
+    }
+
+    state->offset += sizeof(struct state_section_header);
+}
+
+void
+state_end_section(struct state *state)
+{
+    struct state_section_header *header;
+    size_t size, padded;
+
+    if (state->error) {
+        return;
+    }
+
+    size = state->offset - state->section - sizeof(*header);
+    padded = STATE_PAD(state->offset);
+
+    if (padded > state->size) {
+        state->error = true;
+        return;
+    }
+
+    if (state->buffer) {
+        header = (struct state_section_header *)(state->buffer +
+                                                 state->section);
+        header->size = size;
+        memset(state->buffer + state->offset, 0, padded - state->offset);
+    }
+
+    state->sizes[state->id] = size;
+    state->offset = padded;
+}
+
+void
+state_write(struct state *state, const void *data, size_t size)
+{
+    if (state->error || state->size - state->offset < size) {
+        state->error = true;
+        return;
+    }
+
+    if (state->buffer) {
+        memcpy(state->buffer + state->offset, data, size);
+    }
+
+    state->offset += size;
+}
+
+/* Checks the header and indexes the sections, without loading anything */
+bool
+state_begin_read(struct state *state, const void *buffer, size_t size)
+{
+    struct state_header header;
+    struct state_section_header section;
+    size_t offset;
+
+    memset(state, 0, sizeof(*state));
+
+    state->buffer = (uint8_t *)buffer;
+    state->size = size;
+    state->error = true;
+
+    if (size < sizeof(header)) {
+        printf("state: error: truncated header\n");
+        return false;
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+
+    if (memcmp(header.magic, STATE_MAGIC, sizeof(header.magic))) {
+        printf("state: error: not a savestate\n");
+        return false;
+    }
+
+    if (header.version != STATE_VERSION) {
+        printf("state: error: version %u, expected %u\n", header.version,
+               STATE_VERSION);
+        return false;
+    }
+
+    if (header.size > size) {
+        printf("state: error: truncated, %u bytes of %u\n", (unsigned)size,
+               header.size);
+        return false;
+    }
+
+    state->size = header.size;
+    state->flags = header.flags;
+
+    for (offset = STATE_PAD(sizeof(header));
+         offset + sizeof(section) <= state->size;
+         offset = STATE_PAD(offset + sizeof(section) + section.size)) {
+        memcpy(&section, state->buffer + offset, sizeof(section));
+
+        if (section.size > state->size - offset - sizeof(section)) {
+            printf("state: error: section %u overruns the state\n",
+                   section.id);
+            return false;
+        }
+
+        /* Unknown sections are skipped */
+        if (section.id < STATE_NR_SECTIONS) {
+            state->sizes[section.id] = section.size;
+        }
+    }
+
+    state->error = false;
+    return true;
+}
+
+bool
+state_find_section(struct state *state, enum state_section section)
+{
+    struct state_section_header header;
+    size_t offset;
+
+    assert(section < STATE_NR_SECTIONS);
+
+    for (offset = STATE_PAD(sizeof(struct state_header));
+         offset + sizeof(header) <= state->size;
+         offset = STATE_PAD(offset + sizeof(header) + header.size)) {
+        memcpy(&header, state->buffer + offset, sizeof(header));
+
+        if (header.id == section) {
+            state->offset = offset + sizeof(header);
+            state->end = state->offset + header.size;
+            return true;
+        }
+    }
+
+    state->error = true;
+    return false;
+}
+
+void
+state_read(struct state *state, void *data, size_t size)
+{
+    if (state->error || state->end - state->offset < size) {
+        state->error = true;
+        return;
+    }
+
+    memcpy(data, state->buffer + state->offset, size);
+    state->offset += size;
+}
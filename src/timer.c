@@ -0,0 +1,502 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "macros.h"
+#include "psx.h"
+#include "psx_machine.h"
+#include "r3000.h"
+#include "scheduler.h"
+#include "state.h"
+#include "timer.h"
+
+#define TIMER_MODE_SYNC_ENABLE          0x0001
+#define TIMER_MODE_SYNC_MODE            0x0006
+#define TIMER_MODE_RESET_TARGET         0x0008
+#define TIMER_MODE_IRQ_TARGET           0x0010
+#define TIMER_MODE_IRQ_OVERFLOW         0x0020
+#define TIMER_MODE_IRQ_REPEAT           0x0040
+#define TIMER_MODE_IRQ_TOGGLE           0x0080
+#define TIMER_MODE_SOURCE               0x0300
+#define TIMER_MODE_IRQ_N                0x0400
+#define TIMER_MODE_REACHED_TARGET       0x0800
+#define TIMER_MODE_REACHED_OVERFLOW     0x1000
+#define TIMER_MODE_WRITABLE             0x03ff
+
+#define TIMER_LINES_PER_FRAME           263     /* NTSC */
+
+/* GP1(08h) horizontal resolutions 256, 320, 512 and 640, then 368 */
+static const unsigned int TIMER_DOT_DIVIDERS[5] = { 10, 8, 5, 4, 7 };
+
+static void timer_event0(struct psx_machine *psx, uint64_t timestamp);
+static void timer_event1(struct psx_machine *psx, uint64_t timestamp);
+static void timer_event2(struct psx_machine *psx, uint64_t timestamp);
+
+static const scheduler_callback TIMER_EVENTS[TIMER_NR_COUNTERS] = {
+    timer_event0, timer_event1, timer_event2
+};
+
+static unsigned int
+timer_sync_mode(const struct timer_counter *counter)
+{
+    return (counter->mode & TIMER_MODE_SYNC_MODE) >> 1;
+}
+
+/* Ticks of the clock source are floor(cycle * num / den) */
+static void
+timer_rate(struct psx_machine *psx, unsigned int i, uint64_t *num,
+           uint64_t *den)
+{
+    unsigned int source;
+
+    source = (psx->timer.counter[i].mode & TIMER_MODE_SOURCE) >> 8;
+
+    *num = 1;
+    *den = 1;
+
+    switch (i) {
+    case 0:
+        /* The dot clock runs off the 11/7 faster video clock */
+        if (source & 0x1) {
+            *num = 11;
+            *den = 7 * psx->timer.dot_divider;
+        }
+
+        break;
+    case 1:
+        if (source & 0x1) {
+            *num = TIMER_LINES_PER_FRAME;
+            *den = PSX_CYCLES_PER_FRAME;
+        }
+
+        break;
+    default:
+        if (source & 0x2) {
+            *den = 8;
+        }
+
+        break;
+    }
+}
+
+/* Ticks from value until the counter next becomes point */
+static uint64_t
+timer_distance(unsigned int value, unsigned int point, unsigned int period)
+{
+    unsigned int distance;
+
+    distance = (point + period - value) % period;
+    return distance ? distance : period;
+}
+
+/* Times the counter becomes point within ticks */
+static uint64_t
+timer_hits(unsigned int value, uint64_t ticks, unsigned int point,
+           unsigned int period)
+{
+    uint64_t first;
+
+    first = timer_distance(value, point, period);
+    return ticks >= first ? (ticks - first) / period + 1 : 0;
+}
+
+static void
+timer_irq(struct psx_machine *psx, unsigned int i, uint64_t count)
+{
+    struct timer_counter *counter = &psx->timer.counter[i];
+    bool assert_irq;
+
+    if (!(counter->mode & TIMER_MODE_IRQ_REPEAT)) {
+        if (counter->irq_done) {
+            return;
+        }
+
+        counter->irq_done = true;
+        count = 1;
+    }
+
+    /* Pulses leave bit 10 high; toggling raises the IRQ when it goes low */
+    if (counter->mode & TIMER_MODE_IRQ_TOGGLE) {
+        assert_irq = count > 1 || (counter->mode & TIMER_MODE_IRQ_N);
+
+        if (count & 1) {
+            counter->mode ^= TIMER_MODE_IRQ_N;
+        }
+    } else {
+        assert_irq = true;
+    }
+
+    if (assert_irq) {
+        psx_assert_irq(psx, PSX_INTERRUPT_TMR0 << i);
+    }
+}
+
+/* Counts ticks, noting every time the counter reached its target or FFFFh */
+static void
+timer_advance(struct psx_machine *psx, unsigned int i, uint64_t ticks)
+{
+    struct timer_counter *counter = &psx->timer.counter[i];
+    uint64_t target_hits, overflow_hits, irqs;
+    unsigned int period, wrap;
+
+    if (!ticks) {
+        return;
+    }
+
+    target_hits = 0;
+    overflow_hits = 0;
+
+    if (!(counter->mode & TIMER_MODE_RESET_TARGET)) {
+        target_hits = timer_hits(counter->value, ticks, counter->target,
+                                 0x10000);
+        overflow_hits = timer_hits(counter->value, ticks, 0xffff, 0x10000);
+        counter->value += ticks;
+    } else {
+        period = counter->target + 1;
+
+        /* Above the target, it has to wrap around before resetting */
+        if (counter->value > counter->target) {
+            wrap = 0x10000 - counter->value;
+
+            if (ticks < wrap) {
+                overflow_hits = counter->value + ticks == 0xffff;
+                counter->value += ticks;
+                ticks = 0;
+            } else {
+                overflow_hits = counter->value != 0xffff;
+                counter->value = counter->target;
+                ticks -= wrap - 1;
+            }
+        }
+
+        if (ticks) {
+            target_hits = timer_hits(counter->value, ticks, counter->target,
+                                     period);
+
+            if (counter->target == 0xffff) {
+                overflow_hits += target_hits;
+            }
+
+            counter->value = (counter->value + ticks) % period;
+        }
+    }
+
+    if (target_hits) {
+        counter->mode |= TIMER_MODE_REACHED_TARGET;
+    }
+
+    if (overflow_hits) {
+        counter->mode |= TIMER_MODE_REACHED_OVERFLOW;
+    }
+
+    irqs = 0;
+
+    if (counter->mode & TIMER_MODE_IRQ_TARGET) {
+        irqs += target_hits;
+    }
+
+    if (counter->mode & TIMER_MODE_IRQ_OVERFLOW) {
+        irqs += overflow_hits;
+    }
+
+    if (irqs) {
+        timer_irq(psx, i, irqs);
+    }
+}
+
+/* Brings the counter up to the current cycle */
+static void
+timer_update(struct psx_machine *psx, unsigned int i)
+{
+    struct timer_counter *counter = &psx->timer.counter[i];
+    uint64_t now, num, den;
+
+    now = scheduler_now(psx);
+
+    if (!counter->paused) {
+        timer_rate(psx, i, &num, &den);
+        timer_advance(psx, i, now * num / den - counter->base * num / den);
+    }
+
+    counter->base = now;
+}
+
+/* Queues an event for the next tick that raises an IRQ, if any will */
+static void
+timer_schedule(struct psx_machine *psx, unsigned int i)
+{
+    struct timer_counter *counter = &psx->timer.counter[i];
+    uint64_t distance, ticks, num, den;
+    unsigned int period;
+
+    scheduler_cancel(psx, SCHEDULER_EVENT_TIMER0 + i);
+
+    if (counter->paused ||
+        !(counter->mode & (TIMER_MODE_IRQ_TARGET | TIMER_MODE_IRQ_OVERFLOW)) ||
+        (counter->irq_done && !(counter->mode & TIMER_MODE_IRQ_REPEAT))) {
+        return;
+    }
+
+    distance = UINT64_MAX;
+
+    if (!(counter->mode & TIMER_MODE_RESET_TARGET)) {
+        if (counter->mode & TIMER_MODE_IRQ_TARGET) {
+            distance = timer_distance(counter->value, counter->target,
+                                      0x10000);
+        }
+
+        if (counter->mode & TIMER_MODE_IRQ_OVERFLOW) {
+            distance = MIN(distance, timer_distance(counter->value, 0xffff,
+                                                    0x10000));
+        }
+    } else if (counter->value > counter->target) {
+        if (counter->mode & TIMER_MODE_IRQ_TARGET) {
+            distance = 0x10000 - counter->value + counter->target;
+        }
+
+        if ((counter->mode & TIMER_MODE_IRQ_OVERFLOW) &&
+            counter->value != 0xffff) {
+            distance = MIN(distance, (uint64_t)(0xffff - counter->value));
+        }
+    } else {
+        period = counter->target + 1;
+
+        if ((counter->mode & TIMER_MODE_IRQ_TARGET) ||
+            counter->target == 0xffff) {
+            distance = timer_distance(counter->value, counter->target,
+                                      period);
+        }
+    }
+
+    if (distance == UINT64_MAX) {
+        return;
+    }
+
+    /* First cycle at which the clock source has ticked that many times */
+    timer_rate(psx, i, &num, &den);
+    ticks = counter->base * num / den + distance;
+
+    scheduler_schedule(psx, SCHEDULER_EVENT_TIMER0 + i,
+                       (ticks * den + num - 1) / num, TIMER_EVENTS[i]);
+}
+
+static void
+timer_event(struct psx_machine *psx, unsigned int i)
+{
+    timer_update(psx, i);
+    timer_schedule(psx, i);
+}
+
+static void
+timer_event0(struct psx_machine *psx, uint64_t timestamp)
+{
+    (void)timestamp;
+
+    timer_event(psx, 0);
+}
+
+static void
+timer_event1(struct psx_machine *psx, uint64_t timestamp)
+{
+    (void)timestamp;
+
+    timer_event(psx, 1);
+}
+
+static void
+timer_event2(struct psx_machine *psx, uint64_t timestamp)
+{
+    (void)timestamp;
+
+    timer_event(psx, 2);
+}
+
+/*
+ * Timer 2 can be stopped outright, and timer 1 paused until or outside of
+ * VBLANK. Only the VBLANK instant is modelled, so pausing during it is
+ * ignored, and so are the HBLANK sync modes of timer 0.
+ */
+static bool
+timer_sync_paused(const struct timer_counter *counter, unsigned int i)
+{
+    if (!(counter->mode & TIMER_MODE_SYNC_ENABLE)) {
+        return false;
+    }
+
+    switch (i) {
+    case 1:
+        return timer_sync_mode(counter) >= 2;
+    case 2:
+        return timer_sync_mode(counter) == 0 || timer_sync_mode(counter) == 3;
+    default:
+        return false;
+    }
+}
+
+void
+timer_setup(struct psx_machine *psx)
+{
+    for (unsigned int i = 0; i < TIMER_NR_COUNTERS; ++i) {
+        scheduler_register(psx, SCHEDULER_EVENT_TIMER0 + i, TIMER_EVENTS[i]);
+    }
+
+    timer_hard_reset(psx);
+}
+
+void
+timer_hard_reset(struct psx_machine *psx)
+{
+    for (unsigned int i = 0; i < TIMER_NR_COUNTERS; ++i) {
+        scheduler_cancel(psx, SCHEDULER_EVENT_TIMER0 + i);
+    }
+
+    memset(&psx->timer, 0, sizeof(psx->timer));
+
+    for (unsigned int i = 0; i < TIMER_NR_COUNTERS; ++i) {
+        psx->timer.counter[i].base = scheduler_now(psx);
+        psx->timer.counter[i].mode = TIMER_MODE_IRQ_N;
+    }
+
+    psx->timer.dot_divider = TIMER_DOT_DIVIDERS[0];
+}
+
+uint32_t
+timer_read(struct psx_machine *psx, uint32_t address)
+{
+    struct timer_counter *counter;
+    unsigned int i;
+    uint32_t value;
+
+    i = (address >> 4) & 0x3;
+
+    if (i >= TIMER_NR_COUNTERS) {
+        printf("timer: error: read from unknown register 0x%08x\n", address);
+        PANIC;
+        return 0;
+    }
+
+    counter = &psx->timer.counter[i];
+
+    switch (address & 0xf) {
+    case 0x0:
+        timer_update(psx, i);
+        return counter->value;
+    case 0x4:
+        timer_update(psx, i);
+
+        /* The reached flags are cleared by reading them */
+        value = counter->mode;
+        counter->mode &= ~(TIMER_MODE_REACHED_TARGET |
+                           TIMER_MODE_REACHED_OVERFLOW);
+
+        return value;
+    case 0x8:
+        return counter->target;
+    default:
+        return 0;
+    }
+}
+
+void
+timer_write(struct psx_machine *psx, uint32_t address, uint32_t value)
+{
+    struct timer_counter *counter;
+    unsigned int i;
+
+    i = (address >> 4) & 0x3;
+
+    if (i >= TIMER_NR_COUNTERS) {
+        printf("timer: error: write to unknown register 0x%08x: 0x%08x\n",
+               address, value);
+        PANIC;
+        return;
+    }
+
+    counter = &psx->timer.counter[i];
+
+    timer_update(psx, i);
+
+    switch (address & 0xf) {
+    case 0x0:
+        counter->value = value;
+        break;
+    case 0x4:
+        /* Writing the mode restarts the counter and rearms its IRQ */
+        counter->mode &= ~TIMER_MODE_WRITABLE;
+        counter->mode |= (value & TIMER_MODE_WRITABLE) | TIMER_MODE_IRQ_N;
+        counter->value = 0;
+        counter->irq_done = false;
+        counter->paused = timer_sync_paused(counter, i);
+        break;
+    case 0x8:
+        counter->target = value;
+        break;
+    default:
+        break;
+    }
+
+    timer_schedule(psx, i);
+}
+
+void
+timer_vblank(struct psx_machine *psx)
+{
+    struct timer_counter *counter = &psx->timer.counter[1];
+
+    if (!(counter->mode & TIMER_MODE_SYNC_ENABLE)) {
+        return;
+    }
+
+    timer_update(psx, 1);
+
+    switch (timer_sync_mode(counter)) {
+    case 1:
+    case 2:
+        counter->value = 0;
+        break;
+    case 3:
+        /* Paused until the first VBLANK, then free running */
+        counter->paused = false;
+        break;
+    default:
+        break;
+    }
+
+    timer_schedule(psx, 1);
+}
+
+/* Called with the GP1(08h) parameter as the CPU writes it */
+void
+timer_display_mode(struct psx_machine *psx, uint32_t mode)
+{
+    unsigned int divider;
+
+    divider = TIMER_DOT_DIVIDERS[mode & 0x40 ? 4 : mode & 0x3];
+
+    if (divider == psx->timer.dot_divider) {
+        return;
+    }
+
+    /* Catch timer 0 up at the old rate before changing it */
+    timer_update(psx, 0);
+    psx->timer.dot_divider = divider;
+    timer_schedule(psx, 0);
+}
+
+void
+timer_save_state(struct psx_machine *psx, struct state *state)
+{
+    state_begin_section(state, STATE_SECTION_TIMER);
+    state_write(state, &psx->timer, sizeof(psx->timer));
+    state_end_section(state);
+}
+
+void
+timer_load_state(struct psx_machine *psx, struct state *state)
+{
+    if (state_find_section(state, STATE_SECTION_TIMER)) {
+        state_read(state, &psx->timer, sizeof(psx->timer));
+    }
+}
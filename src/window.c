@@ -17,7 +17,11 @@
 
 #define WINDOW_AUDIO_SAMPLE_RATE        44100
 #define WINDOW_AUDIO_NR_CHANNELS        2
-#define WINDOW_AUDIO_DELAY              0.05
+#define WINDOW_AUDIO_DEVICE_FRAMES      256
+#define WINDOW_AUDIO_DELAY              0.01    /* Target buffer fill */
+#define WINDOW_AUDIO_MAX_ADJUST         0.005   /* Largest rate change */
+#define WINDOW_AUDIO_SMOOTHING          0.05
+#define WINDOW_AUDIO_BATCH              512     /* Resampled frames */
 
 #define WINDOW_TITLE                    "psx_emu"
 #define WINDOW_WIDTH                    800
@@ -29,17 +33,36 @@ static SDL_Window *window;
 static SDL_GLContext context;
 static SDL_AudioDeviceID audio_device;
 
-static unsigned int window_last_time = 0;
+static uint64_t window_next_frame;
 
+/* Filled by the emulation thread, drained by the SDL audio thread */
 static struct rb window_audio_buffer;
 
+/*
+ * Linear resampler between the SPU and the buffer. Its ratio, input frames
+ * per output frame, is nudged by how far the buffer is from its target fill,
+ * so a small buffer neither runs dry nor fills up when emulation and the
+ * audio device clocks drift apart.
+ */
+static struct {
+    double ratio;
+    double position;                /* Between previous and next input */
+    int16_t previous[WINDOW_AUDIO_NR_CHANNELS];
+} window_audio_resampler;
+
 void
 window_audio_callback(void *userdata, uint8_t *stream, int len)
 {
+    size_t nr_frames, frames_read;
+
     (void)userdata;
 
-    memset(stream, 0, len);
-    rb_read(&window_audio_buffer, stream, len);
+    nr_frames = len / RB_FRAME_SIZE;
+    frames_read = rb_read_frames(&window_audio_buffer, (int16_t *)stream,
+                                 nr_frames);
+
+    memset(stream + frames_read * RB_FRAME_SIZE, 0,
+           len - frames_read * RB_FRAME_SIZE);
 }
 
 bool
@@ -98,21 +121,20 @@ window_setup(void)
         return false;
     }
 
-    buffer_size = WINDOW_AUDIO_SAMPLE_RATE * WINDOW_AUDIO_NR_CHANNELS *
-                  WINDOW_AUDIO_DELAY * sizeof(int16_t) * 2;
+    /* Headroom of four times the target, so fill errors can be corrected */
+    buffer_size = WINDOW_AUDIO_SAMPLE_RATE * WINDOW_AUDIO_DELAY *
+                  RB_FRAME_SIZE * 4;
 
     if (!rb_init(&window_audio_buffer, buffer_size)) {
         printf("window: error: unable to allocate audio buffer\n");
         return false;
     }
 
-    rb_clear(&window_audio_buffer);
-
     SDL_zero(want);
     want.freq = WINDOW_AUDIO_SAMPLE_RATE;
     want.format = AUDIO_S16;
     want.channels = WINDOW_AUDIO_NR_CHANNELS;
-    want.samples = 1024;
+    want.samples = WINDOW_AUDIO_DEVICE_FRAMES;
     want.callback = window_audio_callback;
 
     audio_device = SDL_OpenAudioDevice(NULL, false, &want, &have, 0);
@@ -125,9 +147,12 @@ window_setup(void)
 
     SDL_PauseAudioDevice(audio_device, true);
 
+    window_audio_resampler.ratio = 1.0;
+    window_audio_resampler.position = 0.0;
+
     gui_setup(window, context);
 
-    window_last_time = SDL_GetTicks();
+    window_next_frame = SDL_GetPerformanceCounter();
 
     return true;
 }
@@ -151,7 +176,7 @@ bool
 window_update(void)
 {
     bool quit;
-    unsigned int elapsed_time;
+    uint64_t now, frame_time;
     SDL_Event event;
 
     quit = false;
@@ -187,14 +212,19 @@ window_update(void)
 
     SDL_GL_SwapWindow(window);
 
-    elapsed_time = SDL_GetTicks() - window_last_time;
-
-    if (elapsed_time < WINDOW_FRAME_TIME) {
-        SDL_Delay(WINDOW_FRAME_TIME - elapsed_time);
+    /* Pace against an absolute deadline, so rounding the delay to whole
+     * milliseconds doesn't make frames drift */
+    frame_time = SDL_GetPerformanceFrequency() * WINDOW_FRAME_TIME / 1000.0;
+    window_next_frame += frame_time;
+    now = SDL_GetPerformanceCounter();
+
+    if (now < window_next_frame) {
+        SDL_Delay((window_next_frame - now) * 1000 /
+                  SDL_GetPerformanceFrequency());
+    } else if (now - window_next_frame > frame_time) {
+        window_next_frame = now;
     }
 
-    window_last_time = SDL_GetTicks();
-
     return quit;
 }
 
@@ -204,8 +234,69 @@ window_audio_pause(bool pause)
     SDL_PauseAudioDevice(audio_device, pause);
 }
 
+/* Proportional to the fill error, smoothed so the pitch change is inaudible */
+static void
+window_audio_update_ratio(void)
+{
+    double target, error, ratio;
+
+    target = WINDOW_AUDIO_SAMPLE_RATE * WINDOW_AUDIO_DELAY;
+    error = (rb_count(&window_audio_buffer) / RB_FRAME_SIZE - target) / target;
+    error = error < -1.0 ? -1.0 : (error > 1.0 ? 1.0 : error);
+
+    ratio = 1.0 + error * WINDOW_AUDIO_MAX_ADJUST;
+    window_audio_resampler.ratio += (ratio - window_audio_resampler.ratio) *
+                                    WINDOW_AUDIO_SMOOTHING;
+}
+
 void
 window_audio_write_samples(int16_t *samples, size_t amount)
 {
-    rb_write(&window_audio_buffer, samples, amount * sizeof(int16_t));
+    int16_t output[WINDOW_AUDIO_BATCH * WINDOW_AUDIO_NR_CHANNELS];
+    int16_t *previous, *next;
+    size_t nr_frames, nr_output;
+    double position;
+
+    window_audio_update_ratio();
+
+    previous = window_audio_resampler.previous;
+    position = window_audio_resampler.position;
+    nr_frames = amount / WINDOW_AUDIO_NR_CHANNELS;
+    nr_output = 0;
+
+    for (size_t i = 0; i < nr_frames; ++i) {
+        next = &samples[i * WINDOW_AUDIO_NR_CHANNELS];
+
+        while (position < 1.0) {
+            for (int c = 0; c < WINDOW_AUDIO_NR_CHANNELS; ++c) {
+                output[nr_output * WINDOW_AUDIO_NR_CHANNELS + c] =
+                    previous[c] + (next[c] - previous[c]) * position;
+            }
+
+            position += window_audio_resampler.ratio;
+
+            if (++nr_output == WINDOW_AUDIO_BATCH) {
+                rb_write_frames(&window_audio_buffer, output, nr_output);
+                nr_output = 0;
+            }
+        }
+
+        position -= 1.0;
+        memcpy(previous, next, sizeof(window_audio_resampler.previous));
+    }
+
+    rb_write_frames(&window_audio_buffer, output, nr_output);
+
+    window_audio_resampler.position = position;
+}
+
+void
+window_audio_stats(struct window_audio_stats *stats)
+{
+    stats->usage = rb_usage(&window_audio_buffer);
+    stats->latency = rb_count(&window_audio_buffer) / RB_FRAME_SIZE * 1000.0 /
+                     WINDOW_AUDIO_SAMPLE_RATE;
+    stats->ratio = window_audio_resampler.ratio;
+    stats->underruns = rb_underruns(&window_audio_buffer);
+    stats->overruns = rb_overruns(&window_audio_buffer);
 }